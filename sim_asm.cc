@@ -0,0 +1,295 @@
+#include "sim_asm.h"
+#include <stdlib.h>
+#include <iostream>
+#include <cstring>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+/* =============================================================
+
+   MNEMONIC TABLE
+
+   ============================================================= */
+
+/* FNV-1a */
+static inline unsigned hash_name(const char *name, size_t len){
+	unsigned h = 2166136261u;
+	for (size_t i=0; i<len; i++) h = (h ^ (unsigned char)name[i]) * 16777619u;
+	return h;
+}
+
+size_t asm_name_hash::operator()(const asm_name_t &n) const{
+	return hash_name(n.str, n.len);
+}
+
+asm_isa::asm_isa(const asm_mnemonic_t *t, unsigned n, unsigned regs){
+	table = t;
+	entries = n;
+	num_registers = regs;
+
+	// searches a multiplier spreading the names over the slots without collisions,
+	// doubling the slots every 4096 failed attempts
+	for (unsigned bits = 5; ; bits++){
+		shift = 32 - bits;
+		slots.assign(1u << bits, 0);
+		for (seed = 1; seed < 2*4096; seed += 2){
+			bool collision = false;
+			for (unsigned i=0; i<entries && !collision; i++){
+				unsigned s = (hash_name(table[i].name, strlen(table[i].name)) * seed) >> shift;
+				if (slots[s]) collision = true;
+				else slots[s] = i + 1;
+			}
+			if (!collision) return;
+			std::fill(slots.begin(), slots.end(), 0);
+		}
+	}
+}
+
+const asm_mnemonic_t *asm_isa::lookup(const char *name, size_t len) const{
+	unsigned s = slots[(hash_name(name, len) * seed) >> shift];
+	if (!s) return NULL;
+	const asm_mnemonic_t *m = &table[s - 1];
+	if (strncmp(m->name, name, len) != 0 || m->name[len] != '\0') return NULL;
+	return m;
+}
+
+/* =============================================================
+
+   LABEL NAMES
+
+   ============================================================= */
+
+asm_labels::asm_labels(){
+	clear();
+}
+
+void asm_labels::clear(){
+	index_buf.clear();
+	offset_buf.clear();
+	name_buf.clear();
+	indexes = NULL;
+	offsets = NULL;
+	names = NULL;
+	count = 0;
+}
+
+void asm_labels::add(unsigned index, const char *name, size_t len){
+	index_buf.push_back(index);
+	offset_buf.push_back(name_buf.size());
+	name_buf.append(name, len);
+	name_buf.push_back('\0');
+	indexes = &index_buf[0];
+	offsets = &offset_buf[0];
+	names = name_buf.c_str();
+	count = index_buf.size();
+}
+
+void asm_labels::view(const unsigned *i, const unsigned *o, const char *n, unsigned c){
+	clear();
+	indexes = i;
+	offsets = o;
+	names = n;
+	count = c;
+}
+
+const char *asm_labels::name(unsigned index) const{
+	const unsigned *it = lower_bound(indexes, indexes + count, index);
+	if (it == indexes + count || *it != index) return "";
+	return names + offsets[it - indexes];
+}
+
+unsigned asm_labels::name_table_size() const{
+	if (count == 0) return 0;
+	return offsets[count-1] + strlen(names + offsets[count-1]) + 1;
+}
+
+/* =============================================================
+
+   SOURCE FILE
+
+   ============================================================= */
+
+sim_asm::sim_asm(const asm_isa &i, const char *fname) : isa(i){
+	filename = fname;
+	text = NULL;
+	size = 0;
+
+	int fd = open(filename, O_RDONLY);
+	struct stat st;
+	if (fd < 0 || fstat(fd, &st) != 0) {
+		cerr << "error: open file " << filename << " failed!" << endl;
+		exit(-1);
+	}
+	size = st.st_size;
+	if (size > 0){
+		void *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (map == MAP_FAILED) {
+			cerr << "error: mmap of file " << filename << " failed!" << endl;
+			exit(-1);
+		}
+		madvise(map, size, MADV_SEQUENTIAL);
+		text = (const char *)map;
+	}
+	close(fd);
+
+	pos = text;
+	end = text + size;
+	line_start = text;
+	line = 1;
+	// generated code has about one label every few lines: avoids rehashing the label table while loading
+	labels.reserve(size / 64);
+}
+
+sim_asm::~sim_asm(){
+	if (text) munmap((void *)text, size);
+}
+
+void sim_asm::error(const char *at, const char *l_start, unsigned l, const string &msg){
+	cerr << filename << ":" << l << ":" << (at - l_start + 1) << ": error: " << msg << endl;
+	exit(-1);
+}
+
+void sim_asm::error(const char *at, const string &msg){
+	error(at, line_start, line, msg);
+}
+
+/* =============================================================
+
+   TOKENISER
+
+   ============================================================= */
+
+static inline bool is_separator(char c){
+	return (c == ' ' || c == '\t' || c == '\r' || c == ',');
+}
+
+/* returns the next token of the current line (NULL at the end of the line, before a comment, or at the end of the file) */
+const char *sim_asm::token(size_t &len){
+	while (pos < end && is_separator(*pos)) pos++;
+	if (pos == end || *pos == '\n' || *pos == ';' || *pos == '#') return NULL;
+	const char *start = pos;
+	while (pos < end && !is_separator(*pos) && *pos != '\n' && *pos != ';' && *pos != '#') pos++;
+	len = pos - start;
+	return start;
+}
+
+/* "R<n>" (or "F<n>" if prefix is 'F') */
+unsigned sim_asm::parse_register(const char *tok, size_t len, char prefix){
+	if (len < 2 || tok[0] != prefix)
+		error(tok, string("expected ") + (prefix == 'F' ? "FP" : "integer") + " register, found '" + string(tok, len) + "'");
+	unsigned reg = 0;
+	for (size_t i=1; i<len; i++){
+		if (tok[i] < '0' || tok[i] > '9') error(tok + i, "invalid register '" + string(tok, len) + "'");
+		reg = reg * 10 + (tok[i] - '0');
+		if (reg >= isa.registers()) error(tok, "register '" + string(tok, len) + "' out of range");
+	}
+	return reg;
+}
+
+/* same syntax as strtoul(.., 0): decimal, 0x hexadecimal or 0 octal, optionally negated */
+unsigned sim_asm::parse_immediate(const char *tok, size_t len){
+	const char *p = tok;
+	const char *e = tok + len;
+	bool negative = false;
+	if (p < e && (*p == '-' || *p == '+')) negative = (*p++ == '-');
+	unsigned base = 10;
+	if (e - p > 2 && p[0] == '0' && (p[1] == 'x' || p[1] == 'X')) { base = 16; p += 2; }
+	else if (e - p > 1 && p[0] == '0') { base = 8; p++; }
+	if (p == e) error(tok, "invalid immediate '" + string(tok, len) + "'");
+	unsigned value = 0;
+	for (; p < e; p++){
+		unsigned digit;
+		if (*p >= '0' && *p <= '9') digit = *p - '0';
+		else if (*p >= 'a' && *p <= 'f') digit = *p - 'a' + 10;
+		else if (*p >= 'A' && *p <= 'F') digit = *p - 'A' + 10;
+		else digit = base;
+		if (digit >= base) error(p, "invalid immediate '" + string(tok, len) + "'");
+		value = value * base + digit;
+	}
+	return negative ? -value : value;
+}
+
+/* =============================================================
+
+   PARSER
+
+   ============================================================= */
+
+bool sim_asm::next(asm_fields_t &f, unsigned index){
+	for (; pos < end; pos++, line++, line_start = pos){
+		size_t len;
+		const char *tok = token(len);
+
+		// label definition(s)
+		while (tok && tok[len-1] == ':'){
+			if (len == 1) error(tok, "empty label");
+			asm_name_t name = {tok, len - 1};
+			if (!labels.insert(make_pair(name, index)).second)
+				error(tok, "label '" + string(tok, len - 1) + "' already defined");
+			definitions.push_back(make_pair(name, index));
+			tok = token(len);
+		}
+
+		if (tok){
+			const asm_mnemonic_t *m = isa.lookup(tok, len);
+			if (m == NULL) error(tok, "invalid opcode '" + string(tok, len) + "'");
+
+			f.opcode = m->opcode;
+			f.src1 = 0;
+			f.src2 = 0;
+			f.dest = 0;
+			f.immediate = 0;
+
+			for (const char *o = m->operands; *o; o++){
+				const char *op = token(len);
+				if (op == NULL) error(pos, string("missing operand for ") + m->name);
+				switch(*o){
+				case 'd': f.dest = parse_register(op, len, 'R'); break;
+				case 'D': f.dest = parse_register(op, len, 'F'); break;
+				case 's': f.src1 = parse_register(op, len, 'R'); break;
+				case 'S': f.src1 = parse_register(op, len, 'F'); break;
+				case 't': f.src2 = parse_register(op, len, 'R'); break;
+				case 'T': f.src2 = parse_register(op, len, 'F'); break;
+				case 'i': f.immediate = parse_immediate(op, len); break;
+				case 'm':
+				case 'n': {
+					const char *open = (const char *)memchr(op, '(', len);
+					if (open == NULL || op[len-1] != ')') error(op, "expected imm(Rn), found '" + string(op, len) + "'");
+					f.immediate = (open == op) ? 0 : parse_immediate(op, open - op);
+					unsigned base = parse_register(open + 1, op + len - 1 - (open + 1), 'R');
+					if (*o == 'm') f.src1 = base; else f.src2 = base;
+					break;
+				}
+				case 'l': {
+					pending_t p = {index, {op, len}, line, line_start};
+					pending.push_back(p);
+					break;
+				}
+				}
+			}
+
+			const char *extra = token(len);
+			if (extra) error(extra, "unexpected '" + string(extra, len) + "' after " + m->name);
+		}
+
+		// skip the comment (if any) and stop on the newline
+		while (pos < end && *pos != '\n') pos++;
+		if (tok){
+			if (pos < end) { pos++; line++; line_start = pos; }
+			return true;
+		}
+		if (pos == end) break;
+	}
+	return false;
+}
+
+unsigned sim_asm::resolve(const pending_t &p){
+	unordered_map<asm_name_t, unsigned, asm_name_hash>::iterator target = labels.find(p.label);
+	if (target == labels.end()) error(p.label.str, p.line_start, p.line, "undefined label '" + string(p.label.str, p.label.len) + "'");
+	return target->second;
+}
@@ -0,0 +1,192 @@
+#ifndef SIM_ASM_H_
+#define SIM_ASM_H_
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+/* =============================================================
+
+   ASSEMBLER FRONT END
+
+   Shared by sim_pipe and sim_pipe_fp: the instruction set is
+   described by a table of mnemonics, so this file does not depend
+   on either simulator's opcode_t.
+
+   The source file is memory-mapped and tokenised in place; labels
+   are resolved in a second pass over the branches. Any syntax error
+   is reported as "file:line:col: error: ..." and terminates the program.
+
+   ============================================================= */
+
+// one mnemonic of the instruction set; "operands" lists the operands in assembly order, one char each:
+//  'd' / 'D'  destination integer / FP register
+//  's' / 'S'  first source integer / FP register
+//  't' / 'T'  second source integer / FP register
+//  'i'        immediate
+//  'm'        memory operand imm(Rn), base register in src1 (loads)
+//  'n'        memory operand imm(Rn), base register in src2 (stores)
+//  'l'        label of the branch target
+typedef struct {
+	const char *name;
+	unsigned opcode;
+	const char *operands;
+} asm_mnemonic_t;
+
+// instruction fields as parsed (registers are numbered within their own register file)
+typedef struct {
+	unsigned opcode;
+	unsigned src1;
+	unsigned src2;
+	unsigned dest;
+	unsigned immediate;
+} asm_fields_t;
+
+// name pointing into the mapped source (not NUL-terminated)
+struct asm_name_t {
+	const char *str;
+	size_t len;
+	bool operator==(const asm_name_t &o) const { return len == o.len && std::char_traits<char>::compare(str, o.str, len) == 0; }
+};
+
+struct asm_name_hash {
+	size_t operator()(const asm_name_t &n) const;
+};
+
+// label names by instruction index, kept only for the trace (all names share one buffer)
+class asm_labels {
+
+	// owned storage, filled by add()
+	std::vector<unsigned> index_buf;
+	std::vector<unsigned> offset_buf;
+	std::string name_buf;
+
+	// table in use: the owned storage, or a table owned by someone else (see view())
+	const unsigned *indexes; // increasing instruction indexes
+	const unsigned *offsets; // offset in "names" of the label of each entry of "indexes"
+	const char *names;       // NUL-terminated names
+	unsigned count;
+
+public:
+	asm_labels();
+
+	void clear();
+
+	// adds a label; labels must be added by increasing instruction index
+	void add(unsigned index, const char *name, size_t len);
+
+	// uses a table stored elsewhere (e.g. in a mapped program image), which must outlive its use
+	void view(const unsigned *indexes, const unsigned *offsets, const char *names, unsigned count);
+
+	// returns the name of the label of instruction "index" ("" if it has none)
+	const char *name(unsigned index) const;
+
+	// raw table, as taken by view()
+	unsigned size() const { return count; }
+	const unsigned *index_table() const { return indexes; }
+	const unsigned *offset_table() const { return offsets; }
+	const char *name_table() const { return names; }
+	unsigned name_table_size() const;
+};
+
+// mnemonic table with a collision-free hash, built once per instruction set
+class asm_isa {
+
+	const asm_mnemonic_t *table;
+	unsigned entries;
+	unsigned num_registers;
+
+	std::vector<unsigned char> slots; // 1 + index in "table", 0 if empty
+	unsigned seed;
+	unsigned shift;
+
+public:
+	// "table" must outlive the object; register numbers must be below "num_registers"
+	asm_isa(const asm_mnemonic_t *table, unsigned entries, unsigned num_registers);
+
+	// returns the mnemonic spelled by [name, name+len), NULL if there is none
+	const asm_mnemonic_t *lookup(const char *name, size_t len) const;
+
+	unsigned registers() const { return num_registers; }
+};
+
+class sim_asm {
+
+	const asm_isa &isa;
+	const char *filename;
+
+	// memory-mapped source
+	const char *text;
+	size_t size;
+
+	// cursor
+	const char *pos;
+	const char *end;
+	const char *line_start;
+	unsigned line;
+
+	// label definitions (in source order, and hashed by name), and the branches still to be resolved
+	std::vector< std::pair<asm_name_t, unsigned> > definitions;
+	std::unordered_map<asm_name_t, unsigned, asm_name_hash> labels;
+	struct pending_t { unsigned index; asm_name_t label; unsigned line; const char *line_start; };
+	std::vector<pending_t> pending;
+
+	sim_asm(const sim_asm &);
+	sim_asm &operator=(const sim_asm &);
+
+	// parses the next instruction into "f" (labels on the way are recorded); false at the end of the file
+	bool next(asm_fields_t &f, unsigned index);
+
+	// returns the target index of pending branch "p" (exits if its label is undefined)
+	unsigned resolve(const pending_t &p);
+
+	const char *token(size_t &len);
+	unsigned parse_register(const char *tok, size_t len, char prefix);
+	unsigned parse_immediate(const char *tok, size_t len);
+	void error(const char *at, const std::string &msg);
+	void error(const char *at, const char *l_start, unsigned l, const std::string &msg);
+
+public:
+	// maps "filename" (exits if it cannot be opened)
+	sim_asm(const asm_isa &isa, const char *filename);
+	~sim_asm();
+
+	// assembles the whole file into "program"; branches get their "target" index and the PC-relative
+	// "immediate", and "label_names" gets the name of each label (for the trace)
+	template <class instr_t>
+	void assemble(std::vector<instr_t> &program, asm_labels &label_names);
+};
+
+template <class instr_t>
+void sim_asm::assemble(std::vector<instr_t> &program, asm_labels &label_names){
+	asm_fields_t f;
+	instr_t instr;
+
+	// assembly lines are rarely shorter than 8 bytes: reserving on the file size avoids reallocations
+	program.clear();
+	program.reserve(size / 8 + 1);
+
+	while (next(f, program.size())){
+		instr.reset();
+		instr.opcode = (decltype(instr.opcode)) f.opcode;
+		instr.src1 = f.src1;
+		instr.src2 = f.src2;
+		instr.dest = f.dest;
+		instr.immediate = f.immediate;
+		program.push_back(instr);
+	}
+
+	for (unsigned b=0; b<pending.size(); b++){
+		unsigned i = pending[b].index;
+		unsigned target = resolve(pending[b]);
+		program[i].target = target;
+		program[i].immediate = (target - i - 1) << 2;
+	}
+
+	label_names.clear();
+	for (unsigned l=0; l<definitions.size(); l++)
+		label_names.add(definitions[l].second, definitions[l].first.str, definitions[l].first.len);
+}
+
+#endif /*SIM_ASM_H_*/
@@ -0,0 +1,109 @@
+#include "sim_bpred.h"
+#include <cstring>
+#include <algorithm>
+
+using namespace std;
+
+#define BTB_EMPTY 0xFFFFFFFF
+
+/* 2-bit saturating counter: >= 2 means taken */
+static inline void train(unsigned char &counter, bool taken){
+	if (taken) { if (counter < 3) counter++; }
+	else       { if (counter > 0) counter--; }
+}
+
+sim_bpred::sim_bpred(bpred_policy_t p, unsigned table_bits, unsigned btb_bits){
+	policy = p;
+	table_mask = (1u << table_bits) - 1;
+	btb_mask = (1u << btb_bits) - 1;
+	local.resize(table_mask + 1);
+	global.resize(table_mask + 1);
+	chooser.resize(table_mask + 1);
+	btb_tag.resize(btb_mask + 1);
+	btb_target.resize(btb_mask + 1);
+	reset();
+}
+
+void sim_bpred::reset(){
+	// weakly not taken (1-bit: not taken); the chooser starts weakly on the per-PC table
+	fill(local.begin(), local.end(), (policy == BP_ONE_BIT) ? 0 : 1);
+	fill(global.begin(), global.end(), 1);
+	fill(chooser.begin(), chooser.end(), 1);
+	fill(btb_tag.begin(), btb_tag.end(), BTB_EMPTY);
+	history = 0;
+	memset(&stats, 0, sizeof stats);
+}
+
+/* predicted direction of a conditional branch whose target (from the BTB) is "target" */
+bool sim_bpred::direction(unsigned pc, unsigned target) const{
+	switch(policy){
+	case BP_BTFN:
+		return target < pc;
+	case BP_ONE_BIT:
+		return local[table_index(pc)] != 0;
+	case BP_TWO_BIT:
+		return local[table_index(pc)] >= 2;
+	case BP_GSHARE:
+		return global[global_index(pc)] >= 2;
+	case BP_TOURNAMENT:
+		if (chooser[table_index(pc)] >= 2) return global[global_index(pc)] >= 2;
+		return local[table_index(pc)] >= 2;
+	default:
+		return false;
+	}
+}
+
+unsigned sim_bpred::predict(unsigned pc, bool conditional){
+	unsigned fallthrough = pc + 4;
+	if (policy == BP_NONE) return fallthrough;
+
+	stats.btb_lookups++;
+	unsigned e = btb_index(pc);
+	if (btb_tag[e] != pc) return fallthrough;
+	stats.btb_hits++;
+
+	if (!conditional || direction(pc, btb_target[e])) return btb_target[e];
+	return fallthrough;
+}
+
+bool sim_bpred::update(unsigned pc, bool conditional, bool taken, unsigned target, unsigned predicted){
+	unsigned actual = taken ? target : pc + 4;
+	bool wrong = (actual != predicted);
+
+	stats.branches++;
+	if (taken) stats.taken++;
+	if (wrong) stats.mispredictions++;
+
+	if (taken){
+		unsigned e = btb_index(pc);
+		btb_tag[e] = pc;
+		btb_target[e] = target;
+	}
+	if (!conditional) return wrong;
+
+	unsigned l = table_index(pc);
+	unsigned g = global_index(pc);
+	switch(policy){
+	case BP_ONE_BIT:
+		local[l] = taken;
+		break;
+	case BP_TWO_BIT:
+		train(local[l], taken);
+		break;
+	case BP_GSHARE:
+		train(global[g], taken);
+		break;
+	case BP_TOURNAMENT: {
+		bool local_right = ((local[l] >= 2) == taken);
+		bool global_right = ((global[g] >= 2) == taken);
+		if (local_right != global_right) train(chooser[l], global_right);
+		train(local[l], taken);
+		train(global[g], taken);
+		break;
+	}
+	default:
+		break;
+	}
+	history = ((history << 1) | taken) & table_mask;
+	return wrong;
+}
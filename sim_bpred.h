@@ -0,0 +1,82 @@
+#ifndef SIM_BPRED_H_
+#define SIM_BPRED_H_
+
+#include <vector>
+
+/* =============================================================
+
+   BRANCH PREDICTION UNIT
+
+   Shared by sim_pipe and sim_pipe_fp. Fetch asks for a prediction
+   for every branch (predict) and EX trains the unit with the outcome
+   (update). The unit only knows PCs: a branch is predicted taken
+   only if the BTB holds its target, which is how the front end of a
+   real pipeline learns where to fetch from. Unconditional branches
+   are predicted taken on every BTB hit, whatever the policy.
+
+   ============================================================= */
+
+typedef enum {
+	BP_NONE,        // no prediction: fetch waits for every branch to be resolved
+	BP_NOT_TAKEN,   // static, always not taken
+	BP_BTFN,        // static, backward taken / forward not taken
+	BP_ONE_BIT,     // last outcome, per PC
+	BP_TWO_BIT,     // 2-bit saturating counters, per PC
+	BP_GSHARE,      // 2-bit counters indexed by PC xor global history
+	BP_TOURNAMENT   // 2-bit per PC and gshare, chosen by a per-PC 2-bit selector
+} bpred_policy_t;
+
+#define BPRED_MAX_BITS 24 // largest log2 of the entries of a prediction table or of the BTB
+
+// accuracy counters
+typedef struct {
+	unsigned long branches;       // branches resolved
+	unsigned long taken;          // ... of which taken
+	unsigned long mispredictions; // wrong direction or target
+	unsigned long btb_lookups;
+	unsigned long btb_hits;
+} bpred_stats_t;
+
+class sim_bpred {
+
+	bpred_policy_t policy;
+
+	// pattern history tables (2-bit counters, or 1-bit values for BP_ONE_BIT)
+	std::vector<unsigned char> local;    // indexed by PC
+	std::vector<unsigned char> global;   // indexed by PC xor history
+	std::vector<unsigned char> chooser;  // BP_TOURNAMENT: >= 2 selects "global"
+	unsigned table_mask;
+	unsigned history;                    // global outcome history, youngest in bit 0
+
+	// branch target buffer (direct mapped)
+	std::vector<unsigned> btb_tag;       // PC of the branch (0xFFFFFFFF if the entry is empty)
+	std::vector<unsigned> btb_target;
+	unsigned btb_mask;
+
+	bpred_stats_t stats;
+
+	unsigned table_index(unsigned pc) const { return (pc >> 2) & table_mask; }
+	unsigned btb_index(unsigned pc) const { return (pc >> 2) & btb_mask; }
+	unsigned global_index(unsigned pc) const { return ((pc >> 2) ^ history) & table_mask; }
+	bool direction(unsigned pc, unsigned target) const;
+
+public:
+	// "table_bits": log2 of the entries of each prediction table; "btb_bits": log2 of the BTB entries (both up to BPRED_MAX_BITS)
+	sim_bpred(bpred_policy_t policy=BP_NONE, unsigned table_bits=10, unsigned btb_bits=6);
+
+	// clears tables, history and counters
+	void reset();
+
+	bool enabled() const { return policy != BP_NONE; }
+
+	// returns the PC to be fetched after the branch at "pc" ("conditional" is false for jumps)
+	unsigned predict(unsigned pc, bool conditional);
+
+	// trains the unit with the outcome of the branch at "pc"; "predicted" is the PC returned by predict()
+	// returns true if the prediction was wrong
+	bool update(unsigned pc, bool conditional, bool taken, unsigned target, unsigned predicted);
+
+	const bpred_stats_t &get_stats() const { return stats; }
+};
+
+#endif /*SIM_BPRED_H_*/
@@ -0,0 +1,210 @@
+#include "sim_cache.h"
+#include <stdlib.h>
+#include <iostream>
+#include <cstring>
+#include <algorithm>
+
+using namespace std;
+
+#define LINE_VALID 0x1
+#define LINE_DIRTY 0x2
+#define LINE_PREFETCHED 0x4 // filled by the prefetcher and not used yet
+
+#define RANDOM_SEED 0x9E3779B9
+
+static inline bool is_power_of_two(unsigned x){
+	return x != 0 && (x & (x - 1)) == 0;
+}
+
+sim_cache::sim_cache(){
+	num_sets = 0;
+	associativity = 0;
+	line_bits = 0;
+	hit_latency = 0;
+	replacement = CACHE_LRU;
+	write_policy = WRITE_BACK;
+	write_allocate = true;
+	next_line_prefetch = false;
+	next = NULL;
+	memory_latency = 0;
+	reset();
+}
+
+void sim_cache::configure(unsigned size, unsigned line_size, unsigned assoc, unsigned latency,
+                          cache_replacement_t repl, cache_write_t write, bool allocate){
+	if (!is_power_of_two(size) || !is_power_of_two(line_size) || line_size < 4 || assoc == 0 || size / line_size < assoc) {
+		cerr << "error: invalid cache geometry (" << size << " bytes, " << line_size << "-byte lines, " << assoc << " ways)" << endl;
+		exit(-1);
+	}
+	if (!is_power_of_two(size / line_size / assoc) || (repl == CACHE_PLRU && (!is_power_of_two(assoc) || assoc > 64))) {
+		cerr << "error: the number of sets (and the ways of a PLRU cache, up to 64) must be a power of two" << endl;
+		exit(-1);
+	}
+	num_sets = size / line_size / assoc;
+	associativity = assoc;
+	line_bits = __builtin_ctz(line_size);
+	hit_latency = latency;
+	replacement = repl;
+	write_policy = write;
+	write_allocate = allocate;
+
+	tags.assign(num_sets * associativity, 0);
+	flags.assign(num_sets * associativity, 0);
+	last_use.assign(num_sets * associativity, 0);
+	ready.assign(num_sets * associativity, 0);
+	plru.assign(num_sets, 0);
+	reset();
+}
+
+void sim_cache::connect(sim_cache *n, unsigned latency){
+	next = n;
+	memory_latency = latency;
+}
+
+void sim_cache::reset(){
+	fill(flags.begin(), flags.end(), 0);
+	fill(last_use.begin(), last_use.end(), 0);
+	fill(plru.begin(), plru.end(), 0);
+	clock = 0;
+	random_state = RANDOM_SEED;
+	memset(&stats, 0, sizeof stats);
+}
+
+/* =============================================================
+
+   REPLACEMENT
+
+   ============================================================= */
+
+// marks "way" as the most recently used of "set"
+void sim_cache::touch(unsigned set, unsigned way){
+	last_use[set * associativity + way] = ++clock;
+
+	if (replacement != CACHE_PLRU) return;
+	// walk from the root to the leaf of "way", pointing every node away from it
+	uint64_t &tree = plru[set];
+	unsigned node = 1;
+	for (unsigned bit = associativity >> 1; bit; bit >>= 1){
+		bool right = (way & bit) != 0;
+		if (right) tree &= ~((uint64_t)1 << node);
+		else       tree |= (uint64_t)1 << node;
+		node = 2 * node + right;
+	}
+}
+
+// way of "set" to be filled: an invalid one if any, else the one chosen by the policy
+unsigned sim_cache::victim(unsigned set){
+	unsigned base = set * associativity;
+	for (unsigned w = 0; w < associativity; w++)
+		if (!(flags[base + w] & LINE_VALID)) return w;
+
+	switch(replacement){
+	case CACHE_PLRU: {
+		unsigned node = 1, way = 0;
+		for (unsigned bit = associativity >> 1; bit; bit >>= 1){
+			bool right = (plru[set] >> node) & 1;
+			if (right) way |= bit;
+			node = 2 * node + right;
+		}
+		return way;
+	}
+	case CACHE_RANDOM:
+		random_state ^= random_state << 13;
+		random_state ^= random_state >> 17;
+		random_state ^= random_state << 5;
+		return random_state % associativity;
+	default:
+		return min_element(last_use.begin() + base, last_use.begin() + base + associativity) - (last_use.begin() + base);
+	}
+}
+
+/* =============================================================
+
+   ACCESS
+
+   ============================================================= */
+
+unsigned sim_cache::next_level(unsigned address, bool write, unsigned long now){
+	if (next && next->enabled()) return next->access(address, write, now);
+	return memory_latency;
+}
+
+// fills "line" in the background, unless it is already cached
+void sim_cache::prefetch(unsigned line, unsigned long now){
+	unsigned set = line & (num_sets - 1);
+	unsigned base = set * associativity;
+	for (unsigned w = 0; w < associativity; w++)
+		if ((flags[base + w] & LINE_VALID) && tags[base + w] == line) return;
+
+	unsigned way = victim(set);
+	unsigned char &victim_flags = flags[base + way];
+	unsigned long fill = now;
+	if (victim_flags & LINE_VALID) {
+		stats.evictions++;
+		if (victim_flags & LINE_DIRTY) {
+			stats.writebacks++;
+			fill += next_level(tags[base + way] << line_bits, true, now);
+		}
+	}
+	fill += next_level(line << line_bits, false, now);
+	stats.prefetches++;
+	tags[base + way] = line;
+	victim_flags = LINE_VALID | LINE_PREFETCHED;
+	ready[base + way] = fill;
+	touch(set, way);
+}
+
+unsigned sim_cache::access(unsigned address, bool write, unsigned long now){
+	if (!enabled()) return next_level(address, write, now);
+
+	if (write) stats.writes++;
+	else stats.reads++;
+
+	unsigned line = address >> line_bits;
+	unsigned set = line & (num_sets - 1);
+	unsigned base = set * associativity;
+	unsigned cycles = hit_latency;
+
+	unsigned way = associativity;
+	for (unsigned w = 0; w < associativity; w++)
+		if ((flags[base + w] & LINE_VALID) && tags[base + w] == line) { way = w; break; }
+
+	if (way < associativity) {
+		stats.hits++;
+		touch(set, way);
+		if (flags[base + way] & LINE_PREFETCHED) {
+			// first use of a prefetched line: wait for the end of its fill, and prefetch the next one
+			stats.prefetch_hits++;
+			flags[base + way] &= ~LINE_PREFETCHED;
+			if (ready[base + way] > now) cycles += ready[base + way] - now;
+			if (next_line_prefetch) prefetch(line + 1, now);
+		}
+	}
+	else {
+		stats.misses++;
+		// write miss without allocation: the word goes straight to the next level
+		if (write && !write_allocate) return cycles + next_level(address, true, now);
+
+		way = victim(set);
+		unsigned char &victim_flags = flags[base + way];
+		if (victim_flags & LINE_VALID) {
+			stats.evictions++;
+			if (victim_flags & LINE_DIRTY) {
+				stats.writebacks++;
+				cycles += next_level(tags[base + way] << line_bits, true, now);
+			}
+		}
+		cycles += next_level(line << line_bits, false, now);
+		tags[base + way] = line;
+		victim_flags = LINE_VALID;
+		touch(set, way);
+		// the next line is requested once the missing one has arrived
+		if (next_line_prefetch) prefetch(line + 1, now + cycles);
+	}
+
+	if (write) {
+		if (write_policy == WRITE_THROUGH) cycles += next_level(address, true, now);
+		else flags[base + way] |= LINE_DIRTY;
+	}
+	return cycles;
+}
@@ -0,0 +1,123 @@
+#ifndef SIM_CACHE_H_
+#define SIM_CACHE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+/* =============================================================
+
+   CACHE HIERARCHY
+
+   Shared by sim_pipe and sim_pipe_fp. A sim_cache is one level of
+   a set-associative cache: L1D between the MEM stage and the data
+   memory, L1I between IF and the instruction memory, and an optional
+   L2 below both. A level forwards its misses, fills and write-backs
+   to the next level, and the last level to the memory.
+
+   The caches model timing only: the data itself always lives in the
+   data memory, so a cache never holds a stale copy. access() updates
+   tags, replacement and dirty state and returns the cycles the access
+   takes beyond the MEM cycle:
+
+     hit:  hit latency
+     miss: hit latency + write-back of a dirty victim (if any) + fill
+           from the next level
+     write-through write: hit latency (+ fill on a write-allocate
+           miss) + write to the next level
+
+   There is no write buffer, so the next-level writes stall the
+   pipeline as well. A disabled level (the default) is skipped.
+
+   With next-line prefetching (tagged), a demand miss and the first
+   hit on a prefetched line fetch the following line from the next
+   level in the background. The prefetched line can be used once the
+   fill completes; a demand access that arrives earlier waits for the
+   rest of the fill.
+
+   ============================================================= */
+
+typedef enum {
+	CACHE_LRU,    // least recently used
+	CACHE_PLRU,   // tree pseudo-LRU (associativity up to 64)
+	CACHE_RANDOM  // xorshift, restarted by reset() so runs are reproducible
+} cache_replacement_t;
+
+typedef enum {WRITE_BACK, WRITE_THROUGH} cache_write_t;
+
+typedef enum {L1I, L1D, L2} cache_level_t;
+
+// per-level counters
+typedef struct {
+	unsigned long reads;
+	unsigned long writes;
+	unsigned long hits;
+	unsigned long misses;
+	unsigned long evictions;  // valid lines replaced
+	unsigned long writebacks; // ... of which dirty
+	unsigned long prefetches;     // lines filled by the next-line prefetcher
+	unsigned long prefetch_hits;  // ... later hit by a demand access
+} cache_stats_t;
+
+class sim_cache {
+
+	// geometry (a disabled cache has no sets)
+	unsigned num_sets;
+	unsigned associativity;
+	unsigned line_bits;      // log2 of the line size
+	unsigned hit_latency;
+
+	cache_replacement_t replacement;
+	cache_write_t write_policy;
+	bool write_allocate;
+	bool next_line_prefetch;
+
+	// lines, set-major: line (set, way) is at set * associativity + way
+	std::vector<unsigned> tags;            // line address (address >> line_bits)
+	std::vector<unsigned char> flags;      // LINE_VALID | LINE_DIRTY | LINE_PREFETCHED
+	std::vector<unsigned long> ready;      // prefetched lines: cycle their fill completes
+	std::vector<unsigned long> last_use;   // CACHE_LRU: value of "clock" at the last access
+	std::vector<uint64_t> plru;            // CACHE_PLRU: tree bits of each set, root in bit 1
+	unsigned long clock;
+	unsigned random_state;
+
+	// where misses go: the next level if enabled, else the data memory
+	sim_cache *next;
+	unsigned memory_latency;
+
+	cache_stats_t stats;
+
+	unsigned next_level(unsigned address, bool write, unsigned long now);
+	unsigned victim(unsigned set);
+	void touch(unsigned set, unsigned way);
+	void prefetch(unsigned line, unsigned long now);
+
+public:
+	sim_cache();
+
+	// "size" and "line_size" in bytes, "hit_latency" in clock cycles; sizes must be powers of two
+	// and size must hold at least "associativity" lines. Also resets the cache.
+	void configure(unsigned size, unsigned line_size, unsigned associativity, unsigned hit_latency,
+	               cache_replacement_t replacement=CACHE_LRU, cache_write_t write_policy=WRITE_BACK, bool write_allocate=true);
+
+	// misses are served by "next" if enabled, else by a memory of "memory_latency" cycles
+	void connect(sim_cache *next, unsigned memory_latency);
+
+	// once a hierarchy has been copied level by level: the copy of a level connected to "from" is connected to "to"
+	void relink(const sim_cache *from, sim_cache *to) { if (next == from) next = to; }
+
+	// enables the next-line prefetcher (off by default)
+	void set_next_line_prefetch(bool enable) { next_line_prefetch = enable; }
+
+	bool enabled() const { return num_sets != 0; }
+
+	// invalidates all lines and clears the counters (the configuration is kept)
+	void reset();
+
+	// accesses the word at "address" in cycle "now"; returns the cycles taken beyond the cycle of the stage
+	unsigned access(unsigned address, bool write, unsigned long now);
+
+	const cache_stats_t &get_stats() const { return stats; }
+};
+
+#endif /*SIM_CACHE_H_*/
@@ -0,0 +1,480 @@
+#include "sim_events.h"
+#include <stdlib.h>
+#include <iostream>
+#include <cstring>
+#include <algorithm>
+
+using namespace std;
+
+#define EVENT_ENDIAN 0x01020304
+#define NO_VALUE 0xFFFFFFFF
+#define NO_FRAME ((size_t)-1)
+
+static const char *stage_names[NUM_EVENT_STAGES] = {"IF", "ID", "EX", "MEM", "WB", "IS", "CMT"};
+static const char *stall_names[EVENT_NO_STALL + 1] = {"data", "control", "memory", "fetch", "structural", "none"};
+
+#define MAX_VARINT 10 // bytes of the largest varint
+
+/* writes "value" at "p" as a varint (7 bits per byte, least significant first) and moves "p" past it */
+static inline void put_varint(char *&p, unsigned long value){
+	while (value >= 0x80) {
+		*p++ = (char)(value | 0x80);
+		value >>= 7;
+	}
+	*p++ = (char)value;
+}
+
+/* writes a signed value as a varint, small magnitudes first (zigzag) */
+static inline void put_zigzag(char *&p, long value){
+	put_varint(p, ((unsigned long)value << 1) ^ (unsigned long)(value >> 63));
+}
+
+/* =============================================================
+
+   RECORDING (simulation thread)
+
+   ============================================================= */
+
+sim_events::sim_events(){
+	active = false;
+	current = NULL;
+	cursor = limit = NULL;
+	frame = 0;
+	last_frame = NO_FRAME;
+	records = 0;
+	stop = false;
+	used = 0;
+}
+
+sim_events::~sim_events(){
+	close();
+}
+
+void sim_events::open(const char *name, const char *isa, const char *const *opcode_names, unsigned opcodes, const vector<string> &slot_names){
+	close();
+
+	filename = name;
+	file.open(name, ios::out | ios::binary | ios::trunc);
+	if (!file.is_open()) {
+		cerr << "error: open event trace file " << name << " failed!" << endl;
+		exit(-1);
+	}
+
+	string names;
+	for (unsigned k = 0; k < opcodes; k++) names.append(opcode_names[k]).push_back('\0');
+	for (unsigned k = 0; k < slot_names.size(); k++) names.append(slot_names[k]).push_back('\0');
+
+	event_header_t h;
+	memset(&h, 0, sizeof h);
+	memcpy(h.magic, EVENT_MAGIC, sizeof h.magic);
+	h.version = EVENT_VERSION;
+	h.endian = EVENT_ENDIAN;
+	strncpy(h.isa, isa, sizeof h.isa - 1);
+	h.opcodes = opcodes;
+	h.slots = slot_names.size();
+	h.names_size = names.size();
+	file.write((const char *)&h, sizeof h);
+	file.write(names.data(), names.size());
+
+	last.clear();
+	mark.clear();
+	encoded = 0;
+	memset(stall, EVENT_NO_STALL, sizeof stall);
+	last_cycle = 0;
+	last_seq = 0;
+	used = 0;
+
+	for (unsigned k = 0; k < EVENT_CHUNKS; k++) {
+		chunk_t *chunk = new chunk_t;
+		chunk->data.resize(EVENT_CHUNK_SIZE);
+		chunk->used = 0;
+		chunks.push_back(chunk);
+		spare.push_back(chunk);
+	}
+	record_in(take_chunk());
+	frame = 0;
+	records = 0;
+	stop = false;
+	writer = thread(&sim_events::write_chunks, this);
+	active = true;
+}
+
+void sim_events::close(){
+	if (!active) return;
+	active = false;
+
+	current->used = cursor - &current->data[0];
+	if (current->used) {
+		if (frame < current->used) ((frame_t *)&current->data[frame])->records = records;
+		hand_off(current);
+	} else spare.push_back(current);
+	current = NULL;
+	cursor = limit = NULL;
+	{
+		lock_guard<mutex> guard(lock);
+		stop = true;
+	}
+	filled.notify_one();
+	writer.join();
+
+	file.close();
+	if (!file) {
+		cerr << "error: write to event trace file " << filename << " failed!" << endl;
+		exit(-1);
+	}
+	for (unsigned k = 0; k < chunks.size(); k++) delete chunks[k];
+	chunks.clear();
+	spare.clear();
+}
+
+/* waits for a chunk written to the file */
+sim_events::chunk_t *sim_events::take_chunk(){
+	unique_lock<mutex> guard(lock);
+	while (spare.empty()) freed.wait(guard);
+	chunk_t *chunk = spare.back();
+	spare.pop_back();
+	return chunk;
+}
+
+/* makes "chunk" the one being recorded in */
+void sim_events::record_in(chunk_t *chunk){
+	current = chunk;
+	cursor = &chunk->data[chunk->used];
+	limit = &chunk->data[0] + chunk->data.size();
+	last_frame = NO_FRAME;
+}
+
+/* queues a chunk for the writer */
+void sim_events::hand_off(chunk_t *chunk){
+	{
+		lock_guard<mutex> guard(lock);
+		full.push_back(chunk);
+	}
+	filled.notify_one();
+}
+
+void sim_events::begin_cycle(unsigned long cycle){
+	if (cursor + sizeof(frame_t) > limit) {
+		current->used = cursor - &current->data[0];
+		hand_off(current);
+		record_in(take_chunk());
+	}
+	frame = cursor - &current->data[0];
+	frame_t &f = *(frame_t *)cursor;
+	f.cycle = cycle;
+	f.records = 0;
+	memset(f.stall, EVENT_NO_STALL, sizeof f.stall);
+	cursor += sizeof(frame_t);
+	records = 0;
+}
+
+/* no room left for a record: the complete cycles go to the writer, and the one being recorded moves to a new chunk
+   (a cycle larger than a chunk makes the chunk grow) */
+void sim_events::grow(){
+	current->used = cursor - &current->data[0];
+	if (frame == 0) {
+		current->data.resize(current->data.size() * 2);
+		record_in(current);
+		return;
+	}
+	chunk_t *next = take_chunk();
+	size_t partial = current->used - frame;
+	if (next->data.size() < partial + sizeof(event_record_t)) next->data.resize(2 * (partial + sizeof(event_record_t)));
+	memcpy(&next->data[0], &current->data[frame], partial);
+	next->used = partial;
+	current->used = frame;
+	hand_off(current);
+	record_in(next);
+	frame = 0;
+}
+
+/* a cycle with the records and stall reasons of the previous one (a stalled pipeline, most of the time) is dropped
+   here, while it is still in the cache: the writer would find nothing to write */
+void sim_events::end_cycle(const unsigned char *stall){
+	frame_t &f = *(frame_t *)&current->data[frame];
+	f.records = records;
+	memcpy(f.stall, stall, EVENT_STALL_STAGES);
+
+	if (last_frame != NO_FRAME) {
+		const frame_t &l = *(const frame_t *)&current->data[last_frame];
+		if (l.records == f.records && memcmp(l.stall, f.stall, sizeof f.stall) == 0) {
+			const event_record_t *a = (const event_record_t *)(&l + 1), *b = (const event_record_t *)(&f + 1);
+			unsigned n = 0;
+			while (n < records && b[n].stage != EVENT_RETIRED && a[n].slot == b[n].slot && a[n].stage == b[n].stage && a[n].seq == b[n].seq
+			       && memcmp(a[n].field, b[n].field, sizeof a[n].field) == 0) n++;
+			if (n == records) {
+				cursor = (char *)&f;
+				return;
+			}
+		}
+	}
+	last_frame = frame;
+}
+
+/* =============================================================
+
+   ENCODING (writer thread)
+
+   ============================================================= */
+
+void sim_events::write_chunks(){
+	for (;;) {
+		chunk_t *chunk;
+		{
+			unique_lock<mutex> guard(lock);
+			while (full.empty() && !stop) filled.wait(guard);
+			if (full.empty()) return;
+			chunk = full.front();
+			full.pop_front();
+		}
+
+		size_t p = 0;
+		while (p < chunk->used) {
+			const frame_t &f = *(const frame_t *)&chunk->data[p];
+			p += sizeof(frame_t);
+			encode(f, (const event_record_t *)&chunk->data[p]);
+			p += f.records * sizeof(event_record_t);
+		}
+		file.write(out.data(), used);
+		used = 0;
+
+		{
+			lock_guard<mutex> guard(lock);
+			chunk->used = 0;
+			spare.push_back(chunk);
+		}
+		freed.notify_one();
+	}
+}
+
+/* the record of instruction "seq" in the previous cycle written (NULL if it was not there); "slot" is looked at
+   first, then the others in the order of the slots, as the reader does (the records of a cycle are added in that order) */
+const event_record_t *sim_events::previous(unsigned long seq, unsigned slot) const{
+	const event_record_t *found = NULL;
+	for (unsigned k = 0; k < last.size(); k++) {
+		if (last[k].seq != seq) continue;
+		if (last[k].slot == slot) return &last[k];
+		if (!found) found = &last[k];
+	}
+	return found;
+}
+
+/* appends the changes from the previous cycle written to "out" (nothing if there are none) */
+void sim_events::encode(const frame_t &f, const event_record_t *records){
+	// room for the largest encoding of the cycle, written through a pointer
+	size_t largest = MAX_VARINT + last.size() * MAX_VARINT + f.records * (4 + EVENT_FIELDS) * MAX_VARINT + EVENT_STALL_STAGES * 2 * MAX_VARINT + 1;
+	if (out.size() < used + largest) out.resize(2 * (used + largest));
+	char *p = &out[used];
+	put_varint(p, f.cycle - last_cycle);
+	char *items = p;
+
+	// the slots emptied: those of the previous cycle without a record in this one
+	encoded++;
+	for (unsigned n = 0; n < f.records; n++) {
+		if (records[n].stage == EVENT_RETIRED) continue;
+		if (records[n].slot >= mark.size()) mark.resize(records[n].slot + 1, 0);
+		mark[records[n].slot] = encoded;
+	}
+	for (unsigned k = 0; k < last.size(); k++)
+		if (mark[last[k].slot] != encoded) put_varint(p, (unsigned long)last[k].slot << 3 | EVENT_EMPTY);
+
+	// the instructions, against the previous cycle (the state is updated once they are all encoded)
+	for (unsigned n = 0; n < f.records; n++) {
+		const event_record_t &r = records[n];
+		if (r.stage == EVENT_RETIRED) {
+			put_varint(p, EVENT_RETIRE);
+			put_zigzag(p, (long)(r.seq - last_seq));
+			last_seq = r.seq;
+			continue;
+		}
+		const event_record_t *base = previous(r.seq, r.slot);
+		if (base && base->slot == r.slot && base->stage == r.stage && memcmp(base->field, r.field, sizeof r.field) == 0) continue;
+
+		unsigned mask = 0;
+		if (base) {
+			for (unsigned k = 0; k < EVENT_FIELDS; k++)
+				mask |= (unsigned)(r.field[k] != base->field[k]) << k;
+		} else {
+			for (unsigned k = 0; k < EVENT_FIELDS; k++)
+				mask |= (unsigned)(r.field[k] != NO_VALUE) << k;
+		}
+		put_varint(p, (unsigned long)r.slot << 3 | EVENT_INSTR);
+		put_varint(p, r.stage);
+		put_zigzag(p, (long)(r.seq - last_seq));
+		last_seq = r.seq;
+		put_varint(p, mask);
+		for (unsigned k = 0; k < EVENT_FIELDS; k++)
+			if (mask & (1u << k)) put_varint(p, (unsigned long)r.field[k] + 1);
+	}
+
+	for (unsigned s = 0; s < EVENT_STALL_STAGES; s++) {
+		if (f.stall[s] == stall[s]) continue;
+		put_varint(p, (unsigned long)s << 3 | EVENT_STALL);
+		put_varint(p, f.stall[s]);
+		stall[s] = f.stall[s];
+	}
+
+	// the new state
+	last.clear();
+	for (unsigned n = 0; n < f.records; n++)
+		if (records[n].stage != EVENT_RETIRED) last.push_back(records[n]);
+
+	if (p == items) return;
+	put_varint(p, EVENT_END);
+	used = p - &out[0];
+	last_cycle = f.cycle;
+}
+
+/* =============================================================
+
+   READING
+
+   ============================================================= */
+
+void event_reader::open(const char *filename){
+	file.open(filename, ios::in | ios::binary);
+	if (!file.is_open()) {
+		cerr << "error: open file " << filename << " failed!" << endl;
+		exit(-1);
+	}
+	if (!file.read((char *)&header, sizeof header) || memcmp(header.magic, EVENT_MAGIC, sizeof header.magic) != 0) {
+		cerr << "error: " << filename << " is not an event trace" << endl;
+		exit(-1);
+	}
+	if (header.endian != EVENT_ENDIAN || header.version != EVENT_VERSION) {
+		cerr << "error: " << filename << " is a version " << header.version << " event trace (or was written on a host with different endianness); expected version " << EVENT_VERSION << endl;
+		exit(-1);
+	}
+	vector<char> names(header.names_size);
+	if (header.names_size && !file.read(&names[0], names.size())) corrupted();
+	size_t p = 0;
+	for (unsigned k = 0; k < header.opcodes + header.slots; k++) {
+		size_t q = p;
+		while (q < names.size() && names[q]) q++;
+		if (q == names.size()) corrupted();
+		(k < header.opcodes ? opcode_names : slot_names).push_back(string(&names[p], q - p));
+		p = q + 1;
+	}
+
+	buffer.resize(1 << 16);
+	pos = end = 0;
+	last_seq = 0;
+	cycle = 0;
+	memset(stall, EVENT_NO_STALL, sizeof stall);
+}
+
+void event_reader::corrupted(){
+	cerr << "error: the event trace is truncated or corrupted" << endl;
+	exit(-1);
+}
+
+bool event_reader::fill(){
+	file.read(&buffer[0], buffer.size());
+	end = file.gcount();
+	pos = 0;
+	return end > 0;
+}
+
+bool event_reader::byte(unsigned char &b){
+	if (pos == end && !fill()) return false;
+	b = (unsigned char)buffer[pos++];
+	return true;
+}
+
+unsigned long event_reader::varint(){
+	unsigned long value = 0;
+	unsigned char b;
+	for (unsigned shift = 0; shift < 64; shift += 7) {
+		if (!byte(b)) corrupted();
+		value |= (unsigned long)(b & 0x7F) << shift;
+		if (!(b & 0x80)) return value;
+	}
+	corrupted();
+	return 0;
+}
+
+long event_reader::zigzag(){
+	unsigned long value = varint();
+	return (long)(value >> 1) ^ -(long)(value & 1);
+}
+
+bool event_reader::next(){
+	// the cycle delta; a clean end of the file comes before it
+	unsigned char b;
+	if (!byte(b)) return false;
+	pos--;
+	cycle += varint();
+	retired.clear();
+
+	// the changes are read against the previous cycle, and applied at its end
+	vector<event_record_t> changed;
+	vector<unsigned> emptied;
+	for (;;) {
+		unsigned long tag = varint();
+		unsigned slot = tag >> 3;
+		switch (tag & 7) {
+		case EVENT_EMPTY:
+			emptied.push_back(slot);
+			break;
+		case EVENT_INSTR: {
+			event_record_t r;
+			r.slot = slot;
+			r.stage = varint();
+			r.seq = last_seq + zigzag();
+			last_seq = r.seq;
+			const event_record_t *base = NULL;
+			if (slot < present.size() && present[slot] && state[slot].seq == r.seq) base = &state[slot];
+			for (unsigned k = 0; !base && k < present.size(); k++)
+				if (present[k] && state[k].seq == r.seq) base = &state[k];
+			unsigned long mask = varint();
+			for (unsigned k = 0; k < EVENT_FIELDS; k++)
+				r.field[k] = (mask & (1u << k)) ? (unsigned)(varint() - 1) : (base ? base->field[k] : NO_VALUE);
+			changed.push_back(r);
+			break;
+		}
+		case EVENT_STALL:
+			if (slot >= EVENT_STALL_STAGES) corrupted();
+			stall[slot] = varint();
+			break;
+		case EVENT_RETIRE:
+			last_seq += zigzag();
+			retired.push_back(last_seq);
+			break;
+		case EVENT_END:
+			for (unsigned k = 0; k < emptied.size(); k++)
+				if (emptied[k] < present.size()) present[emptied[k]] = 0;
+			for (unsigned k = 0; k < changed.size(); k++) {
+				if (changed[k].slot >= present.size()) {
+					present.resize(changed[k].slot + 1, 0);
+					state.resize(changed[k].slot + 1);
+				}
+				present[changed[k].slot] = 1;
+				state[changed[k].slot] = changed[k];
+			}
+			records.clear();
+			for (unsigned k = 0; k < present.size(); k++)
+				if (present[k]) records.push_back(state[k]);
+			return true;
+		default:
+			corrupted();
+		}
+	}
+}
+
+string event_reader::opcode(unsigned opcode) const{
+	if (opcode < opcode_names.size()) return opcode_names[opcode];
+	return "?";
+}
+
+string event_reader::slot(unsigned slot) const{
+	if (slot < slot_names.size()) return slot_names[slot];
+	return "slot " + to_string(slot);
+}
+
+const char *event_reader::stage(unsigned stage){
+	return stage < NUM_EVENT_STAGES ? stage_names[stage] : "?";
+}
+
+const char *event_reader::stall_reason(unsigned reason){
+	return reason <= EVENT_NO_STALL ? stall_names[reason] : "?";
+}
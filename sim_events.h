@@ -0,0 +1,225 @@
+#ifndef SIM_EVENTS_H_
+#define SIM_EVENTS_H_
+
+#include <fstream>
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+/* =============================================================
+
+   EVENT TRACE
+
+   Structured record of every cycle of the cycle model (see
+   set_event_trace in the simulators), replacing the free-form text of
+   sim_trace.h when the pipeline is to be looked at with a tool
+   (sim_eventview.cc). For each cycle:
+
+     - the instructions in the latches (and, in sim_pipe_fp, in the
+       execution units or the reorder buffer): slot, stage, fetch order
+       and the latch contents (PC, NPC, IR, A, B, IMM, COND, ALU_OUTPUT,
+       LMD, predicted PC)
+     - the stall reason of IF, ID and MEM
+     - the instructions retired
+
+   The stage of a latch is the one it feeds: IF/ID holds the
+   instructions in ID, and so on; an instruction is in IF the cycle
+   before it first appears. The simulation thread only copies the
+   records into a chunk of memory; a background thread encodes the
+   full chunks and writes them to the file:
+
+     header | opcode names | slot names | cycle | cycle | ...
+
+   Only what changed since the previous cycle is written, as varints:
+
+     cycle:   cycles since the previous one written (cycles where nothing
+              changed are not written), then items up to EVENT_END
+     item:    tag = (slot << 3) | kind, then
+              EVENT_EMPTY    -
+              EVENT_INSTR    stage, fetch order (zigzag, from the previous
+                             one written), mask of the fields that differ
+                             from those of the same instruction in the
+                             previous cycle (from all UNDEFINED if it was
+                             not there), and each of those fields + 1
+              EVENT_STALL    (slot = stage) the stall reason
+              EVENT_RETIRE   fetch order (zigzag, as above)
+
+   ============================================================= */
+
+#define EVENT_MAGIC "SIMEVENT"
+#define EVENT_VERSION 1
+
+#define EVENT_CHUNK_SIZE (1 << 20) // bytes of records handed to the writer at once
+#define EVENT_CHUNKS 4             // chunks being recorded, written or waiting to be (the recording waits if none is free)
+
+// stage of an instruction; IF to WB in the order of stage_t
+typedef enum {
+	EVENT_IF, EVENT_ID, EVENT_EX, EVENT_MEM, EVENT_WB,
+	EVENT_IS,  // issued, waiting for its operands (reservation station, or scoreboard read-operands)
+	EVENT_CMT, // completed, waiting to commit (reorder buffer)
+	NUM_EVENT_STAGES,
+	EVENT_RETIRED = NUM_EVENT_STAGES // the instruction retired in this cycle (a record without fields)
+} event_stage_t;
+
+#define EVENT_STALL_STAGES 5 // stall reasons are recorded for IF to WB
+
+// items of a cycle in the file
+typedef enum {EVENT_EMPTY, EVENT_INSTR, EVENT_STALL, EVENT_RETIRE, EVENT_END} event_item_t;
+
+// why a stage held its instructions in a cycle; the first four are those of stall_t
+typedef enum {EVENT_DATA_STALL, EVENT_CONTROL_STALL, EVENT_MEMORY_STALL, EVENT_FETCH_STALL, EVENT_STRUCTURAL_STALL, EVENT_NO_STALL} event_stall_t;
+
+// latch contents of a record
+typedef enum {
+	EVENT_PC, EVENT_NPC, EVENT_OPCODE, EVENT_SRC1, EVENT_SRC2, EVENT_DEST, EVENT_IMMEDIATE, EVENT_TARGET,
+	EVENT_A, EVENT_B, EVENT_IMM, EVENT_COND, EVENT_ALU_OUTPUT, EVENT_LMD, EVENT_PRED_PC, EVENT_FIELDS
+} event_field_t;
+
+// an instruction in a slot in one cycle
+typedef struct {
+	unsigned slot;                // latch lane, execution unit or reorder buffer entry, numbered by the simulator
+	unsigned stage;               // event_stage_t
+	unsigned long seq;            // fetch order of the instruction
+	unsigned field[EVENT_FIELDS]; // latch contents (UNDEFINED if not used)
+} event_record_t;
+
+typedef struct {
+	char magic[8];          // EVENT_MAGIC
+	unsigned version;       // EVENT_VERSION
+	unsigned endian;        // 0x01020304 as written by the host that recorded the trace
+	char isa[8];            // instruction set of the simulator (NUL-padded)
+	unsigned opcodes;       // number of opcode names
+	unsigned slots;         // number of slot names
+	unsigned names_size;    // size in bytes of the names (NUL-terminated, opcodes first)
+} event_header_t;
+
+// writes the event trace of a simulator
+class sim_events {
+
+	// cycles recorded by the simulation thread: a frame header per cycle, followed by its records
+	typedef struct {
+		unsigned long cycle;
+		unsigned records;
+		unsigned char stall[EVENT_STALL_STAGES];
+	} frame_t;
+
+	typedef struct {
+		std::vector<char> data;
+		size_t used;
+	} chunk_t;
+
+	bool active;
+	std::ofstream file;
+	std::string filename;
+
+	// simulation thread
+	chunk_t *current;
+	char *cursor;      // end of what has been recorded in current
+	char *limit;       // end of current
+	size_t frame;      // offset in current of the cycle being recorded
+	size_t last_frame; // and of the one before it (NO_FRAME if it is not in current)
+	unsigned records;  // records of that cycle so far
+
+	// hand-off between the two threads
+	std::thread writer;
+	std::mutex lock;
+	std::condition_variable filled; // a chunk is waiting to be written, or stop is set
+	std::condition_variable freed;  // a chunk has been written
+	std::deque<chunk_t *> full;
+	std::vector<chunk_t *> spare;
+	std::vector<chunk_t *> chunks;
+	bool stop;
+
+	// writer thread: state of the previous cycle written
+	std::vector<event_record_t> last;  // its instructions
+	std::vector<unsigned long> mark;   // by slot: the last cycle encoded with an instruction in the slot
+	unsigned long encoded;             // cycles encoded
+	unsigned char stall[EVENT_STALL_STAGES];
+	unsigned long last_cycle;
+	unsigned long last_seq;
+	std::vector<char> out; // encoding of the chunk
+	size_t used;
+
+	sim_events(const sim_events &);
+	sim_events &operator=(const sim_events &);
+
+	chunk_t *take_chunk();
+	void record_in(chunk_t *chunk);
+	void grow();
+	void hand_off(chunk_t *chunk);
+	void write_chunks();
+	void encode(const frame_t &f, const event_record_t *records);
+	const event_record_t *previous(unsigned long seq, unsigned slot) const;
+
+public:
+	sim_events();
+	~sim_events();
+
+	// starts writing the trace to "filename": the header, with the names of the opcodes and of the slots
+	void open(const char *filename, const char *isa, const char *const *opcode_names, unsigned opcodes, const std::vector<std::string> &slot_names);
+
+	// writes what has been recorded and closes the file (nothing if not open)
+	void close();
+
+	bool enabled() const { return active; }
+
+	// the records of a cycle: begin_cycle, then add for each instruction in the order of the slots (and for each one retired), then end_cycle
+	void begin_cycle(unsigned long cycle);
+	event_record_t &add(unsigned slot, unsigned stage, unsigned long seq){
+		if(cursor + sizeof(event_record_t) > limit) grow();
+		event_record_t &r = *(event_record_t *)cursor;
+		cursor += sizeof(event_record_t);
+		records++;
+		r.slot = slot;
+		r.stage = stage;
+		r.seq = seq;
+		return r;
+	}
+	void end_cycle(const unsigned char *stall);
+};
+
+// reads an event trace, one cycle written at a time
+class event_reader {
+
+	std::ifstream file;
+	std::vector<char> buffer;
+	size_t pos;
+	size_t end;
+	unsigned long last_seq;
+	std::vector<event_record_t> state; // by slot
+	std::vector<char> present;
+
+	bool fill();
+	bool byte(unsigned char &b);
+	unsigned long varint();
+	long zigzag();
+	void corrupted();
+
+public:
+	event_header_t header;
+	std::vector<std::string> opcode_names;
+	std::vector<std::string> slot_names;
+
+	// the cycle read by next(): it lasts until the cycle of the next one
+	unsigned long cycle;
+	std::vector<event_record_t> records; // instructions in the slots, by slot
+	std::vector<unsigned long> retired;  // instructions retired in the cycle
+	unsigned char stall[EVENT_STALL_STAGES];
+
+	// opens "filename" and reads its header (terminates the program if it is not an event trace)
+	void open(const char *filename);
+
+	// reads the next cycle written; false at the end of the trace
+	bool next();
+
+	// names of an opcode, a slot, a stage and a stall reason
+	std::string opcode(unsigned opcode) const;
+	std::string slot(unsigned slot) const;
+	static const char *stage(unsigned stage);
+	static const char *stall_reason(unsigned reason);
+};
+
+#endif /*SIM_EVENTS_H_*/
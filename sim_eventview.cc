@@ -0,0 +1,447 @@
+/* =============================================================
+
+   EVENT TRACE VIEWER
+
+   Prints an event trace written by set_event_trace (sim_events.h),
+   of either simulator, as:
+
+     diagram  the classic pipeline diagram: a row per instruction, in
+              fetch order, and a column per cycle with the stage the
+              instruction is in. A cycle spent again in IF, ID or MEM
+              while that stage is stalled shows the reason instead:
+              d (data), c (control), m (memory), f (fetch, I-cache
+              miss), s (structural); x marks a squashed instruction
+     konata   a log for the Konata pipeline viewer (Kanata 0004); the
+              stall reasons are in the detail text of the instructions
+     chrome   Chrome trace event JSON (chrome://tracing, Perfetto): a
+              track per slot (latch lane, execution unit or reorder
+              buffer entry) with the instructions it holds, and a track
+              per stage with its stalls; 1 cycle = 1 us
+
+   usage: eventview [-o diagram|konata|chrome] [-r first:last] trace
+
+     -o format output (default diagram)
+     -r range  cycles shown (default: all, and the first 60 for the
+               diagram)
+
+   ============================================================= */
+
+#include "sim_events.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <iostream>
+#include <map>
+#include <set>
+
+using namespace std;
+
+#define DIAGRAM_CYCLES 60
+#define IF_TRACK 1000    // chrome: tracks of IF (one per slot an instruction is fetched into) ...
+#define STALL_TRACK 2000 // ... and of the stalls of each stage
+
+static const char stall_letters[EVENT_NO_STALL + 1] = {'d', 'c', 'm', 'f', 's', ' '};
+
+static void usage(const char *message){
+	cerr << "error: " << message << endl;
+	cerr << "usage: eventview [-o diagram|konata|chrome] [-r first:last] trace" << endl;
+	exit(-1);
+}
+
+// an instruction in flight
+typedef struct {
+	unsigned long seq;
+	unsigned pc;
+	unsigned opcode;
+	unsigned stage;
+	unsigned slot;
+	unsigned long since; // cycle it entered its stage (or slot)
+	bool retired;
+} inst_t;
+
+/* =============================================================
+
+   OUTPUT FORMATS
+
+   Told, in cycle order, of what happens to the instructions and the
+   stalls of the cycles shown (see walk).
+
+   ============================================================= */
+
+class trace_view {
+public:
+	virtual ~trace_view() {}
+	// the first cycle shown, with the instructions in flight and the stall reasons then
+	virtual void start(unsigned long cycle, const map<unsigned long, inst_t> &flight, const unsigned char *stall) = 0;
+	// "inst" appears in "cycle" (it was in IF the cycle before)
+	virtual void enter(const inst_t &inst, unsigned long cycle) = 0;
+	// "inst" leaves its stage (or slot) in "cycle", for another one
+	virtual void change(const inst_t &inst, unsigned long cycle) = 0;
+	// "inst" has gone in "cycle": retired, or squashed
+	virtual void leave(const inst_t &inst, unsigned long cycle) = 0;
+	// "stage" stalled for "reason" from "since" up to "cycle"
+	virtual void stall(unsigned stage, unsigned reason, unsigned long since, unsigned long cycle, const map<unsigned long, inst_t> &flight) = 0;
+	// the cycles shown end before "cycle"
+	virtual void finish(unsigned long cycle) = 0;
+};
+
+/* the pipeline diagram, drawn once all the cycles shown are known */
+class diagram_view : public trace_view {
+
+	typedef struct {
+		unsigned stage;
+		unsigned long since, until;
+	} span_t;
+
+	typedef struct {
+		unsigned pc;
+		unsigned opcode;
+		unsigned long fetched; // cycle in IF (the one before it appeared)
+		vector<span_t> spans;
+		bool squashed;
+	} row_t;
+
+	const event_reader &trace;
+	unsigned long first;
+	map<unsigned long, row_t> rows;
+	vector<unsigned char> stalls[EVENT_STALL_STAGES]; // stall reason of each stage in each cycle shown
+
+	row_t &row(const inst_t &inst, unsigned long fetched){
+		map<unsigned long, row_t>::iterator r = rows.find(inst.seq);
+		if (r != rows.end()) return r->second;
+		row_t &n = rows[inst.seq];
+		n.pc = inst.pc;
+		n.opcode = inst.opcode;
+		n.fetched = fetched;
+		n.squashed = false;
+		return n;
+	}
+
+	void close(const inst_t &inst, unsigned long cycle){
+		span_t s = {inst.stage, inst.since, cycle};
+		row(inst, inst.since - 1).spans.push_back(s);
+	}
+
+	unsigned char reason(unsigned stage, unsigned long cycle){
+		if (stage >= EVENT_STALL_STAGES || cycle < first || cycle - first >= stalls[stage].size()) return EVENT_NO_STALL;
+		return stalls[stage][cycle - first];
+	}
+
+public:
+	diagram_view(const event_reader &reader) : trace(reader) { first = 0; }
+
+	void start(unsigned long cycle, const map<unsigned long, inst_t> &, const unsigned char *){
+		first = cycle;
+	}
+
+	void enter(const inst_t &inst, unsigned long cycle){
+		row(inst, cycle - 1);
+	}
+
+	void change(const inst_t &inst, unsigned long cycle){
+		close(inst, cycle);
+	}
+
+	void leave(const inst_t &inst, unsigned long cycle){
+		close(inst, cycle);
+		if (!inst.retired) rows[inst.seq].squashed = true;
+	}
+
+	void stall(unsigned stage, unsigned reason, unsigned long since, unsigned long cycle, const map<unsigned long, inst_t> &){
+		if (stage >= EVENT_STALL_STAGES) return;
+		if (stalls[stage].size() < cycle - first) stalls[stage].resize(cycle - first, EVENT_NO_STALL);
+		for (unsigned long t = since; t < cycle; t++) stalls[stage][t - first] = reason;
+	}
+
+	void finish(unsigned long cycle){
+		unsigned long columns = cycle - first;
+		printf("%-24s", "cycle (mod 1000)");
+		for (unsigned long t = first; t < cycle; t++) printf("%4lu", t % 1000);
+		printf("\n");
+
+		for (map<unsigned long, row_t>::iterator r = rows.begin(); r != rows.end(); r++) {
+			row_t &row = r->second;
+			vector<string> cells(columns, "");
+			if (row.fetched >= first && row.fetched < cycle) {
+				cells[row.fetched - first] = "IF";
+				// the cycles IF waited for the I-cache to fetch it
+				for (unsigned long t = row.fetched; t > first && reason(EVENT_IF, t - 1) == EVENT_FETCH_STALL && cells[t - 1 - first].empty(); t--)
+					cells[t - 1 - first] = "f";
+			}
+			unsigned long end = row.fetched + 1;
+			for (unsigned k = 0; k < row.spans.size(); k++) {
+				const span_t &s = row.spans[k];
+				for (unsigned long t = max(s.since, first); t < s.until && t < cycle; t++) {
+					unsigned char why = reason(s.stage, t);
+					if (t == s.since || why == EVENT_NO_STALL) cells[t - first] = event_reader::stage(s.stage);
+					else cells[t - first] = string(1, stall_letters[why]);
+				}
+				end = max(end, s.until);
+			}
+			if (row.squashed && end >= first && end < cycle) cells[end - first] = "x";
+
+			char label[32];
+			snprintf(label, sizeof label, "%6lu 0x%04x %s", r->first, row.pc, trace.opcode(row.opcode).c_str());
+			printf("%-24s", label);
+			for (unsigned long t = 0; t < columns; t++) printf("%4s", cells[t].c_str());
+			printf("\n");
+		}
+	}
+};
+
+/* Konata log: one command per line, the cycle moving forward with C */
+class konata_view : public trace_view {
+
+	const event_reader &trace;
+	unsigned long now;
+	unsigned long next_id;
+	unsigned long next_retire;
+	map<unsigned long, unsigned long> ids; // konata id of each instruction in flight
+
+	void advance(unsigned long cycle){
+		if (cycle > now) printf("C\t%lu\n", cycle - now);
+		now = max(now, cycle);
+	}
+
+	unsigned long introduce(const inst_t &inst){
+		unsigned long id = next_id++;
+		ids[inst.seq] = id;
+		printf("I\t%lu\t%lu\t0\n", id, inst.seq);
+		printf("L\t%lu\t0\t0x%04x: %s\n", id, inst.pc, trace.opcode(inst.opcode).c_str());
+		return id;
+	}
+
+public:
+	konata_view(const event_reader &reader) : trace(reader) { now = next_id = next_retire = 0; }
+
+	void start(unsigned long cycle, const map<unsigned long, inst_t> &flight, const unsigned char *){
+		printf("Kanata\t0004\nC=\t%lu\n", cycle);
+		now = cycle;
+		for (map<unsigned long, inst_t>::const_iterator i = flight.begin(); i != flight.end(); i++)
+			printf("S\t%lu\t0\t%s\n", introduce(i->second), event_reader::stage(i->second.stage));
+	}
+
+	void enter(const inst_t &inst, unsigned long cycle){
+		if (cycle > now) {
+			advance(cycle - 1);
+			unsigned long id = introduce(inst);
+			printf("S\t%lu\t0\tIF\n", id);
+			advance(cycle);
+			printf("E\t%lu\t0\tIF\n", id);
+			printf("S\t%lu\t0\t%s\n", id, event_reader::stage(inst.stage));
+		}
+		else printf("S\t%lu\t0\t%s\n", introduce(inst), event_reader::stage(inst.stage));
+	}
+
+	void change(const inst_t &inst, unsigned long cycle){
+		advance(cycle);
+		printf("E\t%lu\t0\t%s\n", ids[inst.seq], event_reader::stage(inst.stage));
+	}
+
+	void leave(const inst_t &inst, unsigned long cycle){
+		advance(cycle);
+		unsigned long id = ids[inst.seq];
+		printf("E\t%lu\t0\t%s\n", id, event_reader::stage(inst.stage));
+		printf("R\t%lu\t%lu\t%d\n", id, inst.retired ? next_retire++ : 0, inst.retired ? 0 : 1);
+		ids.erase(inst.seq);
+	}
+
+	// the reason is added to the detail text of the instructions in the stage
+	void stall(unsigned stage, unsigned reason, unsigned long since, unsigned long cycle, const map<unsigned long, inst_t> &flight){
+		if (reason == EVENT_NO_STALL) return;
+		for (map<unsigned long, inst_t>::const_iterator i = flight.begin(); i != flight.end(); i++)
+			if (i->second.stage == stage && ids.count(i->first))
+				printf("L\t%lu\t1\t%s stalled (%s) in cycles %lu-%lu\\n\n", ids[i->first], event_reader::stage(stage), event_reader::stall_reason(reason), since, cycle - 1);
+	}
+
+	void finish(unsigned long cycle){
+		advance(cycle);
+	}
+};
+
+/* Chrome trace events: a complete event ("X") per instruction and slot, and per stall */
+class chrome_view : public trace_view {
+
+	const event_reader &trace;
+	unsigned long first;
+	bool comma;
+	set<unsigned> tracks;
+	map<unsigned long, inst_t> open; // the instructions in flight, as in their current slot
+
+	void event(const string &name, const char *category, unsigned track, unsigned long since, unsigned long until, const string &args){
+		if (!tracks.count(track)) {
+			string thread = track >= STALL_TRACK ? string(event_reader::stage(track - STALL_TRACK)) + " stalls"
+			              : track >= IF_TRACK ? "IF (" + trace.slot(track - IF_TRACK) + ")" : trace.slot(track);
+			printf("%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s\"}}", comma ? ",\n" : "", track, thread.c_str());
+			printf(",\n{\"name\":\"thread_sort_index\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"sort_index\":%u}}", track, track);
+			tracks.insert(track);
+			comma = true;
+		}
+		printf("%s{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%lu,\"dur\":%lu,\"pid\":1,\"tid\":%u%s}",
+		       comma ? ",\n" : "", name.c_str(), category, since, until - since, track, args.c_str());
+		comma = true;
+	}
+
+	void span(const inst_t &inst, unsigned long cycle){
+		char args[96];
+		snprintf(args, sizeof args, ",\"args\":{\"seq\":%lu,\"pc\":\"0x%04x\"}", inst.seq, inst.pc);
+		event(trace.opcode(inst.opcode), event_reader::stage(inst.stage), inst.slot, max(inst.since, first), cycle, args);
+	}
+
+public:
+	chrome_view(const event_reader &reader) : trace(reader) { first = 0; comma = false; }
+
+	void start(unsigned long cycle, const map<unsigned long, inst_t> &flight, const unsigned char *){
+		first = cycle;
+		printf("{\"traceEvents\":[\n");
+		open = flight;
+	}
+
+	void enter(const inst_t &inst, unsigned long cycle){
+		if (cycle > first) {
+			inst_t fetch = inst;
+			fetch.stage = EVENT_IF;
+			fetch.slot = IF_TRACK + inst.slot;
+			fetch.since = cycle - 1;
+			span(fetch, cycle);
+		}
+		open[inst.seq] = inst;
+	}
+
+	void change(const inst_t &inst, unsigned long cycle){
+		span(inst, cycle);
+	}
+
+	void leave(const inst_t &inst, unsigned long cycle){
+		span(inst, cycle);
+		open.erase(inst.seq);
+	}
+
+	void stall(unsigned stage, unsigned reason, unsigned long since, unsigned long cycle, const map<unsigned long, inst_t> &){
+		if (reason == EVENT_NO_STALL) return;
+		event(event_reader::stall_reason(reason), "stall", STALL_TRACK + stage, max(since, first), cycle, "");
+	}
+
+	void finish(unsigned long){
+		printf("\n]}\n");
+	}
+};
+
+/* =============================================================
+
+   WALK
+
+   ============================================================= */
+
+/* reads the trace and tells "view" what happens in the cycles from "first" to "last" */
+static void walk(event_reader &trace, unsigned long first, unsigned long last, trace_view &view){
+	map<unsigned long, inst_t> flight;
+	unsigned char stall[EVENT_STALL_STAGES];
+	unsigned long stall_since[EVENT_STALL_STAGES];
+	memset(stall, EVENT_NO_STALL, sizeof stall);
+	memset(stall_since, 0, sizeof stall_since);
+	bool seen = false, started = false;
+	unsigned long end = first;
+
+	while (trace.next() && trace.cycle <= last) {
+		unsigned long c = trace.cycle;
+		if (!started && c >= first) {
+			// the cycles shown start with the state of the last cycle written before them (if any)
+			unsigned long start = seen ? first : max(c, first);
+			for (map<unsigned long, inst_t>::iterator i = flight.begin(); i != flight.end(); i++) i->second.since = max(i->second.since, start);
+			for (unsigned s = 0; s < EVENT_STALL_STAGES; s++) stall_since[s] = max(stall_since[s], start);
+			view.start(start, flight, stall);
+			started = true;
+		}
+
+		// the instructions gone, those in a new stage or slot, and the new ones
+		set<unsigned long> present;
+		for (unsigned k = 0; k < trace.records.size(); k++) present.insert(trace.records[k].seq);
+		for (map<unsigned long, inst_t>::iterator i = flight.begin(); i != flight.end(); ) {
+			if (present.count(i->first)) {
+				i++;
+				continue;
+			}
+			if (started) view.leave(i->second, c);
+			flight.erase(i++);
+		}
+		for (unsigned k = 0; k < trace.records.size(); k++) {
+			const event_record_t &r = trace.records[k];
+			map<unsigned long, inst_t>::iterator i = flight.find(r.seq);
+			if (i == flight.end()) {
+				inst_t inst = {r.seq, r.field[EVENT_PC], r.field[EVENT_OPCODE], r.stage, r.slot, c, false};
+				flight[r.seq] = inst;
+				if (started) view.enter(inst, c);
+			}
+			else if (i->second.stage != r.stage || i->second.slot != r.slot) {
+				if (started) view.change(i->second, c);
+				i->second.stage = r.stage;
+				i->second.slot = r.slot;
+				i->second.since = c;
+			}
+		}
+		// (an instruction retires in a cycle it is still in, which may be its first)
+		for (unsigned k = 0; k < trace.retired.size(); k++)
+			if (flight.count(trace.retired[k])) flight[trace.retired[k]].retired = true;
+
+		for (unsigned s = 0; s < EVENT_STALL_STAGES; s++) {
+			if (trace.stall[s] == stall[s]) continue;
+			if (started) view.stall(s, stall[s], stall_since[s], c, flight);
+			stall[s] = trace.stall[s];
+			stall_since[s] = c;
+		}
+		seen = true;
+		end = c + 1;
+	}
+
+	if (!started) {
+		view.start(first, flight, stall);
+		end = first;
+	}
+	if (last != (unsigned long)-1) end = last + 1;
+
+	// what is still going on ends with the cycles shown (the instructions retired in the last one are gone)
+	for (unsigned s = 0; s < EVENT_STALL_STAGES; s++)
+		if (stall_since[s] < end) view.stall(s, stall[s], stall_since[s], end, flight);
+	for (map<unsigned long, inst_t>::iterator i = flight.begin(); i != flight.end(); i++) {
+		if (i->second.since >= end) continue;
+		if (i->second.retired) view.leave(i->second, end);
+		else view.change(i->second, end);
+	}
+	view.finish(end);
+}
+
+int main(int argc, char **argv){
+	string format = "diagram";
+	unsigned long first = 0, last = (unsigned long)-1;
+	bool range = false;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "o:r:")) != -1) {
+		switch (opt) {
+		case 'o':
+			format = optarg;
+			if (format != "diagram" && format != "konata" && format != "chrome") usage("-o expects diagram, konata or chrome");
+			break;
+		case 'r':
+			if (sscanf(optarg, "%lu:%lu", &first, &last) != 2 || last < first) usage("-r expects first:last cycles");
+			range = true;
+			break;
+		default: usage("unknown option");
+		}
+	}
+	if (optind != argc - 1) usage("expected one event trace");
+	if (format == "diagram" && !range) last = first + DIAGRAM_CYCLES - 1;
+
+	event_reader trace;
+	trace.open(argv[optind]);
+
+	trace_view *view;
+	if (format == "konata") view = new konata_view(trace);
+	else if (format == "chrome") view = new chrome_view(trace);
+	else view = new diagram_view(trace);
+	walk(trace, first, last, *view);
+	delete view;
+	return 0;
+}
@@ -0,0 +1,145 @@
+#include "sim_image.h"
+#include <stdlib.h>
+#include <iostream>
+#include <fstream>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+#define IMAGE_ENDIAN 0x01020304
+
+sim_image::sim_image(){
+	map = NULL;
+	size = 0;
+	header = NULL;
+}
+
+sim_image::~sim_image(){
+	unload();
+}
+
+void sim_image::unload(){
+	if (map) munmap(map, size);
+	map = NULL;
+	size = 0;
+	header = NULL;
+}
+
+/* =============================================================
+
+   LOADING
+
+   ============================================================= */
+
+void sim_image::load(const char *filename, const char *isa, unsigned record_size){
+	unload();
+
+	int fd = open(filename, O_RDONLY);
+	struct stat st;
+	if (fd < 0 || fstat(fd, &st) != 0) {
+		cerr << "error: open file " << filename << " failed!" << endl;
+		exit(-1);
+	}
+	if ((size_t)st.st_size < sizeof(image_header_t)) {
+		cerr << "error: " << filename << " is not a program image" << endl;
+		exit(-1);
+	}
+	size = st.st_size;
+	map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		cerr << "error: mmap of file " << filename << " failed!" << endl;
+		exit(-1);
+	}
+	header = (const image_header_t *)map;
+
+	if (memcmp(header->magic, IMAGE_MAGIC, sizeof header->magic) != 0) {
+		cerr << "error: " << filename << " is not a program image" << endl;
+		exit(-1);
+	}
+	if (header->endian != IMAGE_ENDIAN || header->version != IMAGE_VERSION) {
+		cerr << "error: " << filename << " is a version " << header->version << " image (or was written on a host with different endianness); expected version " << IMAGE_VERSION << endl;
+		exit(-1);
+	}
+	if (strncmp(header->isa, isa, sizeof header->isa) != 0 || header->record_size != record_size) {
+		cerr << "error: " << filename << " holds " << string(header->isa, strnlen(header->isa, sizeof header->isa)) << " instructions of " << header->record_size
+		     << " bytes; this simulator executes " << isa << " instructions of " << record_size << " bytes" << endl;
+		exit(-1);
+	}
+	size_t expected = sizeof(image_header_t) + (size_t)header->count * header->record_size
+	                + 2 * sizeof(unsigned) * (size_t)header->labels + header->names_size;
+	if (size != expected) {
+		cerr << "error: " << filename << " is truncated or corrupted (" << size << " bytes, expected " << expected << ")" << endl;
+		exit(-1);
+	}
+
+	// the label table is searched by index and its names printed: indexes in order, names inside the table and terminated
+	const unsigned *indexes = (const unsigned *)((const char *)records() + (size_t)header->count * header->record_size);
+	const unsigned *offsets = indexes + header->labels;
+	const char *names = (const char *)(offsets + header->labels);
+	bool valid = header->labels == 0 || (header->names_size > 0 && names[header->names_size - 1] == '\0');
+	for (unsigned l = 0; valid && l < header->labels; l++)
+		valid = (l == 0 || indexes[l] >= indexes[l-1]) && offsets[l] < header->names_size;
+	if (!valid) {
+		cerr << "error: " << filename << " is corrupted (invalid label table)" << endl;
+		exit(-1);
+	}
+}
+
+const void *sim_image::records() const{
+	if (!header) return NULL;
+	return (const char *)map + sizeof(image_header_t);
+}
+
+unsigned sim_image::count() const{
+	if (!header) return 0;
+	return header->count;
+}
+
+void sim_image::labels(asm_labels &labels) const{
+	if (!header || header->labels == 0) {
+		labels.clear();
+		return;
+	}
+	const unsigned *indexes = (const unsigned *)((const char *)records() + (size_t)header->count * header->record_size);
+	const unsigned *offsets = indexes + header->labels;
+	labels.view(indexes, offsets, (const char *)(offsets + header->labels), header->labels);
+}
+
+/* =============================================================
+
+   SAVING
+
+   ============================================================= */
+
+void sim_image::save(const char *filename, const char *isa, const void *records, unsigned record_size, unsigned count, const asm_labels &labels){
+	image_header_t h;
+	memset(&h, 0, sizeof h);
+	memcpy(h.magic, IMAGE_MAGIC, sizeof h.magic);
+	h.version = IMAGE_VERSION;
+	h.endian = IMAGE_ENDIAN;
+	strncpy(h.isa, isa, sizeof h.isa - 1);
+	h.record_size = record_size;
+	h.count = count;
+	h.labels = labels.size();
+	h.names_size = labels.name_table_size();
+
+	ofstream fout(filename, ios::out | ios::binary | ios::trunc);
+	if (!fout.is_open()) {
+		cerr << "error: open file " << filename << " failed!" << endl;
+		exit(-1);
+	}
+	fout.write((const char *)&h, sizeof h);
+	fout.write((const char *)records, (size_t)count * record_size);
+	fout.write((const char *)labels.index_table(), h.labels * sizeof(unsigned));
+	fout.write((const char *)labels.offset_table(), h.labels * sizeof(unsigned));
+	fout.write(labels.name_table(), h.names_size);
+	if (!fout) {
+		cerr << "error: write to file " << filename << " failed!" << endl;
+		exit(-1);
+	}
+}
@@ -0,0 +1,68 @@
+#ifndef SIM_IMAGE_H_
+#define SIM_IMAGE_H_
+
+#include <stddef.h>
+#include "sim_asm.h"
+
+/* =============================================================
+
+   PRE-ASSEMBLED PROGRAM IMAGE
+
+   Binary form of an assembled program, loaded by mapping the file
+   and executing its instruction records in place:
+
+     header | instruction records | label indexes | label name offsets | label names
+
+   The records are the simulator's own instruction_t, so an image can
+   only be loaded by the simulator (ISA tag) and build (record size)
+   that wrote it. Any mismatch terminates the program, as does a label
+   table out of order or out of bounds; the records themselves are
+   checked by the simulator loading them.
+
+   ============================================================= */
+
+#define IMAGE_MAGIC "SIMIMAGE"
+#define IMAGE_VERSION 1
+
+typedef struct {
+	char magic[8];          // IMAGE_MAGIC
+	unsigned version;       // IMAGE_VERSION
+	unsigned endian;        // 0x01020304 as written by the host that built the image
+	char isa[8];            // instruction set of the records (NUL-padded)
+	unsigned record_size;   // sizeof(instruction_t) of the simulator that wrote the image
+	unsigned count;         // number of instruction records
+	unsigned labels;        // number of labels
+	unsigned names_size;    // size in bytes of the label names
+} image_header_t;
+
+class sim_image {
+
+	void *map;
+	size_t size;
+	const image_header_t *header;
+
+	sim_image(const sim_image &);
+	sim_image &operator=(const sim_image &);
+
+public:
+	sim_image();
+	~sim_image();
+
+	// maps "filename" and checks that it holds a program for "isa" with records of "record_size" bytes
+	void load(const char *filename, const char *isa, unsigned record_size);
+
+	// releases the mapping (the records and label table must not be used afterwards)
+	void unload();
+
+	// instruction records and their number (NULL / 0 if no image is loaded)
+	const void *records() const;
+	unsigned count() const;
+
+	// points "labels" at the label table of the image
+	void labels(asm_labels &labels) const;
+
+	// writes "count" records of "record_size" bytes and the label table to "filename"
+	static void save(const char *filename, const char *isa, const void *records, unsigned record_size, unsigned count, const asm_labels &labels);
+};
+
+#endif /*SIM_IMAGE_H_*/
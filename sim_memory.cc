@@ -0,0 +1,111 @@
+#include "sim_memory.h"
+#include <stdlib.h>
+#include <iostream>
+#include <cstring>
+
+using namespace std;
+
+#define NO_PAGE 0xFFFFFFFF
+#define MAX_SIZE ((uint64_t)1 << 32)
+#define TABLE_MASK ((1u << PAGE_TABLE_BITS) - 1)
+
+sim_memory::sim_memory(uint64_t bytes){
+	blank = new page_t;
+	blank->refs = 2;
+	memset(blank->data, 0xFF, PAGE_SIZE);
+	size = 0;
+	flush_tlb();
+	resize(bytes);
+}
+
+sim_memory::~sim_memory(){
+	reset();
+	for (unsigned p = 0; p < spare.size(); p++) delete spare[p];
+	delete blank;
+}
+
+void sim_memory::resize(uint64_t bytes){
+	if (bytes > MAX_SIZE) {
+		cerr << "error: a data memory of " << bytes << " bytes does not fit in a 32-bit address space" << endl;
+		exit(-1);
+	}
+	reset();
+	size = bytes;
+	uint64_t pages = (size + PAGE_SIZE - 1) >> PAGE_BITS;
+	root.assign((pages + TABLE_MASK) >> PAGE_TABLE_BITS, vector<page_t *>());
+}
+
+void sim_memory::flush_tlb(){
+	for (unsigned k = 0; k < TLB_ENTRIES; k++) {
+		tlb[k].page = NO_PAGE;
+		tlb[k].data = blank;
+	}
+}
+
+void sim_memory::release(page_t *page){
+	if (page->refs.fetch_sub(1, memory_order_acq_rel) == 1) spare.push_back(page);
+}
+
+// the pages that are not blank go back to the blank page; the second level tables are kept
+void sim_memory::reset(){
+	for (unsigned k = 0; k < mapped.size(); k++) {
+		page_t *&entry = root[mapped[k] >> PAGE_TABLE_BITS][mapped[k] & TABLE_MASK];
+		release(entry);
+		entry = blank;
+	}
+	mapped.clear();
+	flush_tlb();
+}
+
+void sim_memory::share(const sim_memory &source){
+	if (&source == this) return;
+	reset();
+	size = source.size;
+	root.assign(source.root.size(), vector<page_t *>());
+	for (unsigned t = 0; t < root.size(); t++)
+		if (!source.root[t].empty()) root[t].assign(1u << PAGE_TABLE_BITS, blank);
+	mapped = source.mapped;
+	for (unsigned k = 0; k < mapped.size(); k++) {
+		page_t *page = source.root[mapped[k] >> PAGE_TABLE_BITS][mapped[k] & TABLE_MASK];
+		page->refs.fetch_add(1, memory_order_relaxed);
+		root[mapped[k] >> PAGE_TABLE_BITS][mapped[k] & TABLE_MASK] = page;
+	}
+}
+
+sim_memory::page_t *sim_memory::lookup(unsigned page){
+	const vector<page_t *> &table = root[page >> PAGE_TABLE_BITS];
+	page_t *data = table.empty() ? blank : table[page & TABLE_MASK];
+	tlb_entry_t &e = tlb[page & (TLB_ENTRIES - 1)];
+	e.page = page;
+	e.data = data;
+	return data;
+}
+
+sim_memory::page_t *sim_memory::map(unsigned page){
+	vector<page_t *> &table = root[page >> PAGE_TABLE_BITS];
+	if (table.empty()) table.assign(1u << PAGE_TABLE_BITS, blank);
+	page_t *&entry = table[page & TABLE_MASK];
+	if (entry->refs.load(memory_order_acquire) != 1) {
+		// first write since the page was blank or shared: a private copy
+		page_t *copy;
+		if (spare.empty()) copy = new page_t;
+		else {
+			copy = spare.back();
+			spare.pop_back();
+		}
+		copy->refs.store(1, memory_order_relaxed);
+		memcpy(copy->data, entry->data, PAGE_SIZE);
+		if (entry == blank) mapped.push_back(page);
+		else release(entry);
+		entry = copy;
+	}
+	tlb_entry_t &e = tlb[page & (TLB_ENTRIES - 1)];
+	e.page = page;
+	e.data = entry;
+	return entry;
+}
+
+void sim_memory::out_of_range(unsigned address, unsigned bytes) const{
+	cerr << "error: access of " << bytes << " byte(s) at address 0x" << hex << address << dec << " is outside the data memory (" << size << " bytes)" << endl;
+	exit(-1);
+}
@@ -0,0 +1,138 @@
+#ifndef SIM_MEMORY_H_
+#define SIM_MEMORY_H_
+
+#include <stdint.h>
+#include <vector>
+#include <atomic>
+
+/* =============================================================
+
+   PAGED DATA MEMORY
+
+   Shared by sim_pipe and sim_pipe_fp. The address space is split in
+   pages of PAGE_SIZE bytes, found through a two-level page table
+   (PAGE_TABLE_BITS of the page number per level). A page is allocated
+   on its first write; until then it is mapped to a single blank page
+   that reads 0xFF, so a large memory costs nothing until it is used.
+   reset() unmaps the pages written since the previous reset and keeps
+   them for reuse, in time proportional to their number.
+
+   share() makes a memory a copy of another one in time proportional
+   to the pages written: the two share their pages, copy-on-write. A
+   page counts the memories that map it, and a write to a page mapped
+   by more than one gets a private copy first. The counts are atomic,
+   so memories sharing pages may be used by different threads.
+
+   The last TLB_ENTRIES translations are kept in a direct-mapped TLB,
+   so that an access within a page seen recently takes one compare. A
+   TLB entry of a shared page (or of the blank page) serves reads only:
+   the first write goes through the page table, which copies the page.
+
+   Words are little endian and may be unaligned (a word that straddles
+   two pages is accessed byte by byte). An access past the end of the
+   memory is an error.
+
+   ============================================================= */
+
+#define PAGE_BITS 12
+#define PAGE_SIZE (1u << PAGE_BITS)
+#define PAGE_TABLE_BITS 10 // entries of a page table level: 1 << PAGE_TABLE_BITS
+#define TLB_ENTRIES 16 // a power of two
+
+class sim_memory {
+
+	typedef struct {
+		std::atomic<unsigned> refs;   // memories mapping the page (never 1 for the blank page)
+		unsigned char data[PAGE_SIZE];
+	} page_t;
+
+	typedef struct {
+		unsigned page; // page number (0xFFFFFFFF if the entry is empty)
+		page_t *data;  // its bytes (possibly shared, or the blank page)
+	} tlb_entry_t;
+
+	uint64_t size;                            // bytes
+	std::vector<std::vector<page_t *> > root; // second level tables, allocated on first write (empty: all blank)
+	page_t *blank;                            // read-only page of 0xFF
+	std::vector<unsigned> mapped;             // pages that are not blank
+	std::vector<page_t *> spare;              // pages released by reset, to be reused
+	tlb_entry_t tlb[TLB_ENTRIES];
+
+	// page "page" (the blank page if it has not been written)
+	page_t *lookup(unsigned page);
+	// page "page", allocated or copied if it is not private yet
+	page_t *map(unsigned page);
+	// drops one reference to "page", which is kept for reuse if it was the last
+	void release(page_t *page);
+	void flush_tlb();
+	void out_of_range(unsigned address, unsigned bytes) const;
+
+	// bytes of the page holding "address", for reading / for writing
+	const unsigned char *readable(unsigned address){
+		tlb_entry_t &e = tlb[(address >> PAGE_BITS) & (TLB_ENTRIES - 1)];
+		return ((e.page == address >> PAGE_BITS) ? e.data : lookup(address >> PAGE_BITS))->data;
+	}
+	unsigned char *writable(unsigned address){
+		tlb_entry_t &e = tlb[(address >> PAGE_BITS) & (TLB_ENTRIES - 1)];
+		bool owned = e.page == address >> PAGE_BITS && e.data->refs.load(std::memory_order_acquire) == 1;
+		return (owned ? e.data : map(address >> PAGE_BITS))->data;
+	}
+
+	// no implicit copies (see share)
+	sim_memory(const sim_memory &);
+	sim_memory &operator=(const sim_memory &);
+
+public:
+	// "size" bytes, all 0xFF (up to 4 GiB)
+	sim_memory(uint64_t size=0);
+	~sim_memory();
+
+	// changes the size; the content is reset
+	void resize(uint64_t size);
+
+	uint64_t get_size() const { return size; }
+
+	// every byte reads 0xFF again
+	void reset();
+
+	// becomes a copy of "source" (size and content), sharing its pages until either memory writes them
+	void share(const sim_memory &source);
+
+	// pages written since the last reset (or mapped from the memory shared)
+	unsigned pages_touched() const { return mapped.size(); }
+
+	unsigned char read_byte(unsigned address){
+		if (address >= size) out_of_range(address, 1);
+		return readable(address)[address & (PAGE_SIZE - 1)];
+	}
+
+	void write_byte(unsigned address, unsigned char value){
+		if (address >= size) out_of_range(address, 1);
+		writable(address)[address & (PAGE_SIZE - 1)] = value;
+	}
+
+	unsigned read_word(unsigned address){
+		if ((uint64_t)address + 4 > size) out_of_range(address, 4);
+		unsigned offset = address & (PAGE_SIZE - 1);
+		if (offset > PAGE_SIZE - 4)
+			return read_byte(address) | read_byte(address + 1) << 8 | read_byte(address + 2) << 16 | (unsigned)read_byte(address + 3) << 24;
+		const unsigned char *b = readable(address) + offset;
+		return b[0] | b[1] << 8 | b[2] << 16 | (unsigned)b[3] << 24;
+	}
+
+	void write_word(unsigned address, unsigned value){
+		if ((uint64_t)address + 4 > size) out_of_range(address, 4);
+		unsigned offset = address & (PAGE_SIZE - 1);
+		if (offset > PAGE_SIZE - 4) {
+			for (unsigned k = 0; k < 4; k++) write_byte(address + k, value >> (8 * k));
+			return;
+		}
+		unsigned char *b = writable(address) + offset;
+		b[0] = value;
+		b[1] = value >> 8;
+		b[2] = value >> 16;
+		b[3] = value >> 24;
+	}
+};
+
+#endif /*SIM_MEMORY_H_*/
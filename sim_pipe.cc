@@ -1,4 +1,5 @@
 #include "sim_pipe.h"
+#include "sim_pool.h"
 #include <stdlib.h>
 #include <iostream>
 #include <fstream>
@@ -16,6 +17,17 @@ static const char *reg_names[NUM_SP_REGISTERS] = {"PC", "NPC", "IR", "A", "B", "
 static const char *stage_names[NUM_STAGES] = {"IF", "ID", "EX", "MEM", "WB"};
 static const char *instr_names[NUM_OPCODES] = {"LW", "SW", "ADD", "ADDI", "SUB", "SUBI", "XOR", "BEQZ", "BNEZ", "BLTZ", "BGTZ", "BLEZ", "BGEZ", "JUMP", "EOP", "NOP"};
 
+//assembly syntax of each opcode (operand letters are described in sim_asm.h)
+static const asm_mnemonic_t mnemonics[NUM_OPCODES] = {
+	{"LW", LW, "dm"}, {"SW", SW, "sn"},
+	{"ADD", ADD, "dst"}, {"ADDI", ADDI, "dsi"}, {"SUB", SUB, "dst"}, {"SUBI", SUBI, "dsi"}, {"XOR", XOR, "dst"},
+	{"BEQZ", BEQZ, "sl"}, {"BNEZ", BNEZ, "sl"}, {"BLTZ", BLTZ, "sl"}, {"BGTZ", BGTZ, "sl"}, {"BLEZ", BLEZ, "sl"}, {"BGEZ", BGEZ, "sl"},
+	{"JUMP", JUMP, "l"}, {"EOP", EOP, ""}, {"NOP", NOP, ""}};
+static const asm_isa isa(mnemonics, NUM_OPCODES, NUM_GP_REGISTERS);
+
+//instruction set tag of the program images (see sim_image.h)
+#define IMAGE_ISA "PIPE"
+
 /* =============================================================
 
    HELPER FUNCTIONS
@@ -23,21 +35,6 @@ static const char *instr_names[NUM_OPCODES] = {"LW", "SW", "ADD", "ADDI", "SUB",
    ============================================================= */
 
 
-/* converts integer into array of unsigned char - little indian */
-inline void int2char(unsigned value, unsigned char *buffer){
-	//cout<<"\n int2char buffer: "<<static_cast<void const*>(buffer)<< " Value: "<<value;
-
-	memcpy(buffer, &value, sizeof value);
-}
-
-/* converts array of char into integer - little indian */
-inline unsigned char2int(unsigned char *buffer){
-	//cout<<"\n char2int buffer: "<<static_cast<void const*>(buffer);
-	unsigned d;
-	memcpy(&d, buffer, sizeof d);
-	return d;
-}
-
 /* implements the ALU operations */
 unsigned alu(unsigned opcode, unsigned a, unsigned b, unsigned imm, unsigned npc){
 	switch(opcode){
@@ -67,6 +64,80 @@ unsigned alu(unsigned opcode, unsigned a, unsigned b, unsigned imm, unsigned npc
 	}
 }
 
+/* the following functions return the kind of the considered opcode */
+
+bool is_branch(opcode_t opcode){
+	return (opcode == BEQZ || opcode == BNEZ || opcode == BLTZ || opcode == BLEZ || opcode == BGTZ || opcode == BGEZ || opcode == JUMP);
+}
+
+/* true if the instruction writes its dest register */
+bool writes_register(opcode_t opcode){
+	return (opcode == ADD || opcode == ADDI || opcode == SUB || opcode == SUBI || opcode == XOR || opcode == LW);
+}
+
+/* mask of the registers read by an instruction (see sim_scoreboard.h) */
+regmask_t source_registers(const instruction_t &instr){
+	switch(instr.opcode){
+	case ADD:
+	case SUB:
+	case XOR:
+	case SW:
+		return REG_MASK(instr.src1) | REG_MASK(instr.src2);
+	case ADDI:
+	case SUBI:
+	case LW:
+	case BEQZ:
+	case BNEZ:
+	case BLTZ:
+	case BGTZ:
+	case BLEZ:
+	case BGEZ:
+		return REG_MASK(instr.src1);
+	default:
+		return 0;
+	}
+}
+
+/* mask of the register written by an instruction */
+regmask_t dest_registers(const instruction_t &instr){
+	return writes_register(instr.opcode) ? REG_MASK(instr.dest) : 0;
+}
+
+/* empties the "width" lanes of a latch (bubbles) */
+static void reset_group(pipeline_Registers *group, unsigned width){
+	for(unsigned l = 0; l < width; l++) group[l].reset();
+}
+
+/* true if one of the "width" lanes of a latch holds a branch */
+static bool branch_in_group(const pipeline_Registers *group, unsigned width){
+	for(unsigned l = 0; l < width; l++)
+		if(is_branch(group[l].pipe_IR.opcode)) return true;
+	return false;
+}
+
+/* evaluates the condition of a branch on the value of its source register */
+bool branch_taken(opcode_t opcode, unsigned a){
+	int value = (int)a;
+	switch(opcode){
+	case BEQZ:
+		return (value == 0);
+	case BNEZ:
+		return (value != 0);
+	case BLTZ:
+		return (value < 0);
+	case BGTZ:
+		return (value > 0);
+	case BLEZ:
+		return (value <= 0);
+	case BGEZ:
+		return (value >= 0);
+	case JUMP:
+		return true;
+	default:
+		return false;
+	}
+}
+
 /* =============================================================
 
    CODE PROVIDED - NO NEED TO MODIFY FUNCTIONS BELOW
@@ -82,138 +153,144 @@ void sim_pipe::load_program(const char *filename, unsigned base_address){
 	/* Point Program Counter to start address of program*/
 	specialP_Reg[IF][PC] = instr_base_address;
 
-	/* creating a map with the valid opcodes and with the valid labels */
-	map<string, opcode_t> opcodes; //for opcodes
-	map<string, unsigned> labels;  //for branches
-	for (int i=0; i<NUM_OPCODES; i++)
-		opcodes[string(instr_names[i])]=(opcode_t)i;
+	/* assembling the file into the instruction memory (branch targets resolved, labels kept for the trace) */
+	sim_asm assembler(isa, filename);
+	assembler.assemble(instr_memory, labelNames);
 
-	/* opening the assembly file */
-	ifstream fin(filename, ios::in | ios::binary);
-	if (!fin.is_open()) {
-		cerr << "error: open file " << filename << " failed!" << endl;
-		exit(-1);
-	}
+	image.unload();
+	program = instr_memory.empty() ? NULL : &instr_memory[0];
+	program_size = instr_memory.size();
+	flush_blocks();
+}
 
-	/* parsing the assembly file line by line */
-	string line;
-	unsigned instruction_nr = 0;
-	while (getline(fin,line)){
-		// set the instruction field
-		char *str = const_cast<char*>(line.c_str());
-
-		// tokenize the instruction
-		char *token = strtok (str," \t");
-		map<string, opcode_t>::iterator search = opcodes.find(token);
-		if (search == opcodes.end()){
-			// this is a label for a branch - extract it and save it in the labels map
-			string label = string(token).substr(0, string(token).length() - 1);
-			labels[label]=instruction_nr;
-			// move to next token, which must be the instruction opcode
-			token = strtok (NULL, " \t");
-			search = opcodes.find(token);
-			if (search == opcodes.end()) cout << "ERROR: invalid opcode: " << token << " !" << endl;
+/* exits unless every record of a program image is an instruction the assembler could have written: the records are executed as they are */
+static void check_program(const char *filename, const instruction_t *program, unsigned count){
+	for(unsigned i = 0; i < count; i++)
+	{
+		const instruction_t &ir = program[i];
+		const char *problem = NULL;
+		if((unsigned)ir.opcode >= NUM_OPCODES) problem = "an invalid opcode";
+		else if(ir.src1 >= NUM_GP_REGISTERS || ir.src2 >= NUM_GP_REGISTERS || ir.dest >= NUM_GP_REGISTERS) problem = "an invalid register";
+		// (a branch may target the end of the program, where a label can be: fetching there stops with an error)
+		else if(is_branch(ir.opcode) && ir.target > count) problem = "a branch target outside the program";
+		if(problem)
+		{
+			cerr << "error: " << filename << " is corrupted: instruction " << i << " has " << problem << endl;
+			exit(-1);
 		}
-		instr_memory[instruction_nr].opcode = search->second;
+	}
+}
 
-		//reading remaining parameters
-		char *par1;
-		char *par2;
-		char *par3;
-		switch(instr_memory[instruction_nr].opcode){
-		case ADD:
-		case SUB:
-		case XOR:
-			par1 = strtok (NULL, " \t");
-			par2 = strtok (NULL, " \t");
-			par3 = strtok (NULL, " \t");
-			instr_memory[instruction_nr].dest = atoi(strtok(par1, "R"));
-			instr_memory[instruction_nr].src1 = atoi(strtok(par2, "R"));
-			instr_memory[instruction_nr].src2 = atoi(strtok(par3, "R"));
-			break;
-		case ADDI:
-		case SUBI:
-			par1 = strtok (NULL, " \t");
-			par2 = strtok (NULL, " \t");
-			par3 = strtok (NULL, " \t");
-			instr_memory[instruction_nr].dest = atoi(strtok(par1, "R"));
-			instr_memory[instruction_nr].src1 = atoi(strtok(par2, "R"));
-			instr_memory[instruction_nr].immediate = strtoul (par3, NULL, 0);
-			break;
-		case LW:
-			par1 = strtok (NULL, " \t");
-			par2 = strtok (NULL, " \t");
-			instr_memory[instruction_nr].dest = atoi(strtok(par1, "R"));
-			instr_memory[instruction_nr].immediate = strtoul(strtok(par2, "()"), NULL, 0);
-			instr_memory[instruction_nr].src1 = atoi(strtok(NULL, "R"));
-			break;
-		case SW:
-			par1 = strtok (NULL, " \t");
-			par2 = strtok (NULL, " \t");
-			instr_memory[instruction_nr].src1 = atoi(strtok(par1, "R"));
-			instr_memory[instruction_nr].immediate = strtoul(strtok(par2, "()"), NULL, 0);
-			instr_memory[instruction_nr].src2 = atoi(strtok(NULL, "R"));
-			break;
-		case BEQZ:
-		case BNEZ:
-		case BLTZ:
-		case BGTZ:
-		case BLEZ:
-		case BGEZ:
-			par1 = strtok (NULL, " \t");
-			par2 = strtok (NULL, " \t");
-			instr_memory[instruction_nr].src1 = atoi(strtok(par1, "R"));
-			instr_memory[instruction_nr].label = par2;
-			break;
-		case JUMP:
-			par2 = strtok (NULL, " \t");
-			instr_memory[instruction_nr].label = par2;
-			break;
+/* loads the program image in file "filename" in instruction memory at the specified address */
+void sim_pipe::load_binary(const char *filename, unsigned base_address){
 
-		default:
-			break;
+	instr_base_address = base_address;
+	specialP_Reg[IF][PC] = instr_base_address;
 
-		}
+	instr_memory.clear();
+	image.load(filename, IMAGE_ISA, sizeof(instruction_t));
+	image.labels(labelNames);
 
-		/* increment instruction number before moving to next line */
-		instruction_nr++;
-	}
-	//reconstructing the labels of the branch operations
-	int i = 0;
-	while(true){
-		instruction_t instr = instr_memory[i];
-		if (instr.opcode == EOP) break;
-		if (instr.opcode == BLTZ || instr.opcode == BNEZ ||
-				instr.opcode == BGTZ || instr.opcode == BEQZ ||
-				instr.opcode == BGEZ || instr.opcode == BLEZ ||
-				instr.opcode == JUMP
-		){
-			instr_memory[i].immediate = (labels[instr.label] - i - 1) << 2;
-		}
-		i++;
+	program = (const instruction_t *)image.records();
+	program_size = image.count();
+	check_program(filename, program, program_size);
+	flush_blocks();
+}
+
+/* writes the loaded program as a binary image */
+void sim_pipe::save_binary(const char *filename){
+	sim_image::save(filename, IMAGE_ISA, program, sizeof(instruction_t), program_size, labelNames);
+}
+
+/* executes the program of another simulator in place */
+void sim_pipe::share_program(const sim_pipe &source){
+
+	instr_base_address = source.instr_base_address;
+	specialP_Reg[IF][PC] = instr_base_address;
+
+	instr_memory.clear();
+	image.unload();
+	labelNames.view(source.labelNames.index_table(), source.labelNames.offset_table(), source.labelNames.name_table(), source.labelNames.size());
+
+	program = source.program;
+	program_size = source.program_size;
+	flush_blocks();
+}
+
+/* copies the state of the simulator, sharing the data memory pages copy-on-write */
+sim_pipe *sim_pipe::snapshot(){
+	sim_pipe *copy = new sim_pipe(0, data_memory_latency, forwarding);
+	copy->restore(*this);
+	return copy;
+}
+
+/* copies back the state saved by snapshot() */
+void sim_pipe::restore(const sim_pipe &snapshot){
+	if(&snapshot == this) return;
+	if(program != snapshot.program) share_program(snapshot);
+	instr_base_address = snapshot.instr_base_address;
+
+	data_memory.share(snapshot.data_memory);
+	data_memory_latency = snapshot.data_memory_latency;
+
+	// the levels are copied as a whole, then connected to each other instead of to the levels of the snapshot
+	dcache = snapshot.dcache;
+	l2cache = snapshot.l2cache;
+	icache = snapshot.icache;
+	dcache.relink(&snapshot.l2cache, &l2cache);
+	icache.relink(&snapshot.l2cache, &l2cache);
+
+	forwarding = snapshot.forwarding;
+	issue_width = snapshot.issue_width;
+
+	std::copy(snapshot.generalP_Reg, snapshot.generalP_Reg + NUM_GP_REGISTERS, generalP_Reg);
+	for(int s = 0; s < NUM_STAGES; s++) std::copy(snapshot.specialP_Reg[s], snapshot.specialP_Reg[s] + NUM_SP_REGISTERS, specialP_Reg[s]);
+	for(int k = FIRST; k <= FORTH; k++){
+		std::copy(snapshot.pipe_reg[k], snapshot.pipe_reg[k] + MAX_ISSUE_WIDTH, pipe_reg[k]);
+		std::copy(snapshot.pipe_next[k], snapshot.pipe_next[k] + MAX_ISSUE_WIDTH, pipe_next[k]);
 	}
-	//copy branch-labels into member variable
-	std::map<std::string, unsigned>::iterator mapIt = labels.begin();
-	labelPCMap.insert( labels.begin(), labels.end());
+
+	clkIn = snapshot.clkIn;
+	runAlways = snapshot.runAlways;
+	inst_count = snapshot.inst_count;
+	totalInstCount = snapshot.totalInstCount;
+	fetchSeq = snapshot.fetchSeq;
+
+	stalls = snapshot.stalls;
+	scoreboard = snapshot.scoreboard;
+	totalStalls = snapshot.totalStalls;
+	std::copy(snapshot.stallCount, snapshot.stallCount + NUM_STALL_TYPES, stallCount);
+
+	branchTarget = snapshot.branchTarget;
+	branchStall = snapshot.branchStall;
+	bpred = snapshot.bpred;
+	mispredict = snapshot.mispredict;
+
+	memoryStall = snapshot.memoryStall;
+	stallMem = snapshot.stallMem;
+	memLatency = snapshot.memLatency;
+
+	fetchMiss = snapshot.fetchMiss;
+	fetchReady = snapshot.fetchReady;
+
+	draining = snapshot.draining;
+	eopFetched = snapshot.eopFetched;
+	eopRetired = snapshot.eopRetired;
 }
 
 /* writes an integer value to data memory at the specified address (use little-endian format: https://en.wikipedia.org/wiki/Endianness) */
 void sim_pipe::write_memory(unsigned address, unsigned value){
 
-	//cout<<"\n #write_memory address: "<<static_cast<void const*>(data_memory+address)<<" Value: "<<value;
-
-	int2char(value, data_memory+address);
+	data_memory.write_word(address, value);
 }
 
 /* prints the content of the data memory within the specified address range */
 void sim_pipe::print_memory(unsigned start_address, unsigned end_address){
 
-	//	cout<<"\n #print_memory data_memory: "<<static_cast<void const*>(data_memory);
-
 	cout << "data_memory[0x" << hex << setw(8) << setfill('0') << start_address << ":0x" << hex << setw(8) << setfill('0') <<  end_address << "]" << endl;
 	for (unsigned i=start_address; i<end_address; i++){
 		if (i%4 == 0) cout << "0x" << hex << setw(8) << setfill('0') << i << ": ";
-		cout << hex << setw(2) << setfill('0') << int(data_memory[i]) << " ";
+		cout << hex << setw(2) << setfill('0') << int(data_memory.read_byte(i)) << " ";
 		if (i%4 == 3) cout << endl;
 	}
 }
@@ -233,18 +310,101 @@ void sim_pipe::print_registers(){
 		if (get_gp_register(i)!=(int)UNDEFINED) cout << "R" << dec << i << " = " << get_gp_register(i) << hex << " / 0x" << get_gp_register(i) << endl;
 }
 
+/* selects the destination of the trace */
+void sim_pipe::set_trace_sink(trace_sink_t sink, const char *filename, unsigned ring_size){
+	trace.set_sink(sink, filename, ring_size);
+}
+
+/* writes the content of the in-memory trace ring */
+void sim_pipe::dump_trace(ostream &os){
+	trace.dump(os);
+}
+
+/* starts or stops the event trace; the slots are the lanes of the latches, named after them */
+void sim_pipe::set_event_trace(const char *filename){
+	if(!filename)
+	{
+		events.close();
+		return;
+	}
+	static const char *latch_names[NUM_STAGES-1] = {"IF/ID", "ID/EX", "EX/MEM", "MEM/WB"};
+	vector<string> slots;
+	for(int k = FIRST; k <= FORTH; k++)
+		for(unsigned l = 0; l < MAX_ISSUE_WIDTH; l++)
+			slots.push_back(string(latch_names[k]) + "." + to_string(l));
+	events.open(filename, IMAGE_ISA, instr_names, NUM_OPCODES, slots);
+}
+
+/* sets the number of instructions per latch */
+void sim_pipe::init_issue_width(unsigned width){
+	if(width == 0 || width > MAX_ISSUE_WIDTH)
+	{
+		cerr << "error: the issue width must be between 1 and " << MAX_ISSUE_WIDTH << endl;
+		exit(-1);
+	}
+	issue_width = width;
+}
+
+/* selects the branch predictor */
+void sim_pipe::init_branch_predictor(bpred_policy_t policy, unsigned table_bits, unsigned btb_bits){
+	if(table_bits > BPRED_MAX_BITS || btb_bits > BPRED_MAX_BITS)
+	{
+		cerr << "error: the prediction tables and the BTB have at most 2^" << BPRED_MAX_BITS << " entries" << endl;
+		exit(-1);
+	}
+	bpred = sim_bpred(policy, table_bits, btb_bits);
+}
+
+/* returns the branch prediction counters */
+bpred_stats_t sim_pipe::get_branch_stats(){
+	return bpred.get_stats();
+}
+
+/* adds a data cache level */
+void sim_pipe::init_cache(cache_level_t level, unsigned size, unsigned line_size, unsigned associativity, unsigned hit_latency,
+                          cache_replacement_t replacement, cache_write_t write_policy, bool write_allocate){
+	if(level == L1I)
+	{
+		cerr << "error: the instruction cache is configured with init_icache" << endl;
+		exit(-1);
+	}
+	sim_cache &cache = (level == L1D) ? dcache : l2cache;
+	cache.configure(size, line_size, associativity, hit_latency, replacement, write_policy, write_allocate);
+}
+
+/* adds the instruction cache */
+void sim_pipe::init_icache(unsigned size, unsigned line_size, unsigned associativity, unsigned miss_latency,
+                           bool next_line_prefetch, cache_replacement_t replacement){
+	icache.configure(size, line_size, associativity, 0, replacement);
+	icache.set_next_line_prefetch(next_line_prefetch);
+	icache.connect(&l2cache, miss_latency);
+}
+
+/* returns the counters of a cache level */
+cache_stats_t sim_pipe::get_cache_stats(cache_level_t level){
+	if(level == L1I) return icache.get_stats();
+	return (level == L1D) ? dcache.get_stats() : l2cache.get_stats();
+}
+
 /* initializes the pipeline simulator */
-sim_pipe::sim_pipe(unsigned mem_size, unsigned mem_latency){
-	data_memory_size = mem_size;
+sim_pipe::sim_pipe(uint64_t mem_size, unsigned mem_latency, bool bypass){
+	data_memory.resize(mem_size);
 	data_memory_latency = mem_latency;
-	data_memory = new unsigned char[data_memory_size];
+	forwarding = bypass;
+	issue_width = 1;
+	instr_base_address = 0;
+	program = NULL;
+	program_size = 0;
+
+	// an access goes through the enabled levels, down to the data memory
+	dcache.connect(&l2cache, data_memory_latency);
+	l2cache.connect(NULL, data_memory_latency);
 
 	reset();
 }
 
 /* deallocates the pipeline simulator */
 sim_pipe::~sim_pipe(){
-	delete [] data_memory;
 }
 
 /* =============================================================
@@ -257,692 +417,1086 @@ sim_pipe::~sim_pipe(){
 /* body of the simulator */
 void sim_pipe::run(unsigned cycles){
 
-	if(cycles == 0) runAlways = 1;
+	runAlways = (cycles == 0);
+	unsigned long stopClk = clkIn + cycles;
 
-	cout<<"\n## START of run, clkIn: "<<clkIn<<" cycles: "<<cycles;
+	SIM_TRACE_CYCLE(trace, "\n## START of run, clkIn: "<<clkIn<<" cycles: "<<cycles);
 
-	run:
-	do
+	// one iteration per clock cycle: the stages are evaluated from WB back to IF; each stage reads
+	// the latches as they were at the beginning of the cycle (pipe_reg) and writes the latch it feeds
+	// for the next cycle (pipe_next). A stage that does not write its latch leaves it unchanged (stall).
+	while(!eopRetired && (runAlways || clkIn < stopClk))
 	{
+		if(events.enabled()) trace_cycle();
 
-		switch(clkIn)
-		{
-		cout<<"\n## Switch, clkIn: "<<clkIn<<" cycles: "<<cycles;
-
-		case (IF+1):
-			fetch();
-		break;
-
-		case (ID+1):
-			decode();//c=3
-		break;
+		for(int k = FIRST; k <= FORTH; k++) std::copy(pipe_reg[k], pipe_reg[k] + issue_width, pipe_next[k]);
 
-		case (EXE+1):
-			execute();//c=4
-		break;
+		writeBack();
+		memory();
+		execute();
+		decode();
+		fetch();
 
-		case (MEM+1):
-			memory();//c=5
-		break;
+		if(events.enabled()) events.end_cycle(stageStall);
 
-		case (WB+1):
-			writeBack();
-		break;
+		for(int k = FIRST; k <= FORTH; k++) std::copy(pipe_next[k], pipe_next[k] + issue_width, pipe_reg[k]);
+		++clkIn;
+		update_sp_registers();
 
-		default:
-			if(clkIn > (WB+1)) writeBack();
-		}
+		SIM_TRACE_CYCLE(trace, "\n--- cycle done---clkIn: "<<clkIn<<" instructions: "<<totalInstCount<<" stalls: "<<totalStalls<<"\n");
+	}
 
-	}while(runAlways);//end of while
+	if(eopRetired)
+		SIM_TRACE_CYCLE(trace, "\n --- End Of Program Detected ---, clkIn: "<<clkIn<<"\n");
 
-	if(runAlways){ goto run;}
+	SIM_TRACE_CYCLE(trace, "\n## END of run, clkIn: "<<clkIn<<"\n");
+}
 
-	cout<<"\n## END of run, clkIn: "<<clkIn<<"\n";
+/* records the instructions in the latches at the beginning of the cycle in the event trace; the stall reasons
+   and the instructions retired are added by the stages */
+void sim_pipe::trace_cycle(){
+	events.begin_cycle(clkIn);
+	std::fill_n(stageStall, EVENT_STALL_STAGES, EVENT_NO_STALL);
+	for(int k = FIRST; k <= FORTH; k++)
+		for(unsigned l = 0; l < issue_width; l++)
+			if(pipe_reg[k][l].pipe_IR.opcode != NOP) trace_latch(k*MAX_ISSUE_WIDTH + l, (event_stage_t)(k + 1), pipe_reg[k][l]);
+}
 
-	return;
+/* records an instruction with the contents of its latch */
+void sim_pipe::trace_latch(unsigned slot, event_stage_t stage, const pipeline_Registers &latch){
+	event_record_t &r = events.add(slot, stage, latch.pipe_SEQ);
+	r.field[EVENT_PC] = latch.pipe_PC;
+	r.field[EVENT_NPC] = latch.pipe_NPC;
+	r.field[EVENT_OPCODE] = latch.pipe_IR.opcode;
+	r.field[EVENT_SRC1] = latch.pipe_IR.src1;
+	r.field[EVENT_SRC2] = latch.pipe_IR.src2;
+	r.field[EVENT_DEST] = latch.pipe_IR.dest;
+	r.field[EVENT_IMMEDIATE] = latch.pipe_IR.immediate;
+	r.field[EVENT_TARGET] = latch.pipe_IR.target;
+	r.field[EVENT_A] = latch.pipe_A;
+	r.field[EVENT_B] = latch.pipe_B;
+	r.field[EVENT_IMM] = latch.pipe_IMM;
+	r.field[EVENT_COND] = latch.pipe_COND;
+	r.field[EVENT_ALU_OUTPUT] = latch.pipe_ALU_OUTPUT;
+	r.field[EVENT_LMD] = latch.pipe_LMD;
+	r.field[EVENT_PRED_PC] = latch.pipe_PRED_PC;
 }
 
-/* reset the state of the pipeline simulator */
-void sim_pipe::reset(){
+/* =============================================================
 
-	std::fill_n(data_memory, data_memory_size, 0xFF);
+   FUNCTIONAL MODE
 
-	/* Reset object's member variables */
+   run_functional interprets the program directly: one switch per
+   instruction on the decoded records, with the registers in locals,
+   and the ALU, branch conditions and data memory of the cycle model.
+   With "warm" set (functional warming) it also drives the caches and
+   trains the branch predictor, as fetch, MEM and EX would.
 
-	std::fill_n(generalP_Reg, NUM_GP_REGISTERS, UNDEFINED);
+   ============================================================= */
 
-	for(int k = IF; k <= WB ; k++)
-		std::fill_n(specialP_Reg[k], NUM_SP_REGISTERS, UNDEFINED);
+/* true if no instruction is in flight and IF is not being redirected */
+bool sim_pipe::pipeline_empty(){
+	if(mispredict || memoryStall) return false;
+	for(int k = FIRST; k <= FORTH; k++)
+		for(unsigned l = 0; l < issue_width; l++)
+			if(pipe_reg[k][l].pipe_IR.opcode != NOP) return false;
+	return true;
+}
 
-	pipe_reg[FIRST].reset();
-	pipe_reg[SECOND].reset();
-	pipe_reg[THIRD].reset();
-	pipe_reg[FORTH].reset();
+/* the instructions in flight complete in the cycle model, IF fetching no more; IF is left at the next instruction */
+void sim_pipe::drain(){
+	draining = true;
+	while(!eopRetired && !pipeline_empty()) run(1);
+	draining = false;
+	if(eopRetired) return;
 
-	clkIn = 1;
-	runAlways = 0;
-	inst_count = 0;
-	totalInstCount = 0;
+	// a taken branch may have been resolved without IF having been redirected yet
+	if(branchTarget != UNDEFINED)
+	{
+		inst_count = branchTarget;
+		branchTarget = UNDEFINED;
+	}
+}
 
-	stalls = 0;
-	totalStalls = 0;
-	stallMem = 0;
-	currentClk = 0;
-	branchToLabel = "";
+unsigned long sim_pipe::run_functional(unsigned long instructions, bool warm){
 
-	noBranches = true;
-	branchStall = false;
-	memoryStall = false;
-	memStallCompleted = false;
+	// the instructions in flight complete in the cycle model
+	drain();
+	if(eopRetired) return 0;
 
-}
+	SIM_TRACE_CYCLE(trace, "\n## START of functional run, instruction: "<<inst_count);
 
-//return value of special purpose register
-unsigned sim_pipe::get_sp_register(sp_register_t reg, stage_t s)
-{
-	if( (reg >= 0 ) && (reg < NUM_SP_REGISTERS) && (s>=0) && (s<5))
-	{
-		//cout<<"value of register: reg-%d"<<reg<<"value @ reg-%X"<<specialP_Reg[reg]<<"stage s-%d"<<s;
-		return specialP_Reg[s][reg];
-	}
+	unsigned reg[NUM_GP_REGISTERS];
+	std::copy(generalP_Reg, generalP_Reg + NUM_GP_REGISTERS, reg);
 
-	return 0;
-}
+	unsigned long pc = inst_count, executed = 0;
+	unsigned long limit = instructions ? instructions : (unsigned long)-1;
 
-//returns value of general purpose register
-int sim_pipe::get_gp_register(unsigned reg)
-{
-	if( (reg >= 0 ) && (reg < NUM_GP_REGISTERS))
+	// whole blocks run as threaded code; the switch executes what is left (fewer instructions than the next block
+	// holds) and, with "warm" set, the whole run
+	if(!warm)
 	{
-		//cout<<"value of register: reg-%d value @ reg-%X", reg, generalP_Reg[reg];
-		return generalP_Reg[reg];
+		executed = run_blocks(reg, pc, limit);
+		if(eopRetired) limit = executed;
 	}
 
-	return 0;
-}
-
-void sim_pipe::set_gp_register(unsigned reg, int value){
-
-	if( (reg >= 0 ) && (reg < NUM_GP_REGISTERS))
+	while(executed < limit)
 	{
-		generalP_Reg[reg] = value;
+		if(pc >= program_size)
+		{
+			cerr << "error: fetch at PC 0x" << hex << instr_base_address + 4*pc << " is past the end of the program (missing EOP?)" << endl;
+			exit(-1);
+		}
+		const instruction_t &ir = program[pc];
+		if(warm && icache.enabled()) icache.access(instr_base_address + 4*pc, false, clkIn);
+		pc++;
+		unsigned address;
+		bool taken;
+		switch(ir.opcode)
+		{
+		case ADD: reg[ir.dest] = alu(ADD, reg[ir.src1], reg[ir.src2], 0, 0); break;
+		case SUB: reg[ir.dest] = alu(SUB, reg[ir.src1], reg[ir.src2], 0, 0); break;
+		case XOR: reg[ir.dest] = alu(XOR, reg[ir.src1], reg[ir.src2], 0, 0); break;
+		case ADDI: reg[ir.dest] = alu(ADDI, reg[ir.src1], 0, ir.immediate, 0); break;
+		case SUBI: reg[ir.dest] = alu(SUBI, reg[ir.src1], 0, ir.immediate, 0); break;
+		case LW:
+			address = alu(LW, reg[ir.src1], 0, ir.immediate, 0);
+			if(warm) dcache.access(address, false, clkIn);
+			reg[ir.dest] = data_memory.read_word(address);
+			break;
+		case SW: //SW src1 imm(src2)
+			address = alu(SW, reg[ir.src2], 0, ir.immediate, 0);
+			if(warm) dcache.access(address, true, clkIn);
+			data_memory.write_word(address, reg[ir.src1]);
+			break;
+		case BEQZ:
+		case BNEZ:
+		case BLTZ:
+		case BGTZ:
+		case BLEZ:
+		case BGEZ:
+			taken = branch_taken(ir.opcode, reg[ir.src1]);
+			if(warm) warm_branch(pc - 1, ir, taken);
+			if(taken) pc = ir.target;
+			break;
+		case JUMP:
+			if(warm) warm_branch(pc - 1, ir, true);
+			pc = ir.target;
+			break;
+		case EOP:
+			eopFetched = true;
+			eopRetired = true;
+			limit = executed;
+			continue;
+		default: // NOP
+			continue;
+		}
+		++executed;
 	}
-}
 
-float sim_pipe::get_IPC(){
-	float IPC = float(totalInstCount)/float(clkIn);
-	return IPC;
-}
+	std::copy(reg, reg + NUM_GP_REGISTERS, generalP_Reg);
+	inst_count = pc;
+	fetchMiss = UNDEFINED;
+	update_sp_registers();
 
-unsigned sim_pipe::get_instructions_executed(){
-	return totalInstCount;
+	SIM_TRACE_CYCLE(trace, "\n## END of functional run, instructions: "<<executed<<"\n");
+	return executed;
 }
 
-unsigned sim_pipe::get_stalls(){
-	return totalStalls;
+/* functional warming: trains the branch predictor with the branch at instruction "index" */
+void sim_pipe::warm_branch(unsigned long index, const instruction_t &ir, bool taken){
+	if(!bpred.enabled()) return;
+	unsigned address = instr_base_address + 4*index;
+	bool conditional = ir.opcode != JUMP;
+	bpred.update(address, conditional, taken, instr_base_address + 4*ir.target, bpred.predict(address, conditional));
 }
 
-unsigned sim_pipe::get_clock_cycles(){
-	return clkIn;
-}
+/* =============================================================
 
+   TRANSLATION CACHE
+
+   run_functional executes the program a basic block at a time. A
+   block starts at the instruction run_functional reaches and ends at
+   a branch, at EOP, or before the next branch target. It is translated
+   on first use into threaded code: an array with, per instruction, the
+   address of its handler in run_blocks (GNU labels as values) and its
+   register numbers and immediate (NOPs are dropped), closed by the
+   branch, EOP, or a fall through into the next block. Each handler
+   jumps straight to the next one: no decode, no bounds check and no
+   instruction count per instruction. The blocks taken and not taken
+   after a block are looked up the first time they are followed and
+   chained to it, so a loop runs from block to block with no lookup.
+   The cache lasts until the program changes (flush_blocks).
 
-void sim_pipe::fetch()
-{
-	cout<<"\nIn fetch clkIn: "<<clkIn<<"\t current instruction is: "<<inst_count+1;
-	cout<<"\n memoryStall: "<<memoryStall<<"stallMem: "<<stallMem<<"\n";
+   ============================================================= */
 
-	cout<<"\n stalls: "<<stalls;
-	cout<<"\n branchStall: "<<branchStall;
+/* drops the translations (the program has changed) */
+void sim_pipe::flush_blocks(){
+	blocks.clear();
+	block_ops.clear();
+	block_at.clear();
+	block_leader.clear();
+}
 
-	if(inst_count == 8)
+/* translates the block starting at instruction "pc" with the handlers of run_blocks, indexed by opcode (that of NOP
+   falls through into the next block); returns its index in blocks */
+unsigned sim_pipe::translate_block(unsigned long pc, const void *const *handlers){
+	if(pc >= program_size)
 	{
-		cout<<"\n 8insttotalStalls: "<<totalStalls;
+		cerr << "error: fetch at PC 0x" << hex << instr_base_address + 4*pc << " is past the end of the program (missing EOP?)" << endl;
+		exit(-1);
 	}
-	if(memoryStall) return;
-
-	if(stalls)
-	{
-		if(branchStall) pipe_reg[FIRST].reset();
 
-		cout<<"\n Need stalling, skipping fetching new inst";
-		cout<<"\n branchStall:    "<<branchStall;
-
-		cout<<"\n inst_count:     "<<inst_count;
-		cout<<"\n totalInstCount: "<<totalInstCount<<"\n";
-		return;
-	}
+	block_t block;
+	block.start = pc;
+	block.first = block_ops.size();
+	block.executed = 0;
+	block.target = UNDEFINED;
+	block.next[0] = block.next[1] = UNDEFINED;
 
-	cout<<"\n Fetch input: 1.opcode: "<<instr_memory[inst_count].opcode;
-	cout<<"\n Fetch input: instruct: "<<(instr_names[instr_memory[inst_count].opcode]);
-	cout<<"\n Fetch input: 2.dest:   "<<instr_memory[inst_count].dest;
-	cout<<"\n Fetch input: 3.src1:   "<<instr_memory[inst_count].src1;
-	cout<<"\n Fetch input: 4.src2:   "<<instr_memory[inst_count].src2;
-	cout<<"\n Fetch input: 5.imm:    "<<instr_memory[inst_count].immediate;
-	cout<<"\n Fetch input: 6.label:  "<<instr_memory[inst_count].label<<"\n";
+	threaded_op_t op;
+	op.handler = handlers[NOP]; // falls through into the next block, unless a branch or EOP ends this one
+	op.dest = op.src1 = op.src2 = op.imm = 0;
 
-	std::string emptyStr = "";
-	if(branchToLabel != emptyStr)
+	// a block running past the end of the program falls through to it: the error comes if it is reached
+	unsigned long k = pc;
+	while(k < program_size && (k == pc || !block_leader[k]))
 	{
-		unsigned jumpToInst = (labelPCMap.find(branchToLabel))->second;
+		const instruction_t &ir = program[k++];
+		if(ir.opcode == NOP) continue;
+
+		op.handler = handlers[ir.opcode];
+		op.dest = ir.dest;
+		op.src1 = ir.src1;
+		op.src2 = ir.src2;
+		op.imm = ir.immediate;
+		if(is_branch(ir.opcode) || ir.opcode == EOP)
+		{
+			block.target = ir.target;
+			if(ir.opcode != EOP) block.executed++;
+			break;
+		}
+		block_ops.push_back(op);
+		block.executed++;
+		op.handler = handlers[NOP];
+	}
+	block.fallthrough = k;
+	block_ops.push_back(op); // the exit
 
-		cout<<"\n save labels & PCs";
-		cout<<"\n pipe_reg[FIRST].pipe_IR.label: "<<pipe_reg[FIRST].pipe_IR.label;
-		cout<<"\n specialP_Reg[IF][PC]: "<<specialP_Reg[IF][PC];
-		cout<<"\n &instr_memory[inst_count]: "<<(&instr_memory[inst_count]);
-		cout<<"\n inst_count: "<<inst_count;
-		cout<<"\n jumpToInst: "<<jumpToInst;
+	blocks.push_back(block);
+	block_at[pc] = blocks.size() - 1;
+	return blocks.size() - 1;
+}
 
-		inst_count = jumpToInst;
-		branchToLabel = emptyStr;
-	}
+/* runs whole blocks from instruction "pc" while they fit in "limit" instructions; returns the instructions executed
+   and leaves "pc" at the next instruction (the start of the block that did not fit, or the one after EOP) */
+unsigned long sim_pipe::run_blocks(unsigned *reg, unsigned long &pc, unsigned long limit){
 
-	//update IR register of pipeline reg first
-	std::memcpy(&pipe_reg[FIRST].pipe_IR, &instr_memory[inst_count], sizeof (instruction_t) );
-	specialP_Reg[IF][IR] = pipe_reg[FIRST].pipe_IR.opcode;
-	specialP_Reg[ID][IR] =  specialP_Reg[IF][IR];
+	// handlers by opcode: the branches, EOP and NOP (falling through) are only found at the exit of a block
+	static const void *const handlers[NUM_OPCODES] = {
+		&&do_lw, &&do_sw, &&do_add, &&do_addi, &&do_sub, &&do_subi, &&do_xor,
+		&&do_beqz, &&do_bnez, &&do_bltz, &&do_bgtz, &&do_blez, &&do_bgez, &&do_jump, &&do_eop, &&do_fall
+	};
 
-	if(specialP_Reg[IF][IR] != EOP)
+	// the branch targets, found the first time the program is run
+	if(block_at.size() != program_size)
 	{
-		//1.update PC, NPC
-		if(clkIn == 1){//FIRST instr
-			specialP_Reg[IF][PC] = instr_base_address+(4*inst_count) + 4;
-			specialP_Reg[ID][NPC] = specialP_Reg[IF][PC];
-		}
-		else if(clkIn > 1){
-			specialP_Reg[ID][NPC] = instr_base_address+(4*inst_count) + 4; //specialP_Reg[IF][PC] + 4;
-			specialP_Reg[IF][PC] = specialP_Reg[ID][NPC];
-		}
-
-		++inst_count;
-		++totalInstCount;
+		block_at.assign(program_size, UNDEFINED);
+		block_leader.assign(program_size, false);
+		for(unsigned k = 0; k < program_size; k++)
+			if(is_branch(program[k].opcode) && program[k].target < program_size) block_leader[program[k].target] = true;
 	}
 
-	if(clkIn == (IF+1))
+	unsigned long executed = 0;
+	unsigned b = (pc < program_size && block_at[pc] != UNDEFINED) ? block_at[pc] : translate_block(pc, handlers);
+	const block_t *block;
+	const threaded_op_t *op;
+	unsigned side, next;
+	unsigned long successor;
+
+enter:
+	block = &blocks[b];
+	if(block->executed > limit - executed)
 	{
-		++clkIn;
-		cout<<"\n FETCH: Incremented clkIn: "<<clkIn<<" & inst_count: "<<inst_count<<"\n";
+		pc = block->start;
+		return executed;
 	}
-
+	executed += block->executed;
+	op = block_ops.data() + block->first;
+	goto *op->handler;
+
+do_add: reg[op->dest] = alu(ADD, reg[op->src1], reg[op->src2], 0, 0); op++; goto *op->handler;
+do_sub: reg[op->dest] = alu(SUB, reg[op->src1], reg[op->src2], 0, 0); op++; goto *op->handler;
+do_xor: reg[op->dest] = alu(XOR, reg[op->src1], reg[op->src2], 0, 0); op++; goto *op->handler;
+do_addi: reg[op->dest] = alu(ADDI, reg[op->src1], 0, op->imm, 0); op++; goto *op->handler;
+do_subi: reg[op->dest] = alu(SUBI, reg[op->src1], 0, op->imm, 0); op++; goto *op->handler;
+do_lw: reg[op->dest] = data_memory.read_word(alu(LW, reg[op->src1], 0, op->imm, 0)); op++; goto *op->handler;
+do_sw: data_memory.write_word(alu(SW, reg[op->src2], 0, op->imm, 0), reg[op->src1]); op++; goto *op->handler; //SW src1 imm(src2)
+
+// exits: the outcome of a branch is a jump, not an index, so the next block does not wait for the condition
+do_beqz: if(branch_taken(BEQZ, reg[op->src1])) goto taken; goto not_taken;
+do_bnez: if(branch_taken(BNEZ, reg[op->src1])) goto taken; goto not_taken;
+do_bltz: if(branch_taken(BLTZ, reg[op->src1])) goto taken; goto not_taken;
+do_bgtz: if(branch_taken(BGTZ, reg[op->src1])) goto taken; goto not_taken;
+do_blez: if(branch_taken(BLEZ, reg[op->src1])) goto taken; goto not_taken;
+do_bgez: if(branch_taken(BGEZ, reg[op->src1])) goto taken; goto not_taken;
+do_jump: goto taken;
+do_fall: goto not_taken;
+do_eop:
+	eopFetched = true;
+	eopRetired = true;
+	pc = block->fallthrough;
+	return executed;
+
+// the next block is followed through the chain, and looked up the first time only
+taken:
+	side = 1;
+	if(block->next[1] == UNDEFINED) goto link;
+	b = block->next[1];
+	goto enter;
+not_taken:
+	side = 0;
+	if(block->next[0] == UNDEFINED) goto link;
+	b = block->next[0];
+	goto enter;
+link:
+	successor = side ? block->target : block->fallthrough;
+	next = (successor < program_size && block_at[successor] != UNDEFINED) ? block_at[successor] : translate_block(successor, handlers);
+	blocks[b].next[side] = next;
+	b = next;
+	goto enter;
 }
 
-void sim_pipe::decode()
-{
-	cout<<"\n In DECODE clkIn: "<<clkIn;
-	cout<<"\n In DECODE stalls: "<<stalls;
-	cout<<"\n memoryStall: "<<memoryStall<<"stallMem: "<<stallMem<<"\n";
-
-	//cout<<"\n DEC input: 1.opcode: "<<pipe_reg[FIRST].pipe_IR.opcode;
-	cout<<"\n DEC input: instruct: "<<(instr_names[pipe_reg[FIRST].pipe_IR.opcode]);
-	cout<<"\n DEC input: 2.dest:   "<<pipe_reg[FIRST].pipe_IR.dest;
-	cout<<"\n DEC input: 3.src1:   "<<pipe_reg[FIRST].pipe_IR.src1;
-	cout<<"\n DEC input: 4.src2:   "<<pipe_reg[FIRST].pipe_IR.src2;
-	cout<<"\n DEC input: 5.imm:    "<<pipe_reg[FIRST].pipe_IR.immediate;
-	cout<<"\n DEC input: 6.label:  "<<pipe_reg[FIRST].pipe_IR.label<<"\n";
+/* =============================================================
 
-	//if(memoryStall)	return; //140CYCLE, 75 STALLS
+   SAMPLED SIMULATION
 
-	//Find data-hazards & calculate stalls
-	hazardHandler();
+   See sim_sample.h. A detailed window runs the cycle model one cycle
+   at a time until "detailed" more instructions have retired; the next
+   run_functional empties the pipeline, and the instructions completed
+   meanwhile count as executed but are not measured.
 
-	if(memoryStall){
-		return;
-	}
+   ============================================================= */
 
-	if(stalls && (!branchStall))
-	{
-		cout<<"\n hazard present stalls: "<<stalls;
-		cout<<"\n clkIn: "<<clkIn<<"\n";
-		pipe_reg[SECOND].reset();
-		return;
-	}
-	else if( pipe_reg[FIRST].pipe_IR.opcode != NOP )
+sample_stats_t sim_pipe::run_sampled(unsigned long fast_forward, unsigned long warm_up, unsigned long detailed){
+	if(detailed == 0)
 	{
-		//over-write index values with actual values of respective registers
-		pipe_reg[FIRST].pipe_IR.src1 = get_gp_register(pipe_reg[FIRST].pipe_IR.src1);
-		pipe_reg[FIRST].pipe_IR.src2 = get_gp_register(pipe_reg[FIRST].pipe_IR.src2);
+		cerr << "error: a sampled run needs detailed windows of at least one instruction" << endl;
+		exit(-1);
 	}
 
-	//2.update NPC
-	specialP_Reg[EXE][NPC] = specialP_Reg[ID][NPC];
-	specialP_Reg[EXE][IMM] = pipe_reg[FIRST].pipe_IR.immediate;
+	sim_sample sampler;
+	unsigned long functional = 0, retired = totalInstCount;
+	unsigned long last_instructions = 0, last_cycles = 0; // window cut short by EOP
 
-	if( ( specialP_Reg[ID][IR] != SW) &&
-	    ( (pipe_reg[FIRST].pipe_IR.opcode != NOP) ||
-	      (pipe_reg[FIRST].pipe_IR.opcode != EOP)  ) )
+	while(!eopRetired)
 	{
-		specialP_Reg[EXE][A]=pipe_reg[FIRST].pipe_IR.src1; //3
+		if(fast_forward) functional += run_functional(fast_forward);
+		if(warm_up && !eopRetired) functional += run_functional(warm_up, true);
 
-		if(specialP_Reg[ID][IR] != LW ) //LW doesnt have src2
-			specialP_Reg[EXE][B]=pipe_reg[FIRST].pipe_IR.src2; //4
-	}
-	else
-	if( specialP_Reg[ID][IR] == SW )
-	{
-		specialP_Reg[EXE][B] = pipe_reg[FIRST].pipe_IR.src1;
-		specialP_Reg[EXE][A] = pipe_reg[FIRST].pipe_IR.src2;
-		pipe_reg[FIRST].pipe_IR.src1 = specialP_Reg[EXE][A];
-		pipe_reg[FIRST].pipe_IR.src2 = specialP_Reg[EXE][B];
-	}
+		// the window is measured from its first retirement, once the pipeline has filled
+		unsigned long first = totalInstCount;
+		while(!eopRetired && totalInstCount == first) run(1);
+		unsigned long start_clk = clkIn, start_count = totalInstCount;
+		while(!eopRetired && totalInstCount - start_count < detailed) run(1);
 
-	specialP_Reg[EXE][IR] = specialP_Reg[ID][IR];
-
-	//LOAD PIPE2 WITH PIPE1
-	std::memcpy(&pipe_reg[SECOND], &pipe_reg[FIRST], sizeof (pipeline_Registers) );
-
-	if(clkIn == (ID+1))
-	{
-		fetch();
-		++clkIn;
-		cout<<"\n---return true from decode---clkIn: "<<clkIn<<"\n";
+		unsigned long instructions = totalInstCount - start_count, cycles = clkIn - start_clk;
+		if(instructions >= detailed) sampler.add(instructions, cycles);
+		else
+		{
+			last_instructions = instructions;
+			last_cycles = cycles;
+		}
 	}
-	cout<<"\n---Done decode---clkIn: "<<clkIn<<"\n";
+	if(sampler.samples() == 0 && last_instructions > 0) sampler.add(last_instructions, last_cycles);
 
+	return sampler.stats(functional + totalInstCount - retired);
 }
 
-void sim_pipe::execute()
-{
-	cout<<"\nIn exe clkIn: "<<clkIn<<"\n";
-	//	cout<<"\n branchToLabel: "<<branchToLabel;
-	cout<<"\n memoryStall: "<<memoryStall<<"stallMem: "<<stallMem<<"\n";
-
-	cout<<"\n execute input instruct: "<<(instr_names[pipe_reg[SECOND].pipe_IR.opcode]);
-	//cout<<"\n execute input 1.opcode: "<<pipe_reg[SECOND].pipe_IR.opcode;
-	cout<<"\n execute input 2.dest:   "<<pipe_reg[SECOND].pipe_IR.dest;
-	cout<<"\n execute input 3.src1:   "<<pipe_reg[SECOND].pipe_IR.src1;
-	cout<<"\n execute input 4.src2:   "<<pipe_reg[SECOND].pipe_IR.src2;
-	cout<<"\n execute input 5.imm:    "<<pipe_reg[SECOND].pipe_IR.immediate;
-	cout<<"\n execute input 6.label:  "<<pipe_reg[SECOND].pipe_IR.label<<"\n";
+/* =============================================================
 
-	if(memoryStall) return;
+   PARALLEL SIMULATION
 
-	//exe: call alu()
-	pipe_reg[SECOND].pipe_ALU_OUTPUT = alu(pipe_reg[SECOND].pipe_IR.opcode, pipe_reg[SECOND].pipe_IR.src1, pipe_reg[SECOND].pipe_IR.src2, pipe_reg[SECOND].pipe_IR.immediate, pipe_reg[SECOND].pipe_NPC);
+   run_parallel: a functional pass saves a checkpoint (snapshot) at
+   the start of each interval; the checkpoints share the data memory
+   pages they have in common, so each one only costs the pages written
+   since the previous one. The intervals are then independent: each is
+   simulated by a simulator of its own, restored from its checkpoint
+   (or from the previous one, for the warm-up), on the thread pool of
+   sim_pool.h.
 
-	switch(pipe_reg[SECOND].pipe_IR.opcode)
+   ============================================================= */
+
+parallel_stats_t sim_pipe::run_parallel(unsigned long interval, unsigned long warm_up, unsigned long overlap, unsigned threads){
+	if(interval == 0)
 	{
-		cout<<"\n Is branch Instruct: "<<(instr_names[pipe_reg[SECOND].pipe_IR.opcode]);
+		cerr << "error: a parallel run needs intervals of at least one instruction" << endl;
+		exit(-1);
+	}
 
-		noBranches = true;
-		branchToLabel = "";
+	// the functional pass
+	vector<sim_pipe *> checkpoints;
+	vector<unsigned long> lengths;
+	drain();
+	while(!eopRetired)
+	{
+		checkpoints.push_back(snapshot());
+		lengths.push_back(run_functional(interval));
+	}
 
-	case BNEZ:
-		if(pipe_reg[SECOND].pipe_IR.src1 != 0)
-		{
-			branchToLabel = pipe_reg[SECOND].pipe_IR.label;
-			noBranches = false;
-		}
-		break;
+	parallel_stats_t stats;
+	stats.intervals.resize(checkpoints.size());
+	unsigned long first = 0;
+	for(unsigned i = 0; i < checkpoints.size(); i++)
+	{
+		stats.intervals[i].first = first;
+		stats.intervals[i].instructions = lengths[i];
+		first += lengths[i];
+	}
 
-	case BEQZ:
-		if(pipe_reg[SECOND].pipe_IR.src1 == 0)
+	sim_pool pool(threads);
+	pool.run(checkpoints.size(), [&](unsigned i) {
+		interval_t &result = stats.intervals[i];
+		bool last = (i + 1 == checkpoints.size());
+
+		sim_pipe sim(0, data_memory_latency, forwarding);
+#if SIM_TRACE_LEVEL > TRACE_OFF
+		// the workers would interleave their trace on a shared stream: each one keeps its own, in memory
+		sim.set_trace_sink(TRACE_TO_RING);
+#endif
+		if(i > 0 && warm_up > 0)
 		{
-			branchToLabel = pipe_reg[SECOND].pipe_IR.label;
-			noBranches = false;
+			// back to the checkpoint the warm-up starts in (the first one, if the warm-up reaches before it)
+			unsigned from = i;
+			unsigned long warm = 0;
+			while(from > 0 && warm < warm_up) warm += lengths[--from];
+			sim.restore(*checkpoints[from]);
+			if(warm > warm_up) sim.run_functional(warm - warm_up);
+			sim.run_functional(warm < warm_up ? warm : warm_up, true);
 		}
-		break;
-
-	case BLTZ:
-		if(pipe_reg[SECOND].pipe_IR.src1 < 0)
+		else sim.restore(*checkpoints[i]);
+
+		// the interval (the last one up to EOP)
+		unsigned long start_clk = sim.clkIn, start_count = sim.totalInstCount;
+		unsigned start_stalls[NUM_STALL_TYPES];
+		std::copy(sim.stallCount, sim.stallCount + NUM_STALL_TYPES, start_stalls);
+		result.head_cycles = 0;
+		while(!sim.eopRetired && (last || sim.totalInstCount - start_count < lengths[i]))
 		{
-			branchToLabel = pipe_reg[SECOND].pipe_IR.label;
-			noBranches = false;
+			sim.run(1);
+			if(overlap && !result.head_cycles && sim.totalInstCount - start_count >= overlap) result.head_cycles = sim.clkIn - start_clk;
 		}
-		break;
+		result.cycles = sim.clkIn - start_clk;
+		for(unsigned s = 0; s < NUM_STALL_TYPES; s++) result.stalls[s] = sim.stallCount[s] - start_stalls[s];
 
-	case BGTZ:
-		if(pipe_reg[SECOND].pipe_IR.src1 > 0)
+		// then the start of the next one, with everything warm
+		result.tail_cycles = 0;
+		if(!last && overlap)
 		{
-			branchToLabel = pipe_reg[SECOND].pipe_IR.label;
-			noBranches = false;
+			unsigned long end_clk = sim.clkIn;
+			while(!sim.eopRetired && sim.totalInstCount - start_count < lengths[i] + overlap) sim.run(1);
+			if(sim.totalInstCount - start_count >= lengths[i] + overlap) result.tail_cycles = sim.clkIn - end_clk;
 		}
-		break;
-
-	case BLEZ:
-		if(pipe_reg[SECOND].pipe_IR.src1 <= 0)
+	});
+
+	// the intervals stitched together
+	stats.instructions = first;
+	stats.cycles = 0;
+	stats.stalls = 0;
+	std::fill_n(stats.stalls_by_type, NUM_STALL_TYPES, 0);
+	double extra_cycles = 0;
+	for(unsigned i = 0; i < checkpoints.size(); i++)
+	{
+		interval_t &result = stats.intervals[i];
+		result.warmup_error = 0;
+		if(i > 0 && result.head_cycles && stats.intervals[i-1].tail_cycles)
 		{
-			branchToLabel = pipe_reg[SECOND].pipe_IR.label;
-			noBranches = false;
+			result.warmup_error = (double)result.head_cycles / stats.intervals[i-1].tail_cycles - 1;
+			extra_cycles += (double)result.head_cycles - stats.intervals[i-1].tail_cycles;
 		}
-		break;
-
-	case BGEZ:
-		if(pipe_reg[SECOND].pipe_IR.src1 >= 0)
+		stats.cycles += result.cycles;
+		for(unsigned s = 0; s < NUM_STALL_TYPES; s++)
 		{
-			branchToLabel = pipe_reg[SECOND].pipe_IR.label;
-			noBranches = false;
+			stats.stalls_by_type[s] += result.stalls[s];
+			stats.stalls += result.stalls[s];
 		}
-		break;
+		delete checkpoints[i];
+	}
+	stats.ipc = stats.cycles ? (double)stats.instructions / stats.cycles : 0;
+	stats.warmup_error = stats.cycles ? extra_cycles / stats.cycles : 0;
+	return stats;
+}
 
-	default:
-		noBranches = true;
+/* reset the state of the pipeline simulator */
+void sim_pipe::reset(){
+
+	data_memory.reset();
+
+	/* Reset object's member variables */
+
+	std::fill_n(generalP_Reg, NUM_GP_REGISTERS, UNDEFINED);
+
+	for(int k = FIRST; k <= FORTH; k++){
+		reset_group(pipe_reg[k], MAX_ISSUE_WIDTH);
+		reset_group(pipe_next[k], MAX_ISSUE_WIDTH);
 	}
 
-	if(pipe_reg[SECOND].pipe_IR.opcode ==  NOP)
+	clkIn = 0;
+	runAlways = 0;
+	inst_count = 0;
+	totalInstCount = 0;
+	fetchSeq = 0;
+
+	stalls = 0;
+	totalStalls = 0;
+	scoreboard.reset();
+	stallMem = 0;
+	memLatency = 0;
+	dcache.reset();
+	l2cache.reset();
+	icache.reset();
+	fetchMiss = UNDEFINED;
+	fetchReady = 0;
+	std::fill_n(stallCount, NUM_STALL_TYPES, 0);
+	std::fill_n(stageStall, EVENT_STALL_STAGES, EVENT_NO_STALL);
+	branchTarget = UNDEFINED;
+
+	branchStall = false;
+	memoryStall = false;
+	bpred.reset();
+	mispredict = false;
+	draining = false;
+	eopFetched = false;
+	eopRetired = false;
+
+	update_sp_registers();
+}
+
+//return value of special purpose register
+unsigned sim_pipe::get_sp_register(sp_register_t reg, stage_t s)
+{
+	if( (reg >= 0 ) && (reg < NUM_SP_REGISTERS) && (s>=0) && (s<5))
 	{
-		specialP_Reg[MEM][IR] = NOP;
-		specialP_Reg[MEM][ALU_OUTPUT] = 0;
-		specialP_Reg[MEM][B] = UNDEFINED;
+		return specialP_Reg[s][reg];
 	}
-	else{
-		specialP_Reg[MEM][ALU_OUTPUT] = pipe_reg[SECOND].pipe_ALU_OUTPUT;
-		specialP_Reg[MEM][B] =  specialP_Reg[EXE][B]; //For SW, B holds data
-		specialP_Reg[MEM][IR] =  specialP_Reg[EXE][IR];
+
+	return 0;
+}
+
+//returns value of general purpose register
+int sim_pipe::get_gp_register(unsigned reg)
+{
+	if( (reg >= 0 ) && (reg < NUM_GP_REGISTERS))
+	{
+		return generalP_Reg[reg];
 	}
-	//LOAD PIPE3 WITH PIPE2
-	std::memcpy(&pipe_reg[THIRD], &pipe_reg[SECOND], sizeof (pipeline_Registers) );
 
-	if(clkIn == (EXE+1))
+	return 0;
+}
+
+void sim_pipe::set_gp_register(unsigned reg, int value){
+
+	if( (reg >= 0 ) && (reg < NUM_GP_REGISTERS))
 	{
-		decode();
-		fetch();
-		++clkIn;
-		cout<<"\n---return true from execute---clkIn: "<<clkIn<<"\n";
+		generalP_Reg[reg] = value;
 	}
+}
 
+float sim_pipe::get_IPC(){
+	if(!clkIn) return 0;
+	float IPC = float(totalInstCount)/float(clkIn);
+	return IPC;
 }
 
-void sim_pipe::memory()
-{
-	cout<<"\n In memory clkIn: "<<clkIn;
-	cout<<"\n memoryStall: "<<memoryStall<<"stallMem: "<<stallMem<<"\n";
+unsigned sim_pipe::get_instructions_executed(){
+	return totalInstCount;
+}
 
-	cout<<"\n memory input instruct: "<<(instr_names[pipe_reg[THIRD].pipe_IR.opcode]);
-	cout<<"\n memory input 2.dest:   "<<pipe_reg[THIRD].pipe_IR.dest;
-	cout<<"\n memory input 3.src1:   "<<pipe_reg[THIRD].pipe_IR.src1;
-	cout<<"\n memory input 4.src2:   "<<pipe_reg[THIRD].pipe_IR.src2;
-	cout<<"\n memory input 5.imm:    "<<pipe_reg[THIRD].pipe_IR.immediate;
-	cout<<"\n memory input 6.label:  "<<pipe_reg[THIRD].pipe_IR.label<<"\n";
+unsigned sim_pipe::get_stalls(stall_t type){
+	if(type == ALL_STALLS) return totalStalls;
+	return stallCount[type];
+}
 
-	cout<<"\n specialP_Reg[MEM][IR]:  "<<specialP_Reg[MEM][IR]<<"\n";
-	cout<<"\n give specialP_Reg[MEM][ALU_OUTPUT]: "<<specialP_Reg[MEM][ALU_OUTPUT]<<"\n";
+/* counts a stall cycle of the given cause, in the given stage */
+void sim_pipe::count_stall(stall_t type, stage_t stage){
+	stallCount[type] += 1;
+	totalStalls += 1;
+	stageStall[stage] = type;
+}
 
-	if(!data_memory_latency)
-		memoryStall = false;
+unsigned sim_pipe::get_clock_cycles(){
+	return clkIn;
+}
 
-	if(stallMem < data_memory_latency)
-	{
-		if( ( pipe_reg[THIRD].pipe_IR.opcode == LW ) ||
-			( pipe_reg[THIRD].pipe_IR.opcode == SW )  )
-		{
-			if(!stallMem)
-			{
-				cout<<"\n Memory latency required for inst: "<<(instr_names[pipe_reg[THIRD].pipe_IR.opcode]);
-			}
-			memoryStall = true;
-			totalStalls += 1;
-			stallMem += 1;
-			memStallCompleted = false;
-		}
+/* copies the latches (their oldest instruction) into the special purpose registers seen at the entrance of each stage */
+void sim_pipe::update_sp_registers()
+{
+	for(int k = IF; k <= WB ; k++)
+		std::fill_n(specialP_Reg[k], NUM_SP_REGISTERS, UNDEFINED);
 
-	}else
-		if((data_memory_latency) && (stallMem == data_memory_latency))
-		{
-			memoryStall = false;
-			stallMem = 0;
-			memStallCompleted = true;
-		}
+	specialP_Reg[IF][PC] = instr_base_address + 4*inst_count;
 
-	if(memoryStall) return;
+	specialP_Reg[ID][IR]  = pipe_reg[FIRST][0].pipe_IR.opcode;
+	specialP_Reg[ID][NPC] = pipe_reg[FIRST][0].pipe_NPC;
 
-	if(pipe_reg[THIRD].pipe_IR.opcode ==  NOP)
-		specialP_Reg[MEM][IR] = NOP;
+	specialP_Reg[EXE][IR]  = pipe_reg[SECOND][0].pipe_IR.opcode;
+	specialP_Reg[EXE][NPC] = pipe_reg[SECOND][0].pipe_NPC;
+	specialP_Reg[EXE][A]   = pipe_reg[SECOND][0].pipe_A;
+	specialP_Reg[EXE][B]   = pipe_reg[SECOND][0].pipe_B;
+	specialP_Reg[EXE][IMM] = pipe_reg[SECOND][0].pipe_IMM;
 
-	if( specialP_Reg[MEM][IR] == LW) //  LW R1, 4(R2)
-	{
-		pipe_reg[FORTH].pipe_LMD = data_memory[specialP_Reg[MEM][ALU_OUTPUT]]; // index, value
+	specialP_Reg[MEM][IR]         = pipe_reg[THIRD][0].pipe_IR.opcode;
+	specialP_Reg[MEM][B]          = pipe_reg[THIRD][0].pipe_B;
+	specialP_Reg[MEM][COND]       = pipe_reg[THIRD][0].pipe_COND;
+	specialP_Reg[MEM][ALU_OUTPUT] = pipe_reg[THIRD][0].pipe_ALU_OUTPUT;
 
-		//unsigned dataFromMem = *(data_memory + specialP_Reg[MEM][ALU_OUTPUT]);
-		//unsigned char *address = static_cast<void const*>(&data_memory[specialP_Reg[MEM][ALU_OUTPUT]]);
-		//write_memory(specialP_Reg[MEM][ALU_OUTPUT],0x34);
+	specialP_Reg[WB][IR]         = pipe_reg[FORTH][0].pipe_IR.opcode;
+	specialP_Reg[WB][ALU_OUTPUT] = pipe_reg[FORTH][0].pipe_ALU_OUTPUT;
+	specialP_Reg[WB][LMD]        = pipe_reg[FORTH][0].pipe_LMD;
+}
 
-		unsigned da = char2int(data_memory + specialP_Reg[MEM][ALU_OUTPUT]);
 
-		specialP_Reg[WB][LMD]=da;
-	}
-	else
-	if( specialP_Reg[MEM][IR] == SW) //SW reg1, srcreg2:  SW R1, R3 or SW R1, 4(R2)
-	{
-		unsigned long dataMemAddr = 0;
-		unsigned long data = 0;
+void sim_pipe::fetch()
+{
+	SIM_TRACE_STAGE(trace, "\nIn fetch clkIn: "<<clkIn<<"\t current instruction is: "<<inst_count+1);
+	SIM_TRACE_STAGE(trace, "\n stalls: "<<stalls<<" branchStall: "<<branchStall<<" memoryStall: "<<memoryStall);
 
-		data = specialP_Reg[MEM][B];
-		dataMemAddr = specialP_Reg[MEM][ALU_OUTPUT];
+	// ID (or MEM) is stalled: IF/ID keeps its instructions
+	if(memoryStall || stalls) return;
 
-		//Store register value into data memory
-		write_memory(dataMemAddr, data);
+	// the branch in EX was mispredicted: the instructions fetched in this cycle are squashed as well,
+	// and fetch restarts on the right path in the next cycle
+	if(mispredict)
+	{
+		SIM_TRACE_STAGE(trace, "\n Branch mispredicted, restarting at: "<<branchTarget);
+		reset_group(pipe_next[FIRST], issue_width);
+		inst_count = branchTarget;
+		branchTarget = UNDEFINED;
+		eopFetched = false;
+		mispredict = false;
+		count_stall(CONTROL_STALL, IF);
+		return;
 	}
-	else
+
+	// without a predictor, nothing can be fetched while a branch in ID or EX has not been resolved yet
+	if( !bpred.enabled() && (branch_in_group(pipe_reg[FIRST], issue_width) || branch_in_group(pipe_reg[SECOND], issue_width)) )
 	{
-		specialP_Reg[WB][ALU_OUTPUT]=specialP_Reg[MEM][ALU_OUTPUT];
+		SIM_TRACE_STAGE(trace, "\n Branch pending, skipping fetching new inst");
+		reset_group(pipe_next[FIRST], issue_width);
+		branchStall = true;
+		count_stall(CONTROL_STALL, IF);
+		return;
 	}
+	branchStall = false;
 
-	specialP_Reg[WB][IR] = specialP_Reg[MEM][IR];
+	// taken branch resolved in the previous cycle (EX/MEM.cond)
+	if(branchTarget != UNDEFINED)
+	{
+		SIM_TRACE_STAGE(trace, "\n branching to: "<<labelNames.name(branchTarget)<<" jumpToInst: "<<branchTarget);
+
+		inst_count = branchTarget;
+		branchTarget = UNDEFINED;
+	}
 
-	//LOAD PIPE4 WITH PIPE3
-	std::memcpy(&pipe_reg[FORTH], &pipe_reg[THIRD], sizeof (pipeline_Registers) );
+	reset_group(pipe_next[FIRST], issue_width);
 
-	if(clkIn == (MEM+1))
+	// nothing is fetched past the end of the program, nor while run_functional empties the pipeline
+	if(eopFetched || draining) return;
+
+	// up to issue_width consecutive instructions; the group ends at EOP, at a branch predicted taken
+	// (at any branch without a predictor) and at an I-cache miss
+	for(unsigned l = 0; l < issue_width; l++)
 	{
-		execute();
-		decode();
-		fetch();
-		++clkIn;
-		cout<<"\n---return true from memory---clkIn: "<<clkIn<<"\n";
+		if(inst_count >= program_size)
+		{
+			cerr << "error: fetch at PC 0x" << hex << instr_base_address + 4*inst_count << " is past the end of the program (missing EOP?)" << endl;
+			exit(-1);
+		}
+
+		// the I-cache is looked up once per instruction; on a miss IF delivers bubbles until the line arrives
+		// (the fill goes on while IF is frozen, and is abandoned if fetch is redirected)
+		if(icache.enabled() && fetchMiss != inst_count)
+		{
+			unsigned latency = icache.access(instr_base_address + 4*inst_count, false, clkIn);
+			if(latency)
+			{
+				fetchMiss = inst_count;
+				fetchReady = clkIn + latency;
+			}
+		}
+		if(fetchMiss == inst_count && clkIn < fetchReady)
+		{
+			SIM_TRACE_STAGE(trace, "\n I-cache miss, line ready in cycle: "<<fetchReady);
+			if(l == 0) count_stall(FETCH_STALL, IF);
+			return;
+		}
+		fetchMiss = UNDEFINED;
+
+		pipeline_Registers &ifid = pipe_next[FIRST][l];
+		ifid.pipe_IR  = program[inst_count];
+		ifid.pipe_PC  = instr_base_address + 4*inst_count;
+		ifid.pipe_NPC = ifid.pipe_PC + 4;
+		ifid.pipe_SEQ = fetchSeq++;
+
+		SIM_TRACE_STAGE(trace, "\n Fetch input: instruct: "<<(instr_names[ifid.pipe_IR.opcode]));
+
+		opcode_t opcode = ifid.pipe_IR.opcode;
+		if(opcode == EOP)
+		{
+			eopFetched = true;
+			return;
+		}
+		if(bpred.enabled() && is_branch(opcode))
+		{
+			ifid.pipe_PRED_PC = bpred.predict(ifid.pipe_PC, opcode != JUMP);
+			inst_count = (ifid.pipe_PRED_PC - instr_base_address) / 4;
+
+			SIM_TRACE_STAGE(trace, "\n Branch predicted to: 0x"<<hex<<ifid.pipe_PRED_PC<<dec);
+			if(ifid.pipe_PRED_PC != ifid.pipe_NPC) return;
+		}
+		else
+		{
+			++inst_count;
+			if(is_branch(opcode)) return;
+		}
 	}
 }
 
-void sim_pipe::writeBack()
+void sim_pipe::decode()
 {
-	cout<<"\n WB clkIn: "<<clkIn<<"\n";
-	cout<<"\n memoryStall: "<<memoryStall;
-
-	cout<<"\n WB input instruct: "<<(instr_names[pipe_reg[FORTH].pipe_IR.opcode]);
-	cout<<"\n WB input 2.dest:   "<<pipe_reg[FORTH].pipe_IR.dest;
-	cout<<"\n WB input 3.src1:   "<<pipe_reg[FORTH].pipe_IR.src1;
-	cout<<"\n WB input 4.src2:   "<<pipe_reg[FORTH].pipe_IR.src2;
-	cout<<"\n WB input 5.imm:   "<<pipe_reg[FORTH].pipe_IR.immediate;
-	cout<<"\n WB input 6.label: "<<pipe_reg[FORTH].pipe_IR.label<<"\n";
+	SIM_TRACE_STAGE(trace, "\n In DECODE clkIn: "<<clkIn);
 
-	if(pipe_reg[FORTH].pipe_IR.opcode ==  NOP)
-		specialP_Reg[WB][IR] = NOP;
+	// MEM is stalled: ID/EX keeps its instructions
+	if(memoryStall) return;
 
-	if(     (specialP_Reg[WB][IR] == ADD)  ||
-			(specialP_Reg[WB][IR] == ADDI) ||
-			(specialP_Reg[WB][IR] == SUB)  ||
-			(specialP_Reg[WB][IR] == SUBI) ||
-			(specialP_Reg[WB][IR] == XOR)   )
+	// the instructions in ID are on the wrong path of the branch in EX
+	if(mispredict)
 	{
-		set_gp_register(pipe_reg[FORTH].pipe_IR.dest, specialP_Reg[WB][ALU_OUTPUT]); // index, value
+		reset_group(pipe_next[SECOND], issue_width);
+		stalls = 0;
+		count_stall(CONTROL_STALL, ID);
+		return;
 	}
-	else
-		if( specialP_Reg[WB][IR] == LW) //LW
+
+	// the instructions in IF/ID are issued in order, up to the first one with a hazard
+	reset_group(pipe_next[SECOND], issue_width);
+	regmask_t group_writes = 0; // registers written by the instructions issued in this cycle
+	bool group_memory = false;  // a load or store has been issued in this cycle
+	event_stall_t cause = EVENT_NO_STALL;
+	unsigned l = 0;
+	for(; l < issue_width; l++)
 	{
-		set_gp_register(pipe_reg[FORTH].pipe_IR.dest, specialP_Reg[WB][LMD]); // index, value
+		SIM_TRACE_STAGE(trace, "\n DEC input: instruct: "<<(instr_names[pipe_reg[FIRST][l].pipe_IR.opcode]));
+		SIM_TRACE_STAGE(trace, "\n DEC input: 2.dest:   "<<pipe_reg[FIRST][l].pipe_IR.dest);
+		SIM_TRACE_STAGE(trace, "\n DEC input: 3.src1:   "<<pipe_reg[FIRST][l].pipe_IR.src1);
+		SIM_TRACE_STAGE(trace, "\n DEC input: 4.src2:   "<<pipe_reg[FIRST][l].pipe_IR.src2);
+		SIM_TRACE_STAGE(trace, "\n DEC input: 5.imm:    "<<pipe_reg[FIRST][l].pipe_IR.immediate<<"\n");
+
+		//Find data-hazards & calculate stalls
+		cause = hazardHandler(l, group_writes, group_memory);
+		if(stalls) break;
+
+		//read the operands from the register file
+		pipeline_Registers &idex = pipe_next[SECOND][l];
+		idex = pipe_reg[FIRST][l];
+
+		const instruction_t &ir = idex.pipe_IR;
+
+		// the result can be read in ID once written back, three cycles from now; with forwarding, it
+		// reaches EX in time unless it comes from a load, which must first get to MEM/WB (two cycles)
+		if(!forwarding)
+			scoreboard.issue(dest_registers(ir), clkIn + 3);
+		else if(ir.opcode == LW)
+			scoreboard.issue(dest_registers(ir), clkIn + 2);
+		switch(ir.opcode)
+		{
+		case ADD:
+		case SUB:
+		case XOR:
+			idex.pipe_A = get_gp_register(ir.src1);
+			idex.pipe_B = get_gp_register(ir.src2);
+			break;
+		case ADDI:
+		case SUBI:
+		case LW:
+		case BEQZ:
+		case BNEZ:
+		case BLTZ:
+		case BGTZ:
+		case BLEZ:
+		case BGEZ:
+			idex.pipe_A = get_gp_register(ir.src1);
+			idex.pipe_IMM = ir.immediate;
+			break;
+		case SW: //SW src1 imm(src2): A holds the base address, B the data to be stored
+			idex.pipe_A = get_gp_register(ir.src2);
+			idex.pipe_B = get_gp_register(ir.src1);
+			idex.pipe_IMM = ir.immediate;
+			break;
+		case JUMP:
+			idex.pipe_IMM = ir.immediate;
+			break;
+		default:
+			break;
+		}
+		group_writes |= dest_registers(ir);
+		group_memory |= (ir.opcode == LW || ir.opcode == SW);
 	}
 
-	if(clkIn >= (WB+1))
+	if(l == 0)
 	{
-		memory();
-		execute();
-		decode();
-		fetch();
+		SIM_TRACE_STAGE(trace, "\n hazard present stalls: "<<stalls);
+		count_stall(DATA_STALL, ID);
+		stageStall[ID] = cause;
+		return;
+	}
 
-		if((specialP_Reg[WB][IR] == EOP) && (noBranches))
+	// the rest of the group waits in IF/ID, oldest first (IF is frozen while stalls is not 0)
+	if(stalls)
+	{
+		stageStall[ID] = cause;
+		for(unsigned k = 0; k < issue_width; k++)
 		{
-			runAlways = false;
-			cout<<"\n --- End Of Program Detected ---, clkIn: "<<clkIn<<"\n";
-			return;
+			if(l + k < issue_width) pipe_next[FIRST][k] = pipe_reg[FIRST][l + k];
+			else pipe_next[FIRST][k].reset();
 		}
-
-		++clkIn;
-
-		cout<<"\n--- write back cycle done---clkIn: "<<clkIn<<"\n";
 	}
 }
 
-void sim_pipe::hazardHandler()
+void sim_pipe::execute()
 {
-	cout<<"\n hazardHandler, clkIn: "<<clkIn;
-	cout<<"\n hazardHandler, stalls: "<<stalls<<" totalStalls: "<<totalStalls;
-	cout<<"\n hazardHandler, memoryStall: "<<memoryStall;
-	cout<<"\n hazardHandler, stallMem: "<<stallMem;
+	SIM_TRACE_STAGE(trace, "\nIn exe clkIn: "<<clkIn);
 
+	// MEM is stalled: EX/MEM keeps its instructions. The bypassed operands are latched in ID/EX,
+	// since their producer leaves MEM/WB while EX waits.
 	if(memoryStall)
+	{
+		if(forwarding)
+			for(unsigned l = 0; l < issue_width; l++) forward_operands(pipe_next[SECOND][l]);
 		return;
+	}
 
-	bool nopInst = false;
-	cout<<"\n pipe_reg[FIRST].pipe_IR.instru :  "<<instr_names[pipe_reg[FIRST].pipe_IR.opcode];
-	cout<<"\n pipe_reg[SECOND].pipe_IR.instru : "<<instr_names[pipe_reg[SECOND].pipe_IR.opcode];
-	cout<<"\n pipe_reg[THIRD].pipe_IR.instru :  "<<instr_names[pipe_reg[THIRD].pipe_IR.opcode];
-	cout<<"\n pipe_reg[FORTH].pipe_IR.instru :  "<<instr_names[pipe_reg[FORTH].pipe_IR.opcode];
+	for(unsigned l = 0; l < issue_width; l++)
+	{
+		SIM_TRACE_STAGE(trace, "\n execute input instruct: "<<(instr_names[pipe_reg[SECOND][l].pipe_IR.opcode]));
+		SIM_TRACE_STAGE(trace, "\n execute input A: "<<pipe_reg[SECOND][l].pipe_A<<" B: "<<pipe_reg[SECOND][l].pipe_B<<" IMM: "<<pipe_reg[SECOND][l].pipe_IMM<<"\n");
 
+		pipeline_Registers &exmem = pipe_next[THIRD][l];
+		exmem = pipe_reg[SECOND][l];
 
-	if( (pipe_reg[FIRST].pipe_IR.opcode == NOP)  ||
-    	(pipe_reg[SECOND].pipe_IR.opcode == NOP) ||
-		(pipe_reg[THIRD].pipe_IR.opcode == NOP)   )
-	{
-		nopInst = true;
-	}
+		if(forwarding) forward_operands(exmem);
 
-	if((!stalls) && (!nopInst))
-	{
-		if(specialP_Reg[ID][IR] == SW)
-		{
-			specialP_Reg[ID][B] = pipe_reg[FIRST].pipe_IR.src1;
-			specialP_Reg[ID][A] = pipe_reg[FIRST].pipe_IR.src2;
-		}else
-		{
-			specialP_Reg[ID][A] = pipe_reg[FIRST].pipe_IR.src1; //3
-			specialP_Reg[ID][B] = pipe_reg[FIRST].pipe_IR.src2; //4
-		}
+		opcode_t opcode = exmem.pipe_IR.opcode;
+		if(opcode == NOP || opcode == EOP) continue;
+
+		//exe: call alu()
+		exmem.pipe_ALU_OUTPUT = alu(opcode, exmem.pipe_A, exmem.pipe_B, exmem.pipe_IMM, exmem.pipe_NPC);
 
-		if(pipe_reg[FIRST].pipe_IR.opcode == SW)
+		if(is_branch(opcode))
 		{
-			if( ( specialP_Reg[ID][A] == pipe_reg[SECOND].pipe_IR.dest) ||
-				( specialP_Reg[ID][B] == pipe_reg[SECOND].pipe_IR.dest)  )
+			exmem.pipe_COND = branch_taken(opcode, exmem.pipe_A);
+			if(bpred.enabled())
 			{
-				cout<<"\n for instruct: "<<(instr_names[pipe_reg[FIRST].pipe_IR.opcode]);
-				cout<<"\n with instruct: "<<(instr_names[pipe_reg[SECOND].pipe_IR.opcode]);
-
-				stalls = 2;
-				currentClk = clkIn;
-
+				// train the predictor; on a wrong prediction IF and ID are squashed (see decode and fetch)
+				if(bpred.update(exmem.pipe_PC, opcode != JUMP, exmem.pipe_COND, exmem.pipe_ALU_OUTPUT, exmem.pipe_PRED_PC))
+				{
+					mispredict = true;
+					branchTarget = exmem.pipe_COND ? exmem.pipe_IR.target : (exmem.pipe_NPC - instr_base_address) / 4;
+				}
 			}
 			else
-			if( ( (pipe_reg[FORTH].pipe_IR.opcode != NOP) &&
-				  (pipe_reg[FORTH].pipe_IR.opcode != SW)  &&
-				  (pipe_reg[FORTH].pipe_IR.opcode != BNEZ)&&
-				  (pipe_reg[FORTH].pipe_IR.opcode != BLTZ)  ) &&	(
-				  ( specialP_Reg[ID][A] == pipe_reg[FORTH].pipe_IR.dest) ||
-				  ( specialP_Reg[ID][B] == pipe_reg[FORTH].pipe_IR.dest)  ) )
+			if(exmem.pipe_COND)
 			{
-				cout<<"\n for instruct: "<<(instr_names[pipe_reg[FIRST].pipe_IR.opcode]);
-				cout<<"\n with instruct: "<<(instr_names[pipe_reg[FORTH].pipe_IR.opcode]);
-
-					stalls = 1;
-					currentClk = clkIn;
+				SIM_TRACE_STAGE(trace, "\n Branch taken to: "<<labelNames.name(exmem.pipe_IR.target));
+				branchTarget = exmem.pipe_IR.target;
 			}
 		}
-		else
-		if( (specialP_Reg[ID][A] == pipe_reg[SECOND].pipe_IR.dest) ||
-			(specialP_Reg[ID][B] == pipe_reg[SECOND].pipe_IR.dest) )
-		{
-			if( 	(pipe_reg[SECOND].pipe_IR.opcode == ADD)  || //ADD
-					(pipe_reg[SECOND].pipe_IR.opcode == ADDI) || //ADDI
-					(pipe_reg[SECOND].pipe_IR.opcode == SUB)  || //SUB
-					(pipe_reg[SECOND].pipe_IR.opcode == SUBI) || //SUBI
-					(pipe_reg[SECOND].pipe_IR.opcode == XOR)  || //XOR
-					(pipe_reg[SECOND].pipe_IR.opcode == LW)    ) //LW
-			{
-				cout<<"\n for instruct: "<<(instr_names[pipe_reg[FIRST].pipe_IR.opcode]);
-				cout<<"\n with instruct: "<<(instr_names[pipe_reg[SECOND].pipe_IR.opcode]);
+	}
+}
 
-				stalls = 2;
-				currentClk = clkIn;
-			}
-		}
-		else
-		if(( ( pipe_reg[THIRD].pipe_IR.opcode != SW)    &&
-			 ( pipe_reg[FIRST].pipe_IR.opcode != BNEZ)  &&
-	         ( pipe_reg[THIRD].pipe_IR.opcode != NOP)   &&
-			 ( pipe_reg[THIRD].pipe_IR.opcode != BNEZ)   )  &&
-			 ( ( specialP_Reg[ID][A] == pipe_reg[THIRD].pipe_IR.dest) ||
-			   ( specialP_Reg[ID][B] == pipe_reg[THIRD].pipe_IR.dest) ) )
-		{
-			cout<<"\n for instruct: "<<(instr_names[pipe_reg[FIRST].pipe_IR.opcode]);
-			cout<<"\n with instruct: "<<(instr_names[pipe_reg[THIRD].pipe_IR.opcode]);
+void sim_pipe::memory()
+{
+	SIM_TRACE_STAGE(trace, "\n In memory clkIn: "<<clkIn);
+	SIM_TRACE_STAGE(trace, "\n memoryStall: "<<memoryStall<<" stallMem: "<<stallMem);
+
+	// a group holds at most one load or store (see hazardHandler)
+	unsigned m = 0;
+	for(unsigned l = 1; l < issue_width; l++)
+		if(pipe_reg[THIRD][l].pipe_IR.opcode == LW || pipe_reg[THIRD][l].pipe_IR.opcode == SW) m = l;
+
+	const pipeline_Registers &access = pipe_reg[THIRD][m];
+	opcode_t opcode = access.pipe_IR.opcode;
+
+	SIM_TRACE_STAGE(trace, "\n memory input instruct: "<<(instr_names[opcode]));
+	SIM_TRACE_STAGE(trace, "\n memory input ALU_OUTPUT: "<<access.pipe_ALU_OUTPUT<<"\n");
+
+	// the memory access takes memLatency extra cycles, during which the stages before MEM are frozen;
+	// the caches are looked up once, in the first cycle of the access
+	if( (opcode == LW || opcode == SW) && !memoryStall )
+	{
+		memLatency = dcache.access(access.pipe_ALU_OUTPUT, opcode == SW, clkIn);
+		SIM_TRACE_STAGE(trace, "\n memory access latency: "<<memLatency);
+	}
+	if( (opcode == LW || opcode == SW) && (stallMem < memLatency) )
+	{
+		memoryStall = true;
+		stallMem += 1;
+		count_stall(MEMORY_STALL, MEM);
+		reset_group(pipe_next[FORTH], issue_width);
+		return;
+	}
+	memoryStall = false;
+	stallMem = 0;
+
+	for(unsigned l = 0; l < issue_width; l++)
+	{
+		const pipeline_Registers &exmem = pipe_reg[THIRD][l];
+		pipeline_Registers &memwb = pipe_next[FORTH][l];
+		memwb = exmem;
+
+		if(forwarding && exmem.pipe_IR.opcode == LW) scoreboard.release(dest_registers(exmem.pipe_IR));
 
-			stalls = 1;
-			currentClk = clkIn;
+		if(exmem.pipe_IR.opcode == LW) //  LW R1, 4(R2)
+		{
+			memwb.pipe_LMD = data_memory.read_word(exmem.pipe_ALU_OUTPUT);
 		}
 		else
-		if( ( ( pipe_reg[FORTH].pipe_IR.opcode != SW)    &&
-			  ( pipe_reg[FORTH].pipe_IR.opcode != BNEZ)  &&
-			  ( pipe_reg[FIRST].pipe_IR.opcode != BNEZ)  &&
-			  ( pipe_reg[FORTH].pipe_IR.opcode != NOP)   &&
-			  ( pipe_reg[FORTH].pipe_IR.opcode != BLTZ)   ) &&
-			  ( ( specialP_Reg[ID][A] == pipe_reg[FORTH].pipe_IR.dest) ||
-			    ( specialP_Reg[ID][B] == pipe_reg[FORTH].pipe_IR.dest)  ) )
+		if(exmem.pipe_IR.opcode == SW) //  SW R1, 4(R2)
 		{
-			cout<<"\n for instruct: "<<(instr_names[pipe_reg[FIRST].pipe_IR.opcode]);
-			cout<<"\n with instruct: "<<(instr_names[pipe_reg[FORTH].pipe_IR.opcode]);
-
-			stalls = 1;
-			currentClk = clkIn;
-			cout<<"\n stall 1 required";
+			//Store register value into data memory
+			write_memory(exmem.pipe_ALU_OUTPUT, exmem.pipe_B);
 		}
-		else
-			if(     (pipe_reg[FIRST].pipe_IR.opcode == BNEZ) ||
-					(pipe_reg[FIRST].pipe_IR.opcode == BEQZ) ||
-					(pipe_reg[FIRST].pipe_IR.opcode == BLTZ) ||
-					(pipe_reg[FIRST].pipe_IR.opcode == BGTZ) ||
-					(pipe_reg[FIRST].pipe_IR.opcode == BLEZ) ||
-					(pipe_reg[FIRST].pipe_IR.opcode == BGEZ)  )
-			{
-				cout<<"\n Branching detected";
-				cout<<"\n for instruct: "<<(instr_names[pipe_reg[FIRST].pipe_IR.opcode]);
+	}
+}
 
-				stalls = 2;
-				currentClk = clkIn;
-				branchStall = true;
+void sim_pipe::writeBack()
+{
+	SIM_TRACE_STAGE(trace, "\n WB clkIn: "<<clkIn);
 
-			}
+	// the instructions of the group write back in order
+	for(unsigned l = 0; l < issue_width; l++)
+	{
+		const pipeline_Registers &memwb = pipe_reg[FORTH][l];
+
+		SIM_TRACE_STAGE(trace, "\n WB input instruct: "<<(instr_names[memwb.pipe_IR.opcode]));
+		SIM_TRACE_STAGE(trace, "\n WB input 2.dest:   "<<memwb.pipe_IR.dest<<"\n");
+
+		// written in the first half of the cycle: ID reads the new value in the second half
+		if(!forwarding) scoreboard.release(dest_registers(memwb.pipe_IR));
+
+		switch(memwb.pipe_IR.opcode)
+		{
+		case ADD:
+		case ADDI:
+		case SUB:
+		case SUBI:
+		case XOR:
+			set_gp_register(memwb.pipe_IR.dest, memwb.pipe_ALU_OUTPUT); // index, value
+			break;
+		case LW:
+			set_gp_register(memwb.pipe_IR.dest, memwb.pipe_LMD); // index, value
+			break;
+		case EOP:
+			eopRetired = true;
+			if(events.enabled()) events.add(0, EVENT_RETIRED, memwb.pipe_SEQ);
+			return;
+		case NOP:
+			continue;
+		default:
+			break;
+		}
+
+		++totalInstCount;
+		if(events.enabled()) events.add(0, EVENT_RETIRED, memwb.pipe_SEQ);
+	}
+}
 
-		if(stalls){
+/* returns the cause of the stall, for the event trace (EVENT_NO_STALL if none) */
+event_stall_t sim_pipe::hazardHandler(unsigned lane, regmask_t group_writes, bool group_memory)
+{
+	// RAW: the scoreboard holds the registers whose value cannot reach this instruction yet:
+	// those written by the instructions in EX and MEM (the register file is written in the first
+	// half of WB and read in the second half of ID) or, with forwarding, by a load in EX
+	const instruction_t &ir = pipe_reg[FIRST][lane].pipe_IR;
 
-			cout<<"\n--------HAZARD PRESENT-- so far, totalstalls: "<<totalStalls;
-			cout<<"\n more required stalls: "<<stalls<<"\n";
+	stalls = scoreboard.wait(source_registers(ir), clkIn);
 
-		}else
-			memStallCompleted = false;
+	if(stalls)
+	{
+		SIM_TRACE_STAGE(trace, "\n RAW for instruct: "<<(instr_names[ir.opcode])<<" pending registers: 0x"<<hex<<scoreboard.pending_registers()<<dec);
+		return EVENT_DATA_STALL;
+	}
 
+	// within a group: no result is forwarded between instructions in EX in the same cycle, MEM has one
+	// data memory port, and the instructions after a branch wait for the next group
+	event_stall_t cause = EVENT_NO_STALL;
+	if(source_registers(ir) & group_writes) cause = EVENT_DATA_STALL;
+	else if((ir.opcode == LW || ir.opcode == SW) && group_memory) cause = EVENT_STRUCTURAL_STALL;
+	else if(lane > 0 && is_branch(pipe_reg[FIRST][lane-1].pipe_IR.opcode)) cause = EVENT_CONTROL_STALL;
+	if(cause != EVENT_NO_STALL)
+	{
+		SIM_TRACE_STAGE(trace, "\n hazard within the group for instruct: "<<(instr_names[ir.opcode]));
+		stalls = 1;
 	}
+	return cause;
+}
 
-	unsigned memS = 0;
-	if(memStallCompleted && (!branchStall))
+/* bypass network: replaces the operands read in ID with the results of the instructions ahead
+   that have not been written back yet */
+void sim_pipe::forward_operands(pipeline_Registers &idex)
+{
+	const instruction_t &ir = idex.pipe_IR;
+	switch(ir.opcode)
 	{
-		memS = 4;
+	case ADD:
+	case SUB:
+	case XOR:
+		forward_register(ir.src1, idex.pipe_A);
+		forward_register(ir.src2, idex.pipe_B);
+		break;
+	case ADDI:
+	case SUBI:
+	case LW:
+	case BEQZ:
+	case BNEZ:
+	case BLTZ:
+	case BGTZ:
+	case BLEZ:
+	case BGEZ:
+		forward_register(ir.src1, idex.pipe_A);
+		break;
+	case SW:
+		forward_register(ir.src2, idex.pipe_A);
+		forward_register(ir.src1, idex.pipe_B);
+		break;
+	default:
+		break;
 	}
+}
 
-	if((stalls) && (clkIn == (currentClk+stalls+memS)) )
+/* the most recent producer wins: EX/MEM.ALU_OUTPUT (EX->EX), then MEM/WB.ALU_OUTPUT or MEM/WB.LMD (MEM->EX);
+   within a latch, the youngest lane */
+void sim_pipe::forward_register(unsigned reg, unsigned &value)
+{
+	for(unsigned l = issue_width; l-- > 0; )
 	{
-		totalStalls += stalls;
-		stalls = 0;
+		const instruction_t &ex = pipe_reg[THIRD][l].pipe_IR;
+		if(!writes_register(ex.opcode) || ex.dest != reg) continue;
 
-		if(branchStall)	branchStall = false;
+		// a load in EX/MEM has only computed its address (load-use stall)
+		if(ex.opcode == LW) break;
 
-		if(     (pipe_reg[FIRST].pipe_IR.opcode == BNEZ) ||
-				(pipe_reg[FIRST].pipe_IR.opcode == BEQZ) ||
-				(pipe_reg[FIRST].pipe_IR.opcode == BLTZ) ||
-				(pipe_reg[FIRST].pipe_IR.opcode == BGTZ) ||
-				(pipe_reg[FIRST].pipe_IR.opcode == BLEZ) ||
-				(pipe_reg[FIRST].pipe_IR.opcode == BGEZ)  )
-		{
-			stalls = 2;
-			currentClk = clkIn;
-			branchStall = true;
-		}
+		SIM_TRACE_STAGE(trace, "\n forwarding EX/MEM.ALU_OUTPUT to R"<<reg);
+		value = pipe_reg[THIRD][l].pipe_ALU_OUTPUT;
+		return;
+	}
+	for(unsigned l = issue_width; l-- > 0; )
+	{
+		const instruction_t &mem = pipe_reg[FORTH][l].pipe_IR;
+		if(!writes_register(mem.opcode) || mem.dest != reg) continue;
 
+		SIM_TRACE_STAGE(trace, "\n forwarding MEM/WB to R"<<reg);
+		value = (mem.opcode == LW) ? pipe_reg[FORTH][l].pipe_LMD : pipe_reg[FORTH][l].pipe_ALU_OUTPUT;
+		return;
 	}
 }
@@ -6,16 +6,26 @@
 #include <cstdlib>
 #include <iostream>
 #include <map>
+#include <vector>
+#include "sim_trace.h"
+#include "sim_events.h"
+#include "sim_asm.h"
+#include "sim_image.h"
+#include "sim_scoreboard.h"
+#include "sim_bpred.h"
+#include "sim_cache.h"
+#include "sim_memory.h"
+#include "sim_sample.h"
 
 using namespace std;
 
-#define PROGRAM_SIZE 50
-
 #define UNDEFINED 0xFFFFFFFF //used to initialize the registers
 #define NUM_SP_REGISTERS 9
 #define NUM_GP_REGISTERS 32
 #define NUM_OPCODES 16
 #define NUM_STAGES 5
+#define NUM_STALL_TYPES 4
+#define MAX_ISSUE_WIDTH 8 // instructions fetched, issued and retired per cycle (see init_issue_width)
 
 
 typedef enum {PC, NPC, IR, A, B, IMM, COND, ALU_OUTPUT, LMD} sp_register_t;
@@ -24,6 +34,10 @@ typedef enum {LW, SW, ADD, ADDI, SUB, SUBI, XOR, BEQZ, BNEZ, BLTZ, BGTZ, BLEZ, B
 
 typedef enum {IF, ID, EXE, MEM, WB} stage_t;
 
+// cause of a stall cycle: data hazard in ID, unresolved or mispredicted branch, data memory access in MEM,
+// instruction cache miss in IF
+typedef enum {DATA_STALL, CONTROL_STALL, MEMORY_STALL, FETCH_STALL, ALL_STALLS} stall_t;
+
 typedef enum {FIRST, SECOND, THIRD, FORTH} pipelineRegNum;
 
 typedef struct{
@@ -32,7 +46,7 @@ typedef struct{
 	unsigned src2; //second source register in the assembly instruction
 	unsigned dest; //destination register
 	unsigned immediate; //immediate field
-	string label; //for conditional branches, label of the target instruction - used only for parsing/debugging purposes
+	unsigned target; //for branches, index in instruction memory of the target instruction (UNDEFINED otherwise)
 
 	void reset()
 	{
@@ -41,68 +55,159 @@ typedef struct{
 		src2 = 0x00000000;
 		dest = 0x00000000;
 		immediate = 0x00000000;
-		label = "";
+		target = UNDEFINED;
 	}
 
 } instruction_t;
 
+// pipeline latch; fields not used by the instruction it holds are UNDEFINED (a bubble holds a NOP)
 struct pipeline_Registers
 {
 	unsigned pipe_PC; //PC
 	unsigned pipe_NPC; //NPC
 	instruction_t pipe_IR; //IR
+	unsigned pipe_A; //value of the first source register
+	unsigned pipe_B; //value of the second source register (for SW, data to be stored)
+	unsigned pipe_IMM; //immediate
 	unsigned pipe_COND;
 	unsigned pipe_ALU_OUTPUT;
 	unsigned pipe_LMD;
+	unsigned pipe_PRED_PC; //PC fetched after this instruction, as predicted by the branch predictor (branches only)
+	unsigned long pipe_SEQ; //fetch order of the instruction, which identifies it in the event trace
 
 	void reset(void)
 	{
-		pipe_PC = 0x00000000;
-		pipe_NPC = 0x00000000;
+		pipe_PC = UNDEFINED;
+		pipe_NPC = UNDEFINED;
 		pipe_IR.reset();
-		pipe_COND = 0x00000000;
-		pipe_ALU_OUTPUT = 0x00000000;
-		pipe_LMD = 0x00000000;
+		pipe_A = UNDEFINED;
+		pipe_B = UNDEFINED;
+		pipe_IMM = UNDEFINED;
+		pipe_COND = UNDEFINED;
+		pipe_ALU_OUTPUT = UNDEFINED;
+		pipe_LMD = UNDEFINED;
+		pipe_PRED_PC = UNDEFINED;
+		pipe_SEQ = UNDEFINED;
 	}
 
 };
 
+// an interval of run_parallel
+typedef struct{
+	unsigned long first; //instructions executed before it (from the start of run_parallel)
+	unsigned long instructions;
+	unsigned long cycles; //taken to retire them, from an empty pipeline
+	unsigned long stalls[NUM_STALL_TYPES]; //stall cycles meanwhile, by cause
+	unsigned long head_cycles; //taken to retire its first "overlap" instructions (0 if not measured)
+	unsigned long tail_cycles; //taken to retire the first "overlap" instructions of the next interval, going on into it
+	double warmup_error; //head_cycles relative to the tail_cycles of the previous interval, minus 1 (0 if not measured)
+} interval_t;
+
+// result of run_parallel: its intervals, and their totals
+typedef struct{
+	unsigned long instructions;
+	unsigned long cycles;
+	unsigned long stalls;
+	unsigned long stalls_by_type[NUM_STALL_TYPES];
+	double ipc;
+	double warmup_error; //cycles in excess at the start of the intervals (head_cycles - tail_cycles), relative to cycles
+	std::vector<interval_t> intervals;
+} parallel_stats_t;
+
+// an instruction translated for run_functional, with its operands bound (see translate_block)
+typedef struct{
+	const void *handler; //address of its code in run_blocks
+	unsigned dest; //registers, as indexes in the register array of run_functional
+	unsigned src1;
+	unsigned src2;
+	unsigned imm;
+} threaded_op_t;
+
+// basic block of translated instructions, ended by a branch, by EOP, or before the next branch target
+typedef struct{
+	unsigned long start; //index of its first instruction
+	unsigned first; //its operations from block_ops[first], the last being its exit: a branch, EOP, or NOP to fall through
+	unsigned executed; //instructions it executes, with the branch ending it (NOPs are not translated)
+	unsigned long target; //index of the instruction branched to
+	unsigned long fallthrough; //index of the instruction after the block
+	unsigned next[2]; //chained successors, the blocks at fallthrough and at target (UNDEFINED until first followed)
+} block_t;
+
 
 class sim_pipe{
 
 	/* Add the data members required by your simulator's implementation here */
 
 	//instruction memory
-	instruction_t instr_memory[PROGRAM_SIZE];
+	std::vector<instruction_t> instr_memory; // sized by load_program
+	sim_image image; // program image mapped by load_binary
+
+	//instructions being executed: instr_memory, or the records of the mapped image
+	const instruction_t *program;
+	unsigned program_size;
+
+	//translation cache of run_functional: the basic blocks of the program as threaded code (see translate_block)
+	std::vector<block_t> blocks;
+	std::vector<threaded_op_t> block_ops; // operations of all the blocks
+	std::vector<unsigned> block_at; // block starting at each instruction (UNDEFINED if not translated yet)
+	std::vector<bool> block_leader; // branch targets: a block ends before each of them
 
 	//base address in the instruction memory where the program is loaded
 	unsigned instr_base_address;
 
-	//data memory - should be initialize to all 0xFF
-	unsigned char *data_memory;
-
-	//memory size in bytes
-	unsigned data_memory_size;
+	//data memory - should be initialize to all 0xFF (paged: see sim_memory.h)
+	sim_memory data_memory;
 
 	//memory latency in clock cycles
 	unsigned data_memory_latency;
 
+	//data caches between MEM and the data memory (disabled unless configured with init_cache)
+	sim_cache dcache;  // L1D
+	sim_cache l2cache; // L2, filled from the data memory
+	sim_cache icache;  // L1I, filled from the L2 or the instruction memory
+
+	//trace output of the stage functions (see sim_trace.h for the compile-time levels)
+	sim_trace trace;
+
+	//event trace of the cycle model (see sim_events.h), written by a thread of its own while enabled
+	sim_events events;
+
+	//true if results are forwarded from EX/MEM and MEM/WB to EX (see the constructor)
+	bool forwarding;
+
+	//instructions per latch (see init_issue_width)
+	unsigned issue_width;
+
 protected:
 	void fetch();
 	void decode();
 	void execute();
 	void memory();
 	void writeBack();
-	void hazardHandler();
+	event_stall_t hazardHandler(unsigned lane, regmask_t group_writes, bool group_memory);
+	void update_sp_registers();
+	void forward_operands(pipeline_Registers &idex);
+	void forward_register(unsigned reg, unsigned &value);
+	void count_stall(stall_t type, stage_t stage);
+	bool pipeline_empty();
+	void drain();
+	void warm_branch(unsigned long index, const instruction_t &ir, bool taken);
+	unsigned translate_block(unsigned long pc, const void *const *handlers);
+	unsigned long run_blocks(unsigned *reg, unsigned long &pc, unsigned long limit);
+	void flush_blocks();
+	void trace_cycle();
+	void trace_latch(unsigned slot, event_stage_t stage, const pipeline_Registers &latch);
 
 public:
 
 	//instantiates the simulator with a data memory of given size (in bytes) and latency (in clock cycles)
 	/* Note:
            - initialize the registers to UNDEFINED value
-	   - initialize the data memory to all 0xFF values
+	   - initialize the data memory to all 0xFF values (up to 4 GiB, allocated in pages as they are written)
+	   - with forwarding=true, results are bypassed from EX/MEM and MEM/WB to EX, and the
+	     only data hazard left is the 1-cycle stall of an instruction using the result of a load
 	 */
-	sim_pipe(unsigned data_mem_size, unsigned data_mem_latency);
+	sim_pipe(uint64_t data_mem_size, unsigned data_mem_latency, bool forwarding=false);
 
 	//de-allocates the simulator
 	~sim_pipe();
@@ -110,9 +215,69 @@ public:
 	//loads the assembly program in file "filename" in instruction memory at the specified address
 	void load_program(const char *filename, unsigned base_address=0x0);
 
+	//loads the program image in file "filename" (written by save_binary) in instruction memory at the specified address;
+	//the image is mapped and executed in place
+	void load_binary(const char *filename, unsigned base_address=0x0);
+
+	//writes the loaded program (instructions and labels) to "filename" as a binary image for load_binary
+	void save_binary(const char *filename);
+
+	//executes the program loaded in "source" in place, at the same address, without copying it;
+	//"source" must keep the program loaded (no load or reset) while this simulator uses it
+	void share_program(const sim_pipe &source);
+
+	//returns a new simulator in the state of this one: registers, latches, hazard state, counters, caches, branch
+	//predictor and data memory. It executes the program of this simulator in place (as share_program), and shares
+	//the pages of the data memory copy-on-write, so that a snapshot is cheap. The snapshot can be run itself, or
+	//restored (any number of times) into this or any other simulator; it is deleted by the caller
+	sim_pipe *snapshot();
+
+	//brings the simulator back to the state saved by snapshot(), configuration included (the trace sink is kept)
+	void restore(const sim_pipe &snapshot);
+
 	//runs the simulator for "cycles" clock cycles (run the program to completion if cycles=0)
 	void run(unsigned cycles=0);
 
+	//executes the next "instructions" instructions of the program (up to EOP if instructions=0) without modelling the
+	//pipeline, and returns the number executed; for fast-forwarding, and as a reference for the architectural results
+	/* Note:
+	   - the instructions in flight complete first, in the cycle model (IF fetches no more meanwhile)
+	   - then only the registers, the data memory and the next instruction to be fetched change: the clock, the
+	     instruction and stall counters, the caches and the branch predictor are left as they are
+	   - run() continues from the next instruction, with an empty pipeline
+	   - if "warm" is true, the caches see the fetches and data accesses and the branch predictor is trained with
+	     every branch (functional warming, see run_sampled); the clock still does not move
+	   - otherwise whole basic blocks run as threaded code, translated on first use and cached until the program changes
+	 */
+	unsigned long run_functional(unsigned long instructions=0, bool warm=false);
+
+	//sampled simulation (see sim_sample.h): runs the program to completion repeating "fast_forward" instructions of
+	//functional execution, "warm_up" instructions of functional warming and a window of "detailed" instructions in
+	//the cycle model; returns the IPC of the program extrapolated from the windows, with its confidence interval
+	/* Note:
+	   - the counters (clock, instructions, stalls, caches, predictor) are those of the windows and of the cycles
+	     taken to empty the pipeline after each of them; the statistics of the caches and of the predictor also count
+	     the warm-up
+	   - a window cut short by EOP is not measured, unless no window is complete
+	 */
+	sample_stats_t run_sampled(unsigned long fast_forward, unsigned long warm_up, unsigned long detailed);
+
+	//checkpoint-based parallel simulation: runs the program to completion in functional mode, saving a checkpoint
+	//(snapshot) every "interval" instructions, then simulates the intervals in the cycle model from their checkpoints
+	//on "threads" threads (0: one per hardware thread), and returns their cycles, stalls and IPC stitched together
+	/* Note:
+	   - an interval starts with an empty pipeline; with "warm_up" > 0, its caches and branch predictor are first
+	     warmed with the "warm_up" instructions before it (functional warming), from the checkpoint they start in
+	   - with "overlap" > 0, an interval is simulated on into the first "overlap" instructions of the next one: the
+	     cycles they take there, with everything warm, against those they take at the start of the next interval
+	     give the warm-up error of the next interval
+	   - the instructions in flight complete first, and are not counted; the simulator is left at EOP, its counters
+	     unchanged
+	   - the trace of the intervals goes to an in-memory ring of their own, not to the trace sink of the simulator
+	   - uses threads: build with -pthread
+	 */
+	parallel_stats_t run_parallel(unsigned long interval, unsigned long warm_up, unsigned long overlap, unsigned threads=0);
+
 	//resets the state of the simulator
 	/* Note:
 	   - registers should be reset to UNDEFINED value
@@ -150,8 +315,8 @@ public:
 	//returns the number of clock cycles
 	unsigned get_clock_cycles();
 
-	//returns the number of stalls added by processor
-	unsigned get_stalls();
+	//returns the number of stalls added by processor (all of them, or those of the given cause)
+	unsigned get_stalls(stall_t type=ALL_STALLS);
 
 	//prints the content of the data memory within the specified address range
 	void print_memory(unsigned start_address, unsigned end_address);
@@ -162,33 +327,86 @@ public:
 	//prints the values of the registers
 	void print_registers();
 
+	//makes the pipeline "width" instructions wide (1, the default, up to MAX_ISSUE_WIDTH): IF fetches up to
+	//"width" consecutive instructions per cycle, and each latch holds a group of that many, oldest first
+	/* Note:
+	   - a fetch group ends at EOP, at a branch predicted taken (any branch without a predictor), and at an I-cache miss
+	   - ID issues the group in order, up to the first instruction with a hazard, which waits (with the rest of the
+	     group) for the next cycle: an instruction cannot use the result of an older one of its group, a group holds
+	     one load or store (one data memory port), and a branch is the last instruction of its group
+	   - get_sp_register returns the oldest instruction of each latch
+	 */
+	void init_issue_width(unsigned width);
+
+	//selects the branch predictor; with BP_NONE (the default) fetch waits for each branch to be resolved
+	//"table_bits" and "btb_bits" are log2 of the entries of each prediction table and of the BTB (up to BPRED_MAX_BITS)
+	void init_branch_predictor(bpred_policy_t policy, unsigned table_bits=10, unsigned btb_bits=6);
+
+	//returns the branch prediction counters
+	bpred_stats_t get_branch_stats();
+
+	//adds a data cache level (L1D or L2) between the MEM stage and the data memory; once the caches are enabled,
+	//data_memory_latency is only paid by the accesses that miss in the last level
+	//"size" and "line_size" are in bytes, "hit_latency" is the number of clock cycles a hit adds to MEM
+	void init_cache(cache_level_t level, unsigned size, unsigned line_size, unsigned associativity, unsigned hit_latency,
+	                cache_replacement_t replacement=CACHE_LRU, cache_write_t write_policy=WRITE_BACK, bool write_allocate=true);
+
+	//adds an instruction cache (L1I) in front of the instruction memory; a hit is fetched in the IF cycle, a miss
+	//stalls IF until the line is filled from the L2 (if enabled) or from an instruction memory of "miss_latency" clock cycles
+	//with "next_line_prefetch", a miss and the first use of a prefetched line prefetch the following line
+	void init_icache(unsigned size, unsigned line_size, unsigned associativity, unsigned miss_latency,
+	                 bool next_line_prefetch=false, cache_replacement_t replacement=CACHE_LRU);
+
+	//returns the hit/miss/eviction counters of a cache level
+	cache_stats_t get_cache_stats(cache_level_t level);
+
+	//selects where the trace goes (stdout by default); has no effect when built with SIM_TRACE_LEVEL=TRACE_OFF
+	void set_trace_sink(trace_sink_t sink, const char *filename=NULL, unsigned ring_size=TRACE_RING_SIZE);
+
+	//writes the content of the in-memory trace ring to "os"
+	void dump_trace(ostream &os);
+
+	//records the event trace (see sim_events.h) of the cycles run from now on to "filename", encoded and written in the
+	//background; with filename=NULL, writes the rest and closes the file (as does the destructor)
+	void set_event_trace(const char *filename);
+
 	unsigned generalP_Reg[NUM_GP_REGISTERS];
 	unsigned specialP_Reg[NUM_STAGES][NUM_SP_REGISTERS];
-	pipeline_Registers pipe_reg[NUM_STAGES-1];
+	pipeline_Registers pipe_reg[NUM_STAGES-1][MAX_ISSUE_WIDTH]; // latches at the beginning of the current cycle, one instruction per lane
+	pipeline_Registers pipe_next[NUM_STAGES-1][MAX_ISSUE_WIDTH]; // latches being written for the next cycle
 
-	unsigned long clkIn;
+	unsigned long clkIn; // clock cycles completed
 	bool runAlways;
 
-	unsigned long inst_count;
-	unsigned long totalInstCount;
+	unsigned long inst_count; // index of the next instruction to be fetched
+	unsigned long totalInstCount; // instructions retired
+	unsigned long fetchSeq; // fetch order of the next instruction fetched (pipe_SEQ)
 
 	/* -- Member variables to handle hazards -- */
-	unsigned stalls;
+	unsigned stalls; // stall cycles still required by the data hazard in ID (0 if none; IF waits while it is not 0)
+	sim_scoreboard scoreboard; // registers whose new value cannot reach ID/EX yet (see decode)
 	unsigned totalStalls;
-	unsigned currentClk;
+	unsigned stallCount[NUM_STALL_TYPES]; // totalStalls by cause
+	unsigned char stageStall[EVENT_STALL_STAGES]; // event_stall_t of IF to WB in the current cycle, for the event trace
+
+	unsigned branchTarget; // index of the instruction to be fetched next after a taken (or mispredicted) branch (UNDEFINED if none)
+	bool branchStall; // Indicates IF is waiting for a branch to be resolved
 
-	std::string branchToLabel;
-	bool noBranches; // Indicates whether any branching has to be done
-	bool branchStall; // Indicates is stalling for branch instruction going on
+	sim_bpred bpred; // branch predictor (BP_NONE: fetch waits for each branch instead)
+	bool mispredict; // the branch in EX was mispredicted: the instructions in IF and ID are squashed
 
 	bool memoryStall; // Indicates is stalling for memory-operative instruction going on
-	bool memStallCompleted; // Indicates memory-stage stalling is done
 	unsigned stallMem; // Counter for memory-stage stalling to serve memory latency
+	unsigned memLatency; // stall cycles of the access in MEM (data_memory_latency, or the time taken by the caches)
 
-	unsigned branchingCount;
+	unsigned fetchMiss; // index of the instruction whose I-cache miss is being served (UNDEFINED if none)
+	unsigned long fetchReady; // cycle in which its line arrives
 
+	bool draining; // run_functional is waiting for the pipeline to empty: nothing else is fetched
+	bool eopFetched; // EOP has been fetched: nothing else is fetched
+	bool eopRetired; // EOP has reached WB: the program is complete
 
-	std::map< std::string, unsigned> labelPCMap;
+	asm_labels labelNames; // label of each branch target, used only by the trace
 
 };
 
@@ -1,4 +1,5 @@
 #include "sim_pipe_fp.h"
+#include "sim_pool.h"
 #include <stdlib.h>
 #include <iostream>
 #include <fstream>
@@ -6,8 +7,9 @@
 #include <string>
 #include <iomanip>
 #include <map>
+#include <algorithm>
 
-//NOTE: structural hazards on MEM/WB stage not handled
+//NOTE: structural hazards on MEM/WB stage not handled (but by the SCOREBOARD core)
 //====================================================
 
 //#define DEBUG
@@ -21,6 +23,19 @@ static const char *stage_names[NUM_STAGES] = {"IF", "ID", "EX", "MEM", "WB"};
 static const char *instr_names[NUM_OPCODES] = {"LW", "SW", "ADD", "ADDI", "SUB", "SUBI", "XOR", "BEQZ", "BNEZ", "BLTZ", "BGTZ", "BLEZ", "BGEZ", "JUMP", "EOP", "NOP", "LWS", "SWS", "ADDS", "SUBS", "MULTS", "DIVS"};
 static const char *unit_names[4]={"INTEGER", "ADDER", "MULTIPLIER", "DIVIDER"};
 
+//assembly syntax of each opcode (operand letters are described in sim_asm.h)
+static const asm_mnemonic_t mnemonics[NUM_OPCODES] = {
+	{"LW", LW, "dm"}, {"SW", SW, "sn"},
+	{"ADD", ADD, "dst"}, {"ADDI", ADDI, "dsi"}, {"SUB", SUB, "dst"}, {"SUBI", SUBI, "dsi"}, {"XOR", XOR, "dst"},
+	{"BEQZ", BEQZ, "sl"}, {"BNEZ", BNEZ, "sl"}, {"BLTZ", BLTZ, "sl"}, {"BGTZ", BGTZ, "sl"}, {"BLEZ", BLEZ, "sl"}, {"BGEZ", BGEZ, "sl"},
+	{"JUMP", JUMP, "l"}, {"EOP", EOP, ""}, {"NOP", NOP, ""},
+	{"LWS", LWS, "Dm"}, {"SWS", SWS, "Sn"},
+	{"ADDS", ADDS, "DST"}, {"SUBS", SUBS, "DST"}, {"MULTS", MULTS, "DST"}, {"DIVS", DIVS, "DST"}};
+static const asm_isa isa(mnemonics, NUM_OPCODES, NUM_GP_REGISTERS);
+
+//instruction set tag of the program images (see sim_image.h)
+#define IMAGE_ISA "PIPE_FP"
+
 /* =============================================================
 
    HELPER FUNCTIONS
@@ -41,19 +56,6 @@ inline float unsigned2float(unsigned value){
 	return result;
 }
 
-/* convert integer into array of unsigned char - little indian */
-inline void unsigned2char(unsigned value, unsigned char *buffer){
-	buffer[0] = value & 0xFF;
-	buffer[1] = (value >> 8) & 0xFF;
-	buffer[2] = (value >> 16) & 0xFF;
-	buffer[3] = (value >> 24) & 0xFF;
-}
-
-/* convert array of char into integer - little indian */
-inline unsigned char2unsigned(unsigned char *buffer){
-	return buffer[0] + (buffer[1] << 8) + (buffer[2] << 16) + (buffer[3] << 24);
-}
-
 /* the following functions return the kind of the considered opcode */
 
 bool is_branch(opcode_t opcode){
@@ -80,6 +82,87 @@ bool is_fp_alu(opcode_t opcode){
 	return (opcode == ADDS || opcode == SUBS || opcode == MULTS || opcode == DIVS);
 }
 
+/* the following functions return the registers used by an instruction, numbered 0-31 for R0-R31
+   and 32-63 for F0-F31 (UNDEFINED if the instruction does not use them) */
+
+unsigned dest_register(const instruction_t &instr){
+	if (is_int_alu(instr.opcode) || instr.opcode == LW) return instr.dest;
+	if (is_fp_alu(instr.opcode) || instr.opcode == LWS) return instr.dest + NUM_GP_REGISTERS;
+	return UNDEFINED;
+}
+
+unsigned src1_register(const instruction_t &instr){
+	if (is_int_alu(instr.opcode) || instr.opcode == LW || instr.opcode == LWS || instr.opcode == SW) return instr.src1;
+	if (is_branch(instr.opcode) && instr.opcode != JUMP) return instr.src1;
+	if (is_fp_alu(instr.opcode) || instr.opcode == SWS) return instr.src1 + NUM_GP_REGISTERS;
+	return UNDEFINED;
+}
+
+unsigned src2_register(const instruction_t &instr){
+	if (is_int_r(instr.opcode) || instr.opcode == SW || instr.opcode == SWS) return instr.src2;
+	if (is_fp_alu(instr.opcode)) return instr.src2 + NUM_GP_REGISTERS;
+	return UNDEFINED;
+}
+
+/* execution unit type that executes an instruction */
+exe_unit_t unit_type(opcode_t opcode){
+	switch(opcode){
+	case ADDS:
+	case SUBS:
+		return ADDER;
+	case MULTS:
+		return MULTIPLIER;
+	case DIVS:
+		return DIVIDER;
+	case EOP:
+	case NOP:
+		cout << "ERROR:: operations not requiring exec unit!\n";
+		exit(-1);
+	default:
+		return INTEGER;
+	}
+}
+
+/* mask of a register numbered as above (see sim_scoreboard.h) */
+regmask_t register_mask(unsigned reg){
+	return (reg == UNDEFINED) ? 0 : REG_MASK(reg);
+}
+
+/* empties the "width" lanes of a latch (bubbles) */
+static void reset_group(pipeline_Registers *group, unsigned width){
+	for(unsigned l = 0; l < width; l++) group[l].reset();
+}
+
+/* true if one of the "width" lanes of a latch holds a branch */
+static bool branch_in_group(const pipeline_Registers *group, unsigned width){
+	for(unsigned l = 0; l < width; l++)
+		if(is_branch(group[l].pipe_IR.opcode)) return true;
+	return false;
+}
+
+/* evaluates the condition of a branch on the value of its source register */
+bool branch_taken(opcode_t opcode, unsigned a){
+	int value = (int)a;
+	switch(opcode){
+	case BEQZ:
+		return (value == 0);
+	case BNEZ:
+		return (value != 0);
+	case BLTZ:
+		return (value < 0);
+	case BGTZ:
+		return (value > 0);
+	case BLEZ:
+		return (value <= 0);
+	case BGEZ:
+		return (value >= 0);
+	case JUMP:
+		return true;
+	default:
+		return false;
+	}
+}
+
 /* implements the ALU operations */
 unsigned alu(unsigned opcode, unsigned a, unsigned b, unsigned imm, unsigned npc){
 	switch(opcode){
@@ -131,16 +214,30 @@ unsigned alu(unsigned opcode, unsigned a, unsigned b, unsigned imm, unsigned npc
 
 /* ============== primitives to allocate/free the simulator ================== */
 
-sim_pipe_fp::sim_pipe_fp(unsigned mem_size, unsigned mem_latency){
-	data_memory_size = mem_size;
+sim_pipe_fp::sim_pipe_fp(uint64_t mem_size, unsigned mem_latency, core_t core_type){
+	core = core_type;
+	data_memory.resize(mem_size);
 	data_memory_latency = mem_latency;
-	data_memory = new unsigned char[data_memory_size];
 	num_units = 0;
+	std::fill_n(pipe_free_words, NUM_UNIT_TYPES, 0);
+	program = NULL;
+	program_size = 0;
+
+	// an access goes through the enabled levels, down to the data memory
+	dcache.connect(&l2cache, data_memory_latency);
+	l2cache.connect(NULL, data_memory_latency);
+
+	station_t idle;
+	idle.reset();
+	for (unsigned t=0; t<NUM_UNIT_TYPES; t++) stations[t].assign(DEFAULT_STATIONS, idle);
+	rob.resize(DEFAULT_ROB_ENTRIES);
+	cdb_width = 1;
+	issue_width = 1;
+
 	reset();
 }
 
 sim_pipe_fp::~sim_pipe_fp(){
-	delete [] data_memory;
 }
 
 /* =============   primitives to print out the content of the memory & registers and for writing to memory ============== */ 
@@ -149,10 +246,10 @@ void sim_pipe_fp::print_memory(unsigned start_address, unsigned end_address){
 	cout << "data_memory[0x" << hex << setw(8) << setfill('0') << start_address << ":0x" << hex << setw(8) << setfill('0') <<  end_address << "]" << endl;
 	for (unsigned i=start_address; i<end_address; i++){
 		if (i%4 == 0) cout << "0x" << hex << setw(8) << setfill('0') << i << ": "; 
-		cout << hex << setw(2) << setfill('0') << int(data_memory[i]) << " ";
+		cout << hex << setw(2) << setfill('0') << int(data_memory.read_byte(i)) << " ";
 		if (i%4 == 3){
 #ifdef DEBUG_MEMORY 
-			unsigned u = char2unsigned(&data_memory[i-3]);
+			unsigned u = data_memory.read_word(i-3);
 			cout << " - unsigned=" << u << " - float=" << unsigned2float(u);
 #endif
 			cout << endl;
@@ -161,7 +258,7 @@ void sim_pipe_fp::print_memory(unsigned start_address, unsigned end_address){
 }
 
 void sim_pipe_fp::write_memory(unsigned address, unsigned value){
-	unsigned2char(value,data_memory+address);
+	data_memory.write_word(address, value);
 }
 
 
@@ -177,83 +274,318 @@ void sim_pipe_fp::print_registers(){
 	for (i=0; i< NUM_GP_REGISTERS; i++)
 		if (get_int_register(i)!=(int)UNDEFINED) cout << "R" << dec << i << " = " << get_int_register(i) << hex << " / 0x" << get_int_register(i) << endl;
 	for (i=0; i< NUM_GP_REGISTERS; i++)
-		if (get_fp_register(i)!=UNDEFINED) cout << "F" << dec << i << " = " << get_fp_register(i) << hex << " / 0x" << float2unsigned(get_fp_register(i)) << endl;
+		if (generalP_FPReg[i]!=UNDEFINED) cout << "F" << dec << i << " = " << get_fp_register(i) << hex << " / 0x" << float2unsigned(get_fp_register(i)) << endl;
+}
+
+
+/* selects the destination of the trace */
+void sim_pipe_fp::set_trace_sink(trace_sink_t sink, const char *filename, unsigned ring_size){
+	trace.set_sink(sink, filename, ring_size);
+}
+
+/* writes the content of the in-memory trace ring */
+void sim_pipe_fp::dump_trace(ostream &os){
+	trace.dump(os);
+}
+
+/* starts or stops the event trace; the slots are the lanes of the latches, then the execution units (named after
+   their type) or the reorder buffer entries */
+void sim_pipe_fp::set_event_trace(const char *filename){
+	if(!filename)
+	{
+		events.close();
+		return;
+	}
+	static const char *latch_names[NUM_STAGES-1] = {"IF/ID", "ID/EX", "EX/MEM", "MEM/WB"};
+	vector<string> slots;
+	for(int k = FIRST; k <= FORTH; k++)
+		for(unsigned l = 0; l < MAX_ISSUE_WIDTH; l++)
+			slots.push_back(string(latch_names[k]) + "." + to_string(l));
+	if(core == TOMASULO)
+	{
+		for(unsigned e = 0; e < rob.size(); e++) slots.push_back("ROB." + to_string(e));
+	}
+	else
+	{
+		unsigned count[NUM_UNIT_TYPES] = {0};
+		for(unsigned u = 0; u < num_units; u++)
+			slots.push_back(string(unit_names[exec_units[u].type]) + "." + to_string(count[exec_units[u].type]++));
+	}
+	events.open(filename, IMAGE_ISA, instr_names, NUM_OPCODES, slots);
+}
+
+/* selects the branch predictor */
+void sim_pipe_fp::init_branch_predictor(bpred_policy_t policy, unsigned table_bits, unsigned btb_bits){
+	if(table_bits > BPRED_MAX_BITS || btb_bits > BPRED_MAX_BITS)
+	{
+		cerr << "error: the prediction tables and the BTB have at most 2^" << BPRED_MAX_BITS << " entries" << endl;
+		exit(-1);
+	}
+	bpred = sim_bpred(policy, table_bits, btb_bits);
+}
+
+/* returns the branch prediction counters */
+bpred_stats_t sim_pipe_fp::get_branch_stats(){
+	return bpred.get_stats();
+}
+
+/* adds a data cache level */
+void sim_pipe_fp::init_cache(cache_level_t level, unsigned size, unsigned line_size, unsigned associativity, unsigned hit_latency,
+                             cache_replacement_t replacement, cache_write_t write_policy, bool write_allocate){
+	if(level == L1I)
+	{
+		cerr << "error: the instruction cache is configured with init_icache" << endl;
+		exit(-1);
+	}
+	sim_cache &cache = (level == L1D) ? dcache : l2cache;
+	cache.configure(size, line_size, associativity, hit_latency, replacement, write_policy, write_allocate);
+}
+
+/* adds the instruction cache */
+void sim_pipe_fp::init_icache(unsigned size, unsigned line_size, unsigned associativity, unsigned miss_latency,
+                              bool next_line_prefetch, cache_replacement_t replacement){
+	icache.configure(size, line_size, associativity, 0, replacement);
+	icache.set_next_line_prefetch(next_line_prefetch);
+	icache.connect(&l2cache, miss_latency);
 }
 
+/* returns the counters of a cache level */
+cache_stats_t sim_pipe_fp::get_cache_stats(cache_level_t level){
+	if(level == L1I) return icache.get_stats();
+	return (level == L1D) ? dcache.get_stats() : l2cache.get_stats();
+}
 
 /* =============   primitives related to the functional units ============== */ 
 
-/* initializes an execution unit */ 
-void sim_pipe_fp::init_exec_unit(exe_unit_t exec_unit, unsigned latency, unsigned instances){
+/* initializes an execution unit; a pipelined one takes one unit_t per instruction it can have in flight */ 
+void sim_pipe_fp::init_exec_unit(exe_unit_t exec_unit, unsigned latency, unsigned instances, unsigned initiation_interval){
+	unsigned interval = initiation_interval ? initiation_interval : latency;
+	unsigned depth = (interval && latency > interval) ? (latency + interval - 1) / interval : 1;
+	if (instances == 0){
+		cerr << "error: no " << unit_names[exec_unit] << " unit to add (instances is 0)" << endl;
+		exit(-1);
+	}
+	if (pipe_order[exec_unit].size() + instances > MAX_PIPELINES){
+		cerr << "error: more than " << MAX_PIPELINES << " " << unit_names[exec_unit] << " units" << endl;
+		exit(-1);
+	}
 	for (unsigned i=0; i<instances; i++){
-		exec_units[num_units].type = exec_unit;
-		exec_units[num_units].latency = latency;
-		exec_units[num_units].busy = 0;
-		exec_units[num_units].instruction.opcode = NOP;
-		num_units++;
+		pipeline_t pipe;
+		pipe.type = exec_unit;
+		pipe.interval = interval;
+		pipe.accept = 0;
+		pipe.index = pipe_order[exec_unit].size();
+		pipe_order[exec_unit].push_back(pipes.size());
+		if (pipe.index % 64 == 0) pipe_free[exec_unit].push_back(0);
+
+		for (unsigned d=0; d<depth; d++){
+			unit_t unit;
+			unit.type = exec_unit;
+			unit.latency = latency;
+			unit.done = 0;
+			unit.pipe = pipes.size();
+			unit.instruction.reset();
+			unit.operands.reset();
+			unit.issued = 0;
+			unit.rob = UNDEFINED;
+			unit.older = unit.younger = UNDEFINED;
+			unit.phase = SB_OPERANDS;
+			unit.fi = unit.fj = unit.fk = UNDEFINED;
+			unit.qj = unit.qk = UNDEFINED;
+			unit.rj = unit.rk = false;
+			exec_units.push_back(unit);
+			// the idle units are taken from the back, lowest first
+			pipe.idle.insert(pipe.idle.begin(), num_units++);
+		}
+		pipes.push_back(pipe);
+		update_free_map(pipes.size() - 1);
+	}
+}
+
+/* sets the number of reservation stations of a unit type (TOMASULO core) */
+void sim_pipe_fp::init_reservation_stations(exe_unit_t exec_unit, unsigned entries){
+	if (entries == 0){
+		cerr << "error: the " << unit_names[exec_unit] << " units need at least one reservation station" << endl;
+		exit(-1);
+	}
+	station_t idle;
+	idle.reset();
+	stations[exec_unit].assign(entries, idle);
+}
+
+/* sets the size of the reorder buffer and the width of the common data bus (TOMASULO core) */
+void sim_pipe_fp::init_reorder_buffer(unsigned entries, unsigned width){
+	if (entries == 0 || width == 0){
+		cerr << "error: the reorder buffer and the common data bus cannot be empty" << endl;
+		exit(-1);
+	}
+	rob.assign(entries, rob_entry_t());
+	rob_head = 0;
+	rob_count = 0;
+	cdb_width = width;
+}
+
+/* sets the number of instructions per latch */
+void sim_pipe_fp::init_issue_width(unsigned width){
+	if (width == 0 || width > MAX_ISSUE_WIDTH){
+		cerr << "error: the issue width must be between 1 and " << MAX_ISSUE_WIDTH << endl;
+		exit(-1);
 	}
+	issue_width = width;
 }
 
-/* returns a free unit for that particular operation or UNDEFINED if no unit is currently available */
+/* returns a free unit for that particular operation or UNDEFINED if no unit is currently available
+   (a unit whose instruction has completed but not yet moved to MEM is not free, and the units of a
+   pipeline are not free until its initiation interval has elapsed) */
 unsigned sim_pipe_fp::get_free_unit(opcode_t opcode){
 	if (num_units == 0){
 		cout << "ERROR:: simulator does not have any execution units!\n";
 		exit(-1);
 	}
-	for (unsigned u=0; u<num_units; u++){
-		switch(opcode){
-		//Integer unit
-		case LW:
-		case SW:
-		case ADD:
-		case ADDI:
-		case SUB:
-		case SUBI:
-		case XOR:
-		case BEQZ:
-		case BNEZ:
-		case BLTZ:
-		case BGTZ:
-		case BLEZ:
-		case BGEZ:
-		case JUMP:
-		case LWS:
-		case SWS:
-			if (exec_units[u].type==INTEGER && exec_units[u].busy==0) return u;
-			break;
-			// FP adder
-		case ADDS:
-		case SUBS:
-			if (exec_units[u].type==ADDER && exec_units[u].busy==0) return u;
-			break;
-			// Multiplier
-		case MULTS:
-			if (exec_units[u].type==MULTIPLIER && exec_units[u].busy==0) return u;
-			break;
-			// Divider
-		case DIVS:
-			if (exec_units[u].type==DIVIDER && exec_units[u].busy==0) return u;
-			break;
-		default:
-			cout << "ERROR:: operations not requiring exec unit!\n";
-			exit(-1);
+	return free_unit(unit_type(opcode));
+}
+
+/* the lowest pipeline of the type in the free map (the same unit a scan of exec_units would find first):
+   the first non-zero word from the summary, then its first bit; the pipelines whose initiation interval
+   has elapsed since the last call are put back in the map first */
+unsigned sim_pipe_fp::free_unit(exe_unit_t type){
+	while (!pipe_reopen.empty() && pipe_reopen.top().first <= fp_clkIn){
+		unsigned p = pipe_reopen.top().second;
+		pipe_reopen.pop();
+		update_free_map(p);
+	}
+	if (pipe_free_words[type] == 0) return UNDEFINED;
+	unsigned w = __builtin_ctzll(pipe_free_words[type]);
+	unsigned p = pipe_order[type][w * 64 + __builtin_ctzll(pipe_free[type][w])];
+	return pipes[p].idle.back();
+}
+
+void sim_pipe_fp::update_free_map(unsigned p){
+	const pipeline_t &pipe = pipes[p];
+	uint64_t &word = pipe_free[pipe.type][pipe.index / 64];
+	uint64_t bit = (uint64_t)1 << (pipe.index % 64);
+	if (!pipe.idle.empty() && fp_clkIn >= pipe.accept) word |= bit;
+	else word &= ~bit;
+	uint64_t summary = (uint64_t)1 << (pipe.index / 64);
+	if (word) pipe_free_words[pipe.type] |= summary;
+	else pipe_free_words[pipe.type] &= ~summary;
+}
+
+void sim_pipe_fp::claim_unit(unsigned u, const pipeline_Registers &operands, unsigned long issued){
+	unit_t &unit = exec_units[u];
+	vector<unsigned> &idle = pipes[unit.pipe].idle;
+	vector<unsigned>::iterator it = std::find(idle.begin(), idle.end(), u);
+	*it = idle.back();
+	idle.pop_back();
+	update_free_map(unit.pipe);
+
+	unit.instruction = operands.pipe_IR;
+	unit.operands = operands;
+	unit.issued = issued;
+	units_busy++;
+	if (is_branch(unit.instruction.opcode)){
+		unit_ref_t ref = {issued, issued, u};
+		branch_units.push(ref);
+	}
+	// IN_ORDER and SCOREBOARD: the instructions take their units in issue order, so the unit is the youngest
+	if (core != TOMASULO){
+		unit.older = youngest_unit;
+		unit.younger = UNDEFINED;
+		if (youngest_unit != UNDEFINED) exec_units[youngest_unit].younger = u;
+		youngest_unit = u;
+	}
+}
+
+void sim_pipe_fp::release_unit(unsigned u){
+	unit_t &unit = exec_units[u];
+	if (core == TOMASULO){
+		if (rob[unit.rob].unit == u) rob[unit.rob].unit = UNDEFINED;
+	}
+	else {
+		if (unit.younger != UNDEFINED) exec_units[unit.younger].older = unit.older;
+		else youngest_unit = unit.older;
+		if (unit.older != UNDEFINED) exec_units[unit.older].younger = unit.younger;
+		unit.older = unit.younger = UNDEFINED;
+	}
+	unit.waiters.clear();
+	unit.instruction.reset();
+	unit.operands.reset();
+	pipes[unit.pipe].idle.push_back(u);
+	update_free_map(unit.pipe);
+	units_busy--;
+}
+
+bool sim_pipe_fp::unit_holds(const unit_ref_t &ref) const{
+	const unit_t &unit = exec_units[ref.unit];
+	return unit.instruction.opcode != NOP && unit.issued == ref.issued;
+}
+
+/* the units are taken from the front of units_executing; those released before completing are skipped */
+void sim_pipe_fp::collect_completed(){
+	by_age.clear();
+	while (!units_executing.empty() && units_executing.top().key <= fp_clkIn){
+		unit_ref_t ref = units_executing.top();
+		units_executing.pop();
+		if (unit_holds(ref)) by_age.push_back(ref.unit);
+	}
+	std::sort(by_age.begin(), by_age.end(), [this](unsigned a, unsigned b) { return exec_units[a].issued < exec_units[b].issued; });
+}
+
+/* the instruction in unit "u" starts executing in this clock cycle and completes in cycle "done";
+   its pipeline accepts the next instruction after the initiation interval */
+void sim_pipe_fp::start_unit(unsigned u, unsigned long done){
+	pipeline_t &pipe = pipes[exec_units[u].pipe];
+	exec_units[u].done = done;
+	pipe.accept = fp_clkIn + pipe.interval;
+	if (pipe.accept > fp_clkIn) pipe_reopen.push(make_pair(pipe.accept, exec_units[u].pipe));
+	update_free_map(exec_units[u].pipe);
+	unit_ref_t ref = {done, exec_units[u].issued, u};
+	units_executing.push(ref);
+}
+
+/* the squashed units are found from the young end: TOMASULO, of the reorder buffer; the other cores, of the list of
+   busy units by age */
+void sim_pipe_fp::squash_units(unsigned long issued){
+	if (core == TOMASULO){
+		for (unsigned k=rob_count; k-- > 0; ){
+			const rob_entry_t &entry = rob[(rob_head + k) % rob.size()];
+			if (entry.seq <= issued) break;
+			if (entry.unit != UNDEFINED) squash_unit(entry.unit);
 		}
+		return;
 	}
-	return UNDEFINED;
+	while (youngest_unit != UNDEFINED && exec_units[youngest_unit].issued > issued) squash_unit(youngest_unit);
 }
 
-/* decrease the amount of clock cycles during which the functional unit will be busy - to be called at each clock cycle  */
-void sim_pipe_fp::decrement_units_busy_time(){
-	for (unsigned u=0; u<num_units; u++){
-		if (exec_units[u].busy > 0) exec_units[u].busy --;
+void sim_pipe_fp::squash_unit(unsigned u){
+	unit_t &unit = exec_units[u];
+	pipeline_t &pipe = pipes[unit.pipe];
+	SIM_TRACE_STAGE(trace, "\n squashing instruct: "<<(instr_names[unit.instruction.opcode])<<" on unit "<<unit_names[unit.type]);
+	regmask_t dest = register_mask(dest_register(unit.instruction));
+	pending_writes.release(dest);
+	unit_writes.release(dest);
+	unit.done = 0;
+	// the squashed instructions are the last ones to have entered the pipeline: it is flushed
+	pipe.accept = 0;
+	if (core == SCOREBOARD){
+		if (unit.fi != UNDEFINED) register_status[unit.fi] = UNDEFINED;
+		if (unit.rj) register_readers[unit.fj]--;
+		if (unit.rk) register_readers[unit.fk]--;
+		unit.fi = unit.fj = unit.fk = UNDEFINED;
+		unit.qj = unit.qk = UNDEFINED;
+		unit.rj = unit.rk = false;
+		if (mem_user == u) mem_user = UNDEFINED;
+		// the units blocked on the pipeline can read their operands in this cycle
+		if (!pipe.blocked.empty()) pipes_blocked.push(make_pair(fp_clkIn, unit.pipe));
 	}
+	release_unit(u);
 }
 
 
 /* prints out the status of the functional units */
 void sim_pipe_fp::debug_units(){
 	for (unsigned u=0; u<num_units; u++){
-		cout << " -- unit " << unit_names[exec_units[u].type] << " latency=" << exec_units[u].latency << " busy=" << exec_units[u].busy <<
+		cout << " -- unit " << unit_names[exec_units[u].type] << " latency=" << exec_units[u].latency << " done=" << exec_units[u].done <<
 				" instruction=" << instr_names[exec_units[u].instruction.opcode] << endl;
 	}
 }
@@ -271,122 +603,164 @@ void sim_pipe_fp::load_program(const char *filename, unsigned base_address){
 	/* Point Program Counter to start address of program*/
 	specialP_Reg[IF][PC] = instr_base_address;
 
-	/* creating a map with the valid opcodes and with the valid labels */
-	map<string, opcode_t> opcodes; //for opcodes
-	map<string, unsigned> labels;  //for branches
-	for (int i=0; i<NUM_OPCODES; i++)
-		opcodes[string(instr_names[i])]=(opcode_t)i;
+	/* assembling the file into the instruction memory (branch targets resolved, labels kept for the trace) */
+	sim_asm assembler(isa, filename);
+	assembler.assemble(instr_memory, fp_labelNames);
 
-	/* opening the assembly file */
-	ifstream fin(filename, ios::in | ios::binary);
-	if (!fin.is_open()) {
-		cerr << "error: open file " << filename << " failed!" << endl;
-		exit(-1);
+	image.unload();
+	program = instr_memory.empty() ? NULL : &instr_memory[0];
+	program_size = instr_memory.size();
+	flush_blocks();
+}
+
+/* exits unless every record of a program image is an instruction the assembler could have written: the records are executed as they are */
+static void check_program(const char *filename, const instruction_t *program, unsigned count){
+	for(unsigned i = 0; i < count; i++)
+	{
+		const instruction_t &ir = program[i];
+		const char *problem = NULL;
+		if((unsigned)ir.opcode >= NUM_OPCODES) problem = "an invalid opcode";
+		else if(ir.src1 >= NUM_GP_REGISTERS || ir.src2 >= NUM_GP_REGISTERS || ir.dest >= NUM_GP_REGISTERS) problem = "an invalid register";
+		// (a branch may target the end of the program, where a label can be: fetching there stops with an error)
+		else if(is_branch(ir.opcode) && ir.target > count) problem = "a branch target outside the program";
+		if(problem)
+		{
+			cerr << "error: " << filename << " is corrupted: instruction " << i << " has " << problem << endl;
+			exit(-1);
+		}
 	}
+}
 
-	/* parsing the assembly file line by line */
-	string line;
-	unsigned instruction_nr = 0;
-	while (getline(fin,line)){
-
-		// set the instruction field
-		char *str = const_cast<char*>(line.c_str());
-
-		// tokenize the instruction
-		char *token = strtok (str," \t");
-		map<string, opcode_t>::iterator search = opcodes.find(token);
-		if (search == opcodes.end()){
-			// this is a label for a branch - extract it and save it in the labels map
-			string label = string(token).substr(0, string(token).length() - 1);
-			labels[label]=instruction_nr;
-			// move to next token, which must be the instruction opcode
-			token = strtok (NULL, " \t");
-			search = opcodes.find(token);
-			if (search == opcodes.end()) cout << "ERROR: invalid opcode: " << token << " !" << endl;
-		}
-		instr_memory[instruction_nr].opcode = search->second;
-
-		//reading remaining parameters
-		char *par1;
-		char *par2;
-		char *par3;
-		switch(instr_memory[instruction_nr].opcode){
-		case ADD:
-		case SUB:
-		case XOR:
-		case ADDS:
-		case SUBS:
-		case MULTS:
-		case DIVS:
-			par1 = strtok (NULL, " \t");
-			par2 = strtok (NULL, " \t");
-			par3 = strtok (NULL, " \t");
-			instr_memory[instruction_nr].dest = atoi(strtok(par1, "RF"));
-			instr_memory[instruction_nr].src1 = atoi(strtok(par2, "RF"));
-			instr_memory[instruction_nr].src2 = atoi(strtok(par3, "RF"));
-			break;
-		case ADDI:
-		case SUBI:
-			par1 = strtok (NULL, " \t");
-			par2 = strtok (NULL, " \t");
-			par3 = strtok (NULL, " \t");
-			instr_memory[instruction_nr].dest = atoi(strtok(par1, "R"));
-			instr_memory[instruction_nr].src1 = atoi(strtok(par2, "R"));
-			instr_memory[instruction_nr].immediate = strtoul (par3, NULL, 0); 
-			break;
-		case LW:
-		case LWS:
-			par1 = strtok (NULL, " \t");
-			par2 = strtok (NULL, " \t");
-			instr_memory[instruction_nr].dest = atoi(strtok(par1, "RF"));
-			instr_memory[instruction_nr].immediate = strtoul(strtok(par2, "()"), NULL, 0);
-			instr_memory[instruction_nr].src1 = atoi(strtok(NULL, "R"));
-			break;
-		case SW:
-		case SWS:
-			par1 = strtok (NULL, " \t");
-			par2 = strtok (NULL, " \t");
-			instr_memory[instruction_nr].src1 = atoi(strtok(par1, "RF"));
-			instr_memory[instruction_nr].immediate = strtoul(strtok(par2, "()"), NULL, 0);
-			instr_memory[instruction_nr].src2 = atoi(strtok(NULL, "R"));
-			break;
-		case BEQZ:
-		case BNEZ:
-		case BLTZ:
-		case BGTZ:
-		case BLEZ:
-		case BGEZ:
-			par1 = strtok (NULL, " \t");
-			par2 = strtok (NULL, " \t");
-			instr_memory[instruction_nr].src1 = atoi(strtok(par1, "R"));
-			instr_memory[instruction_nr].label = par2;
-			break;
-		case JUMP:
-			par2 = strtok (NULL, " \t");
-			instr_memory[instruction_nr].label = par2;
-		default:
-			break;
+/* loads the program image in file "filename" in instruction memory at the specified address */
+void sim_pipe_fp::load_binary(const char *filename, unsigned base_address){
 
-		}
+	instr_base_address = base_address;
+	specialP_Reg[IF][PC] = instr_base_address;
+
+	instr_memory.clear();
+	image.load(filename, IMAGE_ISA, sizeof(instruction_t));
+	image.labels(fp_labelNames);
+
+	program = (const instruction_t *)image.records();
+	program_size = image.count();
+	check_program(filename, program, program_size);
+	flush_blocks();
+}
+
+/* writes the loaded program as a binary image */
+void sim_pipe_fp::save_binary(const char *filename){
+	sim_image::save(filename, IMAGE_ISA, program, sizeof(instruction_t), program_size, fp_labelNames);
+}
+
+/* executes the program of another simulator in place */
+void sim_pipe_fp::share_program(const sim_pipe_fp &source){
+
+	instr_base_address = source.instr_base_address;
+	specialP_Reg[IF][PC] = instr_base_address;
 
-		/* increment instruction number before moving to next line */
-		instruction_nr++;
+	instr_memory.clear();
+	image.unload();
+	fp_labelNames.view(source.fp_labelNames.index_table(), source.fp_labelNames.offset_table(), source.fp_labelNames.name_table(), source.fp_labelNames.size());
+
+	program = source.program;
+	program_size = source.program_size;
+	flush_blocks();
+}
+
+/* copies the state of the simulator, sharing the data memory pages copy-on-write */
+sim_pipe_fp *sim_pipe_fp::snapshot(){
+	sim_pipe_fp *copy = new sim_pipe_fp(0, data_memory_latency, core);
+	copy->restore(*this);
+	return copy;
+}
+
+/* copies back the state saved by snapshot() */
+void sim_pipe_fp::restore(const sim_pipe_fp &snapshot){
+	if(&snapshot == this) return;
+	if(program != snapshot.program) share_program(snapshot);
+	instr_base_address = snapshot.instr_base_address;
+
+	data_memory.share(snapshot.data_memory);
+	data_memory_latency = snapshot.data_memory_latency;
+
+	// the levels are copied as a whole, then connected to each other instead of to the levels of the snapshot
+	dcache = snapshot.dcache;
+	l2cache = snapshot.l2cache;
+	icache = snapshot.icache;
+	dcache.relink(&snapshot.l2cache, &l2cache);
+	icache.relink(&snapshot.l2cache, &l2cache);
+
+	exec_units = snapshot.exec_units;
+	num_units = snapshot.num_units;
+	pipes = snapshot.pipes;
+	for (unsigned t=0; t<NUM_UNIT_TYPES; t++){
+		pipe_order[t] = snapshot.pipe_order[t];
+		pipe_free[t] = snapshot.pipe_free[t];
+		pipe_free_words[t] = snapshot.pipe_free_words[t];
+		stations[t] = snapshot.stations[t];
 	}
-	//reconstructing the labels of the branch operations
-	int i = 0;
-	while(true){
-		instruction_t instr = instr_memory[i];
-		if (instr.opcode == EOP) break;
-		if (instr.opcode == BLTZ || instr.opcode == BNEZ ||
-				instr.opcode == BGTZ || instr.opcode == BEQZ ||
-				instr.opcode == BGEZ || instr.opcode == BLEZ ||
-				instr.opcode == JUMP
-		){
-			instr_memory[i].immediate = (labels[instr.label] - i - 1) << 2;
-		}
-		i++;
+	pipe_reopen = snapshot.pipe_reopen;
+	units_executing = snapshot.units_executing;
+	units_completed = snapshot.units_completed;
+	branch_units = snapshot.branch_units;
+	units_busy = snapshot.units_busy;
+	youngest_unit = snapshot.youngest_unit;
+
+	bpred = snapshot.bpred;
+	core = snapshot.core;
+	issue_width = snapshot.issue_width;
+	issue_seq = snapshot.issue_seq;
+
+	rob = snapshot.rob;
+	rob_head = snapshot.rob_head;
+	rob_count = snapshot.rob_count;
+	cdb_width = snapshot.cdb_width;
+	std::copy(snapshot.rename_table, snapshot.rename_table + 2*NUM_GP_REGISTERS, rename_table);
+	mem_user = snapshot.mem_user;
+	mem_ready = snapshot.mem_ready;
+	std::copy(snapshot.register_status, snapshot.register_status + 2*NUM_GP_REGISTERS, register_status);
+	std::copy(snapshot.register_readers, snapshot.register_readers + 2*NUM_GP_REGISTERS, register_readers);
+	units_ready = snapshot.units_ready;
+	units_memory = snapshot.units_memory;
+	units_writing = snapshot.units_writing;
+	pipes_blocked = snapshot.pipes_blocked;
+
+	pending_writes = snapshot.pending_writes;
+	unit_writes = snapshot.unit_writes;
+
+	for(int k = FIRST; k <= FORTH; k++){
+		std::copy(snapshot.fp_pipe_reg[k], snapshot.fp_pipe_reg[k] + MAX_ISSUE_WIDTH, fp_pipe_reg[k]);
+		std::copy(snapshot.fp_pipe_next[k], snapshot.fp_pipe_next[k] + MAX_ISSUE_WIDTH, fp_pipe_next[k]);
 	}
 
+	fp_clkIn = snapshot.fp_clkIn;
+	fp_runAlways = snapshot.fp_runAlways;
+	fp_inst_count = snapshot.fp_inst_count;
+	fp_totalInstCount = snapshot.fp_totalInstCount;
+	fp_fetchSeq = snapshot.fp_fetchSeq;
+
+	fp_stalls = snapshot.fp_stalls;
+	fp_totalStalls = snapshot.fp_totalStalls;
+	std::copy(snapshot.fp_stallCount, snapshot.fp_stallCount + NUM_STALL_TYPES, fp_stallCount);
+
+	fp_branchTarget = snapshot.fp_branchTarget;
+	fp_branchStall = snapshot.fp_branchStall;
+	fp_mispredict = snapshot.fp_mispredict;
+
+	fp_memoryStall = snapshot.fp_memoryStall;
+	fp_stallMem = snapshot.fp_stallMem;
+	fp_memLatency = snapshot.fp_memLatency;
+
+	fp_fetchMiss = snapshot.fp_fetchMiss;
+	fp_fetchReady = snapshot.fp_fetchReady;
+
+	fp_draining = snapshot.fp_draining;
+	fp_eopFetched = snapshot.fp_eopFetched;
+	fp_eopRetired = snapshot.fp_eopRetired;
+
+	std::copy(snapshot.generalP_IntReg, snapshot.generalP_IntReg + NUM_GP_REGISTERS, generalP_IntReg);
+	std::copy(snapshot.generalP_FPReg, snapshot.generalP_FPReg + NUM_GP_REGISTERS, generalP_FPReg);
+	for(int s = 0; s < NUM_STAGES; s++) std::copy(snapshot.specialP_Reg[s], snapshot.specialP_Reg[s] + NUM_SP_REGISTERS, specialP_Reg[s]);
 }
 
 /* =============================================================
@@ -398,97 +772,684 @@ void sim_pipe_fp::load_program(const char *filename, unsigned base_address){
 /* simulator */
 void sim_pipe_fp::run(unsigned cycles){
 
-	if(cycles == 0) fp_runAlways = 1;
+	fp_runAlways = (cycles == 0);
+	unsigned long stopClk = fp_clkIn + cycles;
 
-	cout<<"\n## START of run, fp_clkIn: "<<fp_clkIn<<" cycles: "<<cycles;
+	SIM_TRACE_CYCLE(trace, "\n## START of run, fp_clkIn: "<<fp_clkIn<<" cycles: "<<cycles);
 
-	run:
-	do
+	// one iteration per clock cycle: the stages are evaluated from WB back to IF; each stage reads
+	// the latches as they were at the beginning of the cycle (fp_pipe_reg) and writes the latch it feeds
+	// for the next cycle (fp_pipe_next). A stage that does not write its latch leaves it unchanged (stall).
+	// The TOMASULO and SCOREBOARD cores replace ID, EX, MEM and WB by their own stages, in the same order.
+	while(!fp_eopRetired && (fp_runAlways || fp_clkIn < stopClk))
 	{
+		if(events.enabled()) trace_cycle();
 
-		switch(fp_clkIn)
-		{
+		for(int k = FIRST; k <= FORTH; k++) std::copy(fp_pipe_reg[k], fp_pipe_reg[k] + issue_width, fp_pipe_next[k]);
 
-		case (IF+1):
-					fp_fetch();
-		break;
+		if(core == TOMASULO)
+		{
+			ooo_commit();
+			ooo_complete();
+			ooo_memory();
+			ooo_execute();
+			ooo_issue();
+		}
+		else
+		if(core == SCOREBOARD)
+		{
+			sb_writeResult();
+			sb_execute();
+			sb_issue();
+		}
+		else
+		{
+			fp_writeBack();
+			fp_memory();
+			fp_execute();
+			fp_decode();
+		}
+		fp_fetch();
 
-		case (ID+1):
-					fp_decode();
-		break;
+		if(events.enabled()) events.end_cycle(fp_stageStall);
 
-		case (EXE+1):
-					fp_execute();
-		break;
+		for(int k = FIRST; k <= FORTH; k++) std::copy(fp_pipe_next[k], fp_pipe_next[k] + issue_width, fp_pipe_reg[k]);
+		++fp_clkIn;
+		update_sp_registers();
 
-		case (MEM+1):
-					fp_memory();
-		break;
+		SIM_TRACE_CYCLE(trace, "\n--- cycle done---fp_clkIn: "<<fp_clkIn<<" instructions: "<<fp_totalInstCount<<" stalls: "<<fp_totalStalls<<"\n");
+	}
 
-		case (WB+1):
-					fp_writeBack();
-		break;
+	if(fp_eopRetired)
+		SIM_TRACE_CYCLE(trace, "\n---EOP Detected---fp_clkIn: "<<fp_clkIn<<"\n");
+}
 
-		default:
-			if(fp_clkIn > (WB+1)) fp_writeBack();
+/* records the instructions in flight at the beginning of the cycle in the event trace: those in the latches (but
+   for the copies in ID/EX of the instructions issued to the units), then those in the execution units, or those in
+   the reorder buffer; the stall reasons and the instructions retired are added by the stages */
+void sim_pipe_fp::trace_cycle(){
+	events.begin_cycle(fp_clkIn);
+	std::fill_n(fp_stageStall, EVENT_STALL_STAGES, EVENT_NO_STALL);
+	for(int k = FIRST; k <= FORTH; k++)
+		for(unsigned l = 0; l < issue_width; l++)
+		{
+			opcode_t opcode = fp_pipe_reg[k][l].pipe_IR.opcode;
+			if(opcode != NOP && (k != SECOND || opcode == EOP)) trace_latch(k*MAX_ISSUE_WIDTH + l, (event_stage_t)(k + 1), fp_pipe_reg[k][l]);
 		}
 
-	}while(fp_runAlways);//end of while
-
-	if(fp_runAlways){ goto run;}
+	unsigned slot = (NUM_STAGES-1)*MAX_ISSUE_WIDTH;
+	if(core != TOMASULO)
+	{
+		static const event_stage_t sb_stages[] = {EVENT_IS, EVENT_EX, EVENT_MEM, EVENT_WB};
+		for (unsigned u=0; u<num_units; u++)
+			if (exec_units[u].instruction.opcode != NOP)
+				trace_latch(slot + u, core == SCOREBOARD ? sb_stages[exec_units[u].phase] : EVENT_EX, exec_units[u].operands);
+		return;
+	}
 
-	return;
+	// an entry is in a reservation station (IS), in a unit (EX), accessing the memory (MEM) or waiting to commit (CMT)
+	for (unsigned e=0; e<rob.size(); e++){
+		if ((e + rob.size() - rob_head) % rob.size() >= rob_count) continue;
+		const rob_entry_t &entry = rob[e];
+		if (entry.unit != UNDEFINED){
+			trace_latch(slot + e, EVENT_EX, exec_units[entry.unit].operands);
+			continue;
+		}
+		event_record_t &r = trace_latch(slot + e, entry.state == ROB_WAITING ? EVENT_IS : entry.state == ROB_MEMORY ? EVENT_MEM : EVENT_CMT, entry.operands);
+		opcode_t opcode = entry.operands.pipe_IR.opcode;
+		if (is_memory(opcode)) r.field[EVENT_ALU_OUTPUT] = entry.address;
+		if (opcode == LW || opcode == LWS) r.field[EVENT_LMD] = entry.value;
+		else if (opcode == SW || opcode == SWS) r.field[EVENT_B] = entry.value;
+		else r.field[EVENT_ALU_OUTPUT] = entry.value;
+	}
+}
 
+/* records an instruction with the contents of its latch */
+event_record_t &sim_pipe_fp::trace_latch(unsigned slot, event_stage_t stage, const pipeline_Registers &latch){
+	event_record_t &r = events.add(slot, stage, latch.pipe_SEQ);
+	r.field[EVENT_PC] = latch.pipe_PC;
+	r.field[EVENT_NPC] = latch.pipe_NPC;
+	r.field[EVENT_OPCODE] = latch.pipe_IR.opcode;
+	r.field[EVENT_SRC1] = latch.pipe_IR.src1;
+	r.field[EVENT_SRC2] = latch.pipe_IR.src2;
+	r.field[EVENT_DEST] = latch.pipe_IR.dest;
+	r.field[EVENT_IMMEDIATE] = latch.pipe_IR.immediate;
+	r.field[EVENT_TARGET] = latch.pipe_IR.target;
+	r.field[EVENT_A] = latch.pipe_A;
+	r.field[EVENT_B] = latch.pipe_B;
+	r.field[EVENT_IMM] = latch.pipe_IMM;
+	r.field[EVENT_COND] = latch.pipe_COND;
+	r.field[EVENT_ALU_OUTPUT] = latch.pipe_ALU_OUTPUT;
+	r.field[EVENT_LMD] = latch.pipe_LMD;
+	r.field[EVENT_PRED_PC] = latch.pipe_PRED_PC;
+	return r;
 }
 
-//reset the state of the sim_pipe_fpulator
-void sim_pipe_fp::reset(){
-	// init data memory
-	for (unsigned i=0; i<data_memory_size; i++) data_memory[i]=0xFF;
+/* =============================================================
 
-	// init instruction memory
-	for (int i=0; i<PROGRAM_SIZE;i++){
-		instr_memory[i].opcode=(opcode_t)NOP;
-		instr_memory[i].src1=UNDEFINED;
-		instr_memory[i].src2=UNDEFINED;
-		instr_memory[i].dest=UNDEFINED;
-		instr_memory[i].immediate=UNDEFINED;
-	}
+   FUNCTIONAL MODE
 
-	// Initialize member variables
-	std::fill_n(data_memory, data_memory_size, 0xFF);
+   run_functional interprets the program directly: one switch per
+   instruction on the decoded records, with the registers in locals
+   (numbered as in dest_register), and the ALU, branch conditions and
+   data memory of the cycle model.
+   With "warm" set (functional warming) it also drives the caches and
+   trains the branch predictor, as fetch, MEM and EX would.
 
-	std::fill_n(generalP_IntReg, NUM_SP_INT_REGISTERS, UNDEFINED);
-	std::fill_n(generalP_FPReg, NUM_GP_REGISTERS, UNDEFINED);
+   ============================================================= */
 
-	for(int k = IF; k <= WB ; k++)
-		std::fill_n(specialP_Reg[k], NUM_SP_REGISTERS, UNDEFINED);
+/* true if no instruction is in flight and IF is not being redirected */
+bool sim_pipe_fp::pipeline_empty(){
+	if(fp_mispredict || fp_memoryStall || rob_count > 0 || mem_user != UNDEFINED) return false;
+	for(int k = FIRST; k <= FORTH; k++)
+		for(unsigned l = 0; l < issue_width; l++)
+			if(fp_pipe_reg[k][l].pipe_IR.opcode != NOP) return false;
+	return units_busy == 0;
+}
 
-	fp_pipe_reg[FIRST].reset();
-	fp_pipe_reg[SECOND].reset();
-	fp_pipe_reg[THIRD].reset();
-	fp_pipe_reg[FORTH].reset();
+/* the instructions in flight complete in the cycle model, IF fetching no more; IF is left at the next instruction */
+void sim_pipe_fp::drain(){
+	fp_draining = true;
+	while(!fp_eopRetired && !pipeline_empty()) run(1);
+	fp_draining = false;
+	if(fp_eopRetired) return;
 
-	fp_clkIn = 1;
-	fp_inst_count = 0;
-	fp_runAlways = 0;
+	// a taken branch may have been resolved without IF having been redirected yet
+	if(fp_branchTarget != UNDEFINED)
+	{
+		fp_inst_count = fp_branchTarget;
+		fp_branchTarget = UNDEFINED;
+	}
+}
 
-	fp_totalInstCount = 0;
+unsigned long sim_pipe_fp::run_functional(unsigned long instructions, bool warm){
 
-	fp_stalls = 0;
-	fp_totalStalls = 0;
-	fp_stallMem = 0;
-	fp_currentClk = 0;
-	fp_branchToLabel = "";
+	// the instructions in flight complete in the cycle model
+	drain();
+	if(fp_eopRetired) return 0;
 
-	fp_noBranches = true;
-	fp_branchStall = false;
-	fp_memoryStall = false;
-	fp_memStallCompleted = false;
+	SIM_TRACE_CYCLE(trace, "\n## START of functional run, instruction: "<<fp_inst_count);
 
-}
+	unsigned reg[2*NUM_GP_REGISTERS];
+	std::copy(generalP_IntReg, generalP_IntReg + NUM_GP_REGISTERS, reg);
+	std::copy(generalP_FPReg, generalP_FPReg + NUM_GP_REGISTERS, reg + NUM_GP_REGISTERS);
+	unsigned *freg = reg + NUM_GP_REGISTERS;
 
-//return value of special purpose register
+	unsigned long pc = fp_inst_count, executed = 0;
+	unsigned long limit = instructions ? instructions : (unsigned long)-1;
+
+	// whole blocks run as threaded code; the switch executes what is left (fewer instructions than the next block
+	// holds) and, with "warm" set, the whole run
+	if(!warm)
+	{
+		executed = run_blocks(reg, pc, limit);
+		if(fp_eopRetired) limit = executed;
+	}
+
+	while(executed < limit)
+	{
+		if(pc >= program_size)
+		{
+			cerr << "error: fetch at PC 0x" << hex << instr_base_address + 4*pc << " is past the end of the program (missing EOP?)" << endl;
+			exit(-1);
+		}
+		const instruction_t &ir = program[pc];
+		if(warm && icache.enabled()) icache.access(instr_base_address + 4*pc, false, fp_clkIn);
+		pc++;
+		unsigned address;
+		bool taken;
+		switch(ir.opcode)
+		{
+		case ADD: reg[ir.dest] = alu(ADD, reg[ir.src1], reg[ir.src2], 0, 0); break;
+		case SUB: reg[ir.dest] = alu(SUB, reg[ir.src1], reg[ir.src2], 0, 0); break;
+		case XOR: reg[ir.dest] = alu(XOR, reg[ir.src1], reg[ir.src2], 0, 0); break;
+		case ADDI: reg[ir.dest] = alu(ADDI, reg[ir.src1], 0, ir.immediate, 0); break;
+		case SUBI: reg[ir.dest] = alu(SUBI, reg[ir.src1], 0, ir.immediate, 0); break;
+		case ADDS: freg[ir.dest] = alu(ADDS, freg[ir.src1], freg[ir.src2], 0, 0); break;
+		case SUBS: freg[ir.dest] = alu(SUBS, freg[ir.src1], freg[ir.src2], 0, 0); break;
+		case MULTS: freg[ir.dest] = alu(MULTS, freg[ir.src1], freg[ir.src2], 0, 0); break;
+		case DIVS: freg[ir.dest] = alu(DIVS, freg[ir.src1], freg[ir.src2], 0, 0); break;
+		case LW:
+			address = alu(LW, reg[ir.src1], 0, ir.immediate, 0);
+			if(warm) dcache.access(address, false, fp_clkIn);
+			reg[ir.dest] = data_memory.read_word(address);
+			break;
+		case LWS:
+			address = alu(LWS, reg[ir.src1], 0, ir.immediate, 0);
+			if(warm) dcache.access(address, false, fp_clkIn);
+			freg[ir.dest] = data_memory.read_word(address);
+			break;
+		case SW: //SW src1 imm(src2)
+			address = alu(SW, reg[ir.src2], 0, ir.immediate, 0);
+			if(warm) dcache.access(address, true, fp_clkIn);
+			data_memory.write_word(address, reg[ir.src1]);
+			break;
+		case SWS:
+			address = alu(SWS, reg[ir.src2], 0, ir.immediate, 0);
+			if(warm) dcache.access(address, true, fp_clkIn);
+			data_memory.write_word(address, freg[ir.src1]);
+			break;
+		case BEQZ:
+		case BNEZ:
+		case BLTZ:
+		case BGTZ:
+		case BLEZ:
+		case BGEZ:
+			taken = branch_taken(ir.opcode, reg[ir.src1]);
+			if(warm) warm_branch(pc - 1, ir, taken);
+			if(taken) pc = ir.target;
+			break;
+		case JUMP:
+			if(warm) warm_branch(pc - 1, ir, true);
+			pc = ir.target;
+			break;
+		case EOP:
+			fp_eopFetched = true;
+			fp_eopRetired = true;
+			limit = executed;
+			continue;
+		default: // NOP
+			continue;
+		}
+		++executed;
+	}
+
+	std::copy(reg, reg + NUM_GP_REGISTERS, generalP_IntReg);
+	std::copy(freg, freg + NUM_GP_REGISTERS, generalP_FPReg);
+	fp_inst_count = pc;
+	fp_fetchMiss = UNDEFINED;
+	update_sp_registers();
+
+	SIM_TRACE_CYCLE(trace, "\n## END of functional run, instructions: "<<executed<<"\n");
+	return executed;
+}
+
+/* functional warming: trains the branch predictor with the branch at instruction "index" */
+void sim_pipe_fp::warm_branch(unsigned long index, const instruction_t &ir, bool taken){
+	if(!bpred.enabled()) return;
+	unsigned address = instr_base_address + 4*index;
+	bool conditional = ir.opcode != JUMP;
+	bpred.update(address, conditional, taken, instr_base_address + 4*ir.target, bpred.predict(address, conditional));
+}
+
+/* =============================================================
+
+   TRANSLATION CACHE
+
+   run_functional executes the program a basic block at a time. A
+   block starts at the instruction run_functional reaches and ends at
+   a branch, at EOP, or before the next branch target. It is translated
+   on first use into threaded code: an array with, per instruction, the
+   address of its handler in run_blocks (GNU labels as values) and its
+   register numbers and immediate (NOPs are dropped), closed by the
+   branch, EOP, or a fall through into the next block. Each handler
+   jumps straight to the next one: no decode, no bounds check and no
+   instruction count per instruction. The blocks taken and not taken
+   after a block are looked up the first time they are followed and
+   chained to it, so a loop runs from block to block with no lookup.
+   The cache lasts until the program changes (flush_blocks).
+
+   ============================================================= */
+
+/* drops the translations (the program has changed) */
+void sim_pipe_fp::flush_blocks(){
+	blocks.clear();
+	block_ops.clear();
+	block_at.clear();
+	block_leader.clear();
+}
+
+/* translates the block starting at instruction "pc" with the handlers of run_blocks, indexed by opcode (that of NOP
+   falls through into the next block); returns its index in blocks */
+unsigned sim_pipe_fp::translate_block(unsigned long pc, const void *const *handlers){
+	if(pc >= program_size)
+	{
+		cerr << "error: fetch at PC 0x" << hex << instr_base_address + 4*pc << " is past the end of the program (missing EOP?)" << endl;
+		exit(-1);
+	}
+
+	block_t block;
+	block.start = pc;
+	block.first = block_ops.size();
+	block.executed = 0;
+	block.target = UNDEFINED;
+	block.next[0] = block.next[1] = UNDEFINED;
+
+	threaded_op_t op;
+	op.handler = handlers[NOP]; // falls through into the next block, unless a branch or EOP ends this one
+	op.dest = op.src1 = op.src2 = op.imm = 0;
+
+	// a block running past the end of the program falls through to it: the error comes if it is reached
+	unsigned long k = pc;
+	while(k < program_size && (k == pc || !block_leader[k]))
+	{
+		const instruction_t &ir = program[k++];
+		if(ir.opcode == NOP) continue;
+
+		op.handler = handlers[ir.opcode];
+		op.dest = ir.dest;
+		op.src1 = ir.src1;
+		op.src2 = ir.src2;
+		op.imm = ir.immediate;
+		if(is_branch(ir.opcode) || ir.opcode == EOP)
+		{
+			block.target = ir.target;
+			if(ir.opcode != EOP) block.executed++;
+			break;
+		}
+		// the floating point registers follow the integer ones in the register array
+		bool fp_op = ir.opcode == ADDS || ir.opcode == SUBS || ir.opcode == MULTS || ir.opcode == DIVS;
+		if(fp_op || ir.opcode == LWS) op.dest += NUM_GP_REGISTERS;
+		if(fp_op || ir.opcode == SWS) op.src1 += NUM_GP_REGISTERS;
+		if(fp_op) op.src2 += NUM_GP_REGISTERS;
+		block_ops.push_back(op);
+		block.executed++;
+		op.handler = handlers[NOP];
+	}
+	block.fallthrough = k;
+	block_ops.push_back(op); // the exit
+
+	blocks.push_back(block);
+	block_at[pc] = blocks.size() - 1;
+	return blocks.size() - 1;
+}
+
+/* runs whole blocks from instruction "pc" while they fit in "limit" instructions; returns the instructions executed
+   and leaves "pc" at the next instruction (the start of the block that did not fit, or the one after EOP) */
+unsigned long sim_pipe_fp::run_blocks(unsigned *reg, unsigned long &pc, unsigned long limit){
+
+	// handlers by opcode: the branches, EOP and NOP (falling through) are only found at the exit of a block
+	static const void *const handlers[NUM_OPCODES] = {
+		&&do_lw, &&do_sw, &&do_add, &&do_addi, &&do_sub, &&do_subi, &&do_xor,
+		&&do_beqz, &&do_bnez, &&do_bltz, &&do_bgtz, &&do_blez, &&do_bgez, &&do_jump, &&do_eop, &&do_fall,
+		&&do_lw, &&do_sw, &&do_adds, &&do_subs, &&do_mults, &&do_divs // LWS and SWS bind a floating point register
+	};
+
+	// the branch targets, found the first time the program is run
+	if(block_at.size() != program_size)
+	{
+		block_at.assign(program_size, UNDEFINED);
+		block_leader.assign(program_size, false);
+		for(unsigned k = 0; k < program_size; k++)
+			if(is_branch(program[k].opcode) && program[k].target < program_size) block_leader[program[k].target] = true;
+	}
+
+	unsigned long executed = 0;
+	unsigned b = (pc < program_size && block_at[pc] != UNDEFINED) ? block_at[pc] : translate_block(pc, handlers);
+	const block_t *block;
+	const threaded_op_t *op;
+	unsigned side, next;
+	unsigned long successor;
+
+enter:
+	block = &blocks[b];
+	if(block->executed > limit - executed)
+	{
+		pc = block->start;
+		return executed;
+	}
+	executed += block->executed;
+	op = block_ops.data() + block->first;
+	goto *op->handler;
+
+do_add: reg[op->dest] = alu(ADD, reg[op->src1], reg[op->src2], 0, 0); op++; goto *op->handler;
+do_sub: reg[op->dest] = alu(SUB, reg[op->src1], reg[op->src2], 0, 0); op++; goto *op->handler;
+do_xor: reg[op->dest] = alu(XOR, reg[op->src1], reg[op->src2], 0, 0); op++; goto *op->handler;
+do_addi: reg[op->dest] = alu(ADDI, reg[op->src1], 0, op->imm, 0); op++; goto *op->handler;
+do_subi: reg[op->dest] = alu(SUBI, reg[op->src1], 0, op->imm, 0); op++; goto *op->handler;
+do_lw: reg[op->dest] = data_memory.read_word(alu(LW, reg[op->src1], 0, op->imm, 0)); op++; goto *op->handler;
+do_sw: data_memory.write_word(alu(SW, reg[op->src2], 0, op->imm, 0), reg[op->src1]); op++; goto *op->handler; //SW src1 imm(src2)
+do_adds: reg[op->dest] = alu(ADDS, reg[op->src1], reg[op->src2], 0, 0); op++; goto *op->handler;
+do_subs: reg[op->dest] = alu(SUBS, reg[op->src1], reg[op->src2], 0, 0); op++; goto *op->handler;
+do_mults: reg[op->dest] = alu(MULTS, reg[op->src1], reg[op->src2], 0, 0); op++; goto *op->handler;
+do_divs: reg[op->dest] = alu(DIVS, reg[op->src1], reg[op->src2], 0, 0); op++; goto *op->handler;
+
+// exits: the outcome of a branch is a jump, not an index, so the next block does not wait for the condition
+do_beqz: if(branch_taken(BEQZ, reg[op->src1])) goto taken; goto not_taken;
+do_bnez: if(branch_taken(BNEZ, reg[op->src1])) goto taken; goto not_taken;
+do_bltz: if(branch_taken(BLTZ, reg[op->src1])) goto taken; goto not_taken;
+do_bgtz: if(branch_taken(BGTZ, reg[op->src1])) goto taken; goto not_taken;
+do_blez: if(branch_taken(BLEZ, reg[op->src1])) goto taken; goto not_taken;
+do_bgez: if(branch_taken(BGEZ, reg[op->src1])) goto taken; goto not_taken;
+do_jump: goto taken;
+do_fall: goto not_taken;
+do_eop:
+	fp_eopFetched = true;
+	fp_eopRetired = true;
+	pc = block->fallthrough;
+	return executed;
+
+// the next block is followed through the chain, and looked up the first time only
+taken:
+	side = 1;
+	if(block->next[1] == UNDEFINED) goto link;
+	b = block->next[1];
+	goto enter;
+not_taken:
+	side = 0;
+	if(block->next[0] == UNDEFINED) goto link;
+	b = block->next[0];
+	goto enter;
+link:
+	successor = side ? block->target : block->fallthrough;
+	next = (successor < program_size && block_at[successor] != UNDEFINED) ? block_at[successor] : translate_block(successor, handlers);
+	blocks[b].next[side] = next;
+	b = next;
+	goto enter;
+}
+
+/* =============================================================
+
+   SAMPLED SIMULATION
+
+   See sim_sample.h. A detailed window runs the cycle model one cycle
+   at a time until "detailed" more instructions have retired; the next
+   run_functional empties the pipeline, and the instructions completed
+   meanwhile count as executed but are not measured.
+
+   ============================================================= */
+
+sample_stats_t sim_pipe_fp::run_sampled(unsigned long fast_forward, unsigned long warm_up, unsigned long detailed){
+	if(detailed == 0)
+	{
+		cerr << "error: a sampled run needs detailed windows of at least one instruction" << endl;
+		exit(-1);
+	}
+
+	sim_sample sampler;
+	unsigned long functional = 0, retired = fp_totalInstCount;
+	unsigned long last_instructions = 0, last_cycles = 0; // window cut short by EOP
+
+	while(!fp_eopRetired)
+	{
+		if(fast_forward) functional += run_functional(fast_forward);
+		if(warm_up && !fp_eopRetired) functional += run_functional(warm_up, true);
+
+		// the window is measured from its first retirement, once the pipeline has filled
+		unsigned long first = fp_totalInstCount;
+		while(!fp_eopRetired && fp_totalInstCount == first) run(1);
+		unsigned long start_clk = fp_clkIn, start_count = fp_totalInstCount;
+		while(!fp_eopRetired && fp_totalInstCount - start_count < detailed) run(1);
+
+		unsigned long instructions = fp_totalInstCount - start_count, cycles = fp_clkIn - start_clk;
+		if(instructions >= detailed) sampler.add(instructions, cycles);
+		else
+		{
+			last_instructions = instructions;
+			last_cycles = cycles;
+		}
+	}
+	if(sampler.samples() == 0 && last_instructions > 0) sampler.add(last_instructions, last_cycles);
+
+	return sampler.stats(functional + fp_totalInstCount - retired);
+}
+
+/* =============================================================
+
+   PARALLEL SIMULATION
+
+   run_parallel: a functional pass saves a checkpoint (snapshot) at
+   the start of each interval; the checkpoints share the data memory
+   pages they have in common, so each one only costs the pages written
+   since the previous one. The intervals are then independent: each is
+   simulated by a simulator of its own, restored from its checkpoint
+   (or from the previous one, for the warm-up), on the thread pool of
+   sim_pool.h.
+
+   ============================================================= */
+
+parallel_stats_t sim_pipe_fp::run_parallel(unsigned long interval, unsigned long warm_up, unsigned long overlap, unsigned threads){
+	if(interval == 0)
+	{
+		cerr << "error: a parallel run needs intervals of at least one instruction" << endl;
+		exit(-1);
+	}
+
+	// the functional pass
+	vector<sim_pipe_fp *> checkpoints;
+	vector<unsigned long> lengths;
+	drain();
+	while(!fp_eopRetired)
+	{
+		checkpoints.push_back(snapshot());
+		lengths.push_back(run_functional(interval));
+	}
+
+	parallel_stats_t stats;
+	stats.intervals.resize(checkpoints.size());
+	unsigned long first = 0;
+	for(unsigned i = 0; i < checkpoints.size(); i++)
+	{
+		stats.intervals[i].first = first;
+		stats.intervals[i].instructions = lengths[i];
+		first += lengths[i];
+	}
+
+	sim_pool pool(threads);
+	pool.run(checkpoints.size(), [&](unsigned i) {
+		interval_t &result = stats.intervals[i];
+		bool last = (i + 1 == checkpoints.size());
+
+		sim_pipe_fp sim(0, data_memory_latency, core);
+#if SIM_TRACE_LEVEL > TRACE_OFF
+		// the workers would interleave their trace on a shared stream: each one keeps its own, in memory
+		sim.set_trace_sink(TRACE_TO_RING);
+#endif
+		if(i > 0 && warm_up > 0)
+		{
+			// back to the checkpoint the warm-up starts in (the first one, if the warm-up reaches before it)
+			unsigned from = i;
+			unsigned long warm = 0;
+			while(from > 0 && warm < warm_up) warm += lengths[--from];
+			sim.restore(*checkpoints[from]);
+			if(warm > warm_up) sim.run_functional(warm - warm_up);
+			sim.run_functional(warm < warm_up ? warm : warm_up, true);
+		}
+		else sim.restore(*checkpoints[i]);
+
+		// the interval (the last one up to EOP)
+		unsigned long start_clk = sim.fp_clkIn, start_count = sim.fp_totalInstCount;
+		unsigned start_stalls[NUM_STALL_TYPES];
+		std::copy(sim.fp_stallCount, sim.fp_stallCount + NUM_STALL_TYPES, start_stalls);
+		result.head_cycles = 0;
+		while(!sim.fp_eopRetired && (last || sim.fp_totalInstCount - start_count < lengths[i]))
+		{
+			sim.run(1);
+			if(overlap && !result.head_cycles && sim.fp_totalInstCount - start_count >= overlap) result.head_cycles = sim.fp_clkIn - start_clk;
+		}
+		result.cycles = sim.fp_clkIn - start_clk;
+		for(unsigned s = 0; s < NUM_STALL_TYPES; s++) result.stalls[s] = sim.fp_stallCount[s] - start_stalls[s];
+
+		// then the start of the next one, with everything warm
+		result.tail_cycles = 0;
+		if(!last && overlap)
+		{
+			unsigned long end_clk = sim.fp_clkIn;
+			while(!sim.fp_eopRetired && sim.fp_totalInstCount - start_count < lengths[i] + overlap) sim.run(1);
+			if(sim.fp_totalInstCount - start_count >= lengths[i] + overlap) result.tail_cycles = sim.fp_clkIn - end_clk;
+		}
+	});
+
+	// the intervals stitched together
+	stats.instructions = first;
+	stats.cycles = 0;
+	stats.stalls = 0;
+	std::fill_n(stats.stalls_by_type, NUM_STALL_TYPES, 0);
+	double extra_cycles = 0;
+	for(unsigned i = 0; i < checkpoints.size(); i++)
+	{
+		interval_t &result = stats.intervals[i];
+		result.warmup_error = 0;
+		if(i > 0 && result.head_cycles && stats.intervals[i-1].tail_cycles)
+		{
+			result.warmup_error = (double)result.head_cycles / stats.intervals[i-1].tail_cycles - 1;
+			extra_cycles += (double)result.head_cycles - stats.intervals[i-1].tail_cycles;
+		}
+		stats.cycles += result.cycles;
+		for(unsigned s = 0; s < NUM_STALL_TYPES; s++)
+		{
+			stats.stalls_by_type[s] += result.stalls[s];
+			stats.stalls += result.stalls[s];
+		}
+		delete checkpoints[i];
+	}
+	stats.ipc = stats.cycles ? (double)stats.instructions / stats.cycles : 0;
+	stats.warmup_error = stats.cycles ? extra_cycles / stats.cycles : 0;
+	return stats;
+}
+
+//reset the state of the sim_pipe_fpulator
+void sim_pipe_fp::reset(){
+	// init data memory
+	data_memory.reset();
+
+	// init instruction memory
+	instr_memory.clear();
+	image.unload();
+	fp_labelNames.clear();
+	program = NULL;
+	program_size = 0;
+	flush_blocks();
+
+	// Initialize member variables
+	std::fill_n(generalP_IntReg, NUM_GP_REGISTERS, UNDEFINED);
+	std::fill_n(generalP_FPReg, NUM_GP_REGISTERS, UNDEFINED);
+
+	for(int k = FIRST; k <= FORTH; k++){
+		reset_group(fp_pipe_reg[k], MAX_ISSUE_WIDTH);
+		reset_group(fp_pipe_next[k], MAX_ISSUE_WIDTH);
+	}
+
+	for (unsigned p=0; p<pipes.size(); p++){
+		pipes[p].accept = 0;
+		pipes[p].idle.clear();
+		pipes[p].blocked.clear();
+	}
+	for (unsigned u=num_units; u-- > 0; ){
+		exec_units[u].done = 0;
+		exec_units[u].instruction.reset();
+		exec_units[u].operands.reset();
+		exec_units[u].older = exec_units[u].younger = UNDEFINED;
+		exec_units[u].waiters.clear();
+		pipes[exec_units[u].pipe].idle.push_back(u);
+	}
+	while (!pipe_reopen.empty()) pipe_reopen.pop();
+	for (unsigned p=0; p<pipes.size(); p++) update_free_map(p);
+	units_executing = unit_queue_t();
+	units_completed = unit_queue_t();
+	branch_units = unit_queue_t();
+	units_busy = 0;
+	youngest_unit = UNDEFINED;
+
+	for (unsigned t=0; t<NUM_UNIT_TYPES; t++)
+		for (unsigned s=0; s<stations[t].size(); s++) stations[t][s].reset();
+	rob_head = 0;
+	rob_count = 0;
+	issue_seq = 0;
+	std::fill_n(rename_table, 2*NUM_GP_REGISTERS, UNDEFINED);
+	std::fill_n(register_status, 2*NUM_GP_REGISTERS, UNDEFINED);
+	std::fill_n(register_readers, 2*NUM_GP_REGISTERS, 0);
+	units_ready = unit_queue_t();
+	units_memory = unit_queue_t();
+	units_writing = unit_queue_t();
+	while (!pipes_blocked.empty()) pipes_blocked.pop();
+	mem_user = UNDEFINED;
+	mem_ready = 0;
+
+	fp_clkIn = 0;
+	fp_inst_count = 0;
+	fp_runAlways = 0;
+
+	fp_totalInstCount = 0;
+	fp_fetchSeq = 0;
+
+	fp_stalls = 0;
+	fp_totalStalls = 0;
+	pending_writes.reset();
+	unit_writes.reset();
+	fp_stallMem = 0;
+	fp_memLatency = 0;
+	dcache.reset();
+	l2cache.reset();
+	icache.reset();
+	fp_fetchMiss = UNDEFINED;
+	fp_fetchReady = 0;
+	std::fill_n(fp_stallCount, NUM_STALL_TYPES, 0);
+	std::fill_n(fp_stageStall, EVENT_STALL_STAGES, EVENT_NO_STALL);
+	fp_branchTarget = UNDEFINED;
+
+	fp_branchStall = false;
+	fp_memoryStall = false;
+	fp_mispredict = false;
+	bpred.reset();
+	fp_draining = false;
+	fp_eopFetched = false;
+	fp_eopRetired = false;
+
+	update_sp_registers();
+}
+
+//return value of special purpose register
 unsigned sim_pipe_fp::get_sp_register(sp_register_t reg, stage_t s){
 	if( (reg >= 0 ) && (reg < NUM_SP_REGISTERS) && (s>=0) && (s<5))
 	{
@@ -517,7 +1478,7 @@ void sim_pipe_fp::set_int_register(unsigned reg, int value){
 float sim_pipe_fp::get_fp_register(unsigned reg){
 	if( (reg >= 0 ) && (reg < NUM_GP_REGISTERS))
 	{
-		return generalP_FPReg[reg];
+		return unsigned2float(generalP_FPReg[reg]);
 	}
 	return 0.0;
 }
@@ -525,12 +1486,13 @@ float sim_pipe_fp::get_fp_register(unsigned reg){
 void sim_pipe_fp::set_fp_register(unsigned reg, float value){
 	if( (reg >= 0 ) && (reg < NUM_GP_REGISTERS))
 	{
-		generalP_FPReg[reg] = value;
+		generalP_FPReg[reg] = float2unsigned(value);
 	}
 }
 
 
 float sim_pipe_fp::get_IPC(){
+	if(!fp_clkIn) return 0;
 	float IPC = float(fp_totalInstCount)/float(fp_clkIn);
 	return IPC;
 }
@@ -540,594 +1502,1206 @@ unsigned sim_pipe_fp::get_instructions_executed(){
 }
 
 unsigned sim_pipe_fp::get_clock_cycles(){
-	return fp_totalStalls;
+	return fp_clkIn;
 }
 
-unsigned sim_pipe_fp::get_stalls(){
-	return fp_clkIn;
+unsigned sim_pipe_fp::get_stalls(stall_t type){
+	if(type == ALL_STALLS) return fp_totalStalls;
+	return fp_stallCount[type];
+}
+
+/* counts a stall cycle of the given cause, in the given stage */
+void sim_pipe_fp::count_stall(stall_t type, stage_t stage){
+	fp_stallCount[type] += 1;
+	fp_totalStalls += 1;
+	fp_stageStall[stage] = type;
+}
+
+/* copies the latches (their oldest instruction) into the special purpose registers seen at the entrance of each stage */
+void sim_pipe_fp::update_sp_registers()
+{
+	for(int k = IF; k <= WB ; k++)
+		std::fill_n(specialP_Reg[k], NUM_SP_REGISTERS, UNDEFINED);
+
+	specialP_Reg[IF][PC] = instr_base_address + 4*fp_inst_count;
+
+	specialP_Reg[ID][IR]  = fp_pipe_reg[FIRST][0].pipe_IR.opcode;
+	specialP_Reg[ID][NPC] = fp_pipe_reg[FIRST][0].pipe_NPC;
+
+	specialP_Reg[EXE][IR]  = fp_pipe_reg[SECOND][0].pipe_IR.opcode;
+	specialP_Reg[EXE][NPC] = fp_pipe_reg[SECOND][0].pipe_NPC;
+	specialP_Reg[EXE][A]   = fp_pipe_reg[SECOND][0].pipe_A;
+	specialP_Reg[EXE][B]   = fp_pipe_reg[SECOND][0].pipe_B;
+	specialP_Reg[EXE][IMM] = fp_pipe_reg[SECOND][0].pipe_IMM;
+
+	specialP_Reg[MEM][IR]         = fp_pipe_reg[THIRD][0].pipe_IR.opcode;
+	specialP_Reg[MEM][B]          = fp_pipe_reg[THIRD][0].pipe_B;
+	specialP_Reg[MEM][COND]       = fp_pipe_reg[THIRD][0].pipe_COND;
+	specialP_Reg[MEM][ALU_OUTPUT] = fp_pipe_reg[THIRD][0].pipe_ALU_OUTPUT;
+
+	specialP_Reg[WB][IR]         = fp_pipe_reg[FORTH][0].pipe_IR.opcode;
+	specialP_Reg[WB][ALU_OUTPUT] = fp_pipe_reg[FORTH][0].pipe_ALU_OUTPUT;
+	specialP_Reg[WB][LMD]        = fp_pipe_reg[FORTH][0].pipe_LMD;
+}
+
+/* returns the value of register "reg" (numbered as in dest_register) */
+unsigned sim_pipe_fp::read_register(unsigned reg){
+	if(reg >= NUM_GP_REGISTERS) return generalP_FPReg[reg - NUM_GP_REGISTERS];
+	return generalP_IntReg[reg];
+}
+
+/* true if a branch in ID, or not resolved yet in EX (TOMASULO: in the reorder buffer), keeps IF waiting */
+bool sim_pipe_fp::branch_pending(){
+	if(branch_in_group(fp_pipe_reg[FIRST], issue_width)) return true;
+
+	if(core == TOMASULO)
+	{
+		for(unsigned k = 0; k < rob_count; k++)
+		{
+			const rob_entry_t &entry = rob[(rob_head + k) % rob.size()];
+			if(is_branch(entry.operands.pipe_IR.opcode) && entry.state != ROB_DONE) return true;
+		}
+		return false;
+	}
+
+	if(branch_in_group(fp_pipe_next[THIRD], issue_width)) return true;
+	return oldest_branch() != (unsigned long)-1;
+}
+
+/* issue time of the oldest branch still in an execution unit: the later instructions may be on the wrong path */
+unsigned long sim_pipe_fp::oldest_branch(){
+	while (!branch_units.empty() && !unit_holds(branch_units.top())) branch_units.pop();
+	return branch_units.empty() ? (unsigned long)-1 : branch_units.top().issued;
 }
 
 
+
 void sim_pipe_fp::fp_fetch()
 {
-	cout<<"\nIn fetch fp_clkIn: "<<fp_clkIn<<"\t current instruction is: "<<fp_inst_count+1;
+	SIM_TRACE_STAGE(trace, "\nIn fetch fp_clkIn: "<<fp_clkIn<<"\t current instruction is: "<<fp_inst_count+1);
 
-	if(fp_memoryStall) return;
+	// ID (or MEM) is stalled: IF/ID keeps its instructions
+	if(fp_memoryStall || fp_stalls) return;
 
-	if(fp_stalls)
+	// the branch leaving EX was mispredicted: the instructions fetched in this cycle are squashed as well,
+	// and fetch restarts on the right path in the next cycle
+	if(fp_mispredict)
 	{
-		if(fp_branchStall) fp_pipe_reg[FIRST].reset();
+		SIM_TRACE_STAGE(trace, "\n Branch mispredicted, restarting at: "<<fp_branchTarget);
+		reset_group(fp_pipe_next[FIRST], issue_width);
+		fp_inst_count = fp_branchTarget;
+		fp_branchTarget = UNDEFINED;
+		fp_eopFetched = false;
+		fp_mispredict = false;
+		count_stall(CONTROL_STALL, IF);
 		return;
 	}
 
-	cout<<"\n Fetch input: 1.opcode: "<<instr_memory[fp_inst_count].opcode;
-	cout<<"\n Fetch input: instruct: "<<(instr_names[instr_memory[fp_inst_count].opcode]);
-	cout<<"\n Fetch input: 2.dest:   "<<instr_memory[fp_inst_count].dest;
-	cout<<"\n Fetch input: 3.src1:   "<<instr_memory[fp_inst_count].src1;
-	cout<<"\n Fetch input: 4.src2:   "<<instr_memory[fp_inst_count].src2;
-	cout<<"\n Fetch input: 5.imm:    "<<instr_memory[fp_inst_count].immediate;
-	cout<<"\n Fetch input: 6.label:  "<<instr_memory[fp_inst_count].label<<"\n";
+	// without a predictor, nothing can be fetched while a branch has not been resolved yet
+	if(!bpred.enabled() && branch_pending())
+	{
+		SIM_TRACE_STAGE(trace, "\n Branch pending, skipping fetching new inst");
+		reset_group(fp_pipe_next[FIRST], issue_width);
+		fp_branchStall = true;
+		count_stall(CONTROL_STALL, IF);
+		return;
+	}
+	fp_branchStall = false;
 
-	std::string emptyStr = "";
-	if(fp_branchToLabel != emptyStr)
+	// taken branch resolved in the previous cycle (EX/MEM.cond)
+	if(fp_branchTarget != UNDEFINED)
 	{
-		unsigned jumpToInst = 0; //(fp_labelPCMap.find(fp_branchToLabel))->second;
+		SIM_TRACE_STAGE(trace, "\n branching to: "<<fp_labelNames.name(fp_branchTarget)<<" jumpToInst: "<<fp_branchTarget);
 
-		fp_inst_count = jumpToInst;
-		fp_branchToLabel = emptyStr;
+		fp_inst_count = fp_branchTarget;
+		fp_branchTarget = UNDEFINED;
 	}
 
-	//update IR register of pipeline reg first
-	std::memcpy(&fp_pipe_reg[FIRST].pipe_IR, &instr_memory[fp_inst_count], sizeof (instruction_t) );
-	specialP_Reg[IF][IR] = fp_pipe_reg[FIRST].pipe_IR.opcode;
-	specialP_Reg[ID][IR] =  specialP_Reg[IF][IR];
+	reset_group(fp_pipe_next[FIRST], issue_width);
 
-	if(specialP_Reg[IF][IR] != EOP)
+	// nothing is fetched past the end of the program, nor while run_functional empties the pipeline
+	if(fp_eopFetched || fp_draining) return;
+
+	// up to issue_width consecutive instructions; the group ends at EOP, at a branch predicted taken
+	// (at any branch without a predictor) and at an I-cache miss
+	for(unsigned l = 0; l < issue_width; l++)
 	{
-		//1.update PC, NPC
-		if(fp_clkIn == 1){//FIRST instr
-			specialP_Reg[IF][PC] = instr_base_address+(4*fp_inst_count) + 4;
-			specialP_Reg[ID][NPC] = specialP_Reg[IF][PC];
+		if(fp_inst_count >= program_size)
+		{
+			cerr << "error: fetch at PC 0x" << hex << instr_base_address + 4*fp_inst_count << " is past the end of the program (missing EOP?)" << endl;
+			exit(-1);
+		}
+
+		// the I-cache is looked up once per instruction; on a miss IF delivers bubbles until the line arrives
+		// (the fill goes on while IF is frozen, and is abandoned if fetch is redirected)
+		if(icache.enabled() && fp_fetchMiss != fp_inst_count)
+		{
+			unsigned latency = icache.access(instr_base_address + 4*fp_inst_count, false, fp_clkIn);
+			if(latency)
+			{
+				fp_fetchMiss = fp_inst_count;
+				fp_fetchReady = fp_clkIn + latency;
+			}
 		}
-		else if(fp_clkIn > 1){
-			specialP_Reg[ID][NPC] = instr_base_address+(4*fp_inst_count) + 4; //specialP_Reg[IF][PC] + 4;
-			specialP_Reg[IF][PC] = specialP_Reg[ID][NPC];
+		if(fp_fetchMiss == fp_inst_count && fp_clkIn < fp_fetchReady)
+		{
+			SIM_TRACE_STAGE(trace, "\n I-cache miss, line ready in cycle: "<<fp_fetchReady);
+			if(l == 0) count_stall(FETCH_STALL, IF);
+			return;
 		}
+		fp_fetchMiss = UNDEFINED;
 
-		++fp_inst_count;
-		++fp_totalInstCount;
-	}
+		pipeline_Registers &ifid = fp_pipe_next[FIRST][l];
+		ifid.pipe_IR  = program[fp_inst_count];
+		ifid.pipe_PC  = instr_base_address + 4*fp_inst_count;
+		ifid.pipe_NPC = ifid.pipe_PC + 4;
+		ifid.pipe_SEQ = fp_fetchSeq++;
 
-	if(fp_clkIn == (IF+1))
-	{
-		++fp_clkIn;
-		cout<<"\n FETCH: Incremented fp_clkIn: "<<fp_clkIn<<" & fp_inst_count: "<<fp_inst_count<<"\n";
-	}
+		SIM_TRACE_STAGE(trace, "\n Fetch input: instruct: "<<(instr_names[ifid.pipe_IR.opcode]));
+
+		opcode_t opcode = ifid.pipe_IR.opcode;
+		if(opcode == EOP)
+		{
+			fp_eopFetched = true;
+			return;
+		}
+		if(bpred.enabled() && is_branch(opcode))
+		{
+			ifid.pipe_PRED_PC = bpred.predict(ifid.pipe_PC, opcode != JUMP);
+			fp_inst_count = (ifid.pipe_PRED_PC - instr_base_address) / 4;
 
+			SIM_TRACE_STAGE(trace, "\n Branch predicted to: 0x"<<hex<<ifid.pipe_PRED_PC<<dec);
+			if(ifid.pipe_PRED_PC != ifid.pipe_NPC) return;
+		}
+		else
+		{
+			++fp_inst_count;
+			if(is_branch(opcode)) return;
+		}
+	}
 }
 
 void sim_pipe_fp::fp_decode()
 {
-	cout<<"\n In DECODE fp_clkIn: "<<fp_clkIn;
-	cout<<"\n In DECODE fp_stalls: "<<fp_stalls;
-	cout<<"\n fp_memoryStall: "<<fp_memoryStall<<"fp_stallMem: "<<fp_stallMem<<"\n";
+	SIM_TRACE_STAGE(trace, "\n In DECODE fp_clkIn: "<<fp_clkIn);
+
+	// MEM is stalled: ID/EX keeps its instructions
+	if(fp_memoryStall) return;
+
+	// the instructions in ID are on the wrong path of the branch leaving EX
+	if(fp_mispredict)
+	{
+		reset_group(fp_pipe_next[SECOND], issue_width);
+		fp_stalls = 0;
+		count_stall(CONTROL_STALL, ID);
+		return;
+	}
 
-	//cout<<"\n DEC input: 1.opcode: "<<fp_pipe_reg[FIRST].pipe_IR.opcode;
-	cout<<"\n DEC input: instruct: "<<(instr_names[fp_pipe_reg[FIRST].pipe_IR.opcode]);
-	cout<<"\n DEC input: 2.dest:   "<<fp_pipe_reg[FIRST].pipe_IR.dest;
-	cout<<"\n DEC input: 3.src1:   "<<fp_pipe_reg[FIRST].pipe_IR.src1;
-	cout<<"\n DEC input: 4.src2:   "<<fp_pipe_reg[FIRST].pipe_IR.src2;
-	cout<<"\n DEC input: 5.imm:    "<<fp_pipe_reg[FIRST].pipe_IR.immediate;
-	cout<<"\n DEC input: 6.label:  "<<fp_pipe_reg[FIRST].pipe_IR.label<<"\n";
+	// the instructions in IF/ID are issued in order, up to the first one with a hazard; each issue updates
+	// the units and the scoreboards, so the younger instructions of the group see the older ones
+	reset_group(fp_pipe_next[SECOND], issue_width);
+	event_stall_t cause = EVENT_NO_STALL;
+	unsigned l = 0;
+	for(; l < issue_width; l++)
+	{
+		SIM_TRACE_STAGE(trace, "\n DEC input: instruct: "<<(instr_names[fp_pipe_reg[FIRST][l].pipe_IR.opcode]));
+		SIM_TRACE_STAGE(trace, "\n DEC input: 2.dest:   "<<fp_pipe_reg[FIRST][l].pipe_IR.dest);
+		SIM_TRACE_STAGE(trace, "\n DEC input: 3.src1:   "<<fp_pipe_reg[FIRST][l].pipe_IR.src1);
+		SIM_TRACE_STAGE(trace, "\n DEC input: 4.src2:   "<<fp_pipe_reg[FIRST][l].pipe_IR.src2);
+		SIM_TRACE_STAGE(trace, "\n DEC input: 5.imm:    "<<fp_pipe_reg[FIRST][l].pipe_IR.immediate<<"\n");
 
-	if(fp_memoryStall)	return; //140CYCLE, 75 STALLS
+		//Find data/structural hazards & calculate fp_stalls
+		cause = fp_hazardHandler(l);
+		if(fp_stalls) break;
 
-	//Find data-hazards & calculate fp_stalls
-	//fp_hazardHandler();
+		pipeline_Registers &idex = fp_pipe_next[SECOND][l];
+		idex = fp_pipe_reg[FIRST][l];
 
-	if(fp_memoryStall){
-		return;
+		const instruction_t &ir = idex.pipe_IR;
+		if(ir.opcode == NOP || ir.opcode == EOP) continue;
+
+		//read the operands from the register files
+		switch(ir.opcode)
+		{
+		case SW:
+		case SWS: //SW src1 imm(src2): A holds the base address, B the data to be stored
+			idex.pipe_A = read_register(src2_register(ir));
+			idex.pipe_B = read_register(src1_register(ir));
+			break;
+		default:
+			if(src1_register(ir) != UNDEFINED) idex.pipe_A = read_register(src1_register(ir));
+			if(src2_register(ir) != UNDEFINED) idex.pipe_B = read_register(src2_register(ir));
+			break;
+		}
+		if(is_int_imm(ir.opcode) || is_memory(ir.opcode) || is_branch(ir.opcode))
+			idex.pipe_IMM = ir.immediate;
+
+		//issue to the execution unit
+		unsigned u = get_free_unit(ir.opcode);
+		claim_unit(u, idex, issue_seq++);
+		start_unit(u, fp_clkIn + exec_units[u].latency);
+
+		// the result is expected in MEM after the latency of the unit, and in the register file one cycle later
+		regmask_t dest = register_mask(dest_register(ir));
+		unit_writes.issue(dest, fp_clkIn + exec_units[u].latency + 1);
+		pending_writes.issue(dest, fp_clkIn + exec_units[u].latency + 2);
 	}
 
-	if(fp_stalls && (!fp_branchStall))
+	if(l == 0)
 	{
-		cout<<"\n hazard present fp_stalls: "<<fp_stalls;
-		cout<<"\n fp_clkIn: "<<fp_clkIn<<"\n";
-		fp_pipe_reg[SECOND].reset();
+		SIM_TRACE_STAGE(trace, "\n hazard present fp_stalls: "<<fp_stalls);
+		count_stall(DATA_STALL, ID);
+		fp_stageStall[ID] = cause;
 		return;
 	}
-	else if( fp_pipe_reg[FIRST].pipe_IR.opcode != NOP )
+
+	// the rest of the group waits in IF/ID, oldest first (IF is frozen while fp_stalls is not 0)
+	if(fp_stalls)
 	{
-		//over-write index values with actual values of respective registers
-		fp_pipe_reg[FIRST].pipe_IR.src1 = get_int_register(fp_pipe_reg[FIRST].pipe_IR.src1);
-		fp_pipe_reg[FIRST].pipe_IR.src2 = get_int_register(fp_pipe_reg[FIRST].pipe_IR.src2);
+		fp_stageStall[ID] = cause;
+		for(unsigned k = 0; k < issue_width; k++)
+		{
+			if(l + k < issue_width) fp_pipe_next[FIRST][k] = fp_pipe_reg[FIRST][l + k];
+			else fp_pipe_next[FIRST][k].reset();
+		}
 	}
+}
+
+void sim_pipe_fp::fp_execute()
+{
+	SIM_TRACE_STAGE(trace, "\nIn exe fp_clkIn: "<<fp_clkIn<<"\n");
 
-	//2.update NPC
-	specialP_Reg[EXE][NPC] = specialP_Reg[ID][NPC];
-	specialP_Reg[EXE][IMM] = fp_pipe_reg[FIRST].pipe_IR.immediate;
+	// MEM is stalled: EX/MEM keeps its instructions (the units keep working)
+	if(fp_memoryStall) return;
 
-	if( ( specialP_Reg[ID][IR] != SW) &&
-			( (fp_pipe_reg[FIRST].pipe_IR.opcode != NOP) ||
-					(fp_pipe_reg[FIRST].pipe_IR.opcode != EOP)  ) )
-	{
-		specialP_Reg[EXE][A]=fp_pipe_reg[FIRST].pipe_IR.src1; //3
+	// instructions issued after a branch still in the units may be on the wrong path: they wait for it
+	unsigned long oldestBranch = oldest_branch();
 
-		if(specialP_Reg[ID][IR] != LW ) //LW doesnt have src2
-			specialP_Reg[EXE][B]=fp_pipe_reg[FIRST].pipe_IR.src2; //4
+	// the units completed in this cycle join those still waiting to leave EX
+	collect_completed();
+	for (unsigned k=0; k<by_age.size(); k++){
+		unit_ref_t ref = {exec_units[by_age[k]].issued, exec_units[by_age[k]].issued, by_age[k]};
+		units_completed.push(ref);
 	}
-	else
-		if( specialP_Reg[ID][IR] == SW )
-		{
-			specialP_Reg[EXE][B] = fp_pipe_reg[FIRST].pipe_IR.src1;
-			specialP_Reg[EXE][A] = fp_pipe_reg[FIRST].pipe_IR.src2;
-			fp_pipe_reg[FIRST].pipe_IR.src1 = specialP_Reg[EXE][A];
-			fp_pipe_reg[FIRST].pipe_IR.src2 = specialP_Reg[EXE][B];
-		}
 
-	specialP_Reg[EXE][IR] = specialP_Reg[ID][IR];
+	// MEM accepts up to issue_width instructions per cycle: the oldest of the completed ones, with one load or store
+	// (the other loads and stores are held back)
+	by_age.clear();
+	held_back.clear();
+	bool memory = false;
+	while (!units_completed.empty() && by_age.size() < issue_width){
+		unit_ref_t ref = units_completed.top();
+		if (unit_holds(ref) && ref.issued > oldestBranch) break;
+		units_completed.pop();
+		if (!unit_holds(ref)) continue;
+		if (is_memory(exec_units[ref.unit].instruction.opcode)){
+			if (memory){
+				held_back.push_back(ref);
+				continue;
+			}
+			memory = true;
+		}
+		by_age.push_back(ref.unit);
+	}
+	for (unsigned k=0; k<held_back.size(); k++) units_completed.push(held_back[k]);
 
-	//LOAD PIPE2 WITH PIPE1
-	std::memcpy(&fp_pipe_reg[SECOND], &fp_pipe_reg[FIRST], sizeof (pipeline_Registers) );
+	reset_group(fp_pipe_next[THIRD], issue_width);
 
-	if(fp_clkIn == (ID+1))
+	if(by_age.empty())
 	{
-		fp_fetch();
-		++fp_clkIn;
-		cout<<"\n---return true from decode---fp_clkIn: "<<fp_clkIn<<"\n";
+		// EOP leaves ID only once all the units are idle, and does not need one
+		for(unsigned l = 0; l < issue_width; l++)
+			if(fp_pipe_reg[SECOND][l].pipe_IR.opcode == EOP) fp_pipe_next[THIRD][0] = fp_pipe_reg[SECOND][l];
+		return;
 	}
-	cout<<"\n---Done decode---fp_clkIn: "<<fp_clkIn<<"\n";
 
+	for (unsigned k=0; k<by_age.size(); k++){
+		unsigned done = by_age[k];
+		pipeline_Registers &exmem = fp_pipe_next[THIRD][k];
+		exmem = exec_units[done].operands;
+		unsigned long issued = exec_units[done].issued;
+		release_unit(done);
+		unit_writes.release(register_mask(dest_register(exmem.pipe_IR)));
+
+		opcode_t opcode = exmem.pipe_IR.opcode;
+
+		SIM_TRACE_STAGE(trace, "\n execute completed instruct: "<<(instr_names[opcode])<<" on unit "<<unit_names[exec_units[done].type]);
+
+		//exe: call alu()
+		exmem.pipe_ALU_OUTPUT = alu(opcode, exmem.pipe_A, exmem.pipe_B, exmem.pipe_IMM, exmem.pipe_NPC);
+
+		if(is_branch(opcode))
+		{
+			exmem.pipe_COND = branch_taken(opcode, exmem.pipe_A);
+			if(bpred.enabled())
+			{
+				// train the predictor; on a wrong prediction IF, ID and the younger instructions in the units are squashed
+				// (the instructions completing with the branch are older: the younger ones wait for it)
+				if(bpred.update(exmem.pipe_PC, opcode != JUMP, exmem.pipe_COND, exmem.pipe_ALU_OUTPUT, exmem.pipe_PRED_PC))
+				{
+					fp_mispredict = true;
+					fp_branchTarget = exmem.pipe_COND ? exmem.pipe_IR.target : (exmem.pipe_NPC - instr_base_address) / 4;
+					squash_units(issued);
+				}
+			}
+			else
+			if(exmem.pipe_COND)
+			{
+				SIM_TRACE_STAGE(trace, "\n Branch taken to: "<<fp_labelNames.name(exmem.pipe_IR.target));
+				fp_branchTarget = exmem.pipe_IR.target;
+			}
+		}
+	}
 }
 
-void sim_pipe_fp::fp_execute()
+void sim_pipe_fp::fp_memory()
 {
-	cout<<"\nIn exe fp_clkIn: "<<fp_clkIn<<"\n";
-	//	cout<<"\n fp_branchToLabel: "<<fp_branchToLabel;
-	cout<<"\n fp_memoryStall: "<<fp_memoryStall<<"fp_stallMem: "<<fp_stallMem<<"\n";
-
-	cout<<"\n execute input instruct: "<<(instr_names[fp_pipe_reg[SECOND].pipe_IR.opcode]);
-	//cout<<"\n execute input 1.opcode: "<<fp_pipe_reg[SECOND].pipe_IR.opcode;
-	cout<<"\n execute input 2.dest:   "<<fp_pipe_reg[SECOND].pipe_IR.dest;
-	cout<<"\n execute input 3.src1:   "<<fp_pipe_reg[SECOND].pipe_IR.src1;
-	cout<<"\n execute input 4.src2:   "<<fp_pipe_reg[SECOND].pipe_IR.src2;
-	cout<<"\n execute input 5.imm:    "<<fp_pipe_reg[SECOND].pipe_IR.immediate;
-	cout<<"\n execute input 6.label:  "<<fp_pipe_reg[SECOND].pipe_IR.label<<"\n";
+	SIM_TRACE_STAGE(trace, "\n In memory fp_clkIn: "<<fp_clkIn);
+	SIM_TRACE_STAGE(trace, "\n fp_memoryStall: "<<fp_memoryStall<<" fp_stallMem: "<<fp_stallMem);
 
-	if(fp_memoryStall) return;
+	// a group holds at most one load or store (see fp_execute)
+	unsigned m = 0;
+	for(unsigned l = 1; l < issue_width; l++)
+		if(is_memory(fp_pipe_reg[THIRD][l].pipe_IR.opcode)) m = l;
 
-	//exe: call alu()
-	fp_pipe_reg[SECOND].pipe_ALU_OUTPUT = alu(fp_pipe_reg[SECOND].pipe_IR.opcode, fp_pipe_reg[SECOND].pipe_IR.src1, fp_pipe_reg[SECOND].pipe_IR.src2, fp_pipe_reg[SECOND].pipe_IR.immediate, fp_pipe_reg[SECOND].pipe_NPC);
+	const pipeline_Registers &access = fp_pipe_reg[THIRD][m];
+	opcode_t opcode = access.pipe_IR.opcode;
 
-	//	if(fp_pipe_reg[SECOND].pipe_IR.opcode == NOP)
-	//		fp_pipe_reg[SECOND].pipe_ALU_OUTPUT = 0;
+	SIM_TRACE_STAGE(trace, "\n memory input instruct: "<<(instr_names[opcode]));
+	SIM_TRACE_STAGE(trace, "\n memory input ALU_OUTPUT: "<<access.pipe_ALU_OUTPUT<<"\n");
 
-	switch(fp_pipe_reg[SECOND].pipe_IR.opcode)
+	// the memory access takes fp_memLatency extra cycles, during which the stages before MEM are frozen;
+	// the caches are looked up once, in the first cycle of the access
+	if( is_memory(opcode) && !fp_memoryStall )
+	{
+		fp_memLatency = dcache.access(access.pipe_ALU_OUTPUT, opcode == SW || opcode == SWS, fp_clkIn);
+		SIM_TRACE_STAGE(trace, "\n memory access latency: "<<fp_memLatency);
+	}
+	if( is_memory(opcode) && (fp_stallMem < fp_memLatency) )
 	{
-	cout<<"\n Is branch Instruct: "<<(instr_names[fp_pipe_reg[SECOND].pipe_IR.opcode]);
+		fp_memoryStall = true;
+		fp_stallMem += 1;
+		count_stall(MEMORY_STALL, MEM);
+		reset_group(fp_pipe_next[FORTH], issue_width);
+		return;
+	}
+	fp_memoryStall = false;
+	fp_stallMem = 0;
 
-	fp_noBranches = true;
-	fp_branchToLabel = "";
+	for(unsigned l = 0; l < issue_width; l++)
+	{
+		const pipeline_Registers &exmem = fp_pipe_reg[THIRD][l];
+		pipeline_Registers &memwb = fp_pipe_next[FORTH][l];
+		memwb = exmem;
 
-	case BNEZ:
-		if(fp_pipe_reg[SECOND].pipe_IR.src1 != 0)
+		opcode = exmem.pipe_IR.opcode;
+		if(opcode == LW || opcode == LWS) //  LW R1, 4(R2)
 		{
-			fp_branchToLabel = fp_pipe_reg[SECOND].pipe_IR.label;
-			fp_noBranches = false;
+			memwb.pipe_LMD = data_memory.read_word(exmem.pipe_ALU_OUTPUT);
 		}
-		break;
-
-	case BEQZ:
-		if(fp_pipe_reg[SECOND].pipe_IR.src1 == 0)
+		else
+		if(opcode == SW || opcode == SWS) //  SW R1, 4(R2)
 		{
-			fp_branchToLabel = fp_pipe_reg[SECOND].pipe_IR.label;
-			fp_noBranches = false;
-		}
-		break;
+			SIM_TRACE_STAGE(trace, "\n SW: dataMemAddr: "<<exmem.pipe_ALU_OUTPUT<<"\t"<<"data: "<<exmem.pipe_B<<"\n");
 
-	case BLTZ:
-		if(fp_pipe_reg[SECOND].pipe_IR.src1 < 0)
-		{
-			fp_branchToLabel = fp_pipe_reg[SECOND].pipe_IR.label;
-			fp_noBranches = false;
+			//Store register value into data memory
+			write_memory(exmem.pipe_ALU_OUTPUT, exmem.pipe_B);
 		}
-		break;
+	}
+}
 
-	case BGTZ:
-		if(fp_pipe_reg[SECOND].pipe_IR.src1 > 0)
-		{
-			fp_branchToLabel = fp_pipe_reg[SECOND].pipe_IR.label;
-			fp_noBranches = false;
-		}
-		break;
+void sim_pipe_fp::fp_writeBack()
+{
+	SIM_TRACE_STAGE(trace, "\n WB fp_clkIn: "<<fp_clkIn);
 
-	case BLEZ:
-		if(fp_pipe_reg[SECOND].pipe_IR.src1 <= 0)
-		{
-			fp_branchToLabel = fp_pipe_reg[SECOND].pipe_IR.label;
-			fp_noBranches = false;
-		}
-		break;
+	for(unsigned l = 0; l < issue_width; l++)
+	{
+		const pipeline_Registers &memwb = fp_pipe_reg[FORTH][l];
 
-	case BGEZ:
-		if(fp_pipe_reg[SECOND].pipe_IR.src1 >= 0)
+		SIM_TRACE_STAGE(trace, "\n WB input instruct: "<<(instr_names[memwb.pipe_IR.opcode]));
+		SIM_TRACE_STAGE(trace, "\n WB input 2.dest:   "<<memwb.pipe_IR.dest<<"\n");
+
+		// written in the first half of the cycle: ID reads the new value in the second half
+		pending_writes.release(register_mask(dest_register(memwb.pipe_IR)));
+
+		switch(memwb.pipe_IR.opcode)
 		{
-			fp_branchToLabel = fp_pipe_reg[SECOND].pipe_IR.label;
-			fp_noBranches = false;
+		case ADD:
+		case ADDI:
+		case SUB:
+		case SUBI:
+		case XOR:
+			set_int_register(memwb.pipe_IR.dest, memwb.pipe_ALU_OUTPUT); // index, value
+			break;
+		case LW:
+			set_int_register(memwb.pipe_IR.dest, memwb.pipe_LMD); // index, value
+			break;
+		case ADDS:
+		case SUBS:
+		case MULTS:
+		case DIVS:
+			generalP_FPReg[memwb.pipe_IR.dest] = memwb.pipe_ALU_OUTPUT;
+			break;
+		case LWS:
+			generalP_FPReg[memwb.pipe_IR.dest] = memwb.pipe_LMD;
+			break;
+		case EOP:
+			fp_eopRetired = true;
+			if(events.enabled()) events.add(0, EVENT_RETIRED, memwb.pipe_SEQ);
+			return;
+		case NOP:
+			continue;
+		default:
+			break;
 		}
-		break;
 
-	default:
-		fp_noBranches = true;
+		++fp_totalInstCount;
+		if(events.enabled()) events.add(0, EVENT_RETIRED, memwb.pipe_SEQ);
 	}
+}
+
+/* returns the cause of the stall, for the event trace (EVENT_NO_STALL if none) */
+event_stall_t sim_pipe_fp::fp_hazardHandler(unsigned lane)
+{
+	const instruction_t &ir = fp_pipe_reg[FIRST][lane].pipe_IR;
 
-	if(fp_pipe_reg[SECOND].pipe_IR.opcode ==  NOP)
+	fp_stalls = 0;
+
+	if(ir.opcode == NOP) return EVENT_NO_STALL;
+
+	// EOP waits for the execution units to drain so that it retires last
+	if(ir.opcode == EOP)
 	{
-		specialP_Reg[MEM][IR] = NOP;
-		specialP_Reg[MEM][ALU_OUTPUT] = 0;
-		specialP_Reg[MEM][B] = UNDEFINED;
+		if (units_busy > 0) fp_stalls = 1;
+		return fp_stalls ? EVENT_STRUCTURAL_STALL : EVENT_NO_STALL;
 	}
-	else{
-		specialP_Reg[MEM][ALU_OUTPUT] = fp_pipe_reg[SECOND].pipe_ALU_OUTPUT;
-		specialP_Reg[MEM][B] =  specialP_Reg[EXE][B]; //For SW, B holds data
-		specialP_Reg[MEM][IR] =  specialP_Reg[EXE][IR];
+
+	// RAW: the register file is written in the first half of WB and read in the second half of ID
+	fp_stalls = pending_writes.wait(register_mask(src1_register(ir)) | register_mask(src2_register(ir)), fp_clkIn);
+	if(fp_stalls)
+	{
+		SIM_TRACE_STAGE(trace, "\n RAW Hazard detected for instruct: "<<(instr_names[ir.opcode]));
+		return EVENT_DATA_STALL;
 	}
-	//LOAD PIPE3 WITH PIPE2
-	std::memcpy(&fp_pipe_reg[THIRD], &fp_pipe_reg[SECOND], sizeof (pipeline_Registers) );
 
-	if(fp_clkIn == (EXE+1))
+	// WAW: the units complete out of order, so a write must not overtake an older one to the same register
+	if(unit_writes.busy(register_mask(dest_register(ir))))
 	{
-		fp_decode();
-		fp_fetch();
-		++fp_clkIn;
-		cout<<"\n---return true from execute---fp_clkIn: "<<fp_clkIn<<"\n";
+		SIM_TRACE_STAGE(trace, "\n WAW Hazard detected for instruct: "<<(instr_names[ir.opcode]));
+		fp_stalls = 1;
+		return EVENT_DATA_STALL;
 	}
 
+	// structural: no free execution unit of the required type
+	if(get_free_unit(ir.opcode) == UNDEFINED)
+	{
+		SIM_TRACE_STAGE(trace, "\n Structural Hazard detected for instruct: "<<(instr_names[ir.opcode]));
+		fp_stalls = 1;
+		return EVENT_STRUCTURAL_STALL;
+	}
+	return EVENT_NO_STALL;
 }
 
-void sim_pipe_fp::fp_memory()
-{
-	cout<<"\n In memory fp_clkIn: "<<fp_clkIn;
-	cout<<"\n fp_memoryStall: "<<fp_memoryStall<<"fp_stallMem: "<<fp_stallMem<<"\n";
+/* =============================================================
+
+   OUT-OF-ORDER CORE (TOMASULO)
+
+   Selected with core=TOMASULO at construction. IF is the same as in
+   the in-order core; ID, EX, MEM and WB are replaced by:
+
+     issue:    the instruction in IF/ID takes a reorder buffer entry and
+               a reservation station of its unit type, and reads each
+               operand from the register file, from the reorder buffer,
+               or, if it is still being computed, takes the tag of the
+               entry that will produce it (register renaming)
+     execute:  each idle unit starts the oldest instruction in the
+               stations of its type whose operands are both available
+     complete: a branch is resolved and the address of a load or store
+               is computed when its unit completes; results (and loaded
+               values) go on the common data bus to the stations and the
+               reorder buffer, cdb_width per cycle, oldest first. A unit
+               whose result is waiting for the bus stays busy
+     memory:   a load accesses the data memory (through the caches) once
+               its address is known and no older store may write the
+               same word; an older store to the same address provides
+               the value instead
+     commit:   the oldest instruction writes the register file, or the
+               data memory for a store, once its result is known
+
+   A mispredicted branch squashes the younger instructions as soon as
+   it completes, and the register alias table is rebuilt from the
+   reorder buffer. Without a predictor IF waits for each branch, as in
+   the in-order core. Stall cycles are counted when issue is blocked by
+   a full reorder buffer or by the reservation stations (DATA_STALL),
+   when the oldest instruction waits for the data memory (MEMORY_STALL),
+   and by IF (CONTROL_STALL, FETCH_STALL).
+
+   With an issue width N (init_issue_width), issue takes up to N
+   instructions of IF/ID per cycle, in order, until one finds no free
+   entry or station, and commit retires up to N, ending at the first
+   store (the memory port).
+
+   ============================================================= */
+
+/* the value of register "reg", or the reorder buffer entry that will produce it */
+void sim_pipe_fp::read_operand(unsigned reg, unsigned &value, unsigned &tag){
+	value = UNDEFINED;
+	tag = UNDEFINED;
+	if(reg == UNDEFINED) return;
+
+	unsigned e = rename_table[reg];
+	if(e == UNDEFINED) value = read_register(reg);
+	else if(rob[e].state == ROB_DONE) value = rob[e].value;
+	else tag = e;
+}
+
+/* writes the result of entry "e" on the common data bus: the reorder buffer and the waiting stations take it */
+void sim_pipe_fp::broadcast(unsigned e, unsigned value){
+	SIM_TRACE_STAGE(trace, "\n CDB: instruct: "<<(instr_names[rob[e].operands.pipe_IR.opcode])<<" rob: "<<e<<" value: "<<value);
+
+	rob[e].value = value;
+	rob[e].state = ROB_DONE;
+	for (unsigned t=0; t<NUM_UNIT_TYPES; t++){
+		for (unsigned s=0; s<stations[t].size(); s++){
+			station_t &station = stations[t][s];
+			if(!station.busy) continue;
+			if(station.qj == e) { station.vj = value; station.qj = UNDEFINED; }
+			if(station.qk == e) { station.vk = value; station.qk = UNDEFINED; }
+		}
+	}
+}
+
+/* squashes the instructions issued after the one of age "seq" */
+void sim_pipe_fp::squash_younger(unsigned long seq){
+	squash_units(seq);
+	for (unsigned t=0; t<NUM_UNIT_TYPES; t++)
+		for (unsigned s=0; s<stations[t].size(); s++)
+			if(stations[t][s].busy && rob[stations[t][s].rob].seq > seq) stations[t][s].reset();
+	if(mem_user != UNDEFINED && rob[mem_user].seq > seq) mem_user = UNDEFINED;
+	while(rob_count > 0 && rob[(rob_head + rob_count - 1) % rob.size()].seq > seq) rob_count--;
+
+	// the registers are now written by the youngest of the remaining entries, if any
+	std::fill_n(rename_table, 2*NUM_GP_REGISTERS, UNDEFINED);
+	for(unsigned k = 0; k < rob_count; k++)
+	{
+		unsigned e = (rob_head + k) % rob.size();
+		unsigned dest = dest_register(rob[e].operands.pipe_IR);
+		if(dest != UNDEFINED) rename_table[dest] = e;
+	}
+}
 
-	cout<<"\n memory input instruct: "<<(instr_names[fp_pipe_reg[THIRD].pipe_IR.opcode]);
-	cout<<"\n memory input 2.dest:   "<<fp_pipe_reg[THIRD].pipe_IR.dest;
-	cout<<"\n memory input 3.src1:   "<<fp_pipe_reg[THIRD].pipe_IR.src1;
-	cout<<"\n memory input 4.src2:   "<<fp_pipe_reg[THIRD].pipe_IR.src2;
-	cout<<"\n memory input 5.imm:    "<<fp_pipe_reg[THIRD].pipe_IR.immediate;
-	cout<<"\n memory input 6.label:  "<<fp_pipe_reg[THIRD].pipe_IR.label<<"\n";
+void sim_pipe_fp::ooo_issue()
+{
+	SIM_TRACE_STAGE(trace, "\n In ISSUE fp_clkIn: "<<fp_clkIn);
 
-	cout<<"\n specialP_Reg[MEM][IR]:  "<<specialP_Reg[MEM][IR]<<"\n";
-	cout<<"\n give specialP_Reg[MEM][ALU_OUTPUT]: "<<specialP_Reg[MEM][ALU_OUTPUT]<<"\n";
+	fp_stalls = 0;
 
-	if(!data_memory_latency)
-		fp_memoryStall = false;
+	// the instructions in ID are on the wrong path of a branch that has just completed
+	if(fp_mispredict)
+	{
+		count_stall(CONTROL_STALL, ID);
+		return;
+	}
 
-	if(fp_stallMem < data_memory_latency)
+	// the instructions in IF/ID are issued in order, as long as there is room for them
+	unsigned l = 0;
+	for(; l < issue_width; l++)
 	{
-		if( ( fp_pipe_reg[THIRD].pipe_IR.opcode == LW ) ||
-				( fp_pipe_reg[THIRD].pipe_IR.opcode == SW )  )
+		const pipeline_Registers &ifid = fp_pipe_reg[FIRST][l];
+		const instruction_t &ir = ifid.pipe_IR;
+
+		SIM_TRACE_STAGE(trace, "\n issue input instruct: "<<(instr_names[ir.opcode]));
+
+		if(ir.opcode == NOP) continue;
+
+		// structural: a reorder buffer entry and (but for EOP) a reservation station are needed
+		unsigned s = UNDEFINED;
+		if(ir.opcode != EOP)
 		{
-			if(!fp_stallMem)
-			{
-				cout<<"\n Memory latency required for inst: "<<(instr_names[fp_pipe_reg[THIRD].pipe_IR.opcode]);
-			}
-			fp_memoryStall = true;
-			fp_totalStalls += 1;
-			fp_stallMem += 1;
-			fp_memStallCompleted = false;
+			const vector<station_t> &rs = stations[unit_type(ir.opcode)];
+			for(unsigned k = 0; k < rs.size() && s == UNDEFINED; k++)
+				if(!rs[k].busy) s = k;
+		}
+		if(rob_count == rob.size() || (ir.opcode != EOP && s == UNDEFINED))
+		{
+			SIM_TRACE_STAGE(trace, "\n reorder buffer or reservation stations full for instruct: "<<(instr_names[ir.opcode]));
+			fp_stalls = 1;
+			break;
 		}
 
-	}else
-		if((data_memory_latency) && (fp_stallMem == data_memory_latency))
+		unsigned e = (rob_head + rob_count) % rob.size();
+		rob_count++;
+		rob_entry_t &entry = rob[e];
+		entry.operands = ifid;
+		if(is_int_imm(ir.opcode) || is_memory(ir.opcode) || is_branch(ir.opcode))
+			entry.operands.pipe_IMM = ir.immediate;
+		entry.seq = issue_seq++;
+		entry.state = (ir.opcode == EOP) ? ROB_DONE : ROB_WAITING;
+		entry.value = UNDEFINED;
+		entry.address = UNDEFINED;
+		entry.unit = UNDEFINED;
+
+		if(ir.opcode == EOP) continue;
+
+		station_t &station = stations[unit_type(ir.opcode)][s];
+		station.busy = true;
+		station.rob = e;
+		if(ir.opcode == SW || ir.opcode == SWS) //SW src1 imm(src2): A holds the base address, B the data to be stored
 		{
-			fp_memoryStall = false;
-			fp_stallMem = 0;
-			fp_memStallCompleted = true;
+			read_operand(src2_register(ir), station.vj, station.qj);
+			read_operand(src1_register(ir), station.vk, station.qk);
+		}
+		else
+		{
+			read_operand(src1_register(ir), station.vj, station.qj);
+			read_operand(src2_register(ir), station.vk, station.qk);
 		}
 
-	if(fp_memoryStall) return;
+		// the later readers of the destination (also in this group) wait for this entry
+		unsigned dest = dest_register(ir);
+		if(dest != UNDEFINED) rename_table[dest] = e;
+	}
 
-	if(fp_pipe_reg[THIRD].pipe_IR.opcode ==  NOP)
-		specialP_Reg[MEM][IR] = NOP;
+	// a full reorder buffer or full reservation stations are counted as DATA_STALL, and traced as structural
+	if(l == 0 && fp_stalls)
+	{
+		count_stall(DATA_STALL, ID);
+		fp_stageStall[ID] = EVENT_STRUCTURAL_STALL;
+		return;
+	}
 
-	if( specialP_Reg[MEM][IR] == LW) //  LW R1, 4(R2)
+	// the rest of the group waits in IF/ID, oldest first (IF is frozen while fp_stalls is not 0)
+	if(fp_stalls)
 	{
-		fp_pipe_reg[FORTH].pipe_LMD = data_memory[specialP_Reg[MEM][ALU_OUTPUT]]; // index, value
+		fp_stageStall[ID] = EVENT_STRUCTURAL_STALL;
+		for(unsigned k = 0; k < issue_width; k++)
+		{
+			if(l + k < issue_width) fp_pipe_next[FIRST][k] = fp_pipe_reg[FIRST][l + k];
+			else fp_pipe_next[FIRST][k].reset();
+		}
+	}
+}
 
-		unsigned dataFromMem = *(data_memory + specialP_Reg[MEM][ALU_OUTPUT]);
-		//unsigned char *address = static_cast<void const*>(&data_memory[specialP_Reg[MEM][ALU_OUTPUT]]);
-		//write_memory(specialP_Reg[MEM][ALU_OUTPUT],0x34);
+void sim_pipe_fp::ooo_execute()
+{
+	SIM_TRACE_STAGE(trace, "\nIn exe fp_clkIn: "<<fp_clkIn<<"\n");
+
+	// each idle unit starts the oldest instruction of its type whose operands are available
+	for (unsigned t=0; t<NUM_UNIT_TYPES; t++){
+		vector<station_t> &rs = stations[t];
+		unsigned u;
+		while ((u = free_unit((exe_unit_t)t)) != UNDEFINED){
+			unsigned s = UNDEFINED;
+			for (unsigned k=0; k<rs.size(); k++){
+				if (!rs[k].busy || rs[k].qj != UNDEFINED || rs[k].qk != UNDEFINED) continue;
+				if (s == UNDEFINED || rob[rs[k].rob].seq < rob[rs[s].rob].seq) s = k;
+			}
+			if (s == UNDEFINED) break;
+
+			unit_t &unit = exec_units[u];
+			const rob_entry_t &entry = rob[rs[s].rob];
+			claim_unit(u, entry.operands, entry.seq);
+			unit.operands.pipe_A = rs[s].vj;
+			unit.operands.pipe_B = rs[s].vk;
+			unit.rob = rs[s].rob;
+			rob[unit.rob].unit = u;
+			start_unit(u, fp_clkIn + unit.latency + 1);
+			rs[s].reset();
+
+			SIM_TRACE_STAGE(trace, "\n execute started instruct: "<<(instr_names[unit.instruction.opcode])<<" on unit "<<unit_names[unit.type]);
+		}
+	}
+}
 
-		//unsigned da = char2int(data_memory + specialP_Reg[MEM][ALU_OUTPUT]);
+void sim_pipe_fp::ooo_memory()
+{
+	// one access at a time: a committing store, or the oldest load that can go
+	if(mem_user != UNDEFINED) return;
 
-		specialP_Reg[WB][LMD] = dataFromMem;
-	}
-	else
-		if( specialP_Reg[MEM][IR] == SW) //SW reg1, srcreg2:  SW R1, R3 or SW R1, 4(R2)
+	for(unsigned k = 0; k < rob_count; k++)
+	{
+		unsigned e = (rob_head + k) % rob.size();
+		rob_entry_t &load = rob[e];
+		opcode_t opcode = load.operands.pipe_IR.opcode;
+
+		// the loads after a store whose address is not known yet wait for it
+		if((opcode == SW || opcode == SWS) && load.state != ROB_DONE) return;
+		if(load.state != ROB_MEMORY) continue;
+
+		// the youngest older store writing the same word provides the value; one writing part of it must commit first
+		unsigned forward = UNDEFINED;
+		bool overlap = false;
+		for(unsigned j = 0; j < k; j++)
 		{
-			unsigned long dataMemAddr = 0;
-			unsigned long data = 0;
-
-			data = specialP_Reg[MEM][B];
+			const rob_entry_t &store = rob[(rob_head + j) % rob.size()];
+			if(store.operands.pipe_IR.opcode != SW && store.operands.pipe_IR.opcode != SWS) continue;
+			if(store.address == load.address) { forward = (rob_head + j) % rob.size(); overlap = false; }
+			else if(store.address + 4 > load.address && load.address + 4 > store.address) overlap = true;
+		}
+		if(overlap) continue;
 
-			dataMemAddr = specialP_Reg[MEM][ALU_OUTPUT];
+		mem_user = e;
+		if(forward != UNDEFINED)
+		{
+			SIM_TRACE_STAGE(trace, "\n load forwarded from store at rob: "<<forward);
+			load.value = rob[forward].value;
+			mem_ready = fp_clkIn + 1;
+		}
+		else
+		{
+			unsigned latency = dcache.access(load.address, false, fp_clkIn);
+			SIM_TRACE_STAGE(trace, "\n memory access latency: "<<latency);
+			load.value = data_memory.read_word(load.address);
+			mem_ready = fp_clkIn + 1 + latency;
+		}
+		return;
+	}
+}
 
-			cout<<"\n SW: dataMemAddr: "<<dataMemAddr<<"\t"<<"data: "<<data<<"\n";
+void sim_pipe_fp::ooo_complete()
+{
+	SIM_TRACE_STAGE(trace, "\n In COMPLETE fp_clkIn: "<<fp_clkIn);
+
+	// the units whose execution is over in this cycle, oldest first; those with a result for the common data bus
+	// wait in units_completed (the result is kept in the ALU output of the unit)
+	collect_completed();
+
+	for (unsigned k=0; k<by_age.size(); k++){
+		unit_t &unit = exec_units[by_age[k]];
+		if (unit.instruction.opcode == NOP) continue; // squashed by an older branch completing in this cycle
+
+		const pipeline_Registers &ops = unit.operands;
+		opcode_t opcode = ops.pipe_IR.opcode;
+		rob_entry_t &entry = rob[unit.rob];
+		unsigned value = alu(opcode, ops.pipe_A, ops.pipe_B, ops.pipe_IMM, ops.pipe_NPC);
+
+		if (!is_branch(opcode) && !is_memory(opcode)){
+			unit.operands.pipe_ALU_OUTPUT = value;
+			unit_ref_t ref = {unit.issued, unit.issued, by_age[k]};
+			units_completed.push(ref);
+			continue;
+		}
 
-			//Store register value into data memory
-			write_memory(dataMemAddr, data);
+		// branches and addresses do not need the bus: the unit is released at once
+		if (opcode == LW || opcode == LWS){
+			entry.address = value;
+			entry.state = ROB_MEMORY;
 		}
 		else
-		{
-			specialP_Reg[WB][ALU_OUTPUT]=specialP_Reg[MEM][ALU_OUTPUT];
-			//specialP_Reg[MEM][IMM]=fp_pipe_reg[SECOND].pipe_IR.immediate;
+		if (opcode == SW || opcode == SWS){
+			entry.address = value;
+			entry.value = ops.pipe_B;
+			entry.state = ROB_DONE;
+		}
+		else {
+			entry.state = ROB_DONE;
+			bool taken = branch_taken(opcode, ops.pipe_A);
+			if(bpred.enabled())
+			{
+				// train the predictor; on a wrong prediction IF, ID and the younger instructions are squashed
+				if(bpred.update(ops.pipe_PC, opcode != JUMP, taken, value, ops.pipe_PRED_PC))
+				{
+					fp_mispredict = true;
+					fp_branchTarget = taken ? ops.pipe_IR.target : (ops.pipe_NPC - instr_base_address) / 4;
+					squash_younger(unit.issued);
+				}
+			}
+			else
+			if(taken)
+			{
+				SIM_TRACE_STAGE(trace, "\n Branch taken to: "<<fp_labelNames.name(ops.pipe_IR.target));
+				fp_branchTarget = ops.pipe_IR.target;
+			}
 		}
+		release_unit(by_age[k]);
+	}
 
-	specialP_Reg[WB][IR] = specialP_Reg[MEM][IR];
+	// a completed load competes for the bus with the units
+	bool loadReady = mem_user != UNDEFINED && rob[mem_user].state == ROB_MEMORY && fp_clkIn >= mem_ready;
 
-	//LOAD PIPE4 WITH PIPE3
-	std::memcpy(&fp_pipe_reg[FORTH], &fp_pipe_reg[THIRD], sizeof (pipeline_Registers) );
+	for (unsigned b=0; b<cdb_width; b++){
+		// results of the units squashed meanwhile are dropped
+		while (!units_completed.empty() && !unit_holds(units_completed.top())) units_completed.pop();
+		bool unitReady = !units_completed.empty();
 
-	if(fp_clkIn == (MEM+1))
-	{
-		fp_execute();
-		fp_decode();
-		fp_fetch();
-		++fp_clkIn;
-		cout<<"\n---return true from memory---fp_clkIn: "<<fp_clkIn<<"\n";
+		if (loadReady && (!unitReady || rob[mem_user].seq < units_completed.top().issued)){
+			broadcast(mem_user, rob[mem_user].value);
+			mem_user = UNDEFINED;
+			loadReady = false;
+		}
+		else
+		if (unitReady){
+			unsigned u = units_completed.top().unit;
+			units_completed.pop();
+			broadcast(exec_units[u].rob, exec_units[u].operands.pipe_ALU_OUTPUT);
+			release_unit(u);
+		}
 	}
 }
 
-void sim_pipe_fp::fp_writeBack()
+void sim_pipe_fp::ooo_commit()
 {
-	cout<<"\n WB fp_clkIn: "<<fp_clkIn<<"\n";
-	cout<<"\n fp_memoryStall: "<<fp_memoryStall;
-
-	cout<<"\n WB input instruct: "<<(instr_names[fp_pipe_reg[FORTH].pipe_IR.opcode]);
-	//	cout<<"\n WB input 1.opcode: "<<fp_pipe_reg[FORTH].pipe_IR.opcode;
-	cout<<"\n WB input 2.dest:   "<<fp_pipe_reg[FORTH].pipe_IR.dest;
-	cout<<"\n WB input 3.src1:   "<<fp_pipe_reg[FORTH].pipe_IR.src1;
-	cout<<"\n WB input 4.src2:   "<<fp_pipe_reg[FORTH].pipe_IR.src2;
-	cout<<"\n WB input 5.imm:   "<<fp_pipe_reg[FORTH].pipe_IR.immediate;
-	cout<<"\n WB input 6.label: "<<fp_pipe_reg[FORTH].pipe_IR.label<<"\n";
-
-	if(fp_pipe_reg[FORTH].pipe_IR.opcode ==  NOP)
-		specialP_Reg[WB][IR] = NOP;
-
-	if(     (specialP_Reg[WB][IR] == ADD)  ||
-			(specialP_Reg[WB][IR] == ADDI) ||
-			(specialP_Reg[WB][IR] == SUB)  ||
-			(specialP_Reg[WB][IR] == SUBI) ||
-			(specialP_Reg[WB][IR] == XOR)   )
+	// up to issue_width instructions per cycle, in order; a store ends the commits of its cycle (one memory port)
+	for(unsigned c = 0; c < issue_width && rob_count > 0; c++)
 	{
-		set_int_register(fp_pipe_reg[FORTH].pipe_IR.dest, specialP_Reg[WB][ALU_OUTPUT]); // index, value
-	}
-	else
-		if( specialP_Reg[WB][IR] == LW) //LW
+		rob_entry_t &entry = rob[rob_head];
+		const instruction_t &ir = entry.operands.pipe_IR;
+
+		SIM_TRACE_STAGE(trace, "\n In COMMIT fp_clkIn: "<<fp_clkIn<<" instruct: "<<(instr_names[ir.opcode]));
+
+		if(entry.state == ROB_MEMORY && c == 0) count_stall(MEMORY_STALL, MEM);
+		if(entry.state != ROB_DONE) return;
+
+		bool store = ir.opcode == SW || ir.opcode == SWS;
+		if(store)
 		{
-			set_int_register(fp_pipe_reg[FORTH].pipe_IR.dest, specialP_Reg[WB][LMD]); // index, value
+			// the store writes the data memory (through the caches) when it commits, and holds the memory port meanwhile
+			if(mem_user == UNDEFINED)
+			{
+				mem_user = rob_head;
+				mem_ready = fp_clkIn + dcache.access(entry.address, true, fp_clkIn);
+			}
+			if(mem_user != rob_head || fp_clkIn < mem_ready)
+			{
+				if(c == 0) count_stall(MEMORY_STALL, MEM);
+				return;
+			}
+			mem_user = UNDEFINED;
+
+			SIM_TRACE_STAGE(trace, "\n SW: dataMemAddr: "<<entry.address<<"\t"<<"data: "<<entry.value<<"\n");
+			write_memory(entry.address, entry.value);
+		}
+		else
+		{
+			unsigned dest = dest_register(ir);
+			if(dest != UNDEFINED)
+			{
+				if(dest >= NUM_GP_REGISTERS) generalP_FPReg[dest - NUM_GP_REGISTERS] = entry.value;
+				else generalP_IntReg[dest] = entry.value;
+				if(rename_table[dest] == rob_head) rename_table[dest] = UNDEFINED;
+			}
 		}
 
-	if(fp_clkIn >= (WB+1))
-	{
-		fp_memory();
-		fp_execute();
-		fp_decode();
-		fp_fetch();
+		rob_head = (rob_head + 1) % rob.size();
+		rob_count--;
 
-		if((specialP_Reg[WB][IR] == EOP) && (fp_noBranches))
+		if(events.enabled()) events.add(0, EVENT_RETIRED, entry.operands.pipe_SEQ);
+		if(ir.opcode == EOP)
 		{
-			fp_runAlways = false;
-			cout<<"\n---EOP Detected---fp_clkIn: "<<fp_clkIn<<"\n";
+			fp_eopRetired = true;
 			return;
 		}
+		++fp_totalInstCount;
+		if(store) return;
+	}
+}
 
-		/*	cout<<"\n WB--> fp_clkIn: "<<fp_clkIn;
-		cout<<"\n fp_totalStalls: "<<fp_totalStalls;
-		cout<<"\n fp_found:       "<<fp_found;
-		cout<<"\n fp_resolved:    "<<fp_resolved;
-		//	if(specialP_Reg[WB][IR] != 14)
-		 */
+/* =============================================================
 
-		++fp_clkIn;
+   SCOREBOARD CORE (CDC 6600)
+
+   Selected with core=SCOREBOARD at construction. IF is the same as in
+   the in-order core. Each instruction then goes through four phases,
+   controlled by the status of its functional unit (Fi, Fj, Fk, Qj, Qk,
+   Rj, Rk) and by the register result status:
+
+     issue:         in order, once a unit of the required type is free
+                    (structural) and no active instruction writes the
+                    same register (WAW)
+     read operands: once no unit is going to write its sources (RAW)
+     execute:       for the latency of the unit; loads and stores then
+                    access the data memory through a single memory port,
+                    in issue order
+     write result:  once no earlier instruction still has to read the
+                    destination (WAR); the register file has one write
+                    port, given to the oldest instruction that can write
+
+   Instructions issued after a branch that has not been resolved yet
+   execute, but neither store nor write their results until it is; a
+   mispredicted branch squashes them. Stall cycles are counted when
+   issue is blocked (DATA_STALL), for the latency of the memory
+   accesses (MEMORY_STALL), and by IF.
+
+   With an issue width N (init_issue_width), up to N instructions of
+   IF/ID issue per cycle, in order, until one has a hazard, and the
+   register file has N write ports.
 
-		cout<<"\n--- write back cycle done---fp_clkIn: "<<fp_clkIn<<"\n";
-	}
+   ============================================================= */
+
+/* no unit still has to read the register that unit "u" writes (WAR); "u" has read its own operands already */
+bool sim_pipe_fp::sb_no_war(unsigned u){
+	return register_readers[exec_units[u].fi] == 0;
 }
 
-void sim_pipe_fp::fp_hazardHandler()
+void sim_pipe_fp::sb_issue()
 {
-	cout<<"\n hazardHandler, fp_clkIn: "<<fp_clkIn;
-	cout<<"\n hazardHandler, fp_stalls: "<<fp_stalls<<" fp_totalStalls: "<<fp_totalStalls;
-	cout<<"\n hazardHandler, fp_memoryStall: "<<fp_memoryStall;
-	cout<<"\n hazardHandler, fp_stallMem: "<<fp_stallMem;
-
-	if(fp_memoryStall)
-		return;
-
-	bool nopInst = false;
-	cout<<"\n fp_pipe_reg[FIRST].pipe_IR.instru :  "<<instr_names[fp_pipe_reg[FIRST].pipe_IR.opcode];
-	cout<<"\n fp_pipe_reg[SECOND].pipe_IR.instru : "<<instr_names[fp_pipe_reg[SECOND].pipe_IR.opcode];
-	cout<<"\n fp_pipe_reg[THIRD].pipe_IR.instru :  "<<instr_names[fp_pipe_reg[THIRD].pipe_IR.opcode];
-	cout<<"\n fp_pipe_reg[FORTH].pipe_IR.instru :  "<<instr_names[fp_pipe_reg[FORTH].pipe_IR.opcode];
+	SIM_TRACE_STAGE(trace, "\n In ISSUE fp_clkIn: "<<fp_clkIn);
 
+	fp_stalls = 0;
 
-	if( (fp_pipe_reg[FIRST].pipe_IR.opcode == NOP)  ||
-			(fp_pipe_reg[SECOND].pipe_IR.opcode == NOP) ||
-			(fp_pipe_reg[THIRD].pipe_IR.opcode == NOP)   )
+	// the instructions in ID are on the wrong path of a branch that has just been resolved
+	if(fp_mispredict)
 	{
-		nopInst = true;
+		count_stall(CONTROL_STALL, ID);
+		return;
 	}
 
-	if((!fp_stalls) && (!nopInst))
+	// the instructions in IF/ID are issued in order, up to the first one with a hazard; the register result
+	// status and the units are updated at each issue, so the younger instructions of the group see the older ones
+	event_stall_t cause = EVENT_NO_STALL;
+	unsigned l = 0;
+	for(; l < issue_width; l++)
 	{
-		if(specialP_Reg[ID][IR] == SW)
-		{
-			specialP_Reg[ID][B] = fp_pipe_reg[FIRST].pipe_IR.src1;
-			specialP_Reg[ID][A] = fp_pipe_reg[FIRST].pipe_IR.src2;
-		}else
+		const instruction_t &ir = fp_pipe_reg[FIRST][l].pipe_IR;
+
+		SIM_TRACE_STAGE(trace, "\n issue input instruct: "<<(instr_names[ir.opcode]));
+
+		if(ir.opcode == NOP) continue;
+
+		// EOP completes the program once the units have drained
+		if(ir.opcode == EOP)
 		{
-			specialP_Reg[ID][A] = fp_pipe_reg[FIRST].pipe_IR.src1; //3
-			specialP_Reg[ID][B] = fp_pipe_reg[FIRST].pipe_IR.src2; //4
+			if (units_busy > 0) fp_stalls = 1;
+			cause = EVENT_STRUCTURAL_STALL;
+			if(fp_stalls) break;
+			fp_eopRetired = true;
+			if(events.enabled()) events.add(0, EVENT_RETIRED, fp_pipe_reg[FIRST][l].pipe_SEQ);
+			return;
 		}
 
-		if(fp_pipe_reg[FIRST].pipe_IR.opcode == SW)
+		// structural: no free unit of the required type; WAW: an active instruction writes the same register
+		unsigned dest = dest_register(ir);
+		unsigned u = get_free_unit(ir.opcode);
+		if(u == UNDEFINED || (dest != UNDEFINED && register_status[dest] != UNDEFINED))
 		{
-			if( ( specialP_Reg[ID][A] == fp_pipe_reg[SECOND].pipe_IR.dest) ||
-					( specialP_Reg[ID][B] == fp_pipe_reg[SECOND].pipe_IR.dest)  )
-			{
-				cout<<"\n SW hazard detected ";
-				cout<<"\n for instruct: "<<(instr_names[fp_pipe_reg[FIRST].pipe_IR.opcode]);
-				cout<<"\n with instruct: "<<(instr_names[fp_pipe_reg[SECOND].pipe_IR.opcode]);
+			SIM_TRACE_STAGE(trace, "\n "<<(u == UNDEFINED ? "Structural" : "WAW")<<" Hazard detected for instruct: "<<(instr_names[ir.opcode]));
+			fp_stalls = 1;
+			cause = (u == UNDEFINED) ? EVENT_STRUCTURAL_STALL : EVENT_DATA_STALL;
+			break;
+		}
 
-				fp_stalls = 2;
-				cout<<"\n fp_stalls 2 req fp_clkIn: "<<fp_clkIn<<"fp_currentClk: "<<fp_currentClk;
-				fp_found +=1;
-				fp_currentClk = fp_clkIn;
+		unit_t &unit = exec_units[u];
+		claim_unit(u, fp_pipe_reg[FIRST][l], issue_seq++);
+		if(is_int_imm(ir.opcode) || is_memory(ir.opcode) || is_branch(ir.opcode))
+			unit.operands.pipe_IMM = ir.immediate;
+		unit.phase = SB_OPERANDS;
 
-			}
-			else
-				if( ( (fp_pipe_reg[FORTH].pipe_IR.opcode != NOP) &&
-						(fp_pipe_reg[FORTH].pipe_IR.opcode != SW)  &&
-						(fp_pipe_reg[FORTH].pipe_IR.opcode != BNEZ)&&
-						(fp_pipe_reg[FORTH].pipe_IR.opcode != BLTZ)  ) &&	(
-								( specialP_Reg[ID][A] == fp_pipe_reg[FORTH].pipe_IR.dest) ||
-								( specialP_Reg[ID][B] == fp_pipe_reg[FORTH].pipe_IR.dest)  ) )
-				{
-					cout<<"\n SW hazard detected ";
-					cout<<"\n for instruct: "<<(instr_names[fp_pipe_reg[FIRST].pipe_IR.opcode]);
-					cout<<"\n with instruct: "<<(instr_names[fp_pipe_reg[FORTH].pipe_IR.opcode]);
-
-					fp_stalls = 1;
-					cout<<"\n fp_stalls 1 req fp_clkIn: "<<fp_clkIn<<"fp_currentClk: "<<fp_currentClk;
-					fp_found += 1;
-					fp_currentClk = fp_clkIn;
-				}
+		unit.fi = dest;
+		if(ir.opcode == SW || ir.opcode == SWS) //SW src1 imm(src2): A holds the base address, B the data to be stored
+		{
+			unit.fj = src2_register(ir);
+			unit.fk = src1_register(ir);
 		}
 		else
-			if( (specialP_Reg[ID][A] == fp_pipe_reg[SECOND].pipe_IR.dest) ||
-					(specialP_Reg[ID][B] == fp_pipe_reg[SECOND].pipe_IR.dest) )
-			{
-				if( 	(fp_pipe_reg[SECOND].pipe_IR.opcode == ADD)  || //ADD
-						(fp_pipe_reg[SECOND].pipe_IR.opcode == ADDI) || //ADDI
-						(fp_pipe_reg[SECOND].pipe_IR.opcode == SUB)  || //SUB
-						(fp_pipe_reg[SECOND].pipe_IR.opcode == SUBI) || //SUBI
-						(fp_pipe_reg[SECOND].pipe_IR.opcode == XOR)  || //XOR
-						(fp_pipe_reg[SECOND].pipe_IR.opcode == LW)    ) //LW
-				{
-					cout<<"\n RAW Hazard detected";
-					cout<<"\n for instruct: "<<(instr_names[fp_pipe_reg[FIRST].pipe_IR.opcode]);
-					cout<<"\n with instruct: "<<(instr_names[fp_pipe_reg[SECOND].pipe_IR.opcode]);
-
-					fp_stalls = 2;
-					fp_currentClk = fp_clkIn;
-					fp_found +=1;
-					cout<<"\n fp_pipe_reg[SECOND].pipe_IR.opcode: "<<fp_pipe_reg[SECOND].pipe_IR.opcode;
-					cout<<"\n fp_stalls 2 req fp_clkIn: "<<fp_clkIn<<" fp_currentClk: "<<fp_currentClk;
-				}
-			}
-			else
-				if(( ( fp_pipe_reg[THIRD].pipe_IR.opcode != SW)    &&
-						( fp_pipe_reg[FIRST].pipe_IR.opcode != BNEZ)  &&
-						( fp_pipe_reg[THIRD].pipe_IR.opcode != NOP)   &&
-						( fp_pipe_reg[THIRD].pipe_IR.opcode != BNEZ)   )  &&
-						( ( specialP_Reg[ID][A] == fp_pipe_reg[THIRD].pipe_IR.dest) ||
-								( specialP_Reg[ID][B] == fp_pipe_reg[THIRD].pipe_IR.dest) ) )
-				{
-					cout<<"\n Hazard detected, third";
-					cout<<"\n for instruct: "<<(instr_names[fp_pipe_reg[FIRST].pipe_IR.opcode]);
-					cout<<"\n with instruct: "<<(instr_names[fp_pipe_reg[THIRD].pipe_IR.opcode]);
+		{
+			unit.fj = src1_register(ir);
+			unit.fk = src2_register(ir);
+		}
+		unit.qj = (unit.fj == UNDEFINED) ? UNDEFINED : register_status[unit.fj];
+		unit.qk = (unit.fk == UNDEFINED) ? UNDEFINED : register_status[unit.fk];
+		unit.rj = unit.fj != UNDEFINED && unit.qj == UNDEFINED;
+		unit.rk = unit.fk != UNDEFINED && unit.qk == UNDEFINED;
+		if(unit.rj) register_readers[unit.fj]++;
+		if(unit.rk) register_readers[unit.fk]++;
+
+		// the unit waits for the producers of its sources, or can read them; a load or store also waits for the memory port
+		if(unit.qj != UNDEFINED) exec_units[unit.qj].waiters.push_back(u);
+		if(unit.qk != UNDEFINED && unit.qk != unit.qj) exec_units[unit.qk].waiters.push_back(u);
+		if(unit.qj == UNDEFINED && unit.qk == UNDEFINED)
+		{
+			unit_ref_t ready = {u, unit.issued, u};
+			units_ready.push(ready);
+		}
+		if(is_memory(ir.opcode))
+		{
+			unit_ref_t ref = {unit.issued, unit.issued, u};
+			units_memory.push(ref);
+		}
 
-					fp_stalls = 1;
-					fp_currentClk = fp_clkIn;
-					cout<<"\n stall 1 required";
-				}
-				else
-					if( ( ( fp_pipe_reg[FORTH].pipe_IR.opcode != SW)    &&
-							( fp_pipe_reg[FORTH].pipe_IR.opcode != BNEZ)  &&
-							( fp_pipe_reg[FIRST].pipe_IR.opcode != BNEZ)  &&
-							( fp_pipe_reg[FORTH].pipe_IR.opcode != NOP)   &&
-							( fp_pipe_reg[FORTH].pipe_IR.opcode != BLTZ)   ) &&
-							( ( specialP_Reg[ID][A] == fp_pipe_reg[FORTH].pipe_IR.dest) ||
-									( specialP_Reg[ID][B] == fp_pipe_reg[FORTH].pipe_IR.dest)  ) )
-					{
-						cout<<"\n Hazard detected, forth";
-						cout<<"\n for instruct: "<<(instr_names[fp_pipe_reg[FIRST].pipe_IR.opcode]);
-						cout<<"\n with instruct: "<<(instr_names[fp_pipe_reg[FORTH].pipe_IR.opcode]);
-						cout<<"\n fp_pipe_reg[FORTH].pipe_IR.dest: "<<fp_pipe_reg[FORTH].pipe_IR.dest<<"\n";
-
-						fp_stalls = 1;
-						fp_currentClk = fp_clkIn;
-						fp_found +=1;
-						cout<<"\n stall 1 required";
-					}
-					else
-						if(     (fp_pipe_reg[FIRST].pipe_IR.opcode == BNEZ) ||
-								(fp_pipe_reg[FIRST].pipe_IR.opcode == BEQZ) ||
-								(fp_pipe_reg[FIRST].pipe_IR.opcode == BLTZ) ||
-								(fp_pipe_reg[FIRST].pipe_IR.opcode == BGTZ) ||
-								(fp_pipe_reg[FIRST].pipe_IR.opcode == BLEZ) ||
-								(fp_pipe_reg[FIRST].pipe_IR.opcode == BGEZ)  )
-						{
-							cout<<"\n Branching detected";
-							cout<<"\n for instruct: "<<(instr_names[fp_pipe_reg[FIRST].pipe_IR.opcode]);
-
-							fp_stalls = 2;
-							fp_currentClk = fp_clkIn;
-							fp_found +=1;
-							fp_branchStall = true;
-							cout<<"\n fp_stalls 2 req fp_clkIn: "<<fp_clkIn<<" fp_currentClk: "<<fp_currentClk;
-
-						}
-
-		if(fp_stalls){
-			cout<<"\n Hazard detected, required fp_stalls: "<<fp_stalls;
-		}else
-			fp_memStallCompleted = false;
-
-	}
-
-	unsigned memS = 0;
-	if(fp_memStallCompleted && (!fp_branchStall))
-	{
-		memS = 4;
+		if(dest != UNDEFINED) register_status[dest] = u;
 	}
 
-	cout<<"\n fp_memStallCompleted: "<<fp_memStallCompleted;
-
-	cout<<"\n fp_clkIn: "<<fp_clkIn;
+	if(l == 0 && fp_stalls)
+	{
+		count_stall(DATA_STALL, ID);
+		fp_stageStall[ID] = cause;
+		return;
+	}
 
-	cout<<"\n fp_currentClk: "<<fp_currentClk;
-	cout<<"\n fp_stalls: "<<fp_stalls;
-	cout<<"\n memS: "<<memS;
+	// the rest of the group waits in IF/ID, oldest first (IF is frozen while fp_stalls is not 0)
+	if(fp_stalls)
+	{
+		fp_stageStall[ID] = cause;
+		for(unsigned k = 0; k < issue_width; k++)
+		{
+			if(l + k < issue_width) fp_pipe_next[FIRST][k] = fp_pipe_reg[FIRST][l + k];
+			else fp_pipe_next[FIRST][k].reset();
+		}
+	}
+}
 
-	cout<<"\n fp_currentClk+fp_stalls+memS: "<<(fp_currentClk+fp_stalls+memS);
+void sim_pipe_fp::sb_execute()
+{
+	SIM_TRACE_STAGE(trace, "\nIn exe fp_clkIn: "<<fp_clkIn<<"\n");
 
-	if((fp_stalls) && (fp_clkIn == (fp_currentClk+fp_stalls+memS)) )
+	// the access on the memory port is over: the unit can write its result
+	if(mem_user != UNDEFINED)
 	{
-		cout<<"\n fp_pipe_reg[SECOND].pipe_ALU_OUTPUT: "<<fp_pipe_reg[SECOND].pipe_ALU_OUTPUT;
-
-		cout<<"\n------ fp_stalls done---------\n";
+		if(fp_clkIn < mem_ready) count_stall(MEMORY_STALL, MEM);
+		else
+		{
+			exec_units[mem_user].phase = SB_WRITE;
+			unit_ref_t ref = {exec_units[mem_user].issued, exec_units[mem_user].issued, mem_user};
+			units_writing.push(ref);
+			mem_user = UNDEFINED;
+		}
+	}
 
-		fp_totalStalls += fp_stalls;
-		fp_stalls = 0;
-		fp_resolved += 1;
+	// the units whose execution is over
+	collect_completed();
+	for (unsigned k=0; k<by_age.size(); k++){
+		unsigned u = by_age[k];
+		unit_t &unit = exec_units[u];
+		pipeline_Registers &ops = unit.operands;
+		opcode_t opcode = unit.instruction.opcode;
+		SIM_TRACE_STAGE(trace, "\n execute completed instruct: "<<(instr_names[opcode])<<" on unit "<<unit_names[unit.type]);
+		ops.pipe_ALU_OUTPUT = alu(opcode, ops.pipe_A, ops.pipe_B, ops.pipe_IMM, ops.pipe_NPC);
+		if (is_branch(opcode)) ops.pipe_COND = branch_taken(opcode, ops.pipe_A);
+		unit.phase = is_memory(opcode) ? SB_MEMORY : SB_WRITE;
+		if (unit.phase == SB_WRITE){
+			unit_ref_t ref = {unit.issued, unit.issued, u};
+			units_writing.push(ref);
+		}
+	}
 
-		if(fp_branchStall)	fp_branchStall = false;
+	// the pipelines accepting an instruction again give their blocked units another try
+	while (!pipes_blocked.empty() && pipes_blocked.top().first <= fp_clkIn){
+		vector<unit_ref_t> &blocked = pipes[pipes_blocked.top().second].blocked;
+		pipes_blocked.pop();
+		for (unsigned k=0; k<blocked.size(); k++) units_ready.push(blocked[k]);
+		blocked.clear();
 	}
-	/*
-	if(fp_totalStalls == 32)
-	{
-		cout<<"\n 33stalls done----";
+
+	// read operands, lowest unit first (which of the units of a pipeline starts): no unit is going to write the sources
+	// any more (RAW), and the pipeline accepts an instruction (the unit is blocked on it otherwise)
+	while (!units_ready.empty()){
+		unit_ref_t ref = units_ready.top();
+		units_ready.pop();
+		if (!unit_holds(ref)) continue;
+		unit_t &unit = exec_units[ref.unit];
+		pipeline_t &pipe = pipes[unit.pipe];
+		if (fp_clkIn < pipe.accept){
+			if (pipe.blocked.empty()) pipes_blocked.push(make_pair(pipe.accept, unit.pipe));
+			pipe.blocked.push_back(ref);
+			continue;
+		}
+		pipeline_Registers &ops = unit.operands;
+		if (unit.fj != UNDEFINED) ops.pipe_A = read_register(unit.fj);
+		if (unit.fk != UNDEFINED) ops.pipe_B = read_register(unit.fk);
+		if (unit.rj) register_readers[unit.fj]--;
+		if (unit.rk) register_readers[unit.fk]--;
+		unit.rj = false;
+		unit.rk = false;
+		unit.phase = SB_EXECUTE;
+		start_unit(ref.unit, fp_clkIn + unit.latency);
 	}
-	 */
-	cout<<"\n check--> fp_clkIn: "<<fp_clkIn;
-	cout<<"\n fp_totalStalls: "<<fp_totalStalls;
-	/*	cout<<"\n fp_found:       "<<fp_found<<" fp_stalls: "<<fp_stalls;
-	cout<<"\n fp_resolved:    "<<fp_resolved;
 
-	cout<<"\n out fp_pipe_reg[FIRST].pipe_IR.src1: "<<fp_pipe_reg[FIRST].pipe_IR.src1;
-	cout<<"\n out fp_pipe_reg[FIRST].pipe_IR.src2: "<<fp_pipe_reg[FIRST].pipe_IR.src2;
-	 */
+	if(mem_user != UNDEFINED) return;
+
+	// the memory port serves the loads and stores in issue order (those through it are dropped from the front); a
+	// store waits for the older branches
+	while (!units_memory.empty() && (!unit_holds(units_memory.top()) || exec_units[units_memory.top().unit].phase == SB_WRITE))
+		units_memory.pop();
+	if(units_memory.empty()) return;
+	unsigned m = units_memory.top().unit;
+	if(exec_units[m].phase != SB_MEMORY) return;
+
+	pipeline_Registers &ops = exec_units[m].operands;
+	bool store = ops.pipe_IR.opcode == SW || ops.pipe_IR.opcode == SWS;
+	if(store && exec_units[m].issued > oldest_branch()) return;
+
+	unsigned latency = dcache.access(ops.pipe_ALU_OUTPUT, store, fp_clkIn);
+	SIM_TRACE_STAGE(trace, "\n memory access latency: "<<latency);
+	if(store) write_memory(ops.pipe_ALU_OUTPUT, ops.pipe_B);
+	else ops.pipe_LMD = data_memory.read_word(ops.pipe_ALU_OUTPUT);
+	mem_user = m;
+	mem_ready = fp_clkIn + 1 + latency;
+}
+
+void sim_pipe_fp::sb_writeResult()
+{
+	SIM_TRACE_STAGE(trace, "\n In WRITE RESULT fp_clkIn: "<<fp_clkIn);
+
+	// the units waiting to write, oldest first; those that cannot write in this cycle go back to the queue
+	held_back.clear();
+	unsigned written = 0; // register file write ports used (one per instruction of the issue width)
+	while (!units_writing.empty()){
+		unit_ref_t ref = units_writing.top();
+		// squashed by an older branch; or possibly on the wrong path of one, as are all the younger units
+		if (!unit_holds(ref)){
+			units_writing.pop();
+			continue;
+		}
+		if (ref.issued > oldest_branch()) break;
+		units_writing.pop();
+
+		unsigned u = ref.unit;
+		unit_t &unit = exec_units[u];
+		const pipeline_Registers &ops = unit.operands;
+		opcode_t opcode = unit.instruction.opcode;
+
+		if (is_branch(opcode)){
+			if(bpred.enabled())
+			{
+				// train the predictor; on a wrong prediction IF, ID and the younger instructions are squashed
+				if(bpred.update(ops.pipe_PC, opcode != JUMP, ops.pipe_COND, ops.pipe_ALU_OUTPUT, ops.pipe_PRED_PC))
+				{
+					fp_mispredict = true;
+					fp_branchTarget = ops.pipe_COND ? ops.pipe_IR.target : (ops.pipe_NPC - instr_base_address) / 4;
+					squash_units(unit.issued);
+				}
+			}
+			else
+			if(ops.pipe_COND)
+			{
+				SIM_TRACE_STAGE(trace, "\n Branch taken to: "<<fp_labelNames.name(ops.pipe_IR.target));
+				fp_branchTarget = ops.pipe_IR.target;
+			}
+		}
+		else
+		if (unit.fi != UNDEFINED){
+			if (written == issue_width || !sb_no_war(u)){
+				held_back.push_back(ref);
+				continue;
+			}
+			written++;
+
+			unsigned value = (opcode == LW || opcode == LWS) ? ops.pipe_LMD : ops.pipe_ALU_OUTPUT;
+			SIM_TRACE_STAGE(trace, "\n write result instruct: "<<(instr_names[opcode])<<" value: "<<value);
+			if (unit.fi >= NUM_GP_REGISTERS) generalP_FPReg[unit.fi - NUM_GP_REGISTERS] = value;
+			else generalP_IntReg[unit.fi] = value;
+
+			// the units waiting for this result can read it
+			register_status[unit.fi] = UNDEFINED;
+			for (unsigned k=0; k<unit.waiters.size(); k++){
+				unsigned f = unit.waiters[k];
+				unit_t &waiter = exec_units[f];
+				if (waiter.qj != u && waiter.qk != u) continue;
+				if (waiter.qj == u) { waiter.qj = UNDEFINED; waiter.rj = true; register_readers[waiter.fj]++; }
+				if (waiter.qk == u) { waiter.qk = UNDEFINED; waiter.rk = true; register_readers[waiter.fk]++; }
+				if (waiter.qj == UNDEFINED && waiter.qk == UNDEFINED){
+					unit_ref_t ready = {f, waiter.issued, f};
+					units_ready.push(ready);
+				}
+			}
+		}
+
+		if(events.enabled()) events.add(0, EVENT_RETIRED, ops.pipe_SEQ);
+		release_unit(u);
+		unit.fi = unit.fj = unit.fk = UNDEFINED;
+		unit.qj = unit.qk = UNDEFINED;
+		unit.rj = unit.rk = false;
+		++fp_totalInstCount;
+	}
+	for (unsigned k=0; k<held_back.size(); k++) units_writing.push(held_back[k]);
 }
@@ -4,18 +4,32 @@
 #include <stdio.h>
 #include <string>
 #include <map>
+#include <vector>
+#include <queue>
+#include <functional>
+#include "sim_trace.h"
+#include "sim_events.h"
+#include "sim_asm.h"
+#include "sim_image.h"
+#include "sim_scoreboard.h"
+#include "sim_bpred.h"
+#include "sim_cache.h"
+#include "sim_memory.h"
+#include "sim_sample.h"
 
 using namespace std;
 
-#define PROGRAM_SIZE 50
-
 #define UNDEFINED 0xFFFFFFFF
 #define NUM_SP_REGISTERS 9
-#define NUM_SP_INT_REGISTERS 15
 #define NUM_GP_REGISTERS 32
 #define NUM_OPCODES 22
 #define NUM_STAGES 5
-#define MAX_UNITS 10
+#define NUM_STALL_TYPES 4
+#define MAX_ISSUE_WIDTH 8 // instructions fetched, issued and retired per cycle (see init_issue_width)
+#define MAX_PIPELINES 4096 // execution pipelines of one type (two levels of 64-bit free maps)
+#define NUM_UNIT_TYPES 4
+#define DEFAULT_ROB_ENTRIES 16 // TOMASULO core: reorder buffer entries, and reservation stations of each unit type
+#define DEFAULT_STATIONS 4
 
 typedef enum {PC, NPC, IR, A, B, IMM, COND, ALU_OUTPUT, LMD} sp_register_t;
 
@@ -23,8 +37,25 @@ typedef enum {LW, SW, ADD, ADDI, SUB, SUBI, XOR, BEQZ, BNEZ, BLTZ, BGTZ, BLEZ, B
 
 typedef enum {IF, ID, EXE, MEM, WB} stage_t;
 
+// cause of a stall cycle: data or structural hazard in ID, unresolved or mispredicted branch, data memory
+// access in MEM, instruction cache miss in IF
+typedef enum {DATA_STALL, CONTROL_STALL, MEMORY_STALL, FETCH_STALL, ALL_STALLS} stall_t;
+
 typedef enum {INTEGER, ADDER, MULTIPLIER, DIVIDER} exe_unit_t;
 
+// processor core: in-order issue to the execution units (with out-of-order completion), out-of-order
+// execution with reservation stations, register renaming and a reorder buffer (Tomasulo), or
+// out-of-order execution with a scoreboard (CDC 6600)
+typedef enum {IN_ORDER, TOMASULO, SCOREBOARD} core_t;
+
+// SCOREBOARD core: phase of the instruction in a functional unit
+typedef enum {
+	SB_OPERANDS, // issued, waiting to read its operands
+	SB_EXECUTE,  // executing (until the "done" cycle of the unit)
+	SB_MEMORY,   // load or store waiting for (or using) the memory port
+	SB_WRITE     // waiting to write its result
+} sb_phase_t;
+
 typedef enum {FIRST, SECOND, THIRD, FORTH} pipelineRegNum;
 
 // instruction
@@ -35,7 +66,7 @@ typedef struct
 	unsigned src2; //second source register
 	unsigned dest; //destination register
 	unsigned immediate; //immediate field;
-	string label; //in case of branch, label of the target instruction;
+	unsigned target; //in case of branch, index in instruction memory of the target instruction (UNDEFINED otherwise)
 
 	void reset()
 	{
@@ -44,93 +75,271 @@ typedef struct
 		src2 = 0x00000000;
 		dest = 0x00000000;
 		immediate = 0x00000000;
-		label = "";
+		target = UNDEFINED;
 	}
 
 } instruction_t;
 
-// execution unit
-typedef struct{
-	exe_unit_t type;  // execution unit type
-	unsigned latency; // execution unit latency
-	unsigned busy;    // 0 if execution unit is free, otherwise number of clock cycles during
-	// which the execution unit will be busy. It should be initialized
-	// to the latency of the unit when the unit becomes busy, and decremented
-	// at each clock cycle
-	instruction_t instruction; // instruction using the functional unit
-} unit_t;
-
-
+// pipeline latch; fields not used by the instruction it holds are UNDEFINED (a bubble holds a NOP)
 struct pipeline_Registers
 {
 	unsigned pipe_PC; //PC
 	unsigned pipe_NPC; //NPC
 	instruction_t pipe_IR; //IR
+	unsigned pipe_A; //value of the first source register
+	unsigned pipe_B; //value of the second source register (for SW/SWS, data to be stored)
+	unsigned pipe_IMM; //immediate
 	unsigned pipe_COND;
 	unsigned pipe_ALU_OUTPUT;
 	unsigned pipe_LMD;
+	unsigned pipe_PRED_PC; //PC fetched after this instruction, as predicted by the branch predictor (branches only)
+	unsigned long pipe_SEQ; //fetch order of the instruction, which identifies it in the event trace
 
 	void reset(void)
 	{
-		pipe_PC = 0x00000000;
-		pipe_NPC = 0x00000000;
+		pipe_PC = UNDEFINED;
+		pipe_NPC = UNDEFINED;
 		pipe_IR.reset();
-		pipe_COND = 0x00000000;
-		pipe_ALU_OUTPUT = 0x00000000;
-		pipe_LMD = 0x00000000;
+		pipe_A = UNDEFINED;
+		pipe_B = UNDEFINED;
+		pipe_IMM = UNDEFINED;
+		pipe_COND = UNDEFINED;
+		pipe_ALU_OUTPUT = UNDEFINED;
+		pipe_LMD = UNDEFINED;
+		pipe_PRED_PC = UNDEFINED;
+		pipe_SEQ = UNDEFINED;
 	}
 };
 
-static unsigned fp_clkIn = 0;
-static pipeline_Registers fp_pipe_reg[NUM_STAGES-1];
-static unsigned long fp_inst_count = 0;
-static unsigned long fp_totalInstCount = 0;
-static bool fp_runAlways = 0;
-static unsigned fp_stalls = 0;
-static unsigned fp_totalStalls = 0;
-static unsigned fp_currentClk = 0;
-static std::string fp_branchToLabel = "";
-static bool fp_noBranches = true;
-static unsigned fp_found = 0;
-static unsigned fp_resolved = 0;
-static unsigned fp_branchingCount = 0;
-static bool fp_branchStall = false;
-static bool fp_memoryStall = false;
-static unsigned fp_stallMem = 0;
-static bool fp_memStallCompleted = false;
-static unsigned fp_totalMemStalls = 0;
+// an interval of run_parallel
+typedef struct{
+	unsigned long first; //instructions executed before it (from the start of run_parallel)
+	unsigned long instructions;
+	unsigned long cycles; //taken to retire them, from an empty pipeline
+	unsigned long stalls[NUM_STALL_TYPES]; //stall cycles meanwhile, by cause
+	unsigned long head_cycles; //taken to retire its first "overlap" instructions (0 if not measured)
+	unsigned long tail_cycles; //taken to retire the first "overlap" instructions of the next interval, going on into it
+	double warmup_error; //head_cycles relative to the tail_cycles of the previous interval, minus 1 (0 if not measured)
+} interval_t;
+
+// result of run_parallel: its intervals, and their totals
+typedef struct{
+	unsigned long instructions;
+	unsigned long cycles;
+	unsigned long stalls;
+	unsigned long stalls_by_type[NUM_STALL_TYPES];
+	double ipc;
+	double warmup_error; //cycles in excess at the start of the intervals (head_cycles - tail_cycles), relative to cycles
+	std::vector<interval_t> intervals;
+} parallel_stats_t;
+
+// an instruction translated for run_functional, with its operands bound (see translate_block)
+typedef struct{
+	const void *handler; //address of its code in run_blocks
+	unsigned dest; //registers, as indexes in the register array of run_functional
+	unsigned src1;
+	unsigned src2;
+	unsigned imm;
+} threaded_op_t;
+
+// basic block of translated instructions, ended by a branch, by EOP, or before the next branch target
+typedef struct{
+	unsigned long start; //index of its first instruction
+	unsigned first; //its operations from block_ops[first], the last being its exit: a branch, EOP, or NOP to fall through
+	unsigned executed; //instructions it executes, with the branch ending it (NOPs are not translated)
+	unsigned long target; //index of the instruction branched to
+	unsigned long fallthrough; //index of the instruction after the block
+	unsigned next[2]; //chained successors, the blocks at fallthrough and at target (UNDEFINED until first followed)
+} block_t;
 
+// execution unit
+typedef struct{
+	exe_unit_t type;  // execution unit type
+	unsigned latency; // execution unit latency
+	unsigned long done; // clock cycle from which the instruction in the unit has completed its execution
+	// (set when it starts, see start_unit; nothing is counted down at each clock cycle)
+	unsigned pipe;    // pipeline of the unit (a pipelined unit is made of one unit per instruction in flight)
 
+	instruction_t instruction; // instruction using the functional unit
+	pipeline_Registers operands; // ID/EX latch of that instruction
+	unsigned long issued; // age of the instruction (see issue_seq)
+	unsigned rob; // TOMASULO: reorder buffer entry of the instruction
+	unsigned older, younger; // IN_ORDER and SCOREBOARD: neighbours in the list of busy units by age (UNDEFINED at its ends)
+
+	// SCOREBOARD: functional unit status
+	sb_phase_t phase;
+	unsigned fi, fj, fk; // destination and source registers, numbered as in dest_register (UNDEFINED if not used)
+	unsigned qj, qk;     // units producing fj and fk (UNDEFINED if none)
+	bool rj, rk;         // fj and fk are ready and not read yet
+	std::vector<unsigned> waiters; // units whose qj or qk is this one
+} unit_t;
+
+// an execution unit in a queue of busy units (see units_executing), ordered by "key"
+typedef struct {
+	unsigned long key;    // clock cycle in which its execution completes, age of its instruction, or (units_ready) "unit"
+	unsigned long issued; // age of its instruction: the entry is stale once the unit holds another one (see unit_holds)
+	unsigned unit;
+} unit_ref_t;
+
+inline bool operator>(const unit_ref_t &a, const unit_ref_t &b){
+	return a.key > b.key || (a.key == b.key && a.unit > b.unit);
+}
+
+typedef std::priority_queue<unit_ref_t, std::vector<unit_ref_t>, std::greater<unit_ref_t> > unit_queue_t;
+
+// execution pipeline: the unit_t of a non-pipelined unit, or those of a pipelined one
+typedef struct {
+	exe_unit_t type;
+	unsigned interval;      // initiation interval: clock cycles between two instructions entering the pipeline
+	unsigned long accept;   // clock cycle from which it accepts a new instruction
+	unsigned index;         // position among the pipelines of its type (bit in the free map)
+	std::vector<unsigned> idle; // its free units
+	std::vector<unit_ref_t> blocked; // SCOREBOARD: units that can read their operands, waiting for "accept"
+} pipeline_t;
+
+// TOMASULO core: state of an instruction in the reorder buffer
+typedef enum {
+	ROB_WAITING, // in a reservation station or an execution unit
+	ROB_MEMORY,  // load with its address computed, waiting for (or using) the memory port
+	ROB_DONE     // result known (stores: address and data known; branches: resolved); can commit
+} rob_state_t;
+
+// TOMASULO core: reorder buffer entry
+typedef struct {
+	pipeline_Registers operands; // IF/ID latch of the instruction (PC, NPC, IR, PRED_PC)
+	unsigned long seq; // issue order, compared to find the oldest instruction
+	rob_state_t state;
+	unsigned value;   // result, or data of a store
+	unsigned address; // effective address of a load or store
+	unsigned unit;    // execution unit holding the instruction (UNDEFINED if none)
+} rob_entry_t;
+
+// TOMASULO core: reservation station
+typedef struct {
+	bool busy;
+	unsigned rob;    // reorder buffer entry of the instruction waiting in the station
+	unsigned vj, vk; // operands, as A and B in the ID/EX latch
+	unsigned qj, qk; // reorder buffer entries that will produce them (UNDEFINED once the value is in vj/vk)
+
+	void reset()
+	{
+		busy = false;
+		rob = UNDEFINED;
+		vj = vk = UNDEFINED;
+		qj = qk = UNDEFINED;
+	}
+} station_t;
 
 class sim_pipe_fp{
 
 	//instruction memory
-	instruction_t instr_memory[PROGRAM_SIZE];
+	std::vector<instruction_t> instr_memory; // sized by load_program
+	sim_image image; // program image mapped by load_binary
+
+	//instructions being executed: instr_memory, or the records of the mapped image
+	const instruction_t *program;
+	unsigned program_size;
+
+	//translation cache of run_functional: the basic blocks of the program as threaded code (see translate_block)
+	std::vector<block_t> blocks;
+	std::vector<threaded_op_t> block_ops; // operations of all the blocks
+	std::vector<unsigned> block_at; // block starting at each instruction (UNDEFINED if not translated yet)
+	std::vector<bool> block_leader; // branch targets: a block ends before each of them
 
 	//base address in the instruction memory where the program is loaded
 	unsigned instr_base_address;
 
-	//data memory - should be initialize to all 0xFF
-	unsigned char *data_memory;
-
-	//memory size in bytes
-	unsigned data_memory_size;
+	//data memory - should be initialize to all 0xFF (paged: see sim_memory.h)
+	sim_memory data_memory;
 
 	//memory latency in clock cycles
 	unsigned data_memory_latency;
 
-	//execution units
-	unit_t exec_units[MAX_UNITS];
+	//data caches between MEM and the data memory (disabled unless configured with init_cache)
+	sim_cache dcache;  // L1D
+	sim_cache l2cache; // L2, filled from the data memory
+	sim_cache icache;  // L1I, filled from the L2 or the instruction memory
+
+	//trace output of the stage functions (see sim_trace.h for the compile-time levels)
+	sim_trace trace;
+
+	//event trace of the cycle model (see sim_events.h), written by a thread of its own while enabled
+	sim_events events;
+
+	//execution units and their pipelines
+	std::vector<unit_t> exec_units;
 	unsigned num_units;
+	std::vector<pipeline_t> pipes;
+
+	//free map of each unit type: bit i of pipe_free[type] is set if pipeline pipe_order[type][i] accepts an instruction
+	//(one of its units is free and its initiation interval has elapsed); bit w of pipe_free_words[type] is set if
+	//word w of pipe_free[type] is not zero
+	std::vector<unsigned> pipe_order[NUM_UNIT_TYPES];
+	std::vector<uint64_t> pipe_free[NUM_UNIT_TYPES];
+	uint64_t pipe_free_words[NUM_UNIT_TYPES];
+
+	//pipelines waiting for their initiation interval to elapse: (clock cycle, pipeline), earliest first
+	std::priority_queue<pair<unsigned long, unsigned>, vector<pair<unsigned long, unsigned> >, greater<pair<unsigned long, unsigned> > > pipe_reopen;
+
+	//busy units, so that a cycle does not scan all of them: the units executing by the cycle they complete in; IN_ORDER
+	//and TOMASULO cores, those completed but not out of EX yet (TOMASULO: waiting for the common data bus), oldest
+	//first; the units holding a branch, oldest first. The entries of a unit that has been released (or squashed) are
+	//dropped when they reach the front
+	unit_queue_t units_executing;
+	unit_queue_t units_completed;
+	unit_queue_t branch_units;
+	unsigned units_busy; // units holding an instruction
+	unsigned youngest_unit; // IN_ORDER and SCOREBOARD: the young end of the list of busy units (UNDEFINED if none)
+
+	std::vector<unsigned> by_age; // units completed in the cycle, oldest first (scratch)
+	std::vector<unit_ref_t> held_back; // units left in their queue for a later cycle (scratch)
+
+	//branch predictor (BP_NONE: fetch waits for each branch instead)
+	sim_bpred bpred;
+
+	//core selected at construction
+	core_t core;
+
+	//instructions per latch, and issued and retired per cycle (see init_issue_width)
+	unsigned issue_width;
+
+	//age of the next instruction issued (to the units, or to the reorder buffer): the instructions of a group share their issue cycle
+	unsigned long issue_seq;
+
+	//TOMASULO core: reservation stations of each unit type, reorder buffer (a circular queue from rob_head),
+	//register alias table, and the memory port shared by loads and stores (also used by the SCOREBOARD core)
+	std::vector<station_t> stations[NUM_UNIT_TYPES];
+	std::vector<rob_entry_t> rob;
+	unsigned rob_head;
+	unsigned rob_count;
+	unsigned cdb_width; // results broadcast on the common data bus per cycle
+	unsigned rename_table[2*NUM_GP_REGISTERS]; // reorder buffer entry that will write each register (UNDEFINED if none)
+	unsigned mem_user; // reorder buffer entry (SCOREBOARD: unit) using the memory port (UNDEFINED if idle)
+	unsigned long mem_ready; // cycle in which its access completes
+
+	//SCOREBOARD core: register result status (unit that will write each register, UNDEFINED if none), and units that
+	//still have to read each register (Rj or Rk set)
+	unsigned register_status[2*NUM_GP_REGISTERS];
+	unsigned register_readers[2*NUM_GP_REGISTERS];
+
+	//SCOREBOARD core: the units that can read their operands, lowest first; the loads and stores not through the memory
+	//port yet, and the units waiting to write their results, oldest first (stale entries are dropped as in
+	//units_executing); the pipelines with blocked units, by the cycle they accept an instruction again
+	unit_queue_t units_ready;
+	unit_queue_t units_memory;
+	unit_queue_t units_writing;
+	std::priority_queue<pair<unsigned long, unsigned>, vector<pair<unsigned long, unsigned> >, greater<pair<unsigned long, unsigned> > > pipes_blocked;
 
 public:
 
 	//instantiates the simulator with a data memory of given size (in bytes) and latency (in clock cycles)
 	/* Note: 
            - initialize the registers to UNDEFINED value 
-	   - initialize the data memory to all 0xFF values
+	   - initialize the data memory to all 0xFF values (up to 4 GiB, allocated in pages as they are written)
 	 */
-	sim_pipe_fp(unsigned data_mem_size, unsigned data_mem_latency);
+	// - core: IN_ORDER, TOMASULO for out-of-order execution (see init_reservation_stations and init_reorder_buffer),
+	//   or SCOREBOARD for out-of-order execution controlled by a scoreboard
+	sim_pipe_fp(uint64_t data_mem_size, unsigned data_mem_latency, core_t core=IN_ORDER);
 
 	//de-allocates the simulator
 	~sim_pipe_fp();
@@ -139,14 +348,98 @@ public:
 	// - exec_unit: type of execution unit to be added
 	// - latency: latency of the execution unit (in clock cycles)
 	// - instances: number of execution units of this type to be added
-	void init_exec_unit(exe_unit_t exec_unit, unsigned latency, unsigned instances=1);
+	// - initiation_interval: clock cycles between two instructions entering a unit (0: latency, i.e. not pipelined);
+	//   a unit of latency 6 and initiation interval 1 has up to six instructions in flight
+	// the cores keep their busy units in queues, so the time a cycle takes does not grow with the units configured
+	void init_exec_unit(exe_unit_t exec_unit, unsigned latency, unsigned instances=1, unsigned initiation_interval=0);
+
+	// TOMASULO core: sets the number of reservation stations in front of the units of a given type
+	// (DEFAULT_STATIONS if not set)
+	void init_reservation_stations(exe_unit_t exec_unit, unsigned entries);
+
+	// TOMASULO core: sets the reorder buffer entries (DEFAULT_ROB_ENTRIES if not set) and the number of results
+	// the common data bus broadcasts per cycle (1 if not set)
+	void init_reorder_buffer(unsigned entries, unsigned cdb_width=1);
+
+	// makes the processor "width" instructions wide (1, the default, up to MAX_ISSUE_WIDTH): IF fetches up to "width"
+	// consecutive instructions per cycle (the group ends at EOP, at a branch predicted taken, at any branch without a
+	// predictor, and at an I-cache miss), and the latches hold groups of that many, oldest first
+	// - IN_ORDER: ID issues the group in order up to the first instruction with a hazard (the units, and the writes of
+	//   the older instructions of the group, are checked as for any other instruction), and EX moves up to "width" completed
+	//   instructions to MEM, one load or store among them
+	// - TOMASULO: up to "width" instructions are issued to the reorder buffer and committed per cycle
+	// - SCOREBOARD: up to "width" instructions are issued, and results written to the register file, per cycle
+	// get_sp_register returns the oldest instruction of each latch
+	void init_issue_width(unsigned width);
 
 	//loads the assembly program in file "filename" in instruction memory at the specified address
 	void load_program(const char *filename, unsigned base_address=0x0);
 
+	//loads the program image in file "filename" (written by save_binary) in instruction memory at the specified address;
+	//the image is mapped and executed in place
+	void load_binary(const char *filename, unsigned base_address=0x0);
+
+	//writes the loaded program (instructions and labels) to "filename" as a binary image for load_binary
+	void save_binary(const char *filename);
+
+	//executes the program loaded in "source" in place, at the same address, without copying it;
+	//"source" must keep the program loaded (no load or reset) while this simulator uses it
+	void share_program(const sim_pipe_fp &source);
+
+	//returns a new simulator in the state of this one: registers, latches, hazard state, counters, execution units,
+	//reservation stations and reorder buffer, caches, branch predictor and data memory. It executes the program of
+	//this simulator in place (as share_program), and shares the pages of the data memory copy-on-write, so that a
+	//snapshot is cheap. The snapshot can be run itself, or restored (any number of times) into this or any other
+	//simulator; it is deleted by the caller
+	sim_pipe_fp *snapshot();
+
+	//brings the simulator back to the state saved by snapshot(), configuration included (the trace sink is kept)
+	void restore(const sim_pipe_fp &snapshot);
+
 	//runs the simulator for "cycles" clock cycles (run the program to completion if cycles=0) 
 	void run(unsigned cycles=0);
 
+	//executes the next "instructions" instructions of the program (up to EOP if instructions=0) without modelling the
+	//pipeline, and returns the number executed; for fast-forwarding, and as a reference for the architectural results
+	/* Note:
+	   - the instructions in flight (in the latches, the execution units or the reorder buffer) complete first, in the
+	     cycle model (IF fetches no more meanwhile)
+	   - then only the registers, the data memory and the next instruction to be fetched change: the clock, the
+	     instruction and stall counters, the caches and the branch predictor are left as they are
+	   - run() continues from the next instruction, with an empty pipeline
+	   - if "warm" is true, the caches see the fetches and data accesses and the branch predictor is trained with
+	     every branch (functional warming, see run_sampled); the clock still does not move
+	   - otherwise whole basic blocks run as threaded code, translated on first use and cached until the program changes
+	 */
+	unsigned long run_functional(unsigned long instructions=0, bool warm=false);
+
+	//sampled simulation (see sim_sample.h): runs the program to completion repeating "fast_forward" instructions of
+	//functional execution, "warm_up" instructions of functional warming and a window of "detailed" instructions in
+	//the cycle model; returns the IPC of the program extrapolated from the windows, with its confidence interval
+	/* Note:
+	   - the counters (clock, instructions, stalls, caches, predictor) are those of the windows and of the cycles
+	     taken to empty the pipeline after each of them; the statistics of the caches and of the predictor also count
+	     the warm-up
+	   - a window cut short by EOP is not measured, unless no window is complete
+	 */
+	sample_stats_t run_sampled(unsigned long fast_forward, unsigned long warm_up, unsigned long detailed);
+
+	//checkpoint-based parallel simulation: runs the program to completion in functional mode, saving a checkpoint
+	//(snapshot) every "interval" instructions, then simulates the intervals in the cycle model from their checkpoints
+	//on "threads" threads (0: one per hardware thread), and returns their cycles, stalls and IPC stitched together
+	/* Note:
+	   - an interval starts with an empty pipeline; with "warm_up" > 0, its caches and branch predictor are first
+	     warmed with the "warm_up" instructions before it (functional warming), from the checkpoint they start in
+	   - with "overlap" > 0, an interval is simulated on into the first "overlap" instructions of the next one: the
+	     cycles they take there, with everything warm, against those they take at the start of the next interval
+	     give the warm-up error of the next interval
+	   - the instructions in flight complete first, and are not counted; the simulator is left at EOP, its counters
+	     unchanged
+	   - the trace of the intervals goes to an in-memory ring of their own, not to the trace sink of the simulator
+	   - uses threads: build with -pthread
+	 */
+	parallel_stats_t run_parallel(unsigned long interval, unsigned long warm_up, unsigned long overlap, unsigned threads=0);
+
 	//resets the state of the simulator
 	/* Note:
 	   - registers should be reset to UNDEFINED value 
@@ -190,8 +483,8 @@ public:
 	//returns the number of clock cycles 
 	unsigned get_clock_cycles();
 
-	//returns the number of stalls added by processor
-	unsigned get_stalls();
+	//returns the number of stalls added by processor (all of them, or those of the given cause)
+	unsigned get_stalls(stall_t type=ALL_STALLS);
 
 	//prints the content of the data memory within the specified address range
 	void print_memory(unsigned start_address, unsigned end_address);
@@ -202,30 +495,158 @@ public:
 	//prints the values of the registers 
 	void print_registers();
 
+	//selects the branch predictor; with BP_NONE (the default) fetch waits for each branch to be resolved
+	//"table_bits" and "btb_bits" are log2 of the entries of each prediction table and of the BTB (up to BPRED_MAX_BITS)
+	void init_branch_predictor(bpred_policy_t policy, unsigned table_bits=10, unsigned btb_bits=6);
+
+	//returns the branch prediction counters
+	bpred_stats_t get_branch_stats();
+
+	//adds a data cache level (L1D or L2) between the MEM stage and the data memory; once the caches are enabled,
+	//data_memory_latency is only paid by the accesses that miss in the last level
+	//"size" and "line_size" are in bytes, "hit_latency" is the number of clock cycles a hit adds to MEM
+	void init_cache(cache_level_t level, unsigned size, unsigned line_size, unsigned associativity, unsigned hit_latency,
+	                cache_replacement_t replacement=CACHE_LRU, cache_write_t write_policy=WRITE_BACK, bool write_allocate=true);
+
+	//adds an instruction cache (L1I) in front of the instruction memory; a hit is fetched in the IF cycle, a miss
+	//stalls IF until the line is filled from the L2 (if enabled) or from an instruction memory of "miss_latency" clock cycles
+	//with "next_line_prefetch", a miss and the first use of a prefetched line prefetch the following line
+	void init_icache(unsigned size, unsigned line_size, unsigned associativity, unsigned miss_latency,
+	                 bool next_line_prefetch=false, cache_replacement_t replacement=CACHE_LRU);
+
+	//returns the hit/miss/eviction counters of a cache level
+	cache_stats_t get_cache_stats(cache_level_t level);
+
+	//selects where the trace goes (stdout by default); has no effect when built with SIM_TRACE_LEVEL=TRACE_OFF
+	void set_trace_sink(trace_sink_t sink, const char *filename=NULL, unsigned ring_size=TRACE_RING_SIZE);
+
+	//writes the content of the in-memory trace ring to "os"
+	void dump_trace(ostream &os);
+
+	//records the event trace (see sim_events.h) of the cycles run from now on to "filename", encoded and written in the
+	//background; with filename=NULL, writes the rest and closes the file (as does the destructor)
+	//the slots are the lanes of the latches, then the execution units (TOMASULO: the reorder buffer entries) configured
+	//at the time of the call
+	void set_event_trace(const char *filename);
+
 protected:
 	void fp_fetch();
 	void fp_decode();
 	void fp_execute();
 	void fp_memory();
 	void fp_writeBack();
-	void fp_hazardHandler();
+	event_stall_t fp_hazardHandler(unsigned lane);
+	void ooo_issue();
+	void ooo_execute();
+	void ooo_memory();
+	void ooo_complete();
+	void ooo_commit();
+	void sb_issue();
+	void sb_execute();
+	void sb_writeResult();
+	void count_stall(stall_t type, stage_t stage);
+	void update_sp_registers();
+	bool pipeline_empty();
+	void drain();
+	void warm_branch(unsigned long index, const instruction_t &ir, bool taken);
+	unsigned translate_block(unsigned long pc, const void *const *handlers);
+	unsigned long run_blocks(unsigned *reg, unsigned long &pc, unsigned long limit);
+	void flush_blocks();
+	void trace_cycle();
+	event_record_t &trace_latch(unsigned slot, event_stage_t stage, const pipeline_Registers &latch);
 
 private:
 
 	// returns a free exec unit for the particular instruction type
 	unsigned get_free_unit(opcode_t opcode);	
 
-	//reduce execution unit busy time (to be invoked at every clock cycle 
-	void decrement_units_busy_time();
+	// returns a free exec unit of the given type, in constant time (UNDEFINED if none)
+	unsigned free_unit(exe_unit_t type);
+
+	// places the instruction of latch "operands", of age "issued", in unit "u" (returned by get_free_unit): it occupies
+	// the unit until release_unit
+	void claim_unit(unsigned u, const pipeline_Registers &operands, unsigned long issued);
+	void release_unit(unsigned u);
+
+	// true while the unit of "ref" holds the instruction it was queued with
+	bool unit_holds(const unit_ref_t &ref) const;
+
+	// takes the units whose execution is over from units_executing into by_age, oldest first
+	void collect_completed();
+
+	// sets or clears the bit of pipeline "p" in the free map of its type
+	void update_free_map(unsigned p);
+
+	// starts the execution of the instruction in unit "u", to be completed in clock cycle "done"
+	void start_unit(unsigned u, unsigned long done);
+
+	// squashes the instructions issued to the execution units after the one of age "issued"
+	void squash_units(unsigned long issued);
+	void squash_unit(unsigned u);
 
 	//debug units
 	void debug_units();
 
-	unsigned generalP_IntReg[NUM_SP_INT_REGISTERS];//R0-R15
+	// returns the value of a register numbered as in dest_register()
+	unsigned read_register(unsigned reg);
+
+	// true if IF must wait for a branch in ID, EX or (TOMASULO) the reorder buffer to be resolved
+	bool branch_pending();
+
+	// issue time of the oldest branch in the execution units ((unsigned long)-1 if none), from branch_units
+	unsigned long oldest_branch();
+
+	// TOMASULO core: renames source register "reg": its value, or the reorder buffer entry that will produce it
+	void read_operand(unsigned reg, unsigned &value, unsigned &tag);
+
+	// TOMASULO core: writes the result of reorder buffer entry "e" on the common data bus
+	void broadcast(unsigned e, unsigned value);
+
+	// TOMASULO core: squashes the instructions younger than "seq" (wrong path of a mispredicted branch)
+	void squash_younger(unsigned long seq);
+
+	// SCOREBOARD core: true if unit "u" can write its result without overwriting an operand not read yet (WAR)
+	bool sb_no_war(unsigned u);
+
+	sim_scoreboard pending_writes; // registers with a write issued and not written back yet (RAW)
+	sim_scoreboard unit_writes;    // registers with a write still in an execution unit (WAW)
+
+	pipeline_Registers fp_pipe_reg[NUM_STAGES-1][MAX_ISSUE_WIDTH]; // latches at the beginning of the current cycle, one instruction per lane
+	pipeline_Registers fp_pipe_next[NUM_STAGES-1][MAX_ISSUE_WIDTH]; // latches being written for the next cycle
+
+	unsigned long fp_clkIn; // clock cycles completed
+	bool fp_runAlways;
+
+	unsigned long fp_inst_count; // index of the next instruction to be fetched
+	unsigned long fp_totalInstCount; // instructions retired
+	unsigned long fp_fetchSeq; // fetch order of the next instruction fetched (pipe_SEQ)
+
+	/* -- Member variables to handle hazards -- */
+	unsigned fp_stalls; // stall cycles still required by the hazard in ID (0 if none; IF waits while it is not 0)
+	unsigned fp_totalStalls;
+	unsigned fp_stallCount[NUM_STALL_TYPES]; // fp_totalStalls by cause
+	unsigned char fp_stageStall[EVENT_STALL_STAGES]; // event_stall_t of IF to WB in the current cycle, for the event trace
+
+	unsigned fp_branchTarget; // index of the instruction to be fetched next after a taken (or mispredicted) branch (UNDEFINED if none)
+	bool fp_branchStall; // IF is waiting for a branch to be resolved
+	bool fp_mispredict; // the branch leaving EX was mispredicted: IF, ID and the younger instructions in the units are squashed
+
+	bool fp_memoryStall; // MEM is serving the latency of a memory access
+	unsigned fp_stallMem; // cycles of the access served so far
+	unsigned fp_memLatency; // stall cycles of the access in MEM (data_memory_latency, or the time taken by the caches)
+
+	unsigned fp_fetchMiss; // index of the instruction whose I-cache miss is being served (UNDEFINED if none)
+	unsigned long fp_fetchReady; // cycle in which its line arrives
+
+	bool fp_draining; // run_functional is waiting for the pipeline to empty: nothing else is fetched
+	bool fp_eopFetched; // EOP has been fetched: nothing else is fetched
+	bool fp_eopRetired; // EOP has reached WB: the program is complete
+
+	unsigned generalP_IntReg[NUM_GP_REGISTERS];//R0-R31
 	unsigned generalP_FPReg[NUM_GP_REGISTERS];//F0-F31
 	unsigned specialP_Reg[NUM_STAGES][NUM_SP_REGISTERS];
 
-	std::map< std::string, unsigned> fp_labelPCMap;
+	asm_labels fp_labelNames; // label of each branch target, used only by the trace
 
 
 };
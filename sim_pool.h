@@ -0,0 +1,88 @@
+#ifndef SIM_POOL_H_
+#define SIM_POOL_H_
+
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+/* =============================================================
+
+   WORK-STEALING THREAD POOL
+
+   Runs a fixed set of independent tasks, numbered 0..count-1, on
+   a number of worker threads. Each worker starts with a contiguous
+   block of tasks in its own queue and takes them from the back. A
+   worker whose queue is empty steals from the front of another
+   worker's queue, so workers that get short simulations help those
+   that got long ones. No task creates new tasks, so a worker stops
+   once every queue is empty.
+
+   Used by the sweep driver (sim_sweep.cc) and by run_parallel; build with
+   -pthread.
+
+   ============================================================= */
+
+class sim_pool {
+
+	struct task_queue {
+		std::mutex lock;
+		std::deque<unsigned> tasks;
+	};
+
+	unsigned num_threads;
+
+	// task to be run by "worker": its own newest, else the oldest of another worker (false if none left)
+	static bool next_task(std::vector<task_queue> &queues, unsigned worker, unsigned &task){
+		{
+			std::lock_guard<std::mutex> guard(queues[worker].lock);
+			if (!queues[worker].tasks.empty()) {
+				task = queues[worker].tasks.back();
+				queues[worker].tasks.pop_back();
+				return true;
+			}
+		}
+		for (unsigned k = 1; k < queues.size(); k++) {
+			task_queue &victim = queues[(worker + k) % queues.size()];
+			std::lock_guard<std::mutex> guard(victim.lock);
+			if (!victim.tasks.empty()) {
+				task = victim.tasks.front();
+				victim.tasks.pop_front();
+				return true;
+			}
+		}
+		return false;
+	}
+
+public:
+	// "threads" workers (0: one per hardware thread)
+	sim_pool(unsigned threads=0){
+		num_threads = threads ? threads : std::thread::hardware_concurrency();
+		if (num_threads == 0) num_threads = 1;
+	}
+
+	unsigned threads() const { return num_threads; }
+
+	// calls run_task(i) once for every i in 0..count-1 and returns when all calls have returned;
+	// calls for different tasks may run concurrently
+	template <class F>
+	void run(unsigned count, F run_task){
+		unsigned workers = (count < num_threads) ? count : num_threads;
+		if (workers == 0) return;
+
+		std::vector<task_queue> queues(workers);
+		for (unsigned w = 0; w < workers; w++)
+			for (unsigned t = (unsigned long)count * w / workers; t < (unsigned long)count * (w + 1) / workers; t++)
+				queues[w].tasks.push_back(t);
+
+		std::vector<std::thread> pool;
+		for (unsigned w = 0; w < workers; w++)
+			pool.push_back(std::thread([&queues, &run_task, w]() {
+				unsigned task;
+				while (next_task(queues, w, task)) run_task(task);
+			}));
+		for (unsigned w = 0; w < workers; w++) pool[w].join();
+	}
+};
+
+#endif /*SIM_POOL_H_*/
@@ -0,0 +1,96 @@
+#ifndef SIM_SAMPLE_H_
+#define SIM_SAMPLE_H_
+
+#include <math.h>
+
+/* =============================================================
+
+   SAMPLED SIMULATION
+
+   Shared by sim_pipe and sim_pipe_fp (see run_sampled). The program
+   is run as a sequence of periods, each made of:
+
+     fast-forward: functional execution only (run_functional)
+     warm-up:      functional execution that also updates the caches
+                   and the branch predictor
+     detailed:     a window of instructions in the cycle model, whose
+                   cycles are measured
+
+   A window is measured from the first instruction it retires, so the
+   cycles taken to fill the pipeline after the functional execution
+   are not counted. The CPI of the program is estimated by the mean CPI
+   of the windows (all of the same number of instructions), with a
+   confidence interval of SAMPLE_Z standard errors (as in SMARTS); the
+   IPC and the cycles of the whole program are extrapolated from it.
+
+   ============================================================= */
+
+#define SAMPLE_Z 1.96 // 95% confidence
+
+// estimate of a sampled run
+typedef struct {
+	unsigned long samples;         // detailed windows measured
+	unsigned long instructions;    // instructions executed by the program, in all modes
+	unsigned long window_instructions; // ... of which measured in the windows
+	unsigned long window_cycles;   // cycles of the windows
+	double cpi;                    // mean CPI of the windows
+	double cpi_error;              // half-width of the confidence interval of cpi (HUGE_VAL with less than two windows)
+	double ipc;                    // 1 / cpi
+	double ipc_low;                // confidence interval of ipc
+	double ipc_high;
+	double cycles;                 // cycles of the whole program: cpi * instructions
+} sample_stats_t;
+
+class sim_sample {
+
+	unsigned long n;
+	unsigned long instructions;
+	unsigned long cycles;
+	double sum;    // of the CPI of the windows
+	double sum_sq; // of their squares
+
+public:
+	sim_sample() { reset(); }
+
+	void reset(){
+		n = 0;
+		instructions = 0;
+		cycles = 0;
+		sum = 0;
+		sum_sq = 0;
+	}
+
+	// a detailed window of "window_instructions" instructions took "window_cycles" cycles
+	void add(unsigned long window_instructions, unsigned long window_cycles){
+		double cpi = (double)window_cycles / window_instructions;
+		n++;
+		instructions += window_instructions;
+		cycles += window_cycles;
+		sum += cpi;
+		sum_sq += cpi * cpi;
+	}
+
+	unsigned long samples() const { return n; }
+
+	// estimate for a program of "total_instructions" instructions
+	sample_stats_t stats(unsigned long total_instructions) const{
+		sample_stats_t s;
+		s.samples = n;
+		s.instructions = total_instructions;
+		s.window_instructions = instructions;
+		s.window_cycles = cycles;
+		s.cpi = n ? sum / n : 0;
+		s.cpi_error = HUGE_VAL;
+		if (n > 1) {
+			double variance = (sum_sq - n * s.cpi * s.cpi) / (n - 1);
+			s.cpi_error = SAMPLE_Z * sqrt(variance > 0 ? variance : 0) / sqrt((double)n);
+		}
+		s.ipc = s.cpi > 0 ? 1 / s.cpi : 0;
+		s.ipc_low = 1 / (s.cpi + s.cpi_error);
+		s.ipc_high = (s.cpi > s.cpi_error) ? 1 / (s.cpi - s.cpi_error) : HUGE_VAL;
+		s.cycles = s.cpi * total_instructions;
+		return s;
+	}
+};
+
+#endif /*SIM_SAMPLE_H_*/
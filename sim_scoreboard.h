@@ -0,0 +1,81 @@
+#ifndef SIM_SCOREBOARD_H_
+#define SIM_SCOREBOARD_H_
+
+#include <stdint.h>
+#include <string.h>
+
+/* =============================================================
+
+   REGISTER SCOREBOARD
+
+   Shared by sim_pipe and sim_pipe_fp. Registers are bits of a 64-bit
+   mask: R0-R31 are bits 0-31 and F0-F31 bits 32-63. An instruction is
+   described at decode by the mask of the registers it reads and the
+   mask of the register it writes, so a hazard check is a few bitwise
+   operations whatever the opcode.
+
+   A register is pending from the issue of a write to its release.
+   The simulator chooses the release point, e.g. write-back, or the
+   cycle the value can be forwarded. Several writes to the same register
+   may be in flight; they are released oldest first.
+
+   ============================================================= */
+
+typedef uint64_t regmask_t;
+
+#define NUM_SCOREBOARD_REGISTERS 64
+#define REG_MASK(r) ((regmask_t)1 << (r))
+#define FP_REG_MASK(r) ((regmask_t)1 << (32 + (r)))
+
+class sim_scoreboard {
+
+	regmask_t pending;                              // registers with at least one write in flight
+	unsigned char writes[NUM_SCOREBOARD_REGISTERS]; // number of writes in flight per register
+	unsigned long ready[NUM_SCOREBOARD_REGISTERS];  // expected cycle of the release of the youngest write
+
+public:
+	sim_scoreboard() { reset(); }
+
+	void reset(){
+		pending = 0;
+		memset(writes, 0, sizeof writes);
+		memset(ready, 0, sizeof ready);
+	}
+
+	// a write to the registers in "dest" has been issued and is expected to be released in cycle "ready_cycle"
+	void issue(regmask_t dest, unsigned long ready_cycle){
+		pending |= dest;
+		for (; dest; dest &= dest - 1){
+			unsigned r = __builtin_ctzll(dest);
+			writes[r]++;
+			ready[r] = ready_cycle;
+		}
+	}
+
+	// the oldest write in flight to the registers in "dest" has been released
+	void release(regmask_t dest){
+		for (dest &= pending; dest; dest &= dest - 1){
+			unsigned r = __builtin_ctzll(dest);
+			if (--writes[r] == 0) pending &= ~REG_MASK(r);
+		}
+	}
+
+	// true if one of the registers in "regs" has a write in flight
+	bool busy(regmask_t regs) const { return (pending & regs) != 0; }
+
+	// cycles an instruction reading "src" still has to wait at cycle "now" (0 if it can proceed;
+	// at least 1 while a write is pending, even if it is later than expected)
+	unsigned wait(regmask_t src, unsigned long now) const{
+		unsigned cycles = 0;
+		for (src &= pending; src; src &= src - 1){
+			unsigned r = __builtin_ctzll(src);
+			unsigned w = (ready[r] > now) ? ready[r] - now : 1;
+			if (w > cycles) cycles = w;
+		}
+		return cycles;
+	}
+
+	regmask_t pending_registers() const { return pending; }
+};
+
+#endif /*SIM_SCOREBOARD_H_*/
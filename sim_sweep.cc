@@ -0,0 +1,331 @@
+/* =============================================================
+
+   PARAMETER SWEEP DRIVER
+
+   Runs one program on every point of a parameter grid and prints
+   one row per point (cycles, instructions, IPC and stalls by cause)
+   as CSV or JSON. The points are independent simulator instances run
+   on a work-stealing thread pool (sim_pool.h). The program is
+   assembled (or mapped) once and shared read-only by all of them
+   (share_program).
+
+   Built twice: "sweep" for sim_pipe and, with -DSWEEP_FP, "sweep_fp"
+   for sim_pipe_fp (see the Makefile). All general purpose registers
+   start at 0 and the data memory at 0xFF.
+
+   usage: sweep    [options] [-f list] program
+          sweep_fp [options] [-u unit:latencies[:instances[:intervals]]]... program
+
+     -l list   data memory latencies (default 0)
+     -w list   issue widths, 1 to MAX_ISSUE_WIDTH (default 1)
+     -f list   sim_pipe: forwarding off/on (default 0)
+     -u spec   sim_pipe_fp: latencies, instance counts and initiation
+               intervals of an execution unit (integer, adder, multiplier
+               or divider), e.g. "multiplier:4-10:1,2:0,1"; each unit
+               defaults to one non-pipelined (interval 0) instance of latency
+               1 (integer), 2 (adder), 5 (multiplier), 10 (divider)
+     -m bytes  data memory size, up to 4 GiB (default 65536)
+     -c cycles cycle limit per point (default 0: run to completion)
+     -s ff:warm:detail
+               sampled simulation (run_sampled, see sim_sample.h): cycles
+               and IPC are extrapolated from detailed windows of "detail"
+               instructions, each after "ff" instructions fast-forwarded and
+               "warm" of functional warming; adds the columns samples,
+               ipc_low and ipc_high (95% confidence; ipc_high is infinite, or
+               null in JSON, with fewer than two windows), and the stalls are
+               those of the windows; -c is ignored
+     -j n      worker threads (default: one per hardware thread)
+     -o format csv (default) or json
+
+   A list is comma-separated values and ranges: "0,2,4", "0-8", "0-16:4".
+
+   ============================================================= */
+
+#ifdef SWEEP_FP
+#include "sim_pipe_fp.h"
+#else
+#include "sim_pipe.h"
+#endif
+#include "sim_pool.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fstream>
+#include <sstream>
+#include <cmath>
+#include <algorithm>
+#include <chrono>
+
+using namespace std;
+
+#ifdef SWEEP_FP
+typedef sim_pipe_fp simulator_t;
+static const char *unit_types[NUM_UNIT_TYPES] = {"integer", "adder", "multiplier", "divider"};
+static const unsigned default_unit_latency[NUM_UNIT_TYPES] = {1, 2, 5, 10};
+#else
+typedef sim_pipe simulator_t;
+#endif
+
+static const char *stall_columns[NUM_STALL_TYPES] = {"data_stalls", "control_stalls", "memory_stalls", "fetch_stalls"};
+
+// one dimension of the grid
+typedef struct {
+	string name;
+	vector<unsigned> values;
+} sweep_axis_t;
+
+typedef struct {
+	unsigned cycles;
+	unsigned instructions;
+	float ipc;
+	unsigned stalls;
+	unsigned stalls_by_type[NUM_STALL_TYPES];
+	unsigned long samples; // sampled simulation only
+	float ipc_low;
+	float ipc_high;
+} sweep_result_t;
+
+static void usage(const char *error){
+	cerr << "error: " << error << endl;
+#ifdef SWEEP_FP
+	cerr << "usage: sweep_fp [-l latencies] [-w widths] [-u unit:latencies[:instances[:intervals]]]... [-m bytes] [-c cycles] [-s ff:warm:detail] [-j threads] [-o csv|json] program" << endl;
+#else
+	cerr << "usage: sweep [-l latencies] [-w widths] [-f 0,1] [-m bytes] [-c cycles] [-s ff:warm:detail] [-j threads] [-o csv|json] program" << endl;
+#endif
+	exit(-1);
+}
+
+static unsigned parse_number(const char *s, char **end){
+	if (*s < '0' || *s > '9') usage("expected a number in a list");
+	return strtoul(s, end, 10);
+}
+
+// "0,2,4", "0-8", "0-16:4"
+static vector<unsigned> parse_list(const char *s){
+	vector<unsigned> values;
+	char *end;
+	while (true) {
+		unsigned first = parse_number(s, &end);
+		unsigned last = first, step = 1;
+		if (*end == '-') last = parse_number(end + 1, &end);
+		if (*end == ':' && last != first) step = parse_number(end + 1, &end);
+		if (last < first || step == 0) usage("bad range in a list");
+		for (unsigned v = first; v <= last; v += step) values.push_back(v);
+		if (*end == '\0') return values;
+		if (*end != ',') usage("bad separator in a list");
+		s = end + 1;
+	}
+}
+
+// values of the parameters at point "p": its coordinates in mixed radix, first axis varying slowest
+static vector<unsigned> point_values(const vector<sweep_axis_t> &axes, unsigned p){
+	vector<unsigned> value(axes.size());
+	for (unsigned a = axes.size(); a-- > 0; p /= axes[a].values.size())
+		value[a] = axes[a].values[p % axes[a].values.size()];
+	return value;
+}
+
+// a string for JSON: quoted, with quotes, backslashes and control characters escaped
+static string json_string(const char *s){
+	string quoted = "\"";
+	for (; *s; s++) {
+		if (*s == '"' || *s == '\\') quoted += '\\';
+		if ((unsigned char)*s < 0x20) {
+			char escape[8];
+			snprintf(escape, sizeof escape, "\\u%04x", (unsigned char)*s);
+			quoted += escape;
+		}
+		else quoted += *s;
+	}
+	return quoted + "\"";
+}
+
+// JSON has no infinity or NaN: they are written as null
+static string json_number(double v){
+	if (!isfinite(v)) return "null";
+	ostringstream s;
+	s << v;
+	return s.str();
+}
+
+static bool is_image(const char *filename){
+	char magic[sizeof IMAGE_MAGIC - 1];
+	ifstream fin(filename, ios::in | ios::binary);
+	return fin.read(magic, sizeof magic) && memcmp(magic, IMAGE_MAGIC, sizeof magic) == 0;
+}
+
+int main(int argc, char **argv){
+
+	vector<unsigned> latencies(1, 0), widths(1, 1);
+#ifdef SWEEP_FP
+	vector<unsigned> unit_latencies[NUM_UNIT_TYPES], unit_instances[NUM_UNIT_TYPES], unit_intervals[NUM_UNIT_TYPES];
+	for (unsigned u = 0; u < NUM_UNIT_TYPES; u++) {
+		unit_latencies[u].assign(1, default_unit_latency[u]);
+		unit_instances[u].assign(1, 1);
+		unit_intervals[u].assign(1, 0);
+	}
+	const char *options = "l:w:u:m:c:s:j:o:";
+#else
+	vector<unsigned> forwarding(1, 0);
+	const char *options = "l:w:f:m:c:s:j:o:";
+#endif
+	uint64_t mem_size = 65536;
+	unsigned max_cycles = 0, threads = 0;
+	bool json = false;
+	bool sampled = false;
+	unsigned long fast_forward = 0, warm_up = 0, detailed = 0;
+
+	int opt;
+	while ((opt = getopt(argc, argv, options)) != -1) {
+		switch (opt) {
+		case 'l': latencies = parse_list(optarg); break;
+		case 'w': widths = parse_list(optarg); break;
+#ifdef SWEEP_FP
+		case 'u': {
+			const char *colon = strchr(optarg, ':');
+			unsigned u = 0;
+			while (u < NUM_UNIT_TYPES && (!colon || strncmp(optarg, unit_types[u], colon - optarg) != 0 || unit_types[u][colon - optarg] != '\0')) u++;
+			if (u == NUM_UNIT_TYPES) usage("-u expects integer, adder, multiplier or divider, followed by ':' and the latencies");
+			string spec(colon + 1);
+			size_t split = spec.find(':');
+			unit_latencies[u] = parse_list(spec.substr(0, split).c_str());
+			if (split == string::npos) break;
+			spec = spec.substr(split + 1);
+			split = spec.find(':');
+			unit_instances[u] = parse_list(spec.substr(0, split).c_str());
+			if (split != string::npos) unit_intervals[u] = parse_list(spec.substr(split + 1).c_str());
+			break;
+		}
+#else
+		case 'f': forwarding = parse_list(optarg); break;
+#endif
+		case 'm': mem_size = strtoull(optarg, NULL, 0); break;
+		case 'c': max_cycles = strtoul(optarg, NULL, 0); break;
+		case 's':
+			if (sscanf(optarg, "%lu:%lu:%lu", &fast_forward, &warm_up, &detailed) != 3 || detailed == 0)
+				usage("-s expects ff:warm:detail instruction counts, with detail > 0");
+			sampled = true;
+			break;
+		case 'j': threads = strtoul(optarg, NULL, 0); break;
+		case 'o':
+			if (strcmp(optarg, "json") == 0) json = true;
+			else if (strcmp(optarg, "csv") != 0) usage("-o expects csv or json");
+			break;
+		default: usage("unknown option");
+		}
+	}
+	if (optind != argc - 1) usage("expected one program");
+	if (*min_element(widths.begin(), widths.end()) == 0 || *max_element(widths.begin(), widths.end()) > MAX_ISSUE_WIDTH) usage("issue widths range from 1 to MAX_ISSUE_WIDTH");
+#ifdef SWEEP_FP
+	for (unsigned u = 0; u < NUM_UNIT_TYPES; u++) {
+		if (*min_element(unit_instances[u].begin(), unit_instances[u].end()) == 0)
+			usage("each unit type needs at least one instance");
+		if (*max_element(unit_instances[u].begin(), unit_instances[u].end()) > MAX_PIPELINES)
+			usage("too many execution unit instances (MAX_PIPELINES per unit type)");
+	}
+#endif
+	const char *filename = argv[optind];
+
+	// the grid (see point_values)
+	vector<sweep_axis_t> axes;
+	sweep_axis_t axis;
+	axis.name = "mem_latency"; axis.values = latencies; axes.push_back(axis);
+	axis.name = "issue_width"; axis.values = widths; axes.push_back(axis);
+#ifdef SWEEP_FP
+	for (unsigned u = 0; u < NUM_UNIT_TYPES; u++) {
+		axis.name = string(unit_types[u]) + "_latency"; axis.values = unit_latencies[u]; axes.push_back(axis);
+		axis.name = string(unit_types[u]) + "_instances"; axis.values = unit_instances[u]; axes.push_back(axis);
+		axis.name = string(unit_types[u]) + "_interval"; axis.values = unit_intervals[u]; axes.push_back(axis);
+	}
+#else
+	axis.name = "forwarding"; axis.values = forwarding; axes.push_back(axis);
+#endif
+	unsigned num_points = 1;
+	for (unsigned a = 0; a < axes.size(); a++) num_points *= axes[a].values.size();
+
+	// the program, assembled once and shared by all the points
+	simulator_t master(4, 0);
+	if (is_image(filename)) master.load_binary(filename);
+	else master.load_program(filename);
+
+	vector<sweep_result_t> results(num_points);
+	sim_pool pool(threads);
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+	pool.run(num_points, [&](unsigned p) {
+		vector<unsigned> value = point_values(axes, p);
+
+#ifdef SWEEP_FP
+		simulator_t sim(mem_size, value[0]);
+		sim.init_issue_width(value[1]);
+		for (unsigned u = 0; u < NUM_UNIT_TYPES; u++)
+			sim.init_exec_unit((exe_unit_t)u, value[2 + 3*u], value[3 + 3*u], value[4 + 3*u]);
+		sim.share_program(master);
+		for (unsigned r = 0; r < NUM_GP_REGISTERS; r++) {
+			sim.set_int_register(r, 0);
+			sim.set_fp_register(r, 0);
+		}
+#else
+		simulator_t sim(mem_size, value[0], value[2] != 0);
+		sim.init_issue_width(value[1]);
+		sim.share_program(master);
+		for (unsigned r = 0; r < NUM_GP_REGISTERS; r++) sim.set_gp_register(r, 0);
+#endif
+		sweep_result_t &res = results[p];
+		if (sampled) {
+			sample_stats_t estimate = sim.run_sampled(fast_forward, warm_up, detailed);
+			res.cycles = estimate.cycles + 0.5;
+			res.instructions = estimate.instructions;
+			res.ipc = estimate.ipc;
+			res.samples = estimate.samples;
+			res.ipc_low = estimate.ipc_low;
+			res.ipc_high = estimate.ipc_high;
+		}
+		else {
+			sim.run(max_cycles);
+			res.cycles = sim.get_clock_cycles();
+			res.instructions = sim.get_instructions_executed();
+			res.ipc = sim.get_IPC();
+		}
+		res.stalls = sim.get_stalls();
+		for (unsigned s = 0; s < NUM_STALL_TYPES; s++) res.stalls_by_type[s] = sim.get_stalls((stall_t)s);
+	});
+
+	double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	cerr << num_points << " points on " << pool.threads() << " threads in " << seconds << " s" << endl;
+
+	// the table, in grid order
+	if (json) cout << "{\"program\": " << json_string(filename) << ", \"points\": [" << endl;
+	else {
+		for (unsigned a = 0; a < axes.size(); a++) cout << axes[a].name << ",";
+		cout << "cycles,instructions,ipc,stalls";
+		for (unsigned s = 0; s < NUM_STALL_TYPES; s++) cout << "," << stall_columns[s];
+		if (sampled) cout << ",samples,ipc_low,ipc_high";
+		cout << endl;
+	}
+	for (unsigned p = 0; p < num_points; p++) {
+		const sweep_result_t &res = results[p];
+		vector<unsigned> value = point_values(axes, p);
+		if (json) cout << "  {";
+		for (unsigned a = 0; a < axes.size(); a++) {
+			if (json) cout << "\"" << axes[a].name << "\": " << value[a] << ", ";
+			else cout << value[a] << ",";
+		}
+		if (json) {
+			cout << "\"cycles\": " << res.cycles << ", \"instructions\": " << res.instructions << ", \"ipc\": " << json_number(res.ipc) << ", \"stalls\": " << res.stalls;
+			for (unsigned s = 0; s < NUM_STALL_TYPES; s++) cout << ", \"" << stall_columns[s] << "\": " << res.stalls_by_type[s];
+			if (sampled) cout << ", \"samples\": " << res.samples << ", \"ipc_low\": " << json_number(res.ipc_low) << ", \"ipc_high\": " << json_number(res.ipc_high);
+			cout << "}" << (p + 1 < num_points ? "," : "") << endl;
+		}
+		else {
+			cout << res.cycles << "," << res.instructions << "," << res.ipc << "," << res.stalls;
+			for (unsigned s = 0; s < NUM_STALL_TYPES; s++) cout << "," << res.stalls_by_type[s];
+			if (sampled) cout << "," << res.samples << "," << res.ipc_low << "," << res.ipc_high;
+			cout << endl;
+		}
+	}
+	if (json) cout << "]}" << endl;
+
+	return 0;
+}
@@ -0,0 +1,99 @@
+#include "sim_trace.h"
+#include <stdlib.h>
+#include <cstring>
+
+using namespace std;
+
+/* =============================================================
+
+   IN-MEMORY RING
+
+   ============================================================= */
+
+trace_ring::trace_ring(){
+	head = 0;
+	wrapped = false;
+}
+
+void trace_ring::resize(unsigned size){
+	buffer.assign(size, 0);
+	head = 0;
+	wrapped = false;
+}
+
+int trace_ring::overflow(int c){
+	if (c == EOF || buffer.empty()) return c;
+	buffer[head] = (char)c;
+	if (++head == buffer.size()){
+		head = 0;
+		wrapped = true;
+	}
+	return c;
+}
+
+streamsize trace_ring::xsputn(const char *s, streamsize n){
+	if (buffer.empty()) return n;
+	streamsize left = n;
+	//only the tail of a message larger than the ring survives
+	if ((size_t)left > buffer.size()){
+		s += left - buffer.size();
+		left = buffer.size();
+	}
+	while (left > 0){
+		size_t chunk = buffer.size() - head;
+		if ((size_t)left < chunk) chunk = left;
+		memcpy(&buffer[head], s, chunk);
+		s += chunk;
+		left -= chunk;
+		head += chunk;
+		if (head == buffer.size()){
+			head = 0;
+			wrapped = true;
+		}
+	}
+	return n;
+}
+
+void trace_ring::dump(ostream &os) const{
+	if (wrapped) os.write(&buffer[head], buffer.size() - head);
+	if (head) os.write(&buffer[0], head);
+}
+
+/* =============================================================
+
+   TRACE SINK
+
+   ============================================================= */
+
+sim_trace::sim_trace() : ring_stream(&ring){
+	sink = TRACE_TO_STDOUT;
+	out = &cout;
+}
+
+void sim_trace::set_sink(trace_sink_t s, const char *filename, unsigned ring_size){
+	if (file.is_open()) file.close();
+	sink = s;
+	switch(sink){
+	case TRACE_TO_STDERR:
+		out = &cerr;
+		break;
+	case TRACE_TO_FILE:
+		file.open(filename, ios::out | ios::trunc);
+		if (!file.is_open()) {
+			cerr << "error: open trace file " << filename << " failed!" << endl;
+			exit(-1);
+		}
+		out = &file;
+		break;
+	case TRACE_TO_RING:
+		ring.resize(ring_size);
+		out = &ring_stream;
+		break;
+	default:
+		out = &cout;
+	}
+}
+
+void sim_trace::dump(ostream &os) const{
+	if (sink == TRACE_TO_RING) ring.dump(os);
+}
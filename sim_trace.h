@@ -0,0 +1,93 @@
+#ifndef SIM_TRACE_H_
+#define SIM_TRACE_H_
+
+#include <iostream>
+#include <fstream>
+#include <streambuf>
+#include <vector>
+
+/* =============================================================
+
+   TRACE LEVELS
+
+   The level is fixed at compile time (-DSIM_TRACE_LEVEL=n); trace
+   statements above the selected level are compiled out entirely.
+   Builds with -DNDEBUG default to TRACE_OFF.
+
+   ============================================================= */
+
+#define TRACE_OFF   0 // no tracing
+#define TRACE_CYCLE 1 // per-cycle summary (start/end of run, end of each cycle)
+#define TRACE_STAGE 2 // per-stage detail (latch contents, hazards, stalls)
+
+#ifndef SIM_TRACE_LEVEL
+#ifdef NDEBUG
+#define SIM_TRACE_LEVEL TRACE_OFF
+#else
+#define SIM_TRACE_LEVEL TRACE_STAGE
+#endif
+#endif
+
+#if SIM_TRACE_LEVEL >= TRACE_CYCLE
+#define SIM_TRACE_CYCLE(t, msg) do { (t).stream() << msg; } while (0)
+#else
+#define SIM_TRACE_CYCLE(t, msg) do { } while (0)
+#endif
+
+#if SIM_TRACE_LEVEL >= TRACE_STAGE
+#define SIM_TRACE_STAGE(t, msg) do { (t).stream() << msg; } while (0)
+#else
+#define SIM_TRACE_STAGE(t, msg) do { } while (0)
+#endif
+
+// runtime destination of the trace (only meaningful when SIM_TRACE_LEVEL > TRACE_OFF)
+typedef enum {TRACE_TO_STDOUT, TRACE_TO_STDERR, TRACE_TO_FILE, TRACE_TO_RING} trace_sink_t;
+
+// default size of the in-memory ring (in bytes)
+#define TRACE_RING_SIZE (1 << 20)
+
+// stream buffer keeping only the most recent "size" bytes written to it
+class trace_ring : public std::streambuf {
+
+	std::vector<char> buffer;
+	unsigned head;  // next position to be written
+	bool wrapped;   // true once the ring has been filled at least once
+
+protected:
+	int overflow(int c);
+	std::streamsize xsputn(const char *s, std::streamsize n);
+
+public:
+	trace_ring();
+
+	//(re)allocates the ring with the given capacity and discards its content
+	void resize(unsigned size);
+
+	//writes the content of the ring to "os", oldest byte first
+	void dump(std::ostream &os) const;
+};
+
+class sim_trace {
+
+	trace_sink_t sink;
+	std::ofstream file;
+	trace_ring ring;
+	std::ostream ring_stream;
+	std::ostream *out;
+
+	sim_trace(const sim_trace &);
+	sim_trace &operator=(const sim_trace &);
+
+public:
+	sim_trace();
+
+	//selects the trace destination; "filename" is used by TRACE_TO_FILE, "ring_size" by TRACE_TO_RING
+	void set_sink(trace_sink_t sink, const char *filename=NULL, unsigned ring_size=TRACE_RING_SIZE);
+
+	//writes the content of the in-memory ring (if any) to "os"
+	void dump(std::ostream &os) const;
+
+	std::ostream &stream() { return *out; }
+};
+
+#endif /*SIM_TRACE_H_*/